@@ -40,6 +40,20 @@
 #include <string.h>
 #endif
 
+/*
+ * Same as in memcpy.c; look there for an explanation.
+ */
+#define WSIZE	sizeof(unsigned long)
+#define WMASK	(WSIZE - 1)
+#define WBITS	(WSIZE * 8)
+#define BLOCK	(8 * WSIZE)
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MERGE(w0, w1, sh)  (((w0) << (sh)) | ((w1) >> (WBITS - (sh))))
+#else
+#define MERGE(w0, w1, sh)  (((w0) >> (sh)) | ((w1) << (WBITS - (sh))))
+#endif
+
 /*
  * C standard function - copy a block of memory, handling overlapping
  * regions correctly.
@@ -48,7 +62,12 @@
 void *
 memmove(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	unsigned char *d;
+	const unsigned char *s;
+	unsigned long *dw;
+	const unsigned long *sw;
+	unsigned long w0, w1;
+	unsigned shift;
 
 	/*
 	 * If the buffers don't overlap, it doesn't matter what direction
@@ -75,7 +94,8 @@ memmove(void *dst, const void *src, size_t len)
          *                     |___|
 	 */
 
-	if ((uintptr_t)dst < (uintptr_t)src) {
+	if ((uintptr_t)dst < (uintptr_t)src ||
+	    (uintptr_t)dst >= (uintptr_t)src + len) {
 		/*
 		 * As author/maintainer of libc, take advantage of the
 		 * fact that we know memcpy copies forwards.
@@ -84,33 +104,76 @@ memmove(void *dst, const void *src, size_t len)
 	}
 
 	/*
-	 * Copy by words in the common case. Look in memcpy.c for more
-	 * information.
+	 * Copy backwards, by words in the common case. This is memcpy
+	 * run in reverse: bytes until the end of the destination is
+	 * word-aligned, then unrolled words, either straight or shifted
+	 * together, then the rest by bytes. As in memcpy, each word is
+	 * stored only after the source words it overlaps have been read.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	d = (unsigned char *)dst + len;
+	s = (const unsigned char *)src + len;
 
-		long *d = dst;
-		const long *s = src;
-
-		/*
-		 * The reason we copy index i-1 and test i>0 is that
-		 * i is unsigned -- so testing i>=0 doesn't work.
-		 */
+	if (len >= 2 * WSIZE) {
+		while ((uintptr_t)d % WSIZE != 0) {
+			*--d = *--s;
+			len--;
+		}
+		dw = (unsigned long *)d;
 
-		for (i=len/sizeof(long); i>0; i--) {
-			d[i-1] = s[i-1];
+		if ((uintptr_t)s % WSIZE == 0) {
+			sw = (const unsigned long *)s;
+			while (len >= BLOCK) {
+				dw -= 8;
+				sw -= 8;
+				dw[7] = sw[7];
+				dw[6] = sw[6];
+				dw[5] = sw[5];
+				dw[4] = sw[4];
+				dw[3] = sw[3];
+				dw[2] = sw[2];
+				dw[1] = sw[1];
+				dw[0] = sw[0];
+				len -= BLOCK;
+			}
+			while (len >= WSIZE) {
+				*--dw = *--sw;
+				len -= WSIZE;
+			}
+			s = (const unsigned char *)sw;
+		}
+		else {
+			shift = ((uintptr_t)s % WSIZE) * 8;
+			sw = (const unsigned long *)((uintptr_t)s & ~WMASK);
+			w1 = *sw;
+			while (len >= 4 * WSIZE) {
+				dw -= 4;
+				sw -= 4;
+				w0 = sw[3];
+				dw[3] = MERGE(w0, w1, shift);
+				w1 = sw[2];
+				dw[2] = MERGE(w1, w0, shift);
+				w0 = sw[1];
+				dw[1] = MERGE(w0, w1, shift);
+				w1 = sw[0];
+				dw[0] = MERGE(w1, w0, shift);
+				len -= 4 * WSIZE;
+			}
+			while (len >= WSIZE) {
+				w0 = *--sw;
+				*--dw = MERGE(w0, w1, shift);
+				w1 = w0;
+				len -= WSIZE;
+			}
+			/* the last byte not yet copied is in sw[0] */
+			s = (const unsigned char *)sw + shift / 8;
 		}
+		d = (unsigned char *)dw;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=len; i>0; i--) {
-			d[i-1] = s[i-1];
-		}
+	while (len > 0) {
+		*--d = *--s;
+		len--;
 	}
 
 	return dst;
@@ -31,9 +31,16 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+/*
+ * Word size and unrolled chunk size; see memcpy.c.
+ */
+#define WSIZE	sizeof(unsigned long)
+#define BLOCK	(8 * WSIZE)
+
 /*
  * C standard function - initialize a block of memory
  */
@@ -41,11 +48,47 @@
 void *
 memset(void *ptr, int ch, size_t len)
 {
-	char *p = ptr;
-	size_t i;
+	unsigned char *p = ptr;
+	unsigned long *pw;
+	unsigned long w;
+
+	/*
+	 * Like memcpy: store bytes until the pointer is word-aligned,
+	 * then whole words (BLOCK bytes at a time while possible), then
+	 * any leftover bytes. ~0UL / 0xff is 0x0101...01, so multiplying
+	 * by it copies the byte into every byte of the word.
+	 */
+
+	if (len >= 2 * WSIZE) {
+		while ((uintptr_t)p % WSIZE != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		w = (unsigned char)ch * (~0UL / 0xff);
+		pw = (unsigned long *)p;
+		while (len >= BLOCK) {
+			pw[0] = w;
+			pw[1] = w;
+			pw[2] = w;
+			pw[3] = w;
+			pw[4] = w;
+			pw[5] = w;
+			pw[6] = w;
+			pw[7] = w;
+			pw += 8;
+			len -= BLOCK;
+		}
+		while (len >= WSIZE) {
+			*pw++ = w;
+			len -= WSIZE;
+		}
+		p = (unsigned char *)pw;
+	}
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
@@ -81,6 +81,8 @@ say(const char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(write_buffer, BUFFER_SIZE, fmt, ap);
 	va_end(ap);
+	/* keep anything printf'd earlier ahead of us */
+	fflush(stdout);
 	return write(STDOUT_FILENO, write_buffer, strlen(write_buffer));
 }
 #endif
@@ -60,13 +60,26 @@ void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
+/*
+ *   tlb_setpid: set the address space ID (see below) that the processor
+ *        matches non-global TLB entries against.
+ *
+ *        The ASID lives in c0_entryhi, which tlb_random, tlb_write,
+ *        tlb_read, and tlb_probe all load with their own value. If
+ *        you use ASIDs, call tlb_setpid again after using any of them
+ *        on an entry that belongs to some other address space.
+ */
+
+void tlb_setpid(uint32_t pid);
+
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * Note that the MIPS has support for a 6-bit address space ID. An
+ * entry only matches if its TLBHI_PID field equals the PID currently
+ * loaded in c0_entryhi (see tlb_setpid), or if TLBLO_GLOBAL is set.
+ * If you don't use ASIDs, these fields can be left always zero, as
+ * can the bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,14 +91,14 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -101,5 +114,13 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Address space IDs: TLBHI_PID holds NUM_ASID of them, starting at
+ * bit TLBHI_PIDSHIFT.
+ */
+
+#define TLBHI_PIDSHIFT  6
+#define NUM_ASID        64
+
 
 #endif /* _MIPS_TLB_H_ */
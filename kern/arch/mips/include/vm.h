@@ -67,6 +67,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* And back again, for a kseg0 address such as kmalloc returns. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -113,14 +116,19 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
+ * A shootdown invalidates the pages from ts_start up to (not
+ * including) ts_end in address space ts_as. Requests for the same
+ * address space whose ranges overlap or touch are merged into one.
+ *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space */
+	vaddr_t ts_start;		/* first page */
+	vaddr_t ts_end;			/* page after the last one */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -36,6 +36,8 @@
 #include <current.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <addrspace.h>
+#include <ktrace.h>
 
 /*
  * System call dispatcher.
@@ -88,6 +90,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curproc != NULL);
 
 	callno = tf->tf_v0;
+	KTRACE(KTR_SYSCALL, callno, tf->tf_a0);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -116,8 +119,31 @@ syscall(struct trapframe *tf)
 		break;
 
 		case SYS__exit:
-		sys_exit();
-		err = 0;
+		sys_exit((int)tf->tf_a0);
+		/* NOTREACHED */
+
+		case SYS_fork:
+		err = sys_fork(tf, false, &retval);
+		break;
+
+		case SYS_vfork:
+		err = sys_fork(tf, true, &retval);
+		break;
+
+		case SYS_execv:
+		err = sys_execv(
+						(userptr_t)tf->tf_a0,
+						(userptr_t)tf->tf_a1
+					);
+		break;
+
+		case SYS_waitpid:
+		err = sys_waitpid(
+						(pid_t)tf->tf_a0,
+						(userptr_t)tf->tf_a1,
+						(int)tf->tf_a2,
+						&retval
+					);
 		break;
 
 		case SYS_open:
@@ -200,11 +226,28 @@ syscall(struct trapframe *tf)
 						);
 			break;
 
+		case SYS_ioctl:
+			err = sys_ioctl(
+							(int)tf->tf_a0,
+							(int)tf->tf_a1,
+							(userptr_t)tf->tf_a2
+						);
+			break;
+
 		case SYS_chdir:
 			err = sys_chdir(
 							(const_userptr_t)tf->tf_a0
 						);
 		break;
+
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_futex:
+		err = sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				(int)tf->tf_a2, &retval);
+		break;
 	    
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
@@ -235,6 +278,8 @@ syscall(struct trapframe *tf)
 
 	tf->tf_epc += 4;
 
+	KTRACE(KTR_SYSRET, callno, err);
+
 	/* Make sure the syscall code didn't forget to lower spl */
 	KASSERT(curthread->t_curspl == 0);
 	/* ...or leak any spinlocks */
@@ -244,13 +289,16 @@ syscall(struct trapframe *tf)
 /*
  * Enter user mode for a newly forked process.
  *
- * This function is provided as a reminder. You need to write
- * both it and the code that calls it.
- *
- * Thus, you can trash it and do things another way if you prefer.
+ * TF is a copy of the parent's trapframe from the fork call, on our
+ * own stack; the child returns 0 from fork.
  */
 void
 enter_forked_process(struct trapframe *tf)
 {
-	(void)tf;
+	tf->tf_v0 = 0;
+	tf->tf_a3 = 0;		/* signal no error */
+	tf->tf_epc += 4;
+
+	as_activate();
+	mips_usermode(tf);
 }
@@ -38,6 +38,12 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <ktrace.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <membar.h>
+#include <platform/maxcpus.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -62,12 +68,108 @@
 /*
  * Wrap ram_stealmem in a spinlock.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER_NAMED("stealmem");
+
+/*
+ * Address space IDs.
+ *
+ * Each CPU hands out the hardware's NUM_ASID ASIDs on its own. An
+ * address space remembers, for each CPU, the ASID it was last given
+ * there, tagged in the bits above the ASID with that CPU's generation
+ * number at the time. If the tag is from an older generation the ASID
+ * may since have been given to someone else, so a new one is needed.
+ * When a CPU runs out of ASIDs it starts a new generation and flushes
+ * its TLB; that is the only time the TLB gets flushed, so a process's
+ * entries survive while other processes run.
+ *
+ * Generation 0 is never used, so the zeroed tags of a new address
+ * space are stale everywhere. The counters start at the last ASID of
+ * generation 1, so the first ASID a CPU hands out begins generation
+ * 2 with a flush of whatever was left in the TLB at boot.
+ *
+ * Because ASIDs are never reused within a generation, an address
+ * space that is destroyed can simply leave its entries behind.
+ *
+ * All of this is per-CPU and only touched by the CPU itself with
+ * interrupts off, so it needs no locking.
+ */
+#define ASID_MASK	(NUM_ASID - 1)
+#define ASID_GEN(a)	((a) & ~(uint32_t)ASID_MASK)
+
+struct dumbvm_cpu {
+	uint32_t dc_asidlast;		/* last ASID handed out (tagged) */
+	struct addrspace *dc_curas;	/* whose ASID is in entryhi */
+	unsigned dc_nextslot;		/* first unused TLB slot */
+
+	/* statistics (kernel menu "tlb") */
+	uint32_t dc_misses;		/* TLB misses handled */
+	uint32_t dc_activates;		/* as_activate calls */
+	uint32_t dc_reloads;		/* ...that had to change entryhi */
+	uint32_t dc_newasids;		/* ...that had to get a new ASID */
+	uint32_t dc_flushes;		/* whole-TLB flushes */
+	uint32_t dc_shootdowns;		/* ranges shot down */
+};
+
+static struct dumbvm_cpu dumbvm_cpus[MAXCPUS];
+
+/*
+ * Shared text.
+ *
+ * A read-only, executable ELF segment is loaded once per (vnode,
+ * segment). Every address space running that file shares it,
+ * including across fork. Its pages are read in from the file the
+ * first time anyone faults on them, and are mapped read-only.
+ *
+ * dumbvm never gives memory back. So text nobody is using stays on
+ * the list, holding a reference to its vnode, and the next exec of
+ * the same file picks it up instead of taking fresh pages.
+ *
+ * Every reference also holds a text reference on the vnode
+ * (vnode_textref), which makes the VFS refuse writes and truncates
+ * with ETXTBSY. So the file can't change under a running process,
+ * which may not have read all its text in yet. Once nobody is using
+ * the text the file may change; dt_gen records the file's write
+ * generation when the text was set up, and text from an older
+ * generation is stale. Stale text is thrown away the next time the
+ * list is searched. Unmount throws away the unused text of the
+ * filesystem being unmounted (vm_purgetext), since the vnode
+ * references would otherwise keep it busy forever.
+ *
+ * The list, the reference counts and the statistics are protected by
+ * text_lock. Page-ins sleep, so they are serialized per segment by
+ * dt_lock instead.
+ */
+struct dumbvm_text {
+	struct dumbvm_text *dt_next;
+	struct vnode *dt_vnode;
+	off_t dt_offset;		/* where the segment is in the file */
+	vaddr_t dt_vaddr;		/* where it goes (not page-aligned) */
+	size_t dt_filesize;
+	size_t dt_memsize;
+	vaddr_t dt_vbase;		/* page-aligned start */
+	unsigned dt_npages;
+	paddr_t dt_pbase;
+	unsigned dt_refcount;
+	unsigned dt_gen;		/* vn_writegen when set up */
+	struct lock *dt_lock;		/* serializes page-ins */
+	volatile bool *dt_loaded;	/* per page: has been read in */
+};
+
+static struct spinlock text_lock = SPINLOCK_INITIALIZER_NAMED("dumbvm text");
+static struct dumbvm_text *text_list;
+static uint32_t text_hits;		/* execs and forks that shared */
+static uint32_t text_misses;		/* execs that loaded new text */
+static uint32_t text_pagessaved;	/* pages not allocated thanks to hits */
+static uint32_t text_pageins;		/* pages read in on demand */
 
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		dumbvm_cpus[i].dc_asidlast = NUM_ASID | ASID_MASK;
+	}
 }
 
 /*
@@ -135,37 +237,546 @@ coremap_used_bytes() {
 	return 0;
 }
 
+/*
+ * Destroy shared text that's off the list. Its pages are leaked, like
+ * all other dumbvm memory.
+ */
+static
+void
+dumbvm_textdestroy(struct dumbvm_text *dt)
+{
+	VOP_DECREF(dt->dt_vnode);
+	lock_destroy(dt->dt_lock);
+	kfree((void *)dt->dt_loaded);
+	kfree(dt);
+}
+
+/*
+ * Text is stale if its file has been written since it was set up. No
+ * lock is needed to look at vn_writegen: for text somebody is using it
+ * can't change, and if it changes under us for text nobody is using,
+ * we'll just see it next time.
+ */
+static
+bool
+dumbvm_textstale(struct dumbvm_text *dt)
+{
+	return dt->dt_gen != dt->dt_vnode->vn_writegen;
+}
+
+/*
+ * Find or create the shared text for a segment of V. Fails with
+ * ETXTBSY if V is being written to.
+ */
+static
+int
+dumbvm_textget(struct vnode *v, off_t offset, vaddr_t vaddr,
+	       size_t memsize, size_t filesize, struct dumbvm_text **ret)
+{
+	struct dumbvm_text **pdt, *dt, *newdt, *dead;
+	vaddr_t vbase;
+	unsigned npages, i;
+	int result;
+
+	vbase = vaddr & PAGE_FRAME;
+	npages = (vaddr + memsize - vbase + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	/* Set up a new one first, in case; we can't kmalloc in the lock */
+	newdt = kmalloc(sizeof(*newdt));
+	if (newdt == NULL) {
+		return ENOMEM;
+	}
+	newdt->dt_lock = lock_create("dumbvm text");
+	newdt->dt_loaded = kmalloc(npages * sizeof(newdt->dt_loaded[0]));
+	if (newdt->dt_lock == NULL || newdt->dt_loaded == NULL) {
+		if (newdt->dt_lock != NULL) {
+			lock_destroy(newdt->dt_lock);
+		}
+		kfree((void *)newdt->dt_loaded);
+		kfree(newdt);
+		return ENOMEM;
+	}
+
+	/* From here on V can't be written to, so its generation is fixed */
+	result = vnode_textref(v);
+	if (result) {
+		lock_destroy(newdt->dt_lock);
+		kfree((void *)newdt->dt_loaded);
+		kfree(newdt);
+		return result;
+	}
+
+	dead = NULL;
+	spinlock_acquire(&text_lock);
+	pdt = &text_list;
+	while ((dt = *pdt) != NULL) {
+		if (dt->dt_refcount == 0 && dumbvm_textstale(dt)) {
+			*pdt = dt->dt_next;
+			dt->dt_next = dead;
+			dead = dt;
+			continue;
+		}
+		if (dt->dt_vnode == v && dt->dt_offset == offset &&
+		    dt->dt_vaddr == vaddr && dt->dt_memsize == memsize &&
+		    dt->dt_filesize == filesize) {
+			KASSERT(!dumbvm_textstale(dt));
+			dt->dt_refcount++;
+			text_hits++;
+			text_pagessaved += dt->dt_npages;
+			spinlock_release(&text_lock);
+
+			lock_destroy(newdt->dt_lock);
+			kfree((void *)newdt->dt_loaded);
+			kfree(newdt);
+			*ret = dt;
+			goto done;
+		}
+		pdt = &dt->dt_next;
+	}
+
+	newdt->dt_pbase = getppages(npages);
+	if (newdt->dt_pbase == 0) {
+		spinlock_release(&text_lock);
+		vnode_textunref(v);
+		lock_destroy(newdt->dt_lock);
+		kfree((void *)newdt->dt_loaded);
+		kfree(newdt);
+		result = ENOMEM;
+		goto done;
+	}
+	newdt->dt_vnode = v;
+	newdt->dt_offset = offset;
+	newdt->dt_vaddr = vaddr;
+	newdt->dt_filesize = filesize;
+	newdt->dt_memsize = memsize;
+	newdt->dt_vbase = vbase;
+	newdt->dt_npages = npages;
+	newdt->dt_refcount = 1;
+	newdt->dt_gen = v->vn_writegen;
+	for (i=0; i<npages; i++) {
+		newdt->dt_loaded[i] = false;
+	}
+	VOP_INCREF(v);
+	newdt->dt_next = text_list;
+	text_list = newdt;
+	text_misses++;
+	spinlock_release(&text_lock);
+	*ret = newdt;
+
+ done:
+	while (dead != NULL) {
+		dt = dead;
+		dead = dt->dt_next;
+		dumbvm_textdestroy(dt);
+	}
+	return result;
+}
+
+/*
+ * Take another reference to shared text (for fork).
+ */
+static
+void
+dumbvm_textref(struct dumbvm_text *dt)
+{
+	int result;
+
+	/* the file is already busy, so this can't fail */
+	result = vnode_textref(dt->dt_vnode);
+	KASSERT(result == 0);
+
+	spinlock_acquire(&text_lock);
+	KASSERT(dt->dt_refcount > 0);
+	dt->dt_refcount++;
+	text_hits++;
+	text_pagessaved += dt->dt_npages;
+	spinlock_release(&text_lock);
+}
+
+/*
+ * Drop a reference to shared text. It stays on the list for the next
+ * exec of the file, unless the file changes first or its filesystem
+ * is unmounted.
+ */
+static
+void
+dumbvm_textput(struct dumbvm_text *dt)
+{
+	spinlock_acquire(&text_lock);
+	KASSERT(dt->dt_refcount > 0);
+	dt->dt_refcount--;
+	spinlock_release(&text_lock);
+
+	vnode_textunref(dt->dt_vnode);
+}
+
+/*
+ * Throw away the text nobody is using from files on FS, so that it
+ * can be unmounted. Called by vfs_unmount before FSOP_UNMOUNT.
+ */
+void
+vm_purgetext(struct fs *fs)
+{
+	struct dumbvm_text **pdt, *dt, *dead;
+
+	dead = NULL;
+	spinlock_acquire(&text_lock);
+	pdt = &text_list;
+	while ((dt = *pdt) != NULL) {
+		if (dt->dt_refcount == 0 && dt->dt_vnode->vn_fs == fs) {
+			*pdt = dt->dt_next;
+			dt->dt_next = dead;
+			dead = dt;
+			continue;
+		}
+		pdt = &dt->dt_next;
+	}
+	spinlock_release(&text_lock);
+
+	while (dead != NULL) {
+		dt = dead;
+		dead = dt->dt_next;
+		dumbvm_textdestroy(dt);
+	}
+}
+
+/*
+ * Make sure page INDEX of shared text has been read in from the file.
+ * Pages only ever go from not loaded to loaded, so once we've seen one
+ * loaded we can use it without the lock.
+ */
+static
+int
+dumbvm_textpage(struct dumbvm_text *dt, unsigned index)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t pagestart, start, end, kva;
+	int result;
+
+	KASSERT(index < dt->dt_npages);
+
+	if (dt->dt_loaded[index]) {
+		membar_load_load();
+		return 0;
+	}
+
+	lock_acquire(dt->dt_lock);
+	if (dt->dt_loaded[index]) {
+		lock_release(dt->dt_lock);
+		return 0;
+	}
+
+	kva = PADDR_TO_KVADDR(dt->dt_pbase + index * PAGE_SIZE);
+	bzero((void *)kva, PAGE_SIZE);
+
+	/* The part of the page that comes from the file, if any */
+	pagestart = dt->dt_vbase + index * PAGE_SIZE;
+	start = pagestart > dt->dt_vaddr ? pagestart : dt->dt_vaddr;
+	end = pagestart + PAGE_SIZE;
+	if (end > dt->dt_vaddr + dt->dt_filesize) {
+		end = dt->dt_vaddr + dt->dt_filesize;
+	}
+	if (start < end) {
+		uio_kinit(&iov, &ku, (void *)(kva + (start - pagestart)),
+			  end - start, dt->dt_offset + (start - dt->dt_vaddr),
+			  UIO_READ);
+		result = VOP_READ(dt->dt_vnode, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			kprintf("dumbvm: short read on text - "
+				"file truncated?\n");
+			result = ENOEXEC;
+		}
+		if (result) {
+			lock_release(dt->dt_lock);
+			return result;
+		}
+	}
+
+	membar_store_store();
+	dt->dt_loaded[index] = true;
+	lock_release(dt->dt_lock);
+
+	spinlock_acquire(&text_lock);
+	text_pageins++;
+	spinlock_release(&text_lock);
+	return 0;
+}
+
+/*
+ * Invalidate the whole TLB of the current CPU. Interrupts must be off.
+ */
+static
+void
+dumbvm_flushtlb(struct dumbvm_cpu *dc)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	dc->dc_nextslot = 0;
+	dc->dc_flushes++;
+}
+
+/*
+ * Give AS a new ASID on the current CPU, starting a new generation
+ * (and flushing the TLB) if they've run out. Interrupts must be off.
+ */
+static
+void
+dumbvm_newasid(struct dumbvm_cpu *dc, struct addrspace *as, unsigned cpunum)
+{
+	uint32_t asid;
+
+	asid = dc->dc_asidlast + 1;
+	if ((asid & ASID_MASK) == 0) {
+		if (asid == 0) {
+			/* generation counter wrapped; skip generation 0 */
+			asid = NUM_ASID;
+		}
+		dumbvm_flushtlb(dc);
+	}
+	dc->dc_asidlast = asid;
+	as->as_asid[cpunum] = asid;
+	dc->dc_newasids++;
+}
+
+/*
+ * Reload entryhi with the ASID of whatever address space this CPU has
+ * active, after something else has clobbered it. Interrupts must be
+ * off.
+ */
+static
+void
+dumbvm_restorepid(struct dumbvm_cpu *dc, unsigned cpunum)
+{
+	if (dc->dc_curas != NULL) {
+		tlb_setpid(dc->dc_curas->as_asid[cpunum] & ASID_MASK);
+	}
+}
+
+/*
+ * Return the set of CPUs that may have TLB entries for AS: those on
+ * which it holds an ASID from the current generation. This peeks at
+ * the other CPUs' state without locking; the answer can only err on
+ * the side of including a CPU, because a CPU starts a new generation
+ * only after flushing its TLB.
+ */
+static
+uint32_t
+dumbvm_residency(struct addrspace *as)
+{
+	unsigned i;
+	uint32_t mask = 0;
+
+	for (i=0; i<num_cpus; i++) {
+		if (as->as_asid[i] != 0 &&
+		    ASID_GEN(as->as_asid[i]) ==
+		    ASID_GEN(dumbvm_cpus[i].dc_asidlast)) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	return mask;
+}
+
+/*
+ * Invalidate the pages from START to END in AS on every CPU that may
+ * have them cached, and wait until that's done. In dumbvm the only
+ * thing that unmaps pages is shrinking the heap (as_sbrk), but the
+ * process may have run on other CPUs since it last touched them.
+ */
+void
+as_shootdown(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	struct tlbshootdown ts;
+	uint32_t mask;
+
+	KASSERT(start < end);
+
+	ts.ts_as = as;
+	ts.ts_start = start & PAGE_FRAME;
+	ts.ts_end = (end + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	mask = dumbvm_residency(as);
+	if (mask != 0) {
+		ipi_tlbshootdown_cpus(mask, &ts);
+	}
+}
+
+bool
+vm_tlbshootdown_merge(struct tlbshootdown *into,
+		      const struct tlbshootdown *ts)
+{
+	if (into->ts_as != ts->ts_as) {
+		return false;
+	}
+	if (ts->ts_start > into->ts_end || ts->ts_end < into->ts_start) {
+		/* a gap in between */
+		return false;
+	}
+	if (ts->ts_start < into->ts_start) {
+		into->ts_start = ts->ts_start;
+	}
+	if (ts->ts_end > into->ts_end) {
+		into->ts_end = ts->ts_end;
+	}
+	return true;
+}
+
+/*
+ * Flush this CPU's TLB. Called from interprocessor_interrupt when
+ * more shootdowns were queued than would fit. Every ASID stays valid;
+ * their entries just have to be faulted back in.
+ */
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	struct dumbvm_cpu *dc;
+	unsigned cpunum;
+	int spl;
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+	dc = &dumbvm_cpus[cpunum];
+	dumbvm_flushtlb(dc);
+	dumbvm_restorepid(dc, cpunum);
+	splx(spl);
 }
 
+/*
+ * Invalidate one range on this CPU. If the address space has no ASID
+ * from this generation here, none of its entries can be in the TLB.
+ * Small ranges are probed for page by page; for big ones it's cheaper
+ * to read through the whole TLB once.
+ */
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	struct dumbvm_cpu *dc;
+	unsigned cpunum;
+	uint32_t asid, pid, ehi, elo;
+	vaddr_t va;
+	int i, spl;
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+	dc = &dumbvm_cpus[cpunum];
+
+	asid = ts->ts_as->as_asid[cpunum];
+	if (ASID_GEN(asid) != ASID_GEN(dc->dc_asidlast)) {
+		splx(spl);
+		return;
+	}
+	pid = (asid & ASID_MASK) << TLBHI_PIDSHIFT;
+
+	if ((ts->ts_end - ts->ts_start) / PAGE_SIZE <= NUM_TLB) {
+		for (va = ts->ts_start; va < ts->ts_end; va += PAGE_SIZE) {
+			i = tlb_probe(va | pid, 0);
+			if (i >= 0) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+		}
+	}
+	else {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			va = ehi & TLBHI_VPAGE;
+			if ((ehi & TLBHI_PID) == pid &&
+			    va >= ts->ts_start && va < ts->ts_end) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+		}
+	}
+	dc->dc_shootdowns++;
+
+	dumbvm_restorepid(dc, cpunum);
+	splx(spl);
 }
 
+/*
+ * Find the physical page behind a user page in one of the read-write
+ * regions (not shared text).
+ */
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+dumbvm_rwpage(struct addrspace *as, vaddr_t page, paddr_t *ret)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	vaddr_t heaptop;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+	heaptop = (as->as_heapend + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (page >= vbase1 && page < vtop1) {
+		*ret = (page - vbase1) + as->as_pbase1;
+	}
+	else if (page >= vbase2 && page < vtop2) {
+		*ret = (page - vbase2) + as->as_pbase2;
+	}
+	else if (page >= stackbase && page < stacktop) {
+		*ret = (page - stackbase) + as->as_stackpbase;
+	}
+	else if (page >= as->as_heapbase && page < heaptop) {
+		*ret = as->as_heappages[(page - as->as_heapbase) / PAGE_SIZE];
+	}
+	else {
+		return EFAULT;
+	}
+	return 0;
+}
+
+int
+vm_translate(vaddr_t vaddr, paddr_t *ret)
+{
+	struct addrspace *as;
+	struct dumbvm_text *dt;
 	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL || as->as_pbase1 == 0) {
+		return EFAULT;
+	}
+	/* shared text isn't writable (and may not be in core) */
+	dt = as->as_text;
+	if (dt != NULL && vaddr >= dt->dt_vbase &&
+	    vaddr < dt->dt_vbase + dt->dt_npages * PAGE_SIZE) {
+		return EFAULT;
+	}
+	result = dumbvm_rwpage(as, vaddr & PAGE_FRAME, &paddr);
+	if (result) {
+		return result;
+	}
+	*ret = paddr | (vaddr & ~PAGE_FRAME);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	paddr_t paddr;
+	uint32_t ehi, elo, asid;
 	struct addrspace *as;
-	int spl;
+	struct dumbvm_cpu *dc;
+	struct dumbvm_text *dt;
+	bool readonly = false;
+	int spl, result;
 
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	KTRACE(KTR_VMFAULT, faulttype, faultaddress);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
+		/* Only shared text is mapped read-only */
+		return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -205,48 +816,67 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+	/* Shared text: read the page in if need be, and map it read-only */
+	dt = as->as_text;
+	if (dt != NULL && faultaddress >= dt->dt_vbase &&
+	    faultaddress < dt->dt_vbase + dt->dt_npages * PAGE_SIZE) {
+		result = dumbvm_textpage(dt,
+				(faultaddress - dt->dt_vbase) / PAGE_SIZE);
+		if (result) {
+			return result;
+		}
+		paddr = (faultaddress - dt->dt_vbase) + dt->dt_pbase;
+		readonly = true;
 	}
 	else {
-		return EFAULT;
+		result = dumbvm_rwpage(as, faultaddress, &paddr);
+		if (result) {
+			return result;
+		}
 	}
 
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
+	/* Everything but shared text is read-write */
+	elo = paddr | TLBLO_VALID;
+	if (!readonly) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/*
+	 * Disable interrupts on this CPU while frobbing the TLB. (Not
+	 * before now: reading in text may have slept, and we may even
+	 * be on a different CPU.)
+	 */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
+	/*
+	 * as_activate has run on this CPU since we were last switched
+	 * in, so the tag is current and entryhi already holds our ASID.
+	 */
+	dc = &dumbvm_cpus[curcpu->c_number];
+	asid = as->as_asid[curcpu->c_number];
+	KASSERT(ASID_GEN(asid) == ASID_GEN(dc->dc_asidlast));
+	dc->dc_misses++;
+
+	/*
+	 * We only get here on a miss, so there is no entry for this
+	 * page and ASID to collide with. Use up the slots freed by the
+	 * last flush first; once they're gone, let the processor pick
+	 * a victim. Either way entryhi is left holding our ASID.
+	 */
+	ehi = faultaddress | ((asid & ASID_MASK) << TLBHI_PIDSHIFT);
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	if (dc->dc_nextslot < NUM_TLB) {
+		tlb_write(ehi, elo, dc->dc_nextslot++);
+	}
+	else {
+		tlb_random(ehi, elo);
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -264,6 +894,20 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	as->as_text = NULL;
+	as->as_heapbase = 0;
+	as->as_heapend = 0;
+	as->as_heappages = NULL;
+	as->as_heapalloc = 0;
+	as->as_heapslots = 0;
+
+	/* No ASIDs yet (generation 0 is never current) */
+	as->as_asid = kmalloc(num_cpus * sizeof(as->as_asid[0]));
+	if (as->as_asid == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	bzero(as->as_asid, num_cpus * sizeof(as->as_asid[0]));
 
 	return as;
 }
@@ -272,27 +916,58 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+
+	/*
+	 * Its TLB entries can stay behind; its ASIDs won't be handed
+	 * out again until the next generation, which flushes them.
+	 * (A new address space that lands at the same address starts
+	 * out with stale tags, so it can't be mistaken for this one.)
+	 */
+	if (as->as_text != NULL) {
+		dumbvm_textput(as->as_text);
+	}
+	kfree(as->as_heappages);
+	kfree(as->as_asid);
 	kfree(as);
 }
 
 void
 as_activate(void)
 {
-	int i, spl;
+	int spl;
+	unsigned cpunum;
 	struct addrspace *as;
+	struct dumbvm_cpu *dc;
 
 	as = proc_getas();
 	if (as == NULL) {
+		/*
+		 * Kernel thread. Leave whatever was loaded alone; it
+		 * can't touch user addresses anyway.
+		 */
 		return;
 	}
 
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	cpunum = curcpu->c_number;
+	dc = &dumbvm_cpus[cpunum];
+	dc->dc_activates++;
+
+	if (ASID_GEN(as->as_asid[cpunum]) != ASID_GEN(dc->dc_asidlast)) {
+		dumbvm_newasid(dc, as, cpunum);
+	}
+	else if (as == dc->dc_curas) {
+		/* Same address space as before; nothing to do. */
+		splx(spl);
+		return;
 	}
 
+	tlb_setpid(as->as_asid[cpunum] & ASID_MASK);
+	dc->dc_curas = as;
+	dc->dc_reloads++;
+
 	splx(spl);
 }
 
@@ -302,6 +977,103 @@ as_deactivate(void)
 	/* nothing */
 }
 
+/*
+ * Print the shared text statistics. Copy them out first; kprintf
+ * can't be called with a spinlock held.
+ */
+static
+void
+print_textstats(void)
+{
+	struct dumbvm_text *dt;
+	unsigned nsegs, npages, nloaded, nrefs, i;
+	uint32_t hits, misses, pagessaved, pageins;
+
+	nsegs = npages = nloaded = nrefs = 0;
+
+	spinlock_acquire(&text_lock);
+	for (dt = text_list; dt != NULL; dt = dt->dt_next) {
+		nsegs++;
+		npages += dt->dt_npages;
+		nrefs += dt->dt_refcount;
+		for (i=0; i<dt->dt_npages; i++) {
+			if (dt->dt_loaded[i]) {
+				nloaded++;
+			}
+		}
+	}
+	hits = text_hits;
+	misses = text_misses;
+	pagessaved = text_pagessaved;
+	pageins = text_pageins;
+	spinlock_release(&text_lock);
+
+	kprintf("text: %u segments, %u pages (%u read in), %u users\n",
+		nsegs, npages, nloaded, nrefs);
+	kprintf("text: %u shared, %u loaded; %u pages saved, "
+		"%u paged in\n", hits, misses, pagessaved, pageins);
+}
+
+/*
+ * Print the per-CPU TLB statistics (kernel menu "tlb").
+ */
+void
+dumbvm_printstats(void)
+{
+	unsigned i;
+	struct dumbvm_cpu *dc;
+	uint32_t misses, activates, reloads, newasids, flushes, shootdowns;
+
+	misses = activates = reloads = newasids = flushes = shootdowns = 0;
+
+	kprintf("cpu     misses  activates    reloads   newasids"
+		"    flushes shootdowns\n");
+	for (i=0; i<num_cpus; i++) {
+		dc = &dumbvm_cpus[i];
+		kprintf("%3u %10u %10u %10u %10u %10u %10u\n", i,
+			dc->dc_misses, dc->dc_activates, dc->dc_reloads,
+			dc->dc_newasids, dc->dc_flushes, dc->dc_shootdowns);
+		misses += dc->dc_misses;
+		activates += dc->dc_activates;
+		reloads += dc->dc_reloads;
+		newasids += dc->dc_newasids;
+		flushes += dc->dc_flushes;
+		shootdowns += dc->dc_shootdowns;
+	}
+	kprintf("all %10u %10u %10u %10u %10u %10u\n",
+		misses, activates, reloads, newasids, flushes, shootdowns);
+
+	print_textstats();
+}
+
+/*
+ * Zero the TLB statistics. The counters belong to their CPUs, so this
+ * can race with them, but only for the usual cost of a lost count.
+ */
+void
+dumbvm_resetstats(void)
+{
+	unsigned i;
+	struct dumbvm_cpu *dc;
+
+	for (i=0; i<num_cpus; i++) {
+		dc = &dumbvm_cpus[i];
+		dc->dc_misses = 0;
+		dc->dc_activates = 0;
+		dc->dc_reloads = 0;
+		dc->dc_newasids = 0;
+		dc->dc_flushes = 0;
+		dc->dc_shootdowns = 0;
+	}
+
+	spinlock_acquire(&text_lock);
+	text_hits = 0;
+	text_misses = 0;
+	text_pagessaved = 0;
+	text_pageins = 0;
+	spinlock_release(&text_lock);
+}
+
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
@@ -350,32 +1122,80 @@ as_zero_region(paddr_t paddr, unsigned npages)
 	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
 }
 
+/*
+ * Set up shared text (see above) as one of the two regions, in place
+ * of as_define_region. The loader must not then load the segment
+ * itself; its pages are read in as they're touched. Only one region
+ * of an address space can be shared text.
+ */
+int
+as_define_text(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t memsize, size_t filesize)
+{
+	struct dumbvm_text *dt;
+	int result;
+
+	dumbvm_can_sleep();
+	KASSERT(as->as_text == NULL);
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	result = as_define_region(as, vaddr, memsize, 1, 0, 1);
+	if (result) {
+		return result;
+	}
+
+	result = dumbvm_textget(v, offset, vaddr, memsize, filesize, &dt);
+	if (result) {
+		return result;
+	}
+	as->as_text = dt;
+
+	/* as_define_region took the first free one */
+	if (as->as_vbase2 == 0) {
+		KASSERT(as->as_npages1 == dt->dt_npages);
+		as->as_pbase1 = dt->dt_pbase;
+	}
+	else {
+		KASSERT(as->as_npages2 == dt->dt_npages);
+		as->as_pbase2 = dt->dt_pbase;
+	}
+	return 0;
+}
+
+/*
+ * Allocate the memory not already supplied by shared text.
+ */
 int
 as_prepare_load(struct addrspace *as)
 {
-	KASSERT(as->as_pbase1 == 0);
-	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
 	dumbvm_can_sleep();
 
-	as->as_pbase1 = getppages(as->as_npages1);
 	if (as->as_pbase1 == 0) {
-		return ENOMEM;
+		as->as_pbase1 = getppages(as->as_npages1);
+		if (as->as_pbase1 == 0) {
+			return ENOMEM;
+		}
+		as_zero_region(as->as_pbase1, as->as_npages1);
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
 	if (as->as_pbase2 == 0) {
-		return ENOMEM;
+		as->as_pbase2 = getppages(as->as_npages2);
+		if (as->as_pbase2 == 0) {
+			return ENOMEM;
+		}
+		as_zero_region(as->as_pbase2, as->as_npages2);
 	}
 
 	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
-
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
 	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
 
 	return 0;
@@ -384,8 +1204,15 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
+	vaddr_t vtop1, vtop2;
+
 	dumbvm_can_sleep();
-	(void)as;
+
+	/* The heap starts out empty, right after the higher region */
+	vtop1 = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+	vtop2 = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+	as->as_heapbase = vtop1 > vtop2 ? vtop1 : vtop2;
+	as->as_heapend = as->as_heapbase;
 	return 0;
 }
 
@@ -398,10 +1225,107 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Make sure the first NPAGES heap pages have physical pages behind
+ * them. Unlike the other regions the heap is allocated a page at a
+ * time, since it grows after the fact and stolen memory can't be
+ * extended in place.
+ */
+static
+int
+dumbvm_heapalloc(struct addrspace *as, unsigned npages)
+{
+	paddr_t *newpages;
+	unsigned newslots;
+	paddr_t pa;
+
+	if (npages > as->as_heapslots) {
+		newslots = as->as_heapslots ? as->as_heapslots : 16;
+		while (newslots < npages) {
+			newslots *= 2;
+		}
+		newpages = kmalloc(newslots * sizeof(newpages[0]));
+		if (newpages == NULL) {
+			return ENOMEM;
+		}
+		if (as->as_heapalloc > 0) {
+			memcpy(newpages, as->as_heappages,
+			       as->as_heapalloc * sizeof(newpages[0]));
+		}
+		kfree(as->as_heappages);
+		as->as_heappages = newpages;
+		as->as_heapslots = newslots;
+	}
+
+	while (as->as_heapalloc < npages) {
+		pa = getppages(1);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		as->as_heappages[as->as_heapalloc++] = pa;
+	}
+	return 0;
+}
+
+/*
+ * Move the break. Memory is never given back in dumbvm, so pages cut
+ * off the end of the heap stay allocated to the address space and are
+ * reused (after zeroing) if it grows again. They do have to become
+ * inaccessible right away, though, which means shooting them down in
+ * every TLB that might hold them.
+ */
+int
+as_sbrk(struct addrspace *as, ssize_t amount, vaddr_t *oldbreak)
+{
+	vaddr_t oldend, newend, stackbase;
+	unsigned oldpages, newpages, i;
+	int result;
+
+	dumbvm_can_sleep();
+	KASSERT(as->as_heapbase != 0);
+
+	oldend = as->as_heapend;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	if (amount < 0) {
+		if ((vaddr_t)-amount > oldend - as->as_heapbase) {
+			return EINVAL;
+		}
+	}
+	else if (oldend > stackbase ||
+		 (vaddr_t)amount > stackbase - oldend) {
+		return ENOMEM;
+	}
+	newend = oldend + amount;
+
+	oldpages = (oldend - as->as_heapbase + PAGE_SIZE - 1) / PAGE_SIZE;
+	newpages = (newend - as->as_heapbase + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	if (newpages > oldpages) {
+		result = dumbvm_heapalloc(as, newpages);
+		if (result) {
+			return result;
+		}
+		for (i=oldpages; i<newpages; i++) {
+			as_zero_region(as->as_heappages[i], 1);
+		}
+	}
+
+	as->as_heapend = newend;
+
+	if (newpages < oldpages) {
+		as_shootdown(as, as->as_heapbase + newpages * PAGE_SIZE,
+			     as->as_heapbase + oldpages * PAGE_SIZE);
+	}
+
+	*oldbreak = oldend;
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	unsigned npages, i;
 
 	dumbvm_can_sleep();
 
@@ -415,6 +1339,18 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
 
+	/* Shared text stays shared */
+	if (old->as_text != NULL) {
+		dumbvm_textref(old->as_text);
+		new->as_text = old->as_text;
+		if (old->as_pbase1 == old->as_text->dt_pbase) {
+			new->as_pbase1 = old->as_pbase1;
+		}
+		else {
+			new->as_pbase2 = old->as_pbase2;
+		}
+	}
+
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
 	if (as_prepare_load(new)) {
 		as_destroy(new);
@@ -425,18 +1361,37 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	KASSERT(new->as_pbase2 != 0);
 	KASSERT(new->as_stackpbase != 0);
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
+	if (new->as_pbase1 != old->as_pbase1) {
+		memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
+			(const void *)PADDR_TO_KVADDR(old->as_pbase1),
+			old->as_npages1*PAGE_SIZE);
+	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	if (new->as_pbase2 != old->as_pbase2) {
+		memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
+			(const void *)PADDR_TO_KVADDR(old->as_pbase2),
+			old->as_npages2*PAGE_SIZE);
+	}
 
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
 
+	/* Only the pages inside the break need copying */
+	new->as_heapbase = old->as_heapbase;
+	new->as_heapend = old->as_heapend;
+	npages = (old->as_heapend - old->as_heapbase + PAGE_SIZE - 1)
+		/ PAGE_SIZE;
+	if (dumbvm_heapalloc(new, npages)) {
+		as_destroy(new);
+		return ENOMEM;
+	}
+	for (i=0; i<npages; i++) {
+		memmove((void *)PADDR_TO_KVADDR(new->as_heappages[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_heappages[i]),
+			PAGE_SIZE);
+	}
+
 	*ret = new;
 	return 0;
 }
@@ -40,6 +40,7 @@
 #include <membar.h>
 #include <synch.h>
 #include <mainbus.h>
+#include <prof.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
 #include "autoconf.h"
@@ -75,6 +76,39 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Read the c0_count register. ($9 == c0_count; again we can't use
+ * the symbolic name.)
+ */
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Read the c0_cause register ($13), to see if a timer interrupt is
+ * pending.
+ */
+static
+uint32_t
+mips_cause_get(void)
+{
+	uint32_t cause;
+
+	__asm volatile("mfc0 %0, $13" : "=r" (cause));
+	return cause;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -284,6 +318,40 @@ mainbus_send_ipi(struct cpu *target)
 #define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
 #define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
 
+/*
+ * Cycle counter.
+ *
+ * Because we reprogram c0_compare with the same value on every tick,
+ * c0_count runs from 0 up to CPU_FREQUENCY/HZ and starts over; so the
+ * cycle count is the number of ticks this CPU has taken (c_hardclocks)
+ * times the tick length, plus c0_count. If the timer has expired but
+ * we haven't run hardclock() for it yet (because interrupts are off)
+ * the tick is still pending in the cause register and has to be
+ * counted by hand. Reread until the pending bit is stable so we don't
+ * mix a count from before the expiry with a cause from after it.
+ */
+uint64_t
+mainbus_cycles(void)
+{
+	uint32_t count, cause1, cause2;
+	uint64_t ticks;
+	int spl;
+
+	spl = splhigh();
+	do {
+		cause1 = mips_cause_get();
+		count = mips_timer_get();
+		cause2 = mips_cause_get();
+	} while ((cause1 ^ cause2) & MIPS_TIMER_BIT);
+	ticks = curcpu->c_hardclocks;
+	splx(spl);
+
+	if (cause2 & MIPS_TIMER_BIT) {
+		ticks++;
+	}
+	return ticks * (CPU_FREQUENCY / HZ) + count;
+}
+
 void
 mainbus_interrupt(struct trapframe *tf)
 {
@@ -306,6 +374,11 @@ mainbus_interrupt(struct trapframe *tf)
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
 		mips_timer_set(CPU_FREQUENCY / HZ);
+		/* take a profiling sample before anything else runs */
+		if (prof_enabled) {
+			prof_sample(tf->tf_epc,
+				    (tf->tf_status & CST_KUp) != 0);
+		}
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -39,6 +39,22 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Otherwise output goes through a transmit ring: writers copy into it
+ * and go on their way, sleeping only if it's full, and the device's
+ * write-done interrupt (con_start) feeds it out a character at a
+ * time. Polled output first drains whatever is in the ring, so
+ * output still comes out in order.
+ *
+ * Input is collected by the read-ready interrupt into a receive ring.
+ * In cooked mode (the default) it is echoed, and backspace and ^U
+ * edit the line still being typed, right there in the ring; a user
+ * read sleeps until a whole line is in and then takes it in one go.
+ * In raw mode there's no echo or editing, and a read waits for a
+ * settable number of bytes. Either way readers are woken once per
+ * read rather than once per character. The mode is set by ioctl; see
+ * <kern/ioctl.h>. The kernel's own line editor, kgets, does its own
+ * echo, so it switches to raw mode while it reads (getch_setmode).
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -49,12 +65,15 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 #include <uio.h>
 #include <cpu.h>
+#include <copyinout.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -111,17 +130,92 @@ flush_delay_buf(void)
 
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Anything still in the transmit ring goes first.
+ *
+ * (If we already hold cs_txlock, we're printing from inside this
+ * file, presumably a panic; just send the character.)
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	bool mustlock;
+
+	mustlock = !spinlock_do_i_hold(&cs->cs_txlock);
+	if (mustlock) {
+		spinlock_acquire(&cs->cs_txlock);
+		while (cs->cs_txcount > 0) {
+			cs->cs_sendpolled(cs->cs_devdata,
+					  cs->cs_txbuf[cs->cs_txtail]);
+			cs->cs_txtail = (cs->cs_txtail + 1) %
+				CONSOLE_OUTPUT_BUFFER_SIZE;
+			cs->cs_txcount--;
+		}
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	if (mustlock) {
+		wchan_wakeall(cs->cs_txwchan, &cs->cs_txlock);
+		spinlock_release(&cs->cs_txlock);
+	}
 }
 
 //////////////////////////////////////////////////
 
+/*
+ * Send the next character from the transmit ring, if there is one
+ * and the device isn't already busy. Call with cs_txlock held.
+ */
+static
+void
+con_txstart(struct con_softc *cs)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_txlock));
+
+	if (cs->cs_txbusy || cs->cs_txcount == 0) {
+		return;
+	}
+	cs->cs_txbusy = true;
+	cs->cs_send(cs->cs_devdata, cs->cs_txbuf[cs->cs_txtail]);
+	cs->cs_txtail = (cs->cs_txtail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_txcount--;
+}
+
+/*
+ * Queue LEN characters for output, turning newlines into CR-LF if
+ * CRLF is set. Sleeps only while the ring is full; otherwise copies
+ * in as much as fits under one acquisition of the lock.
+ */
+static
+void
+con_txqueue(struct con_softc *cs, const char *buf, size_t len, bool crlf)
+{
+	size_t i = 0;
+	bool needcr = true;
+
+	spinlock_acquire(&cs->cs_txlock);
+	while (i < len) {
+		while (cs->cs_txcount == CONSOLE_OUTPUT_BUFFER_SIZE) {
+			con_txstart(cs);
+			wchan_sleep(cs->cs_txwchan, &cs->cs_txlock);
+		}
+		while (i < len && cs->cs_txcount < CONSOLE_OUTPUT_BUFFER_SIZE) {
+			if (crlf && buf[i] == '\n' && needcr) {
+				cs->cs_txbuf[cs->cs_txhead] = '\r';
+				needcr = false;
+			}
+			else {
+				cs->cs_txbuf[cs->cs_txhead] = buf[i++];
+				needcr = true;
+			}
+			cs->cs_txhead = (cs->cs_txhead + 1) %
+				CONSOLE_OUTPUT_BUFFER_SIZE;
+			cs->cs_txcount++;
+		}
+		con_txstart(cs);
+	}
+	spinlock_release(&cs->cs_txlock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -129,8 +223,80 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_txqueue(cs, &c, 1, false);
+}
+
+/*
+ * Echo typed input. This is called from the read-ready interrupt, so
+ * it can't wait for room in the transmit ring; if there isn't any,
+ * the echo is lost.
+ */
+static
+void
+con_echo(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_txlock);
+	for (i=0; i<len && cs->cs_txcount < CONSOLE_OUTPUT_BUFFER_SIZE; i++) {
+		cs->cs_txbuf[cs->cs_txhead] = buf[i];
+		cs->cs_txhead = (cs->cs_txhead + 1) %
+			CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_txcount++;
+	}
+	con_txstart(cs);
+	spinlock_release(&cs->cs_txlock);
+}
+
+/*
+ * Take the next character out of the receive ring. Call with
+ * cs_rxlock held and the ring not empty.
+ */
+static
+unsigned char
+con_rxtake(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_rxlock));
+	KASSERT(cs->cs_gotchars_count > 0);
+
+	ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+	cs->cs_gotchars_tail =
+		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	cs->cs_gotchars_count--;
+	if (ch == '\n') {
+		cs->cs_rxlines--;
+	}
+	/*
+	 * Once a reader has taken them, characters can't be erased.
+	 * A cooked-mode user read only takes part of a line if the
+	 * line filled the ring before it was finished.
+	 */
+	if (cs->cs_rxedit > cs->cs_gotchars_count) {
+		cs->cs_rxedit = cs->cs_gotchars_count;
+	}
+	return ch;
+}
+
+/*
+ * Sleep until con_input has COUNT characters (or, in cooked mode, a
+ * line) for us. Call with cs_rxlock held. If there are several
+ * sleepers the smallest count wins; the others recheck and go back
+ * to sleep.
+ */
+static
+void
+con_rxwait(struct con_softc *cs, unsigned count)
+{
+	KASSERT(spinlock_do_i_hold(&cs->cs_rxlock));
+
+	if (count < cs->cs_rxwant) {
+		cs->cs_rxwant = count;
+	}
+	wchan_sleep(cs->cs_rxwchan, &cs->cs_rxlock);
 }
 
 /*
@@ -142,49 +308,122 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
-	cs->cs_gotchars_tail =
-		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	spinlock_acquire(&cs->cs_rxlock);
+	while (cs->cs_gotchars_count == 0) {
+		con_rxwait(cs, 1);
+	}
+	ret = con_rxtake(cs);
+	spinlock_release(&cs->cs_rxlock);
 	return ret;
 }
 
+/*
+ * Cooked mode: erase the last character of the line being typed, if
+ * there's one left in the ring, from the ring and from the screen.
+ */
+static
+void
+con_erase(struct con_softc *cs)
+{
+	if (cs->cs_rxedit == 0) {
+		return;
+	}
+	cs->cs_gotchars_head = (cs->cs_gotchars_head +
+				CONSOLE_INPUT_BUFFER_SIZE - 1) %
+		CONSOLE_INPUT_BUFFER_SIZE;
+	cs->cs_gotchars_count--;
+	cs->cs_rxedit--;
+	con_echo(cs, "\b \b", 3);
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
- * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * In cooked mode, backspace/DEL and ^U edit the line being typed, CR
+ * is turned into newline, and everything else is echoed. Waiting
+ * readers are woken when a line is finished, when the count they
+ * asked for is reached, or when the ring is full and they'll have to
+ * take what there is. If the ring is already full the character is
+ * dropped.
  */
 void
 con_input(void *vcs, int ch)
 {
 	struct con_softc *cs = vcs;
-	unsigned nexthead;
-
-	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	if (nexthead == cs->cs_gotchars_tail) {
+	bool eol;
+	char c;
+
+	spinlock_acquire(&cs->cs_rxlock);
+	if (cs->cs_rxmode == CON_COOKED) {
+		if (ch == '\b' || ch == 127) {
+			con_erase(cs);
+			spinlock_release(&cs->cs_rxlock);
+			return;
+		}
+		if (ch == 21) {
+			/* ^U */
+			while (cs->cs_rxedit > 0) {
+				con_erase(cs);
+			}
+			spinlock_release(&cs->cs_rxlock);
+			return;
+		}
+	}
+	if (cs->cs_gotchars_count == CONSOLE_INPUT_BUFFER_SIZE) {
 		/* overflow; drop character */
+		spinlock_release(&cs->cs_rxlock);
 		return;
 	}
 
+	if (cs->cs_rxmode == CON_COOKED) {
+		if (ch == '\r') {
+			ch = '\n';
+		}
+		if (ch == '\n') {
+			con_echo(cs, "\r\n", 2);
+			cs->cs_rxedit = 0;
+		}
+		else {
+			c = ch;
+			con_echo(cs, &c, 1);
+			cs->cs_rxedit++;
+		}
+	}
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
-	cs->cs_gotchars_head = nexthead;
+	cs->cs_gotchars_head =
+		(cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	cs->cs_gotchars_count++;
+	if (ch == '\n') {
+		cs->cs_rxlines++;
+	}
 
-	V(cs->cs_rsem);
+	eol = (ch == '\n' && cs->cs_rxmode == CON_COOKED);
+	if (eol || cs->cs_gotchars_count >= cs->cs_rxwant) {
+		/* Everyone resets it when they go back to sleep. */
+		cs->cs_rxwant = CONSOLE_INPUT_BUFFER_SIZE;
+		wchan_wakeall(cs->cs_rxwchan, &cs->cs_rxlock);
+	}
+	spinlock_release(&cs->cs_rxlock);
 }
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next character, and let writers back in once half the
+ * ring is free, so they wake up to copy in a batch rather than one
+ * character per interrupt.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_txlock);
+	cs->cs_txbusy = false;
+	con_txstart(cs);
+	if (cs->cs_txcount <= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_txwchan, &cs->cs_txlock);
+	}
+	spinlock_release(&cs->cs_txlock);
 }
 
 //////////////////////////////////////////////////
@@ -225,6 +464,28 @@ getch(void)
 	return getch_intr(cs);
 }
 
+/*
+ * Set the input mode for getch, like CONIOC_SETMODE does for user
+ * reads, and return the old one.
+ */
+int
+getch_setmode(int mode)
+{
+	struct con_softc *cs = the_console;
+	int old;
+
+	KASSERT(cs != NULL);
+	KASSERT(mode == CON_COOKED || mode == CON_RAW);
+
+	spinlock_acquire(&cs->cs_rxlock);
+	old = cs->cs_rxmode;
+	cs->cs_rxmode = mode;
+	cs->cs_rxedit = 0;
+	wchan_wakeall(cs->cs_rxwchan, &cs->cs_rxlock);
+	spinlock_release(&cs->cs_rxlock);
+	return old;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -240,54 +501,102 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+/*
+ * Read side of con_io. Wait until there's enough input: in cooked
+ * mode a whole line or a full ring, however little the caller asked
+ * for, so that the line can still be edited until it's finished; in
+ * raw mode cs_rxmin bytes (or fewer if that's all the caller asked
+ * for). Then take what's there, stopping after the first newline in
+ * cooked mode, and copy it out in one uiomove. That has to happen
+ * outside the spinlock, since it can fault. The rest of a line that
+ * didn't fit is left for the next read.
+ */
+static
+int
+con_read(struct con_softc *cs, struct uio *uio)
+{
+	char buf[CONSOLE_INPUT_BUFFER_SIZE];
+	unsigned need;
+	size_t len;
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	spinlock_acquire(&cs->cs_rxlock);
+	while (1) {
+		if (cs->cs_rxmode == CON_COOKED) {
+			if (cs->cs_rxlines > 0) {
+				break;
+			}
+			need = CONSOLE_INPUT_BUFFER_SIZE;
+		}
+		else {
+			need = cs->cs_rxmin;
+			if (need > uio->uio_resid) {
+				need = uio->uio_resid;
+			}
+		}
+		if (cs->cs_gotchars_count >= need) {
+			break;
+		}
+		con_rxwait(cs, need);
+	}
+
+	len = 0;
+	while (len < uio->uio_resid && cs->cs_gotchars_count > 0) {
+		buf[len] = con_rxtake(cs);
+		if (buf[len++] == '\n' && cs->cs_rxmode == CON_COOKED) {
+			break;
+		}
+	}
+	spinlock_release(&cs->cs_rxlock);
+
+	return uiomove(buf, len, uio);
+}
+
+/*
+ * Writes are copied in from the uio a chunk at a time (uiomove can
+ * fault, so not under the ring's spinlock) and queued in bulk. The
+ * write lock is still held for the whole transfer, so one process's
+ * write isn't interleaved with another's; but now it's only held for
+ * as long as it takes to fill the ring.
+ */
+#define CON_WRITECHUNK 128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
-	char ch;
-	struct lock *lk;
+	char buf[CON_WRITECHUNK];
+	size_t len;
 
 	(void)dev;  // unused
 
 	if (uio->uio_rw==UIO_READ) {
-		lk = con_userlock_read;
-	}
-	else {
-		lk = con_userlock_write;
+		KASSERT(con_userlock_read != NULL);
+		lock_acquire(con_userlock_read);
+		result = con_read(the_console, uio);
+		lock_release(con_userlock_read);
+		return result;
 	}
 
-	KASSERT(lk != NULL);
-	lock_acquire(lk);
-
+	KASSERT(con_userlock_write != NULL);
+	lock_acquire(con_userlock_write);
 	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+		result = uiomove(buf, len, uio);
+		if (result) {
+			lock_release(con_userlock_write);
+			return result;
 		}
+		con_txqueue(the_console, buf, len, true);
 	}
-	lock_release(lk);
+	lock_release(con_userlock_write);
 	return 0;
 }
 
@@ -295,11 +604,46 @@ static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
 {
-	/* No ioctls. */
-	(void)dev;
-	(void)op;
-	(void)data;
-	return EINVAL;
+	struct con_softc *cs = dev->d_data;
+	int val, result;
+
+	switch (op) {
+	    case CONIOC_GETMODE:
+		spinlock_acquire(&cs->cs_rxlock);
+		val = cs->cs_rxmode;
+		spinlock_release(&cs->cs_rxlock);
+		return copyout(&val, data, sizeof(val));
+	    case CONIOC_SETMODE:
+	    case CONIOC_SETMIN:
+		break;
+	    default:
+		return EIOCTL;
+	}
+
+	result = copyin(data, &val, sizeof(val));
+	if (result) {
+		return result;
+	}
+	if (op == CONIOC_SETMODE && val != CON_COOKED && val != CON_RAW) {
+		return EINVAL;
+	}
+	if (op == CONIOC_SETMIN &&
+	    (val < 1 || val > CONSOLE_INPUT_BUFFER_SIZE)) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&cs->cs_rxlock);
+	if (op == CONIOC_SETMODE) {
+		cs->cs_rxmode = val;
+		/* what was typed before can't be edited any more */
+		cs->cs_rxedit = 0;
+	}
+	else {
+		cs->cs_rxmin = val;
+	}
+	wchan_wakeall(cs->cs_rxwchan, &cs->cs_rxlock);
+	spinlock_release(&cs->cs_rxlock);
+	return 0;
 }
 
 static const struct device_ops console_devops = {
@@ -343,7 +687,7 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct wchan *rxwchan, *txwchan;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -359,33 +703,48 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
+	rxwchan = wchan_create("console read");
+	if (rxwchan == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
+	txwchan = wchan_create("console write");
+	if (txwchan == NULL) {
+		wchan_destroy(rxwchan);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rxwchan);
+		wchan_destroy(txwchan);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rxwchan);
+		wchan_destroy(txwchan);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
+	spinlock_init(&cs->cs_rxlock);
+	spinlock_setname(&cs->cs_rxlock, "console rx");
+	cs->cs_rxwchan = rxwchan;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	cs->cs_gotchars_count = 0;
+	cs->cs_rxlines = 0;
+	cs->cs_rxwant = CONSOLE_INPUT_BUFFER_SIZE;
+	cs->cs_rxmode = CON_COOKED;
+	cs->cs_rxedit = 0;
+	cs->cs_rxmin = 1;
+
+	spinlock_init(&cs->cs_txlock);
+	spinlock_setname(&cs->cs_txlock, "console tx");
+	cs->cs_txwchan = txwchan;
+	cs->cs_txhead = 0;
+	cs->cs_txtail = 0;
+	cs->cs_txcount = 0;
+	cs->cs_txbusy = false;
 
 	the_console = cs;
 	con_userlock_read = rlk;
@@ -30,6 +30,8 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <spinlock.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
@@ -37,7 +39,8 @@
  * device, and are to be initialized by the attach routine.
  */
 
-#define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_INPUT_BUFFER_SIZE 256
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -46,11 +49,42 @@ struct con_softc {
 	void (*cs_sendpolled)(void *devdata, int ch);
 
 	/* initialized by config routine */
-	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
+
+	/*
+	 * Receive ring, filled by con_input from the read-ready
+	 * interrupt. Readers are not woken for every character; they
+	 * set cs_rxwant to the count they're waiting for, and get
+	 * woken when a line is complete (cooked mode), when that many
+	 * characters are in (either mode), or when the ring fills up.
+	 * All of it is protected by cs_rxlock.
+	 */
+	struct spinlock cs_rxlock;
+	struct wchan *cs_rxwchan;	/* readers waiting for input */
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	unsigned cs_gotchars_count;	/* chars in the ring */
+	unsigned cs_rxlines;		/* newlines in the ring */
+	unsigned cs_rxwant;		/* wake readers at this count */
+	int cs_rxmode;			/* CON_COOKED or CON_RAW */
+	unsigned cs_rxedit;		/* cooked: chars of the unfinished
+					   line still in the ring */
+	unsigned cs_rxmin;		/* raw mode: bytes per read */
+
+	/*
+	 * Transmit ring. Writers fill it and con_start drains it from
+	 * the write-done interrupt, one character per interrupt.
+	 * cs_txbusy is true while a character is on its way out, that
+	 * is, while a con_start call is still to come. All of it is
+	 * protected by cs_txlock.
+	 */
+	struct spinlock cs_txlock;
+	struct wchan *cs_txwchan;	/* writers waiting for room */
+	unsigned char cs_txbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_txhead;		/* next slot to put a char in */
+	unsigned cs_txtail;		/* next slot to send from */
+	unsigned cs_txcount;		/* chars in the ring */
+	bool cs_txbusy;
 };
 
 /*
@@ -262,39 +262,51 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 }
 
 /*
- * Common code for read and readdir.
+ * Common code for read and readdir. The caller holds e_lock.
  */
 static
 int
-emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
-	   uint32_t op, struct uio *uio)
+emu_doread_locked(struct emu_softc *sc, uint32_t handle, uint32_t len,
+		  uint32_t op, struct uio *uio)
 {
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	if (uio->uio_offset > (off_t)0xffffffff) {
 		/* beyond the largest size the file can have; generate EOF */
 		return 0;
 	}
 
-	lock_acquire(sc->e_lock);
-
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
 	emu_wreg(sc, REG_OPER, op);
 	result = emu_waitdone(sc);
 	if (result) {
-		goto out;
+		return result;
 	}
 
 	membar_load_load();
 	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
 
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	return result;
+}
 
- out:
+/*
+ * Same, taking the lock.
+ */
+static
+int
+emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
+	   uint32_t op, struct uio *uio)
+{
+	int result;
+
+	lock_acquire(sc->e_lock);
+	result = emu_doread_locked(sc, handle, len, op, uio);
 	lock_release(sc->e_lock);
 	return result;
 }
@@ -404,6 +416,709 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Data cache
+//
+// Every read used to go to the device, and the device does one
+// operation at a time under e_lock, so many processes running
+// programs from emu0: all queued up on that one lock. Now file
+// contents are cached in EMU_MAXIO-sized chunks and reads that hit
+// copy straight out of the cache without touching e_lock. A read that
+// misses fetches all the missing chunks it covers (up to EMUFS_BATCH,
+// and not past the cached size) in one trip through e_lock.
+//
+// Chunk buffers come from a pool of EMUFS_CACHECHUNKS that is filled
+// as needed and never freed, since under dumbvm free_kpages does
+// nothing and a 16K buffer handed back would just be lost. When the
+// pool is used up, the least recently used idle chunk is taken back.
+//
+// Writes go straight through to the device and then drop the chunks
+// they overlap. The host can also change files behind our back; we
+// check the size on every open and throw the file's chunks away if it
+// changed, which catches the common cases (rebuilt binaries, edited
+// text files) but not a change that keeps the size the same.
+//
+// Only files reached by a plain path (no "." or ".." components) are
+// cached, so that each host file has at most one entry. If the same
+// path gets opened under a second handle anyway, the file isn't
+// cached at all until both are gone, since the host keeps the two
+// handles' views of it in step and we can't.
+//
+// Lock order: e_lock, then ef_cachelock.
+//
+
+/* Size of the chunk pool, and so of the cache */
+#define EMUFS_CACHECHUNKS	32
+
+/* Most chunks one read will fetch at once */
+#define EMUFS_BATCH		4
+
+static struct {
+	unsigned reads;		/* VOP_READ calls on cached files */
+	unsigned hits;		/* chunks found in the cache */
+	unsigned misses;	/* chunks not found */
+	unsigned fetchops;	/* device reads issued to fill chunks */
+	unsigned fetchbatches;	/* trips through e_lock to fill chunks */
+	unsigned fetchbytes;	/* bytes read into chunks */
+	unsigned uncached;	/* reads that fell back to the device */
+	unsigned evictions;	/* chunks evicted to make room */
+	unsigned dropped;	/* chunks dropped by writes or host changes */
+	unsigned sizehits;	/* getsize answered from the cache */
+	unsigned sizemisses;	/* getsize sent to the device */
+} emufs_stats;
+
+/*
+ * Make the cache path for NAME looked up in directory DIR. Returns
+ * NULL (don't cache) if DIR isn't cached, if NAME isn't a plain path,
+ * or if we're out of memory.
+ */
+static
+char *
+emufs_cache_path(struct emufs_vnode *dir, const char *name)
+{
+	const char *s, *slash;
+	size_t len;
+	char *path;
+
+	if (dir->ev_file == NULL) {
+		return NULL;
+	}
+
+	/* check each component */
+	s = name;
+	while (1) {
+		slash = strchr(s, '/');
+		len = slash != NULL ? (size_t)(slash - s) : strlen(s);
+		if (len == 0 || (len == 1 && s[0] == '.') ||
+		    (len == 2 && s[0] == '.' && s[1] == '.')) {
+			return NULL;
+		}
+		if (slash == NULL) {
+			break;
+		}
+		s = slash + 1;
+	}
+
+	if (dir->ev_file->cf_path[0] == 0) {
+		return kstrdup(name);
+	}
+	len = strlen(dir->ev_file->cf_path) + 1 + strlen(name) + 1;
+	path = kmalloc(len);
+	if (path == NULL) {
+		return NULL;
+	}
+	snprintf(path, len, "%s/%s", dir->ev_file->cf_path, name);
+	return path;
+}
+
+/*
+ * Put a chunk back in the pool. Cache lock held.
+ */
+static
+void
+emufs_chunk_free(struct emufs_fs *ef, struct emufs_chunk *ck)
+{
+	KASSERT(ck->ck_file == NULL);
+	KASSERT(ck->ck_refs == 0);
+	ck->ck_next = ef->ef_free;
+	ef->ef_free = ck;
+}
+
+/*
+ * Take a chunk out of the cache. If someone is still copying out of
+ * it, the last of them frees it. Cache lock held; does not free the
+ * owning entry.
+ */
+static
+void
+emufs_cache_drop(struct emufs_fs *ef, struct emufs_chunk *ck)
+{
+	struct emufs_chunk **pp;
+
+	KASSERT(ck->ck_file != NULL);
+	for (pp = &ck->ck_file->cf_chunks; *pp != ck; pp = &(*pp)->ck_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = ck->ck_next;
+
+	if (ck->ck_lruprev != NULL) {
+		ck->ck_lruprev->ck_lrunext = ck->ck_lrunext;
+	}
+	else {
+		ef->ef_lruhead = ck->ck_lrunext;
+	}
+	if (ck->ck_lrunext != NULL) {
+		ck->ck_lrunext->ck_lruprev = ck->ck_lruprev;
+	}
+	else {
+		ef->ef_lrutail = ck->ck_lruprev;
+	}
+
+	ck->ck_file = NULL;
+	ck->ck_next = ck->ck_lruprev = ck->ck_lrunext = NULL;
+	if (ck->ck_refs == 0) {
+		emufs_chunk_free(ef, ck);
+	}
+}
+
+/*
+ * Attach the cache entry for PATH to a newly loaded vnode, creating
+ * the entry if needed. Consumes PATH, which may be NULL. If something
+ * goes wrong the vnode just isn't cached.
+ */
+static
+void
+emufs_cache_attach(struct emufs_fs *ef, struct emufs_vnode *ev, char *path)
+{
+	struct emufs_cfile *cf;
+
+	ev->ev_file = NULL;
+	if (path == NULL) {
+		return;
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	for (cf = ef->ef_files; cf != NULL; cf = cf->cf_next) {
+		if (!strcmp(cf->cf_path, path)) {
+			break;
+		}
+	}
+	if (cf == NULL) {
+		cf = kmalloc(sizeof(*cf));
+		if (cf == NULL) {
+			lock_release(ef->ef_cachelock);
+			kfree(path);
+			return;
+		}
+		cf->cf_path = path;
+		cf->cf_nvnodes = 0;
+		cf->cf_nocache = false;
+		cf->cf_chunks = NULL;
+		cf->cf_size = 0;
+		cf->cf_sizevalid = false;
+		cf->cf_gen = 0;
+		cf->cf_next = ef->ef_files;
+		ef->ef_files = cf;
+	}
+	else {
+		kfree(path);
+	}
+	if (cf->cf_nvnodes > 0 && !cf->cf_nocache) {
+		/*
+		 * In use under another handle. Writes through either
+		 * one would leave the other's view stale, so stop
+		 * caching it. Both vnodes still point here, so that
+		 * the entry can't be reused until they're both gone.
+		 */
+		while (cf->cf_chunks != NULL) {
+			emufs_cache_drop(ef, cf->cf_chunks);
+			emufs_stats.dropped++;
+		}
+		cf->cf_nocache = true;
+		cf->cf_sizevalid = false;
+		cf->cf_gen++;
+	}
+	cf->cf_nvnodes++;
+	ev->ev_file = cf;
+	lock_release(ef->ef_cachelock);
+}
+
+/*
+ * Free a cache entry if nothing is using it. Cache lock held.
+ */
+static
+void
+emufs_cache_freefile(struct emufs_fs *ef, struct emufs_cfile *cf)
+{
+	struct emufs_cfile **pp;
+
+	if (cf->cf_nvnodes > 0 || cf->cf_chunks != NULL) {
+		return;
+	}
+	for (pp = &ef->ef_files; *pp != cf; pp = &(*pp)->cf_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = cf->cf_next;
+	kfree(cf->cf_path);
+	kfree(cf);
+}
+
+/*
+ * Detach a vnode from its cache entry, at reclaim time. The cached
+ * data stays around for next time.
+ */
+static
+void
+emufs_cache_detach(struct emufs_fs *ef, struct emufs_vnode *ev)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+
+	if (cf == NULL) {
+		return;
+	}
+	lock_acquire(ef->ef_cachelock);
+	KASSERT(cf->cf_nvnodes > 0);
+	cf->cf_nvnodes--;
+	ev->ev_file = NULL;
+	emufs_cache_freefile(ef, cf);
+	lock_release(ef->ef_cachelock);
+}
+
+/*
+ * Drop the chunks of CF that overlap [START, END), and any short
+ * (end-of-file) chunk since a write may have extended the file.
+ * Cache lock held.
+ */
+static
+void
+emufs_cache_droprange(struct emufs_fs *ef, struct emufs_cfile *cf,
+		      off_t start, off_t end)
+{
+	struct emufs_chunk *ck, *next;
+	off_t ckstart;
+
+	cf->cf_gen++;
+	for (ck = cf->cf_chunks; ck != NULL; ck = next) {
+		next = ck->ck_next;
+		ckstart = (off_t)ck->ck_index * EMU_MAXIO;
+		if (ck->ck_len < EMU_MAXIO ||
+		    (ckstart < end && ckstart + EMU_MAXIO > start)) {
+			emufs_cache_drop(ef, ck);
+			emufs_stats.dropped++;
+		}
+	}
+}
+
+/*
+ * Look up chunk INDEX of a cached file. On a hit, returns it with a
+ * reference held; release with emufs_cache_put.
+ */
+static
+struct emufs_chunk *
+emufs_cache_get(struct emufs_fs *ef, struct emufs_cfile *cf, uint32_t index)
+{
+	struct emufs_chunk *ck;
+
+	lock_acquire(ef->ef_cachelock);
+	for (ck = cf->cf_chunks; ck != NULL; ck = ck->ck_next) {
+		if (ck->ck_index == index) {
+			break;
+		}
+	}
+	if (ck == NULL) {
+		emufs_stats.misses++;
+		lock_release(ef->ef_cachelock);
+		return NULL;
+	}
+	emufs_stats.hits++;
+	ck->ck_refs++;
+
+	/* move to the front of the LRU list */
+	if (ck->ck_lruprev != NULL) {
+		ck->ck_lruprev->ck_lrunext = ck->ck_lrunext;
+		if (ck->ck_lrunext != NULL) {
+			ck->ck_lrunext->ck_lruprev = ck->ck_lruprev;
+		}
+		else {
+			ef->ef_lrutail = ck->ck_lruprev;
+		}
+		ck->ck_lruprev = NULL;
+		ck->ck_lrunext = ef->ef_lruhead;
+		ef->ef_lruhead->ck_lruprev = ck;
+		ef->ef_lruhead = ck;
+	}
+	lock_release(ef->ef_cachelock);
+	return ck;
+}
+
+/*
+ * Release a chunk reference.
+ */
+static
+void
+emufs_cache_put(struct emufs_fs *ef, struct emufs_chunk *ck)
+{
+	lock_acquire(ef->ef_cachelock);
+	KASSERT(ck->ck_refs > 0);
+	ck->ck_refs--;
+	if (ck->ck_file == NULL && ck->ck_refs == 0) {
+		emufs_chunk_free(ef, ck);
+	}
+	lock_release(ef->ef_cachelock);
+}
+
+/*
+ * Get a chunk for INDEX from the pool, growing the pool if it isn't
+ * full yet and otherwise evicting the least recently used idle
+ * chunk. Cache lock held. Returns NULL if every chunk is busy.
+ */
+static
+struct emufs_chunk *
+emufs_chunk_alloc(struct emufs_fs *ef, uint32_t index)
+{
+	struct emufs_chunk *ck;
+	struct emufs_cfile *vf;
+
+	if (ef->ef_free == NULL && ef->ef_npool < EMUFS_CACHECHUNKS) {
+		ck = kmalloc(sizeof(*ck));
+		if (ck != NULL) {
+			ck->ck_data = kmalloc(EMU_MAXIO);
+			if (ck->ck_data == NULL) {
+				kfree(ck);
+				ck = NULL;
+			}
+		}
+		if (ck != NULL) {
+			ef->ef_npool++;
+			ck->ck_file = NULL;
+			ck->ck_refs = 0;
+			emufs_chunk_free(ef, ck);
+		}
+	}
+	if (ef->ef_free == NULL) {
+		for (ck = ef->ef_lrutail; ck != NULL; ck = ck->ck_lruprev) {
+			if (ck->ck_refs == 0) {
+				break;
+			}
+		}
+		if (ck == NULL) {
+			return NULL;
+		}
+		vf = ck->ck_file;
+		emufs_cache_drop(ef, ck);
+		emufs_cache_freefile(ef, vf);
+		emufs_stats.evictions++;
+	}
+
+	ck = ef->ef_free;
+	ef->ef_free = ck->ck_next;
+	ck->ck_file = NULL;
+	ck->ck_index = index;
+	ck->ck_len = 0;
+	ck->ck_refs = 0;
+	ck->ck_next = ck->ck_lruprev = ck->ck_lrunext = NULL;
+	return ck;
+}
+
+/*
+ * Add a freshly read chunk to the cache. Cache lock held.
+ */
+static
+void
+emufs_cache_insert(struct emufs_fs *ef, struct emufs_cfile *cf,
+		   struct emufs_chunk *ck)
+{
+	ck->ck_file = cf;
+	ck->ck_next = cf->cf_chunks;
+	cf->cf_chunks = ck;
+	ck->ck_lruprev = NULL;
+	ck->ck_lrunext = ef->ef_lruhead;
+	if (ef->ef_lruhead != NULL) {
+		ef->ef_lruhead->ck_lruprev = ck;
+	}
+	else {
+		ef->ef_lrutail = ck;
+	}
+	ef->ef_lruhead = ck;
+}
+
+/*
+ * Read chunks INDEX through at most INDEX+COUNT-1 of a cached file
+ * from the device, stopping at end of file or at a chunk that's
+ * already cached, and add them to the cache. Returns chunk INDEX with
+ * a reference held; it may be empty (at or past EOF) and it may not
+ * have made it into the cache, but either way emufs_cache_put gets
+ * rid of it. Returns ENOMEM if the file isn't being cached or no
+ * chunk was free, in which case the caller should read uncached.
+ */
+static
+int
+emufs_cache_fetch(struct emufs_fs *ef, struct emufs_vnode *ev,
+		  uint32_t index, unsigned count, struct emufs_chunk **ret)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+	struct emufs_chunk *cks[EMUFS_BATCH];
+	struct emufs_chunk *ck;
+	struct iovec iov;
+	struct uio ku;
+	unsigned i, n, gen;
+	off_t nchunks;
+	size_t got;
+	int result;
+
+	KASSERT(count > 0);
+	if (count > EMUFS_BATCH) {
+		count = EMUFS_BATCH;
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	if (cf->cf_nocache) {
+		lock_release(ef->ef_cachelock);
+		return ENOMEM;
+	}
+	gen = cf->cf_gen;
+
+	/* Don't fetch past the end of the file... */
+	if (cf->cf_sizevalid) {
+		nchunks = DIVROUNDUP(cf->cf_size, EMU_MAXIO);
+		if (nchunks <= index) {
+			count = 1;
+		}
+		else if (nchunks - index < count) {
+			count = nchunks - index;
+		}
+	}
+
+	/* ...or refetch chunks after the first that are already here. */
+	for (ck = cf->cf_chunks; ck != NULL; ck = ck->ck_next) {
+		if (ck->ck_index > index && ck->ck_index < index + count) {
+			count = ck->ck_index - index;
+		}
+	}
+
+	for (n = 0; n < count; n++) {
+		ck = emufs_chunk_alloc(ef, index + n);
+		if (ck == NULL) {
+			break;
+		}
+		cks[n] = ck;
+	}
+	lock_release(ef->ef_cachelock);
+	if (n == 0) {
+		return ENOMEM;
+	}
+
+	/* Read them all in one trip through the device lock. */
+	result = 0;
+	lock_acquire(ev->ev_emu->e_lock);
+	for (i = 0; i < n; i++) {
+		ck = cks[i];
+		while (ck->ck_len < EMU_MAXIO) {
+			uio_kinit(&iov, &ku, ck->ck_data + ck->ck_len,
+				  EMU_MAXIO - ck->ck_len,
+				  (off_t)ck->ck_index * EMU_MAXIO + ck->ck_len,
+				  UIO_READ);
+			result = emu_doread_locked(ev->ev_emu, ev->ev_handle,
+						   EMU_MAXIO - ck->ck_len,
+						   EMU_OP_READ, &ku);
+			emufs_stats.fetchops++;
+			got = EMU_MAXIO - ck->ck_len - ku.uio_resid;
+			if (result || got == 0) {
+				break;
+			}
+			ck->ck_len += got;
+			emufs_stats.fetchbytes += got;
+		}
+		if (result || ck->ck_len < EMU_MAXIO) {
+			i++;
+			break;
+		}
+	}
+	lock_release(ev->ev_emu->e_lock);
+
+	lock_acquire(ef->ef_cachelock);
+
+	/* Anything past EOF or an error wasn't read at all. */
+	while (n > i) {
+		n--;
+		emufs_chunk_free(ef, cks[n]);
+	}
+	if (result) {
+		while (n > 0) {
+			n--;
+			emufs_chunk_free(ef, cks[n]);
+		}
+		lock_release(ef->ef_cachelock);
+		return result;
+	}
+
+	emufs_stats.fetchbatches++;
+	cks[0]->ck_refs++;
+	for (i = 0; i < n; i++) {
+		ck = cks[i];
+		if (gen == cf->cf_gen && ck->ck_len > 0) {
+			emufs_cache_insert(ef, cf, ck);
+		}
+		else if (i > 0) {
+			/* stale or empty: don't keep it */
+			emufs_chunk_free(ef, ck);
+		}
+	}
+	lock_release(ef->ef_cachelock);
+
+	*ret = cks[0];
+	return 0;
+}
+
+/*
+ * Get the size of a file, from the cache if possible.
+ */
+static
+int
+emufs_cache_getsize(struct emufs_fs *ef, struct emufs_vnode *ev,
+		    off_t *retval)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+	unsigned gen;
+	int result;
+
+	if (cf == NULL) {
+		return emu_getsize(ev->ev_emu, ev->ev_handle, retval);
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	if (cf->cf_sizevalid && !cf->cf_nocache) {
+		*retval = cf->cf_size;
+		emufs_stats.sizehits++;
+		lock_release(ef->ef_cachelock);
+		return 0;
+	}
+	emufs_stats.sizemisses++;
+	gen = cf->cf_gen;
+	lock_release(ef->ef_cachelock);
+
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, retval);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	if (gen == cf->cf_gen && !cf->cf_nocache) {
+		cf->cf_size = *retval;
+		cf->cf_sizevalid = true;
+	}
+	lock_release(ef->ef_cachelock);
+	return 0;
+}
+
+/*
+ * At open time, ask the host for the size, and if it isn't what we
+ * have cached the file has changed underneath us; drop everything.
+ */
+static
+int
+emufs_cache_revalidate(struct emufs_fs *ef, struct emufs_vnode *ev)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+	unsigned gen;
+	off_t size;
+	int result;
+
+	if (cf == NULL) {
+		return 0;
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	if (cf->cf_nocache) {
+		lock_release(ef->ef_cachelock);
+		return 0;
+	}
+	gen = cf->cf_gen;
+	lock_release(ef->ef_cachelock);
+
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(ef->ef_cachelock);
+	emufs_stats.sizemisses++;
+	if (cf->cf_nocache) {
+		/* opened under another handle meanwhile */
+		lock_release(ef->ef_cachelock);
+		return 0;
+	}
+	if (!cf->cf_sizevalid || cf->cf_size != size) {
+		while (cf->cf_chunks != NULL) {
+			emufs_cache_drop(ef, cf->cf_chunks);
+			emufs_stats.dropped++;
+		}
+		cf->cf_gen++;
+	}
+	else if (gen != cf->cf_gen) {
+		/* raced with a write; leave the size unknown */
+		cf->cf_sizevalid = false;
+		lock_release(ef->ef_cachelock);
+		return 0;
+	}
+	cf->cf_size = size;
+	cf->cf_sizevalid = true;
+	lock_release(ef->ef_cachelock);
+	return 0;
+}
+
+/*
+ * Record a successful write of [START, END): drop the chunks it
+ * touched and extend the cached size.
+ */
+static
+void
+emufs_cache_written(struct emufs_fs *ef, struct emufs_vnode *ev,
+		    off_t start, off_t end)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+
+	if (cf == NULL || end <= start) {
+		return;
+	}
+	lock_acquire(ef->ef_cachelock);
+	emufs_cache_droprange(ef, cf, start, end);
+	if (cf->cf_sizevalid && end > cf->cf_size) {
+		cf->cf_size = end;
+	}
+	lock_release(ef->ef_cachelock);
+}
+
+/*
+ * Record a successful truncate to LEN.
+ */
+static
+void
+emufs_cache_truncated(struct emufs_fs *ef, struct emufs_vnode *ev, off_t len)
+{
+	struct emufs_cfile *cf = ev->ev_file;
+
+	if (cf == NULL) {
+		return;
+	}
+	lock_acquire(ef->ef_cachelock);
+	emufs_cache_droprange(ef, cf, len, (off_t)0x7fffffffffffffffLL);
+	cf->cf_size = len;
+	cf->cf_sizevalid = !cf->cf_nocache;
+	lock_release(ef->ef_cachelock);
+}
+
+/*
+ * Print the statistics.
+ */
+void
+emufs_printstats(void)
+{
+	kprintf("emufs cache: %u reads, %u chunk hits, %u misses, "
+		"%u uncached\n", emufs_stats.reads, emufs_stats.hits,
+		emufs_stats.misses, emufs_stats.uncached);
+	kprintf("emufs cache: %u device reads in %u batches, %u KB fetched\n",
+		emufs_stats.fetchops, emufs_stats.fetchbatches,
+		emufs_stats.fetchbytes / 1024);
+	kprintf("emufs cache: %u chunks evicted, %u dropped\n",
+		emufs_stats.evictions, emufs_stats.dropped);
+	kprintf("emufs cache: %u sizes from cache, %u from device\n",
+		emufs_stats.sizehits, emufs_stats.sizemisses);
+}
+
+/*
+ * Reset the statistics.
+ */
+void
+emufs_resetstats(void)
+{
+	bzero(&emufs_stats, sizeof(emufs_stats));
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // vnode functions
@@ -412,7 +1127,7 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 // at bottom of this section
 
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
-			   struct emufs_vnode **ret);
+			   char *path, struct emufs_vnode **ret);
 
 /*
  * VOP_EACHOPEN on files
@@ -427,12 +1142,13 @@ emufs_eachopen(struct vnode *v, int openflags)
 	 *
 	 * Any of O_RDONLY, O_WRONLY, and O_RDWR are valid, so we don't need
 	 * to check that either.
+	 *
+	 * But check that the host hasn't changed the file on us.
 	 */
 
-	(void)v;
 	(void)openflags;
 
-	return 0;
+	return emufs_cache_revalidate(v->vn_fs->fs_data, v->vn_data);
 }
 
 /*
@@ -507,6 +1223,8 @@ emufs_reclaim(struct vnode *v)
 		return result;
 	}
 
+	emufs_cache_detach(ef, ev);
+
 	num = vnodearray_num(ef->ef_vnodes);
 	ix = num;
 	for (i=0; i<num; i++) {
@@ -534,19 +1252,16 @@ emufs_reclaim(struct vnode *v)
 }
 
 /*
- * VOP_READ
+ * Read straight from the device, for files that aren't cached.
  */
 static
 int
-emufs_read(struct vnode *v, struct uio *uio)
+emufs_read_uncached(struct emufs_vnode *ev, struct uio *uio)
 {
-	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_READ);
-
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -569,6 +1284,70 @@ emufs_read(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_READ
+ */
+static
+int
+emufs_read(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	struct emufs_chunk *ck;
+	uint32_t index, within, amt;
+	off_t last;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	if (ev->ev_file == NULL) {
+		return emufs_read_uncached(ev, uio);
+	}
+	emufs_stats.reads++;
+
+	while (uio->uio_resid > 0) {
+		if (uio->uio_offset > (off_t)0xffffffff) {
+			/* beyond the largest size the file can have */
+			break;
+		}
+		index = uio->uio_offset / EMU_MAXIO;
+		within = uio->uio_offset % EMU_MAXIO;
+
+		ck = emufs_cache_get(ef, ev->ev_file, index);
+		if (ck == NULL) {
+			last = (uio->uio_offset + uio->uio_resid - 1) /
+				EMU_MAXIO;
+			result = emufs_cache_fetch(ef, ev, index,
+				last - index < EMUFS_BATCH ?
+				last - index + 1 : EMUFS_BATCH, &ck);
+			if (result == ENOMEM) {
+				emufs_stats.uncached++;
+				return emufs_read_uncached(ev, uio);
+			}
+			if (result) {
+				return result;
+			}
+		}
+
+		if (within >= ck->ck_len) {
+			/* EOF */
+			emufs_cache_put(ef, ck);
+			break;
+		}
+		amt = ck->ck_len - within;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(ck->ck_data + within, amt, uio);
+		emufs_cache_put(ef, ck);
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * VOP_READDIR
  */
@@ -597,8 +1376,10 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	uint32_t amt;
 	size_t oldresid;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
@@ -610,8 +1391,10 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 
 		oldresid = uio->uio_resid;
+		start = uio->uio_offset;
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+		emufs_cache_written(ef, ev, start, uio->uio_offset);
 		if (result) {
 			return result;
 		}
@@ -651,11 +1434,12 @@ int
 emufs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	int result;
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	result = emufs_cache_getsize(ef, ev, &statbuf->st_size);
 	if (result) {
 		return result;
 	}
@@ -725,7 +1509,15 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	int result;
+
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	if (result) {
+		return result;
+	}
+	emufs_cache_truncated(ef, ev, len);
+	return 0;
 }
 
 /*
@@ -749,7 +1541,8 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 		return result;
 	}
 
-	result = emufs_loadvnode(ef, handle, isdir, &newguy);
+	result = emufs_loadvnode(ef, handle, isdir,
+				 emufs_cache_path(ev, name), &newguy);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
 		return result;
@@ -779,7 +1572,8 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 		return result;
 	}
 
-	result = emufs_loadvnode(ef, handle, isdir, &newguy);
+	result = emufs_loadvnode(ef, handle, isdir,
+				 emufs_cache_path(ev, pathname), &newguy);
 	if (result) {
 		emu_close(ev->ev_emu, handle);
 		return result;
@@ -1138,12 +1932,13 @@ static const struct vnode_ops emufs_dirops = {
 };
 
 /*
- * Function to load a vnode into memory.
+ * Function to load a vnode into memory. PATH is the cache path for
+ * the file (see emufs_cache_path) or NULL; it is consumed.
  */
 static
 int
 emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
-		struct emufs_vnode **ret)
+		char *path, struct emufs_vnode **ret)
 {
 	struct vnode *v;
 	struct emufs_vnode *ev;
@@ -1164,6 +1959,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 			lock_release(ef->ef_emu->e_lock);
 			vfs_biglock_release();
+			kfree(path);
 			*ret = ev;
 			return 0;
 		}
@@ -1174,17 +1970,21 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
+		vfs_biglock_release();
+		kfree(path);
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_file = NULL;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		kfree(path);
 		kfree(ev);
 		return result;
 	}
@@ -1195,10 +1995,13 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		kfree(path);
 		kfree(ev);
 		return result;
 	}
 
+	emufs_cache_attach(ef, ev, path);
+
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
@@ -1310,7 +2113,20 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		return ENOMEM;
 	}
 
-	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
+	ef->ef_cachelock = lock_create("emufs-cache");
+	if (ef->ef_cachelock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_files = NULL;
+	ef->ef_lruhead = ef->ef_lrutail = NULL;
+	ef->ef_free = NULL;
+	ef->ef_npool = 0;
+
+	/* The root's cache path is the empty string. */
+	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, kstrdup(""),
+				 &ef->ef_root);
 	if (result) {
 		kfree(ef);
 		return result;
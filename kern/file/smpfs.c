@@ -169,7 +169,6 @@ void _fhs_close(int fd, struct fharray *fhs){
         vfs_close(*handle->fh_vnode);
         kfree(handle->fh_vnode);
         lock_destroy(handle->fh_lock);
-		kfree(handle->fh_vnode);
         kfree(handle->filename);
         kfree(handle);
     }else{
@@ -259,6 +258,34 @@ int _fh_dup2(int oldfd, int newfd, struct fharray* fhs, int* retval){
     return SUCC;
 }
 
+/* Copy a file handler table for fork. The handles are shared, so only their refs go up */
+int _fh_copy(struct fharray *dst, struct fharray *src){
+    KASSERT(dst != NULL);
+    KASSERT(src != NULL);
+
+    unsigned idx;
+    struct fh *handle;
+    int ret;
+
+    fharray_init(dst);
+    ret = fharray_setsize(dst,fharray_num(src));
+    if(ret != 0){
+        return ret;
+    }
+
+    for(idx=0;idx<fharray_num(src);idx++){
+        handle = fharray_get(src,idx);
+        if(handle != NULL){
+            lock_acquire(handle->fh_lock);
+            handle->refs = handle->refs + 1;
+            lock_release(handle->fh_lock);
+        }
+        fharray_set(dst,idx,handle);
+    }
+
+    return SUCC;
+}
+
 /* Bootstrap the file handler table by initializing it and adding console file handles */
 int _fh_bootstrap(struct fharray *fhs){
 
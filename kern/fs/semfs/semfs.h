@@ -31,6 +31,7 @@
 #define SEMFS_H
 
 #include <array.h>
+#include <spinlock.h>
 #include <fs.h>
 #include <vnode.h>
 
@@ -47,14 +48,21 @@
 /*
  * A user-facing semaphore.
  *
- * We don't use the kernel-level semaphore to implement it (although
- * that would be tidy) because we'd have to violate its abstraction.
- * XXX: or would we? review once all this is done.
+ * This is built the same way as the kernel-level semaphore, with a
+ * spinlock and a wait channel, but P and V take counts so we can't
+ * use that directly. sems_sleepers counts threads waiting that
+ * haven't been woken yet, so V can wake exactly as many as it has
+ * units for.
+ *
+ * sems_hasvnode and sems_linked are protected by semfs_tablelock;
+ * the semaphore is destroyed when both are false.
  */
 struct semfs_sem {
-	struct lock *sems_lock;			/* Lock to protect count */
-	struct cv *sems_cv;			/* CV to wait */
+	char *sems_name;			/* Name (for the wchan) */
+	struct spinlock sems_lock;		/* Lock to protect count */
+	struct wchan *sems_wchan;		/* Where to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_sleepers;			/* Waiters not yet woken */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -80,6 +88,7 @@ struct semfs_vnode {
 	struct vnode semv_absvn;		/* Abstract vnode */
 	struct semfs *semv_semfs;		/* Back-pointer to fs */
 	unsigned semv_semnum;			/* Which semaphore */
+	struct semfs_sem *semv_sem;		/* It (NULL for the root) */
 };
 
 /*
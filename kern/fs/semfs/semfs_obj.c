@@ -29,6 +29,8 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
 
 #define SEMFS_INLINE
@@ -44,31 +46,33 @@ struct semfs_sem *
 semfs_sem_create(const char *name)
 {
 	struct semfs_sem *sem;
-	char lockname[32];
-	char cvname[32];
+	char wchanname[32];
 
-	snprintf(lockname, sizeof(lockname), "sem:l.%s", name);
-	snprintf(cvname, sizeof(cvname), "sem:%s", name);
+	snprintf(wchanname, sizeof(wchanname), "sem:%s", name);
 
 	sem = kmalloc(sizeof(*sem));
 	if (sem == NULL) {
 		goto fail_return;
 	}
-	sem->sems_lock = lock_create(lockname);
-	if (sem->sems_lock == NULL) {
+	sem->sems_name = kstrdup(wchanname);
+	if (sem->sems_name == NULL) {
 		goto fail_sem;
 	}
-	sem->sems_cv = cv_create(cvname);
-	if (sem->sems_cv == NULL) {
-		goto fail_lock;
+	sem->sems_wchan = wchan_create(sem->sems_name);
+	if (sem->sems_wchan == NULL) {
+		goto fail_name;
 	}
+	spinlock_init(&sem->sems_lock);
+	/* all user semaphores are lumped together for lockstat */
+	spinlock_setname(&sem->sems_lock, "semfs");
 	sem->sems_count = 0;
+	sem->sems_sleepers = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
 
- fail_lock:
-	lock_destroy(sem->sems_lock);
+ fail_name:
+	kfree(sem->sems_name);
  fail_sem:
 	kfree(sem);
  fail_return:
@@ -81,8 +85,10 @@ semfs_sem_create(const char *name)
 void
 semfs_sem_destroy(struct semfs_sem *sem)
 {
-	cv_destroy(sem->sems_cv);
-	lock_destroy(sem->sems_lock);
+	KASSERT(sem->sems_sleepers == 0);
+	spinlock_cleanup(&sem->sems_lock);
+	wchan_destroy(sem->sems_wchan);
+	kfree(sem->sems_name);
 	kfree(sem);
 }
 
@@ -32,6 +32,8 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
@@ -107,49 +109,28 @@ semfs_fsync(struct vnode *vn)
 // semaphore ops
 
 /*
- * XXX fold these two together
+ * The semaphore ops get the semaphore from the vnode (semv_sem)
+ * without going through the table: as long as the vnode exists the
+ * semaphore can't be destroyed, so the table lock isn't needed.
  */
 
-static
-struct semfs_sem *
-semfs_getsembynum(struct semfs *semfs, unsigned semnum)
-{
-	struct semfs_sem *sem;
-
-	lock_acquire(semfs->semfs_tablelock);
-	sem = semfs_semarray_get(semfs->semfs_sems, semnum);
-	lock_release(semfs->semfs_tablelock);
-
-	return sem;
-}
-
-static
-struct semfs_sem *
-semfs_getsem(struct semfs_vnode *semv)
-{
-	struct semfs *semfs = semv->semv_semfs;
-
-	return semfs_getsembynum(semfs, semv->semv_semnum);
-}
-
 /*
- * Wakeup helper. We only need to wake up if there are sleepers, which
- * should only be the case if the old count is 0; and we only
- * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * Wakeup helper: UNITS have just been added to the count, so wake up
+ * to that many sleepers. Each one woken either takes at least one
+ * unit or, if someone else got there first, goes back to sleep; so
+ * nobody is left asleep while there's count available, and nobody is
+ * woken just to find nothing there. Call with the spinlock held.
  */
 static
 void
-semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
+semfs_wakeup(struct semfs_sem *sem, unsigned units)
 {
-	if (sem->sems_count > 0 || newcount == 0) {
-		return;
-	}
-	if (newcount == 1) {
-		cv_signal(sem->sems_cv, sem->sems_lock);
-	}
-	else {
-		cv_broadcast(sem->sems_cv, sem->sems_lock);
+	KASSERT(spinlock_do_i_hold(&sem->sems_lock));
+
+	while (units > 0 && sem->sems_sleepers > 0) {
+		wchan_wakeone(sem->sems_wchan, &sem->sems_lock);
+		sem->sems_sleepers--;
+		units--;
 	}
 }
 
@@ -161,16 +142,15 @@ int
 semfs_semstat(struct vnode *vn, struct stat *buf)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
-
-	sem = semfs_getsem(semv);
+	struct semfs_sem *sem = semv->semv_sem;
 
 	bzero(buf, sizeof(*buf));
 
-	lock_acquire(sem->sems_lock);
+	spinlock_acquire(&sem->sems_lock);
 	buf->st_size = sem->sems_count;
+	spinlock_release(&sem->sems_lock);
+	/* (this is only a snapshot anyway) */
 	buf->st_nlink = sem->sems_linked ? 1 : 0;
-	lock_release(sem->sems_lock);
 
 	buf->st_mode = S_IFREG | 0666;
 	buf->st_blocks = 0;
@@ -189,12 +169,10 @@ int
 semfs_read(struct vnode *vn, struct uio *uio)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
+	struct semfs_sem *sem = semv->semv_sem;
 	size_t consume;
 
-	sem = semfs_getsem(semv);
-
-	lock_acquire(sem->sems_lock);
+	spinlock_acquire(&sem->sems_lock);
 	while (uio->uio_resid > 0) {
 		if (sem->sems_count > 0) {
 			consume = uio->uio_resid;
@@ -215,10 +193,11 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		if (sem->sems_count == 0) {
 			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
 			      semv->semv_semnum);
-			cv_wait(sem->sems_cv, sem->sems_lock);
+			sem->sems_sleepers++;
+			wchan_sleep(sem->sems_wchan, &sem->sems_lock);
 		}
 	}
-	lock_release(sem->sems_lock);
+	spinlock_release(&sem->sems_lock);
 	return 0;
 }
 
@@ -231,27 +210,30 @@ int
 semfs_write(struct vnode *vn, struct uio *uio)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
-	unsigned newcount;
+	struct semfs_sem *sem = semv->semv_sem;
+	unsigned units, newcount;
 
-	sem = semfs_getsem(semv);
+	/* The whole write is one V of that many units. */
+	units = uio->uio_resid;
+	if (units != uio->uio_resid) {
+		return EFBIG;
+	}
 
-	lock_acquire(sem->sems_lock);
-	while (uio->uio_resid > 0) {
-		newcount = sem->sems_count + uio->uio_resid;
-		if (newcount < sem->sems_count) {
-			/* overflow */
-			lock_release(sem->sems_lock);
-			return EFBIG;
-		}
-		DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
-		      semv->semv_semnum, sem->sems_count, newcount);
-		semfs_wakeup(sem, newcount);
-		sem->sems_count = newcount;
-		uio->uio_offset += uio->uio_resid;
-		uio->uio_resid = 0;
-	}
-	lock_release(sem->sems_lock);
+	spinlock_acquire(&sem->sems_lock);
+	newcount = sem->sems_count + units;
+	if (newcount < sem->sems_count) {
+		/* overflow */
+		spinlock_release(&sem->sems_lock);
+		return EFBIG;
+	}
+	DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
+	      semv->semv_semnum, sem->sems_count, newcount);
+	sem->sems_count = newcount;
+	semfs_wakeup(sem, units);
+	spinlock_release(&sem->sems_lock);
+
+	uio->uio_offset += units;
+	uio->uio_resid = 0;
 	return 0;
 }
 
@@ -270,7 +252,7 @@ semfs_truncate(struct vnode *vn, off_t len)
 	const unsigned max = (unsigned)-1;
 
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
+	struct semfs_sem *sem = semv->semv_sem;
 	unsigned newcount;
 
 	if (len < 0) {
@@ -281,12 +263,10 @@ semfs_truncate(struct vnode *vn, off_t len)
 	}
 	newcount = len;
 
-	sem = semfs_getsem(semv);
-
-	lock_acquire(sem->sems_lock);
-	semfs_wakeup(sem, newcount);
+	spinlock_acquire(&sem->sems_lock);
 	sem->sems_count = newcount;
-	lock_release(sem->sems_lock);
+	semfs_wakeup(sem, newcount);
+	spinlock_release(&sem->sems_lock);
 
 	return 0;
 }
@@ -418,6 +398,9 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 	lock_acquire(semfs->semfs_tablelock);
 	result = semfs_sem_insert(semfs, sem, &semnum);
+	if (result == 0) {
+		sem->sems_linked = true;
+	}
 	lock_release(semfs->semfs_tablelock);
 	if (result) {
 		goto fail_uncreate;
@@ -444,7 +427,6 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		goto fail_undir;
 	}
 
-	sem->sems_linked = true;
 	lock_release(semfs->semfs_dirlock);
 	return 0;
 
@@ -491,20 +473,19 @@ semfs_remove(struct vnode *dirvn, const char *name)
 		}
 		if (!strcmp(name, dent->semd_name)) {
 			/* found */
-			sem = semfs_getsembynum(semfs, dent->semd_semnum);
-			lock_acquire(sem->sems_lock);
+			lock_acquire(semfs->semfs_tablelock);
+			sem = semfs_semarray_get(semfs->semfs_sems,
+						 dent->semd_semnum);
 			KASSERT(sem->sems_linked);
 			sem->sems_linked = false;
 			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
 				semfs_semarray_set(semfs->semfs_sems,
 						   dent->semd_semnum, NULL);
 				lock_release(semfs->semfs_tablelock);
-				lock_release(sem->sems_lock);
 				semfs_sem_destroy(sem);
 			}
 			else {
-				lock_release(sem->sems_lock);
+				lock_release(semfs->semfs_tablelock);
 			}
 			semfs_direntryarray_set(semfs->semfs_dents, i, NULL);
 			semfs_direntry_destroy(dent);
@@ -627,7 +608,9 @@ semfs_reclaim(struct vnode *vn)
 	}
 
 	if (semv->semv_semnum != SEMFS_ROOTDIR) {
-		sem = semfs_semarray_get(semfs->semfs_sems, semv->semv_semnum);
+		sem = semv->semv_sem;
+		KASSERT(sem == semfs_semarray_get(semfs->semfs_sems,
+						  semv->semv_semnum));
 		KASSERT(sem->sems_hasvnode);
 		sem->sems_hasvnode = false;
 		if (sem->sems_linked == false) {
@@ -736,6 +719,7 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 
 	semv->semv_semfs = semfs;
 	semv->semv_semnum = semnum;
+	semv->semv_sem = NULL;
 
 	result = vnode_init(&semv->semv_absvn, optable,
 			    &semfs->semfs_absfs, semv);
@@ -791,6 +775,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem != NULL);
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
+		semv->semv_sem = sem;
 	}
 	lock_release(semfs->semfs_tablelock);
 
@@ -33,6 +33,7 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <sfs.h>
@@ -51,6 +52,125 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
 }
 
+/*
+ * Set up the per-freemap-block bookkeeping, once the freemap has been
+ * read in: which blocks of the freemap need writing back (none yet),
+ * and how many free blocks each one describes.
+ */
+int
+sfs_freemap_setup(struct sfs_fs *sfs)
+{
+	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+	unsigned char *data;
+	unsigned i, j, k, count;
+
+	sfs->sfs_freemapdirtyblocks = bitmap_create(freemapblocks);
+	if (sfs->sfs_freemapdirtyblocks == NULL) {
+		return ENOMEM;
+	}
+	sfs->sfs_freecounts = kmalloc(freemapblocks * sizeof(uint16_t));
+	if (sfs->sfs_freecounts == NULL) {
+		sfs_freemap_cleanup(sfs);
+		return ENOMEM;
+	}
+
+	/* The freemap data was just read in behind the bitmap's back. */
+	bitmap_refresh(sfs->sfs_freemap);
+
+	data = bitmap_getdata(sfs->sfs_freemap);
+	sfs->sfs_freehint = freemapblocks;
+	for (i=0; i<freemapblocks; i++) {
+		count = 0;
+		for (j=0; j<SFS_BLOCKSIZE; j++) {
+			for (k=0; k<CHAR_BIT; k++) {
+				if ((data[j] & (1U << k)) == 0) {
+					count++;
+				}
+			}
+		}
+		data += SFS_BLOCKSIZE;
+		sfs->sfs_freecounts[i] = count;
+		if (count > 0 && sfs->sfs_freehint == freemapblocks) {
+			sfs->sfs_freehint = i;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Free the bookkeeping from sfs_freemap_setup.
+ */
+void
+sfs_freemap_cleanup(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_freemapdirtyblocks != NULL) {
+		bitmap_destroy(sfs->sfs_freemapdirtyblocks);
+		sfs->sfs_freemapdirtyblocks = NULL;
+	}
+	if (sfs->sfs_freecounts != NULL) {
+		kfree(sfs->sfs_freecounts);
+		sfs->sfs_freecounts = NULL;
+	}
+}
+
+/*
+ * Note that DISKBLOCK's bit in the freemap was just set (ALLOC true)
+ * or cleared.
+ */
+static
+void
+sfs_freemap_changed(struct sfs_fs *sfs, daddr_t diskblock, bool alloc)
+{
+	unsigned mapblock = diskblock / SFS_BITSPERBLOCK;
+
+	if (alloc) {
+		KASSERT(sfs->sfs_freecounts[mapblock] > 0);
+		sfs->sfs_freecounts[mapblock]--;
+	}
+	else {
+		sfs->sfs_freecounts[mapblock]++;
+		if (mapblock < sfs->sfs_freehint) {
+			sfs->sfs_freehint = mapblock;
+		}
+	}
+
+	if (!bitmap_isset(sfs->sfs_freemapdirtyblocks, mapblock)) {
+		bitmap_mark(sfs->sfs_freemapdirtyblocks, mapblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Find the first free block and mark it in use. The free counts let
+ * us go straight to the first part of the freemap that has one.
+ */
+static
+int
+sfs_freemap_alloc(struct sfs_fs *sfs, daddr_t *diskblock)
+{
+	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+	unsigned index;
+	int result;
+
+	while (sfs->sfs_freehint < freemapblocks &&
+	       sfs->sfs_freecounts[sfs->sfs_freehint] == 0) {
+		sfs->sfs_freehint++;
+	}
+	if (sfs->sfs_freehint == freemapblocks) {
+		return ENOSPC;
+	}
+
+	result = bitmap_alloc_near(sfs->sfs_freemap,
+				   sfs->sfs_freehint * SFS_BITSPERBLOCK,
+				   &index);
+	if (result) {
+		return result;
+	}
+	KASSERT(index / SFS_BITSPERBLOCK == sfs->sfs_freehint);
+	*diskblock = index;
+	return 0;
+}
+
 /*
  * Allocate a block.
  */
@@ -59,11 +179,11 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = sfs_freemap_alloc(sfs, diskblock);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_changed(sfs, *diskblock, true);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
@@ -74,18 +194,43 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_freemap_changed(sfs, *diskblock, false);
+		return result;
 	}
-	return result;
+
+	sfs_scrub_balloc(sfs, *diskblock);
+	return 0;
 }
 
 /*
  * Free a block.
+ *
+ * With a journal, the block can't be reused until the transaction
+ * that freed it commits: until then the committed metadata still
+ * points at it, and a crash would leave that pointing at whatever
+ * got written there in the meantime. So the journal holds onto it
+ * and calls sfs_brelease after the commit.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
+{
+	sfs_scrub_bfree(sfs, diskblock);
+	if (sfs->sfs_jnl != NULL) {
+		sfs_jnl_forget(sfs, diskblock);
+		sfs_jnl_deferfree(sfs, diskblock);
+		return;
+	}
+	sfs_brelease(sfs, diskblock);
+}
+
+/*
+ * Put a freed block back in the freemap.
+ */
+void
+sfs_brelease(struct sfs_fs *sfs, daddr_t diskblock)
 {
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_changed(sfs, diskblock, false);
 }
 
 /*
@@ -181,7 +181,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		idbuf[idoff] = block;
 
 		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_writemeta(sfs, idblock, idbuf, sizeof(idbuf));
 		if (result) {
 			return result;
 		}
@@ -282,8 +282,8 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		}
 		else if (iddirty) {
 			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
+			result = sfs_writemeta(sfs, idblock, idbuf,
+					       sizeof(idbuf));
 			if (result) {
 				vfs_biglock_release();
 				return result;
@@ -153,6 +153,7 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
@@ -186,7 +187,14 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Let an online scrub know where this inode is now. */
+	sfs_scrub_linkchange(sfs, ino);
+	return 0;
 }
 
 /*
@@ -195,7 +203,23 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	struct sfs_direntry sd;
+	int result;
+
+	/*
+	 * If a scrub is running, tell it about the inode that's
+	 * losing its name; it may still be open.
+	 */
+	if (sfs->sfs_scrub != NULL) {
+		result = sfs_readdir(sv, slot, &sd);
+		if (result) {
+			return result;
+		}
+		if (sd.sfd_ino != SFS_NOINO) {
+			sfs_scrub_linkchange(sfs, sd.sfd_ino);
+		}
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
@@ -52,8 +52,10 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads load the whole bitmap. Writes only write the sectors that
+ * sfs_balloc and sfs_bfree have marked in sfs_freemapdirtyblocks,
+ * since one allocation only changes one sector and large volumes
+ * have hundreds.
  *
  * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
  * sectors of bits, one bit for each sector on the filesystem. The
@@ -64,8 +66,8 @@
  * disk device. This is ok. These sectors are supposed to be marked
  * "in use" by mksfs and never get marked "free".
  *
- * The sectors used by the superblock and the bitmap itself are
- * likewise marked in use by mksfs.
+ * The sectors used by the superblock, the bitmap itself, and the
+ * journal if there is one are likewise marked in use by mksfs.
  */
 static
 int
@@ -92,9 +94,15 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
 					       SFS_BLOCKSIZE);
 		}
+		else if (bitmap_isset(sfs->sfs_freemapdirtyblocks, j)) {
+			result = sfs_writemeta(sfs, SFS_FREEMAP_START+j, ptr,
+					       SFS_BLOCKSIZE);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_freemapdirtyblocks, j);
+			}
+		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			result = 0;
 		}
 
 		/* If we failed, stop. */
@@ -113,12 +121,19 @@ int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
 	unsigned i, num;
+	int result;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	/*
+	 * Go over the array of loaded vnodes, syncing as we go. (Not
+	 * with VOP_FSYNC, which on a journaled volume comes back here.)
+	 */
 	num = vnodearray_num(sfs->sfs_vnodes);
 	for (i=0; i<num; i++) {
 		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		result = sfs_sync_inode(v->vn_data);
+		if (result) {
+			return result;
+		}
 	}
 	return 0;
 }
@@ -153,8 +168,8 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 	int result;
 
 	if (sfs->sfs_superdirty) {
-		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
-					sizeof(sfs->sfs_sb));
+		result = sfs_writemeta(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				       sizeof(sfs->sfs_sb));
 		if (result) {
 			return result;
 		}
@@ -163,6 +178,60 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 	return 0;
 }
 
+/*
+ * Write out all dirty metadata, and if there's a journal, commit it.
+ */
+int
+sfs_syncmeta(struct sfs_fs *sfs)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/* If any vnodes need to be written, write them. */
+	result = sfs_sync_vnodes(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the free block map needs to be written, write it. */
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the superblock needs to be written, write it. */
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* Everything is consistent now; make it durable. */
+	if (sfs->sfs_jnl != NULL) {
+		result = sfs_jnl_commit(sfs);
+		if (result) {
+			return result;
+		}
+
+		/*
+		 * The commit released the blocks the transaction freed,
+		 * which changes the freemap again. Commit that too; it
+		 * frees nothing, so this doesn't go around again.
+		 */
+		if (sfs->sfs_freemapdirty) {
+			result = sfs_sync_freemap(sfs);
+			if (result) {
+				return result;
+			}
+			result = sfs_jnl_commit(sfs);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -208,29 +277,10 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* If any vnodes need to be written, write them. */
-	result = sfs_sync_vnodes(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
+	result = sfs_syncmeta(sfs);
 
 	vfs_biglock_release();
-	return 0;
+	return result;
 }
 
 /*
@@ -262,6 +312,8 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	sfs_freemap_cleanup(sfs);
+	sfs_jnl_destroy(sfs);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -277,6 +329,7 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 
@@ -290,6 +343,15 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Write everything in the journal in place, leaving it empty. */
+	if (sfs->sfs_jnl != NULL) {
+		result = sfs_jnl_checkpoint(sfs);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+	}
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -328,6 +390,9 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	COMPILE_ASSERT(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
@@ -359,6 +424,16 @@ sfs_fs_create(void)
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapdirtyblocks = NULL;
+	sfs->sfs_freecounts = NULL;
+	sfs->sfs_freehint = 0;
+
+	/* journal */
+	sfs->sfs_jnl = NULL;
+
+	/* online scrub */
+	sfs->sfs_scrub = NULL;
+	sfs->sfs_ioops = 0;
 
 	return sfs;
 
@@ -448,6 +523,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Set up the journal, replaying it if we crashed */
+	result = sfs_jnl_mount(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
@@ -457,6 +541,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
+	if (result == 0) {
+		result = sfs_freemap_setup(sfs);
+	}
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
@@ -50,8 +50,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_writemeta(sfs, sv->sv_ino, &sv->sv_i,
+				       sizeof(sv->sv_i));
 		if (result) {
 			return result;
 		}
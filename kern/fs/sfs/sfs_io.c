@@ -49,7 +49,7 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device and sfs_jnl (which is NULL then).
  */
 
 /*
@@ -64,6 +64,8 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
+	sfs->sfs_ioops++;
+
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -112,6 +114,11 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
+	/* The journal may have a newer copy of metadata blocks. */
+	if (sfs->sfs_jnl != NULL && sfs_jnl_read(sfs, block, data)) {
+		return 0;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
@@ -131,6 +138,21 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 	return sfs_rwblock(sfs, &ku);
 }
 
+/*
+ * Write a metadata block. If the volume has a journal this goes
+ * into the running transaction instead of to disk.
+ */
+int
+sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	if (sfs->sfs_jnl != NULL) {
+		return sfs_jnl_write(sfs, block, data);
+	}
+	return sfs_writeblock(sfs, block, data, len);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
@@ -461,8 +483,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		memcpy(metaiobuf + blockoffset, data, len);
 
 		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
+		result = sfs_writemeta(sfs, diskblock,
+				       metaiobuf, sizeof(metaiobuf));
 		if (result) {
 			return result;
 		}
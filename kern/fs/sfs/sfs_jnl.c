@@ -0,0 +1,992 @@
+/*
+ * SFS filesystem
+ *
+ * Write-ahead metadata journal.
+ *
+ * Metadata writes (inodes, indirect blocks, directory blocks, the
+ * freemap, and the superblock; see sfs_writemeta) don't go to disk
+ * directly. Instead the new block image is kept in memory as part
+ * of the running transaction. Reads check here first, so the rest
+ * of SFS sees its own updates.
+ *
+ * sfs_jnl_commit writes the running transaction into the journal
+ * (descriptors, images, then a commit block) and moves its images
+ * to the committed set. Committed images are written to their real
+ * locations only at checkpoint time, which happens when the journal
+ * fills up and at unmount; the checkpoint then moves the journal's
+ * start past everything it has written. After a crash, mount
+ * replays every complete transaction from the start onward, which
+ * leaves the metadata as it was at the last commit, so the volume
+ * does not need a full sfsck.
+ *
+ * Commits happen at sync, at fsync (which commits everything, so
+ * concurrent fsyncs queued behind the big lock find nothing left to
+ * do and share the first one's I/O), and at the end of an operation
+ * that has left the running transaction more than a quarter of the
+ * journal's size. Operations are atomic with respect to commits
+ * because everything here runs under the vfs big lock.
+ *
+ * When a block with a committed image is freed, its block number is
+ * recorded as revoked in the next transaction so that replay won't
+ * write the stale image over whatever the block gets reused for.
+ * Freed blocks also stay marked in the freemap until the transaction
+ * that freed them commits, so nothing can reuse them while the
+ * committed metadata still points at them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Size of the hash table of block images */
+#define SFS_JHASHSIZE	64
+
+/* Commit at the end of an operation once this fraction of the journal is used */
+#define SFS_JOPFRAC	4
+
+/*
+ * In-memory image of a metadata block.
+ */
+struct sfs_jbuf {
+	daddr_t jb_block;		/* where it goes */
+	bool jb_committed;		/* in the journal already */
+	unsigned jb_index;		/* position in its jbufarray */
+	struct sfs_jbuf *jb_next;	/* hash chain */
+	char jb_data[SFS_BLOCKSIZE];
+};
+
+DECLARRAY(sfs_jbuf, static __UNUSED inline);
+DEFARRAY(sfs_jbuf, static __UNUSED inline);
+
+/*
+ * Journal state. Offsets are within the journal: offset 0 is the
+ * header, and the log wraps from the last block back to offset 1.
+ */
+struct sfs_jnl {
+	uint32_t jn_first;		/* disk block of the header */
+	uint32_t jn_size;		/* blocks in journal, with header */
+	uint32_t jn_tail;		/* offset of oldest transaction */
+	uint32_t jn_tailseq;		/* its sequence number */
+	uint32_t jn_head;		/* offset of next transaction */
+	uint32_t jn_seq;		/* its sequence number */
+	uint32_t jn_used;		/* log blocks from tail to head */
+
+	struct sfs_jbuf *jn_hash[SFS_JHASHSIZE];
+	struct sfs_jbufarray *jn_running;	/* running transaction */
+	struct sfs_jbufarray *jn_committed;	/* not yet checkpointed */
+
+	uint32_t *jn_revoked;		/* freed in running transaction */
+	unsigned jn_nrevoked;
+	unsigned jn_maxrevoked;
+	uint32_t *jn_freeing;		/* freed, released after commit */
+	unsigned jn_nfreeing;
+	unsigned jn_maxfreeing;
+	bool jn_mustcheckpoint;		/* couldn't record a revoke */
+	bool jn_warned;			/* warned about overflow */
+};
+
+/*
+ * Block buffers for building descriptors and for replay. Since
+ * they're static, the big lock had better be held.
+ */
+static union {
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	uint32_t words[SFS_BLOCKSIZE / sizeof(uint32_t)];
+} sfs_jblk, sfs_jimg;
+
+////////////////////////////////////////////////////////////
+// Utility functions
+
+/*
+ * Advance an offset in the log, wrapping around.
+ */
+static
+uint32_t
+sfs_jnext(struct sfs_jnl *jn, uint32_t off)
+{
+	off++;
+	if (off >= jn->jn_size) {
+		off = 1;
+	}
+	return off;
+}
+
+/*
+ * Fold a block into a running checksum.
+ */
+static
+uint32_t
+sfs_jcsum(uint32_t csum, const void *data)
+{
+	const uint32_t *words = data;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		csum = SFS_JCSUM(csum, words[i]);
+	}
+	return csum;
+}
+
+/*
+ * Read or write a block of the journal itself.
+ */
+static
+int
+sfs_jio(struct sfs_fs *sfs, uint32_t off, void *data, bool write)
+{
+	daddr_t block = sfs->sfs_jnl->jn_first + off;
+
+	if (write) {
+		return sfs_writeblock(sfs, block, data, SFS_BLOCKSIZE);
+	}
+	return sfs_readblock(sfs, block, data, SFS_BLOCKSIZE);
+}
+
+/*
+ * Find the running (COMMITTED false) or committed image of BLOCK.
+ */
+static
+struct sfs_jbuf *
+sfs_jfind(struct sfs_jnl *jn, daddr_t block, bool committed)
+{
+	struct sfs_jbuf *jb;
+
+	for (jb = jn->jn_hash[block % SFS_JHASHSIZE];
+	     jb != NULL; jb = jb->jb_next) {
+		if (jb->jb_block == block && jb->jb_committed == committed) {
+			return jb;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an image out of the hash table and out of its array, and
+ * free it. The array is kept dense by moving its last entry into
+ * the hole.
+ */
+static
+void
+sfs_jdrop(struct sfs_jnl *jn, struct sfs_jbuf *jb)
+{
+	struct sfs_jbufarray *a;
+	struct sfs_jbuf **pp, *last;
+	unsigned num;
+
+	for (pp = &jn->jn_hash[jb->jb_block % SFS_JHASHSIZE];
+	     *pp != jb; pp = &(*pp)->jb_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = jb->jb_next;
+
+	a = jb->jb_committed ? jn->jn_committed : jn->jn_running;
+	num = sfs_jbufarray_num(a);
+	KASSERT(sfs_jbufarray_get(a, jb->jb_index) == jb);
+	last = sfs_jbufarray_get(a, num - 1);
+	sfs_jbufarray_set(a, jb->jb_index, last);
+	last->jb_index = jb->jb_index;
+	sfs_jbufarray_setsize(a, num - 1);
+
+	kfree(jb);
+}
+
+/*
+ * Drop every image in A.
+ */
+static
+void
+sfs_jdropall(struct sfs_jnl *jn, struct sfs_jbufarray *a)
+{
+	unsigned num;
+
+	while ((num = sfs_jbufarray_num(a)) > 0) {
+		sfs_jdrop(jn, sfs_jbufarray_get(a, num - 1));
+	}
+}
+
+/*
+ * Write the journal header.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+
+	bzero(&sfs_jblk, sizeof(sfs_jblk));
+	sfs_jblk.jh.jh_magic = SFS_JHEADER_MAGIC;
+	sfs_jblk.jh.jh_seq = jn->jn_tailseq;
+	sfs_jblk.jh.jh_start = jn->jn_tail;
+	return sfs_jio(sfs, 0, &sfs_jblk, true);
+}
+
+/*
+ * Make room for one more entry in a growable array of block numbers.
+ */
+static
+int
+sfs_jgrow(uint32_t **blocks, unsigned num, unsigned *max)
+{
+	uint32_t *newblocks;
+	unsigned newmax;
+
+	if (num < *max) {
+		return 0;
+	}
+	newmax = *max ? *max * 2 : 16;
+	newblocks = kmalloc(newmax * sizeof(uint32_t));
+	if (newblocks == NULL) {
+		return ENOMEM;
+	}
+	if (*blocks != NULL) {
+		memcpy(newblocks, *blocks, num * sizeof(uint32_t));
+		kfree(*blocks);
+	}
+	*blocks = newblocks;
+	*max = newmax;
+	return 0;
+}
+
+/*
+ * The running transaction is on disk (or written in place); blocks
+ * it freed can be reused now, and their committed images, which a
+ * checkpoint before now still had to write in place, can go.
+ */
+static
+void
+sfs_jrelease(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+	unsigned i;
+
+	for (i=0; i<jn->jn_nfreeing; i++) {
+		jb = sfs_jfind(jn, jn->jn_freeing[i], true);
+		if (jb != NULL) {
+			sfs_jdrop(jn, jb);
+		}
+		sfs_brelease(sfs, jn->jn_freeing[i]);
+	}
+	jn->jn_nfreeing = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Logging and lookup
+
+/*
+ * Journal a metadata write: put DATA in the running transaction as
+ * the new contents of BLOCK.
+ */
+int
+sfs_jnl_write(struct sfs_fs *sfs, daddr_t block, const void *data)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	jb = sfs_jfind(jn, block, false);
+	if (jb == NULL) {
+		jb = kmalloc(sizeof(*jb));
+		if (jb == NULL) {
+			return ENOMEM;
+		}
+		jb->jb_block = block;
+		jb->jb_committed = false;
+		result = sfs_jbufarray_add(jn->jn_running, jb, &jb->jb_index);
+		if (result) {
+			kfree(jb);
+			return result;
+		}
+		jb->jb_next = jn->jn_hash[block % SFS_JHASHSIZE];
+		jn->jn_hash[block % SFS_JHASHSIZE] = jb;
+	}
+	memcpy(jb->jb_data, data, SFS_BLOCKSIZE);
+	return 0;
+}
+
+/*
+ * If the journal holds a newer copy of BLOCK than the disk does,
+ * copy it to DATA and return true.
+ */
+bool
+sfs_jnl_read(struct sfs_fs *sfs, daddr_t block, void *data)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jfind(jn, block, false);
+	if (jb == NULL) {
+		jb = sfs_jfind(jn, block, true);
+	}
+	if (jb == NULL) {
+		return false;
+	}
+	memcpy(data, jb->jb_data, SFS_BLOCKSIZE);
+	return true;
+}
+
+/*
+ * BLOCK has been freed. Throw away its image in the running
+ * transaction, and if one was already in the journal, revoke it.
+ *
+ * The committed image stays until the freeing transaction commits
+ * (sfs_jrelease): until then the committed metadata still points at
+ * the block, so a checkpoint in the meantime has to write it in place
+ * before moving the journal's start past it.
+ */
+void
+sfs_jnl_forget(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+
+	jb = sfs_jfind(jn, block, false);
+	if (jb != NULL) {
+		sfs_jdrop(jn, jb);
+	}
+
+	jb = sfs_jfind(jn, block, true);
+	if (jb == NULL) {
+		return;
+	}
+
+	if (sfs_jgrow(&jn->jn_revoked, jn->jn_nrevoked, &jn->jn_maxrevoked)) {
+		/*
+		 * Checkpointing before the next commit writes the
+		 * image in place and moves the journal past it,
+		 * which does just as well.
+		 */
+		jn->jn_mustcheckpoint = true;
+		return;
+	}
+	jn->jn_revoked[jn->jn_nrevoked++] = block;
+}
+
+/*
+ * BLOCK has been freed in the running transaction. Keep it marked in
+ * the freemap until that commits.
+ */
+void
+sfs_jnl_deferfree(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+
+	if (sfs_jgrow(&jn->jn_freeing, jn->jn_nfreeing, &jn->jn_maxfreeing)) {
+		/*
+		 * Leave it marked. That leaks the block, but safely;
+		 * sfsck will find it and give it back.
+		 */
+		return;
+	}
+	jn->jn_freeing[jn->jn_nfreeing++] = block;
+}
+
+////////////////////////////////////////////////////////////
+// Commit and checkpoint
+
+/*
+ * Write all committed images in place, then move the start of the
+ * journal up to the end of the log, emptying it.
+ */
+int
+sfs_jnl_checkpoint(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+	unsigned i, num;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	num = sfs_jbufarray_num(jn->jn_committed);
+	for (i=0; i<num; i++) {
+		jb = sfs_jbufarray_get(jn->jn_committed, i);
+		result = sfs_writeblock(sfs, jb->jb_block, jb->jb_data,
+					SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+	}
+
+	jn->jn_tail = jn->jn_head;
+	jn->jn_tailseq = jn->jn_seq;
+	result = sfs_jwriteheader(sfs);
+	if (result) {
+		return result;
+	}
+
+	sfs_jdropall(jn, jn->jn_committed);
+	jn->jn_used = 0;
+	jn->jn_mustcheckpoint = false;
+	return 0;
+}
+
+/*
+ * Write the running transaction into the log at jn_head, NDESC
+ * descriptors' worth. Doesn't update any state.
+ */
+static
+int
+sfs_jwritetrans(struct sfs_fs *sfs, unsigned ndesc)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+	unsigned nimages, nentries, d, i, k, first, num;
+	uint32_t pos, csum, nblocks;
+	int result;
+
+	nimages = sfs_jbufarray_num(jn->jn_running);
+	nentries = nimages + jn->jn_nrevoked;
+	pos = jn->jn_head;
+	csum = 0;
+	nblocks = 0;
+
+	for (d=0; d<ndesc; d++) {
+		first = d * SFS_JDESC_MAX;
+		num = nentries - first;
+		if (num > SFS_JDESC_MAX) {
+			num = SFS_JDESC_MAX;
+		}
+
+		bzero(&sfs_jblk, sizeof(sfs_jblk));
+		sfs_jblk.jd.jd_magic = SFS_JDESC_MAGIC;
+		sfs_jblk.jd.jd_seq = jn->jn_seq;
+		for (i=0; i<num; i++) {
+			k = first + i;
+			if (k < nimages) {
+				jb = sfs_jbufarray_get(jn->jn_running, k);
+				sfs_jblk.jd.jd_blocks[i] = jb->jb_block;
+				sfs_jblk.jd.jd_nimages++;
+			}
+			else {
+				sfs_jblk.jd.jd_blocks[i] =
+					jn->jn_revoked[k - nimages];
+				sfs_jblk.jd.jd_nrevoke++;
+			}
+		}
+		result = sfs_jio(sfs, pos, &sfs_jblk, true);
+		if (result) {
+			return result;
+		}
+		csum = sfs_jcsum(csum, &sfs_jblk);
+		pos = sfs_jnext(jn, pos);
+		nblocks++;
+
+		for (i=0; i<num && first + i < nimages; i++) {
+			jb = sfs_jbufarray_get(jn->jn_running, first + i);
+			result = sfs_jio(sfs, pos, jb->jb_data, true);
+			if (result) {
+				return result;
+			}
+			csum = sfs_jcsum(csum, jb->jb_data);
+			pos = sfs_jnext(jn, pos);
+			nblocks++;
+		}
+	}
+
+	bzero(&sfs_jblk, sizeof(sfs_jblk));
+	sfs_jblk.jc.jc_magic = SFS_JCOMMIT_MAGIC;
+	sfs_jblk.jc.jc_seq = jn->jn_seq;
+	sfs_jblk.jc.jc_nblocks = nblocks;
+	sfs_jblk.jc.jc_checksum = csum;
+	return sfs_jio(sfs, pos, &sfs_jblk, true);
+}
+
+/*
+ * The running transaction doesn't fit in the journal at all. Give
+ * up on atomicity for it and write it in place.
+ */
+static
+int
+sfs_joverflow(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb;
+	unsigned i, num;
+	int result;
+
+	if (!jn->jn_warned) {
+		kprintf("sfs: %s: transaction of %u blocks too big for "
+			"journal; writing it in place\n",
+			sfs->sfs_sb.sb_volname,
+			sfs_jbufarray_num(jn->jn_running));
+		jn->jn_warned = true;
+	}
+
+	/* Older images first, so these override them. */
+	result = sfs_jnl_checkpoint(sfs);
+	if (result) {
+		return result;
+	}
+
+	num = sfs_jbufarray_num(jn->jn_running);
+	for (i=0; i<num; i++) {
+		jb = sfs_jbufarray_get(jn->jn_running, i);
+		result = sfs_writeblock(sfs, jb->jb_block, jb->jb_data,
+					SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+	}
+	sfs_jdropall(jn, jn->jn_running);
+
+	/* The checkpoint got rid of everything there was to revoke. */
+	jn->jn_nrevoked = 0;
+	sfs_jrelease(sfs);
+	return 0;
+}
+
+/*
+ * Commit the running transaction.
+ */
+int
+sfs_jnl_commit(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jbuf *jb, *old;
+	unsigned nimages, ndesc, need, i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	nimages = sfs_jbufarray_num(jn->jn_running);
+	if (nimages == 0 && jn->jn_nrevoked == 0) {
+		/* Nothing uncommitted points at anything freed. */
+		sfs_jrelease(sfs);
+		return 0;
+	}
+
+	ndesc = DIVROUNDUP(nimages + jn->jn_nrevoked, SFS_JDESC_MAX);
+	need = ndesc + nimages + 1;
+	if (need > jn->jn_size - 1) {
+		return sfs_joverflow(sfs);
+	}
+	if (need > jn->jn_size - 1 - jn->jn_used || jn->jn_mustcheckpoint) {
+		result = sfs_jnl_checkpoint(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Make sure moving the images over below can't fail. */
+	result = sfs_jbufarray_preallocate(jn->jn_committed,
+		sfs_jbufarray_num(jn->jn_committed) + nimages);
+	if (result) {
+		return result;
+	}
+
+	result = sfs_jwritetrans(sfs, ndesc);
+	if (result) {
+		return result;
+	}
+
+	/* It's in. Move the images over to the committed set. */
+	for (i=0; i<nimages; i++) {
+		jb = sfs_jbufarray_get(jn->jn_running, i);
+		old = sfs_jfind(jn, jb->jb_block, true);
+		if (old != NULL) {
+			sfs_jdrop(jn, old);
+		}
+		jb->jb_committed = true;
+		result = sfs_jbufarray_add(jn->jn_committed, jb,
+					   &jb->jb_index);
+		KASSERT(result == 0);
+	}
+	sfs_jbufarray_setsize(jn->jn_running, 0);
+
+	jn->jn_nrevoked = 0;
+	sfs_jrelease(sfs);
+	for (i=0; i<need; i++) {
+		jn->jn_head = sfs_jnext(jn, jn->jn_head);
+	}
+	jn->jn_used += need;
+	jn->jn_seq++;
+	return 0;
+}
+
+/*
+ * Called at the end of an operation that may have changed metadata.
+ * Commit early if the running transaction is getting large, so that
+ * it keeps fitting in the journal.
+ */
+void
+sfs_jnl_opdone(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	int result;
+
+	if (jn == NULL) {
+		return;
+	}
+	if (sfs_jbufarray_num(jn->jn_running) < jn->jn_size / SFS_JOPFRAC) {
+		return;
+	}
+	result = sfs_syncmeta(sfs);
+	if (result) {
+		kprintf("sfs: %s: journal commit: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Replay
+
+/*
+ * Revoke records collected by the first replay pass.
+ */
+struct sfs_jrevoke {
+	uint32_t jr_block;
+	uint32_t jr_seq;		/* latest transaction revoking it */
+};
+
+struct sfs_jreplay {
+	struct sfs_jrevoke *jr_revokes;
+	unsigned jr_num;
+	unsigned jr_max;
+};
+
+/*
+ * Note that BLOCK was revoked in transaction SEQ.
+ */
+static
+int
+sfs_jaddrevoke(struct sfs_jreplay *rp, uint32_t block, uint32_t seq)
+{
+	struct sfs_jrevoke *newrevokes;
+	unsigned i, newmax;
+
+	for (i=0; i<rp->jr_num; i++) {
+		if (rp->jr_revokes[i].jr_block == block) {
+			rp->jr_revokes[i].jr_seq = seq;
+			return 0;
+		}
+	}
+	if (rp->jr_num == rp->jr_max) {
+		newmax = rp->jr_max ? rp->jr_max * 2 : 16;
+		newrevokes = kmalloc(newmax * sizeof(*newrevokes));
+		if (newrevokes == NULL) {
+			return ENOMEM;
+		}
+		if (rp->jr_revokes != NULL) {
+			memcpy(newrevokes, rp->jr_revokes,
+			       rp->jr_num * sizeof(*newrevokes));
+			kfree(rp->jr_revokes);
+		}
+		rp->jr_revokes = newrevokes;
+		rp->jr_max = newmax;
+	}
+	rp->jr_revokes[rp->jr_num].jr_block = block;
+	rp->jr_revokes[rp->jr_num].jr_seq = seq;
+	rp->jr_num++;
+	return 0;
+}
+
+/*
+ * Is the image of BLOCK in transaction SEQ superseded by a revoke?
+ */
+static
+bool
+sfs_jrevoked(struct sfs_jreplay *rp, uint32_t block, uint32_t seq)
+{
+	unsigned i;
+
+	for (i=0; i<rp->jr_num; i++) {
+		if (rp->jr_revokes[i].jr_block == block) {
+			return rp->jr_revokes[i].jr_seq > seq;
+		}
+	}
+	return false;
+}
+
+/*
+ * Process the transaction SEQ at *POS. On the first pass (APPLY
+ * false) check it and collect its revokes; set *VALID to say
+ * whether it's complete. On the second pass write its images in
+ * place. Either way advance *POS past it.
+ */
+static
+int
+sfs_jreplaytrans(struct sfs_fs *sfs, struct sfs_jreplay *rp, uint32_t *pos,
+		 uint32_t seq, bool apply, bool *valid)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	uint32_t reserved, nblocks, csum, block, i;
+	struct sfs_jdesc *jd;
+	unsigned nrevokes;
+	int result;
+
+	reserved = jn->jn_first + jn->jn_size;
+	nrevokes = rp->jr_num;
+	nblocks = 0;
+	csum = 0;
+	*valid = false;
+
+	while (nblocks < jn->jn_size - 1) {
+		result = sfs_jio(sfs, *pos, &sfs_jblk, false);
+		if (result) {
+			return result;
+		}
+		*pos = sfs_jnext(jn, *pos);
+
+		if (sfs_jblk.jc.jc_magic == SFS_JCOMMIT_MAGIC &&
+		    sfs_jblk.jc.jc_seq == seq) {
+			*valid = sfs_jblk.jc.jc_nblocks == nblocks &&
+				sfs_jblk.jc.jc_checksum == csum;
+			break;
+		}
+
+		jd = &sfs_jblk.jd;
+		if (jd->jd_magic != SFS_JDESC_MAGIC || jd->jd_seq != seq ||
+		    jd->jd_nimages + jd->jd_nrevoke > SFS_JDESC_MAX) {
+			break;
+		}
+		for (i=0; i<jd->jd_nimages + jd->jd_nrevoke; i++) {
+			block = jd->jd_blocks[i];
+			if ((block >= jn->jn_first && block < reserved) ||
+			    block >= sfs->sfs_sb.sb_nblocks) {
+				goto out;
+			}
+		}
+		csum = sfs_jcsum(csum, jd);
+		nblocks++;
+
+		if (!apply) {
+			for (i=0; i<jd->jd_nrevoke; i++) {
+				result = sfs_jaddrevoke(rp,
+					jd->jd_blocks[jd->jd_nimages + i],
+					seq);
+				if (result) {
+					return result;
+				}
+			}
+		}
+
+		/*
+		 * sfs_jblk gets reused for the images; copy the
+		 * descriptor aside.
+		 */
+		memcpy(&sfs_jimg, jd, sizeof(sfs_jimg));
+		jd = &sfs_jimg.jd;
+		for (i=0; i<jd->jd_nimages; i++) {
+			block = jd->jd_blocks[i];
+			result = sfs_jio(sfs, *pos, &sfs_jblk, false);
+			if (result) {
+				return result;
+			}
+			*pos = sfs_jnext(jn, *pos);
+			csum = sfs_jcsum(csum, &sfs_jblk);
+			nblocks++;
+
+			if (apply && !sfs_jrevoked(rp, block, seq)) {
+				result = sfs_writeblock(sfs, block, &sfs_jblk,
+							SFS_BLOCKSIZE);
+				if (result) {
+					return result;
+				}
+			}
+		}
+	}
+ out:
+	if (!*valid) {
+		/* Not a real transaction; drop its revokes. */
+		rp->jr_num = nrevokes;
+	}
+	return 0;
+}
+
+/*
+ * Replay the journal, and set up the in-memory log state to append
+ * after whatever was found.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs, unsigned *ntrans)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+	struct sfs_jreplay rp;
+	uint32_t pos, seq, end;
+	unsigned i;
+	bool valid;
+	int result;
+
+	rp.jr_revokes = NULL;
+	rp.jr_num = 0;
+	rp.jr_max = 0;
+
+	/* First pass: find the complete transactions. */
+	pos = jn->jn_tail;
+	seq = jn->jn_tailseq;
+	end = pos;
+	*ntrans = 0;
+	while (1) {
+		result = sfs_jreplaytrans(sfs, &rp, &pos, seq, false, &valid);
+		if (result) {
+			goto done;
+		}
+		if (!valid) {
+			break;
+		}
+		end = pos;
+		seq++;
+		(*ntrans)++;
+	}
+
+	/* Second pass: write them in place. */
+	pos = jn->jn_tail;
+	seq = jn->jn_tailseq;
+	for (i=0; i<*ntrans; i++) {
+		result = sfs_jreplaytrans(sfs, &rp, &pos, seq, true, &valid);
+		if (result) {
+			goto done;
+		}
+		KASSERT(valid);
+		seq++;
+	}
+	KASSERT(pos == end);
+
+	/* The log is now empty and continues after what we replayed. */
+	jn->jn_tail = jn->jn_head = end;
+	jn->jn_tailseq = jn->jn_seq = seq;
+	jn->jn_used = 0;
+	result = 0;
+
+ done:
+	if (rp.jr_revokes != NULL) {
+		kfree(rp.jr_revokes);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Setup and teardown
+
+/*
+ * Set up the journal at mount time, replaying it if needed. Called
+ * after the superblock is loaded but before anything else is read.
+ * Does nothing if the volume has no journal.
+ */
+int
+sfs_jnl_mount(struct sfs_fs *sfs)
+{
+	struct sfs_superblock *sb = &sfs->sfs_sb;
+	struct sfs_jnl *jn;
+	unsigned ntrans, i;
+	int result;
+
+	KASSERT(sfs->sfs_jnl == NULL);
+
+	if (sb->sb_journalblocks == 0) {
+		return 0;
+	}
+	if (sb->sb_journalstart !=
+	    SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(sb->sb_nblocks) ||
+	    sb->sb_journalblocks < SFS_JOURNAL_MINBLOCKS ||
+	    sb->sb_journalblocks > sb->sb_nblocks - sb->sb_journalstart) {
+		kprintf("sfs: %s: Invalid journal location %u+%u\n",
+			sb->sb_volname, sb->sb_journalstart,
+			sb->sb_journalblocks);
+		return EINVAL;
+	}
+
+	jn = kmalloc(sizeof(*jn));
+	if (jn == NULL) {
+		return ENOMEM;
+	}
+	jn->jn_first = sb->sb_journalstart;
+	jn->jn_size = sb->sb_journalblocks;
+	for (i=0; i<SFS_JHASHSIZE; i++) {
+		jn->jn_hash[i] = NULL;
+	}
+	jn->jn_revoked = NULL;
+	jn->jn_nrevoked = 0;
+	jn->jn_maxrevoked = 0;
+	jn->jn_freeing = NULL;
+	jn->jn_nfreeing = 0;
+	jn->jn_maxfreeing = 0;
+	jn->jn_mustcheckpoint = false;
+	jn->jn_warned = false;
+	jn->jn_running = sfs_jbufarray_create();
+	jn->jn_committed = sfs_jbufarray_create();
+	sfs->sfs_jnl = jn;
+	if (jn->jn_running == NULL || jn->jn_committed == NULL) {
+		sfs_jnl_destroy(sfs);
+		return ENOMEM;
+	}
+
+	result = sfs_jio(sfs, 0, &sfs_jblk, false);
+	if (result) {
+		sfs_jnl_destroy(sfs);
+		return result;
+	}
+	if (sfs_jblk.jh.jh_magic != SFS_JHEADER_MAGIC ||
+	    sfs_jblk.jh.jh_start == 0 ||
+	    sfs_jblk.jh.jh_start >= jn->jn_size) {
+		kprintf("sfs: %s: Invalid journal header\n", sb->sb_volname);
+		sfs_jnl_destroy(sfs);
+		return EINVAL;
+	}
+	jn->jn_tail = sfs_jblk.jh.jh_start;
+	jn->jn_tailseq = sfs_jblk.jh.jh_seq;
+
+	result = sfs_jreplay(sfs, &ntrans);
+	if (result) {
+		sfs_jnl_destroy(sfs);
+		return result;
+	}
+	if (ntrans == 0) {
+		return 0;
+	}
+
+	kprintf("sfs: %s: replayed %u journal transaction%s\n",
+		sb->sb_volname, ntrans, ntrans == 1 ? "" : "s");
+
+	/* Record that it's done, and pick up any superblock change. */
+	result = sfs_jwriteheader(sfs);
+	if (result == 0) {
+		result = sfs_readblock(sfs, SFS_SUPER_BLOCK, sb, sizeof(*sb));
+	}
+	if (result) {
+		sfs_jnl_destroy(sfs);
+		return result;
+	}
+	sb->sb_volname[sizeof(sb->sb_volname)-1] = 0;
+	return 0;
+}
+
+/*
+ * Throw away the in-memory journal state. At unmount this comes
+ * after a sync and a checkpoint, so there's nothing left in it.
+ */
+void
+sfs_jnl_destroy(struct sfs_fs *sfs)
+{
+	struct sfs_jnl *jn = sfs->sfs_jnl;
+
+	if (jn == NULL) {
+		return;
+	}
+	if (jn->jn_running != NULL) {
+		sfs_jdropall(jn, jn->jn_running);
+		sfs_jbufarray_destroy(jn->jn_running);
+	}
+	if (jn->jn_committed != NULL) {
+		sfs_jdropall(jn, jn->jn_committed);
+		sfs_jbufarray_destroy(jn->jn_committed);
+	}
+	if (jn->jn_revoked != NULL) {
+		kfree(jn->jn_revoked);
+	}
+	if (jn->jn_freeing != NULL) {
+		kfree(jn->jn_freeing);
+	}
+	kfree(jn);
+	sfs->sfs_jnl = NULL;
+}
@@ -0,0 +1,957 @@
+/*
+ * SFS filesystem
+ *
+ * Online consistency scrub.
+ *
+ * A kernel thread walks the directory tree of a mounted volume a few
+ * blocks at a time, checking every inode's block pointers against
+ * the freemap and against each other, and then sweeps the freemap
+ * for blocks that are marked in use but that nothing refers to. Each
+ * batch runs under the vfs big lock, so within a batch it sees the
+ * volume in a consistent state; between batches it sleeps, and the
+ * volume carries on.
+ *
+ * Because the volume changes between batches, the scrub has to be
+ * told about changes that would otherwise look like damage:
+ *
+ *    - blocks freed (sfs_bfree) are forgotten, so that if they are
+ *      reused they are not reported as referenced twice;
+ *    - blocks allocated (sfs_balloc) are remembered as new, so
+ *      they aren't reported as leaked if their owner was already
+ *      checked;
+ *    - any inode linked into or unlinked from a directory is queued
+ *      for checking, so files renamed out of a part of the tree the
+ *      scrub hasn't reached yet, or unlinked while still open, are
+ *      not missed.
+ *
+ * The scrub only reports; it never changes anything. Repairs are
+ * sfsck's job.
+ *
+ * Rate limiting: the scrub reads at most scrub_rate blocks a second,
+ * in batches of SCRUB_BATCHBLOCKS. If any other block I/O happened
+ * on the volume since its last batch, it gives up the rest of that
+ * second, up to SCRUB_MAXBACKOFF seconds in a row.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <bitmap.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Blocks read per batch. */
+#define SCRUB_BATCHBLOCKS	16
+
+/* Default rate limit, in blocks read per second. */
+#define SCRUB_DEFRATE		256
+
+/* Most consecutive seconds to back off for foreground I/O. */
+#define SCRUB_MAXBACKOFF	10
+
+/* Problems reported individually; after this they're only counted. */
+#define SCRUB_MAXREPORT		20
+
+/* Freemap bits checked per unit of batch budget. */
+#define SCRUB_BITSPERUNIT	SFS_BITSPERBLOCK
+
+/* Directory entries per block */
+#define SCRUB_DIRPERBLOCK	(SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+/* Shortcuts */
+#define SCRUB_NBLOCKS(sc)	((sc)->sc_sfs->sfs_sb.sb_nblocks)
+#define SCRUB_VOLNAME(sc)	((sc)->sc_sfs->sfs_sb.sb_volname)
+
+enum scrub_phase {
+	SCRUB_INODES,		/* walking the directory tree */
+	SCRUB_FREEMAP,		/* looking for leaked blocks */
+	SCRUB_DONE,
+};
+
+/*
+ * Counters, kept after the scrub finishes for "scrub" to print.
+ */
+struct scrub_stats {
+	char st_volname[SFS_VOLNAME_SIZE];
+	enum scrub_phase st_phase;
+	bool st_stopped;		/* stopped before finishing */
+	bool st_incomplete;		/* lost track; leak check skipped */
+	unsigned st_inodes;		/* inodes checked */
+	unsigned st_dirs;		/* of which directories */
+	unsigned st_inuse;		/* blocks in use at start */
+	unsigned st_seen;		/* blocks found referenced */
+	unsigned st_reads;		/* blocks read by the scrub */
+	unsigned st_backoffs;		/* seconds given up to other I/O */
+	unsigned st_problems;		/* inconsistencies found */
+	unsigned st_leaked;		/* of which leaked blocks */
+	uint32_t st_freemappos;		/* progress of the freemap sweep */
+	struct timespec st_start;
+	struct timespec st_end;
+};
+
+struct sfs_scrub {
+	struct sfs_fs *sc_sfs;
+	struct vnode *sc_root;		/* held so the fs stays mounted */
+
+	struct bitmap *sc_seen;		/* referenced by something */
+	struct bitmap *sc_visited;	/* inodes already checked */
+	struct bitmap *sc_new;		/* allocated or freed since we started */
+	uint32_t sc_reserved;		/* first block after the journal */
+
+	uint32_t *sc_stack;		/* inodes waiting to be checked */
+	unsigned sc_stacknum;
+	unsigned sc_stackmax;
+
+	uint32_t sc_dirino;		/* directory being read, or 0 */
+	uint32_t sc_dirblock;		/* next block of it to read */
+
+	int sc_budget;			/* reads left in this batch */
+	unsigned sc_ioseen;		/* sfs_ioops after our last batch */
+	bool sc_stop;			/* asked to stop */
+
+	struct scrub_stats sc_stats;
+};
+
+/*
+ * Global state, protected by the vfs big lock. Only one scrub runs
+ * at a time.
+ */
+static struct sfs_scrub *scrub_running;
+static struct semaphore *scrub_done;
+static struct scrub_stats scrub_last;
+static bool scrub_havelast;
+static unsigned scrub_rate = SCRUB_DEFRATE;
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Count a problem. Returns true if it should be printed, in which
+ * case the caller prints the rest of the line.
+ */
+static
+bool
+scrub_report(struct sfs_scrub *sc)
+{
+	sc->sc_stats.st_problems++;
+	if (sc->sc_stats.st_problems <= SCRUB_MAXREPORT) {
+		kprintf("sfs: scrub: %s: ", SCRUB_VOLNAME(sc));
+		return true;
+	}
+	if (sc->sc_stats.st_problems == SCRUB_MAXREPORT + 1) {
+		kprintf("sfs: scrub: %s: further problems not shown\n",
+			SCRUB_VOLNAME(sc));
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+// Inode queue
+
+/*
+ * Queue inode INO to be checked, unless it already has been or is
+ * already queued. Inodes are marked seen when they're queued.
+ */
+static
+void
+scrub_queue(struct sfs_scrub *sc, uint32_t ino)
+{
+	uint32_t *newstack;
+	unsigned newmax;
+
+	if (bitmap_isset(sc->sc_seen, ino)) {
+		return;
+	}
+	if (sc->sc_stacknum == sc->sc_stackmax) {
+		newmax = sc->sc_stackmax * 2;
+		newstack = kmalloc(newmax * sizeof(uint32_t));
+		if (newstack == NULL) {
+			/* Can't keep track; don't trust the leak check. */
+			sc->sc_stats.st_incomplete = true;
+			return;
+		}
+		memcpy(newstack, sc->sc_stack,
+		       sc->sc_stacknum * sizeof(uint32_t));
+		kfree(sc->sc_stack);
+		sc->sc_stack = newstack;
+		sc->sc_stackmax = newmax;
+	}
+	sc->sc_stack[sc->sc_stacknum++] = ino;
+	bitmap_mark(sc->sc_seen, ino);
+	sc->sc_stats.st_seen++;
+}
+
+////////////////////////////////////////////////////////////
+// Checking
+
+/*
+ * Check if BLOCK could be an inode or a file block: not past the end
+ * of the volume and not the superblock or freemap.
+ */
+static
+bool
+scrub_valid(struct sfs_scrub *sc, uint32_t block)
+{
+	return block >= sc->sc_reserved && block < SCRUB_NBLOCKS(sc);
+}
+
+/*
+ * Read a block for the scrub, charging it to the batch.
+ */
+static
+int
+scrub_read(struct sfs_scrub *sc, daddr_t block, void *buf)
+{
+	sc->sc_budget--;
+	sc->sc_stats.st_reads++;
+	return sfs_readblock(sc->sc_sfs, block, buf, SFS_BLOCKSIZE);
+}
+
+/*
+ * Get inode INO. If it's loaded, the in-memory copy is the current
+ * one; otherwise read it from disk.
+ */
+static
+int
+scrub_getinode(struct sfs_scrub *sc, uint32_t ino, struct sfs_dinode *ret)
+{
+	struct sfs_fs *sfs = sc->sc_sfs;
+	struct sfs_vnode *sv;
+	unsigned i, num;
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		if (sv->sv_ino == ino) {
+			*ret = sv->sv_i;
+			return 0;
+		}
+	}
+	return scrub_read(sc, ino, ret);
+}
+
+/*
+ * Check block pointer BLOCK, which is the data block FILEBLOCK of
+ * inode INO, or its indirect block if FILEBLOCK is -1. Marks it seen.
+ * Returns true if the block is safe to read.
+ */
+static
+bool
+scrub_checkptr(struct sfs_scrub *sc, uint32_t ino, uint32_t nfileblocks,
+	       int fileblock, uint32_t block)
+{
+	struct sfs_fs *sfs = sc->sc_sfs;
+	const char *what = fileblock < 0 ? "indirect" : "data";
+
+	if (fileblock >= 0 && (uint32_t)fileblock >= nfileblocks) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: block %u (at %d) is past EOF\n",
+				ino, block, fileblock);
+		}
+	}
+	if (!scrub_valid(sc, block)) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: %s block %u is out of range\n",
+				ino, what, block);
+		}
+		return false;
+	}
+	if (!sfs_bused(sfs, block)) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: %s block %u is marked free\n",
+				ino, what, block);
+		}
+		return false;
+	}
+	if (bitmap_isset(sc->sc_seen, block)) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: %s block %u is also used "
+				"elsewhere\n", ino, what, block);
+		}
+		return false;
+	}
+	bitmap_mark(sc->sc_seen, block);
+	sc->sc_stats.st_seen++;
+	return true;
+}
+
+/*
+ * Check inode INO: its type, and all its block pointers. If it's a
+ * directory, set it up to have its entries read.
+ */
+static
+void
+scrub_inode(struct sfs_scrub *sc, uint32_t ino)
+{
+	struct sfs_dinode dino;
+	uint32_t indir[SFS_DBPERIDB];
+	uint32_t nfileblocks, i;
+	int result;
+
+	result = scrub_getinode(sc, ino, &dino);
+	if (result) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: read error: %s\n", ino,
+				strerror(result));
+		}
+		return;
+	}
+	sc->sc_stats.st_inodes++;
+
+	if (dino.sfi_type != SFS_TYPE_FILE && dino.sfi_type != SFS_TYPE_DIR) {
+		if (scrub_report(sc)) {
+			kprintf("inode %u: invalid type %u\n", ino,
+				dino.sfi_type);
+		}
+		return;
+	}
+
+	nfileblocks = DIVROUNDUP(dino.sfi_size, SFS_BLOCKSIZE);
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (dino.sfi_direct[i] != 0) {
+			scrub_checkptr(sc, ino, nfileblocks, i,
+				       dino.sfi_direct[i]);
+		}
+	}
+	if (dino.sfi_indirect != 0 &&
+	    scrub_checkptr(sc, ino, nfileblocks, -1, dino.sfi_indirect)) {
+		result = scrub_read(sc, dino.sfi_indirect, indir);
+		if (result) {
+			if (scrub_report(sc)) {
+				kprintf("inode %u: indirect block %u: "
+					"read error: %s\n", ino,
+					dino.sfi_indirect, strerror(result));
+			}
+			return;
+		}
+		for (i=0; i<SFS_DBPERIDB; i++) {
+			if (indir[i] != 0) {
+				scrub_checkptr(sc, ino, nfileblocks,
+					       SFS_NDIRECT + i, indir[i]);
+			}
+		}
+	}
+
+	if (dino.sfi_type == SFS_TYPE_DIR) {
+		sc->sc_stats.st_dirs++;
+		if (dino.sfi_size % sizeof(struct sfs_direntry) != 0) {
+			if (scrub_report(sc)) {
+				kprintf("directory %u: size %u is not a "
+					"whole number of entries\n", ino,
+					dino.sfi_size);
+			}
+		}
+		sc->sc_dirino = ino;
+		sc->sc_dirblock = 0;
+	}
+}
+
+/*
+ * Check that a directory entry name is nonempty and terminated.
+ */
+static
+bool
+scrub_nameok(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_NAMELEN; i++) {
+		if (name[i] == 0) {
+			return i > 0;
+		}
+	}
+	return false;
+}
+
+/*
+ * Check the entries in one block of directory DIRINO, starting with
+ * entry number FIRST, and queue the inodes they name.
+ */
+static
+void
+scrub_direntries(struct sfs_scrub *sc, uint32_t dirino, uint32_t first,
+		 uint32_t nentries, struct sfs_direntry *sd)
+{
+	uint32_t i, ino;
+
+	for (i=0; i<nentries; i++) {
+		ino = sd[i].sfd_ino;
+		if (ino == SFS_NOINO) {
+			continue;
+		}
+		if (!scrub_nameok(sd[i].sfd_name)) {
+			if (scrub_report(sc)) {
+				kprintf("directory %u: entry %u has a bad "
+					"name\n", dirino, first + i);
+			}
+			continue;
+		}
+		if (!scrub_valid(sc, ino) && ino != SFS_ROOTDIR_INO) {
+			if (scrub_report(sc)) {
+				kprintf("directory %u: %s: inode %u is out "
+					"of range\n", dirino,
+					sd[i].sfd_name, ino);
+			}
+			continue;
+		}
+		if (!sfs_bused(sc->sc_sfs, ino)) {
+			if (scrub_report(sc)) {
+				kprintf("directory %u: %s: inode %u is "
+					"marked free\n", dirino,
+					sd[i].sfd_name, ino);
+			}
+			continue;
+		}
+		scrub_queue(sc, ino);
+	}
+}
+
+/*
+ * Read more of the directory we're working through. Directories only
+ * ever grow, so picking up where we left off is safe; if it has been
+ * removed in the meantime, give up on it. Blocks that failed
+ * scrub_checkptr were reported already and are skipped.
+ */
+static
+void
+scrub_dir(struct sfs_scrub *sc)
+{
+	struct sfs_direntry sd[SCRUB_DIRPERBLOCK];
+	struct sfs_dinode dino;
+	uint32_t indir[SFS_DBPERIDB];
+	bool haveindir = false;
+	uint32_t ino, nfileblocks, nentries, first, n, block;
+	int result;
+
+	ino = sc->sc_dirino;
+	if (!bitmap_isset(sc->sc_visited, ino) ||
+	    scrub_getinode(sc, ino, &dino) ||
+	    dino.sfi_type != SFS_TYPE_DIR) {
+		sc->sc_dirino = 0;
+		return;
+	}
+
+	nentries = dino.sfi_size / sizeof(struct sfs_direntry);
+	nfileblocks = DIVROUNDUP(nentries, SCRUB_DIRPERBLOCK);
+
+	while (sc->sc_dirblock < nfileblocks && sc->sc_budget > 0) {
+		if (sc->sc_dirblock < SFS_NDIRECT) {
+			block = dino.sfi_direct[sc->sc_dirblock];
+		}
+		else if (!scrub_valid(sc, dino.sfi_indirect)) {
+			break;
+		}
+		else {
+			if (!haveindir) {
+				if (scrub_read(sc, dino.sfi_indirect, indir)) {
+					break;
+				}
+				haveindir = true;
+			}
+			block = indir[sc->sc_dirblock - SFS_NDIRECT];
+		}
+
+		if (block == 0) {
+			if (scrub_report(sc)) {
+				kprintf("directory %u: hole at block %u\n",
+					ino, sc->sc_dirblock);
+			}
+		}
+		else if (scrub_valid(sc, block) &&
+			 sfs_bused(sc->sc_sfs, block)) {
+			result = scrub_read(sc, block, sd);
+			if (result) {
+				if (scrub_report(sc)) {
+					kprintf("directory %u: block %u: "
+						"read error: %s\n", ino,
+						block, strerror(result));
+				}
+			}
+			else {
+				first = sc->sc_dirblock * SCRUB_DIRPERBLOCK;
+				n = nentries - first;
+				if (n > SCRUB_DIRPERBLOCK) {
+					n = SCRUB_DIRPERBLOCK;
+				}
+				scrub_direntries(sc, ino, first, n, sd);
+			}
+		}
+		sc->sc_dirblock++;
+	}
+
+	if (sc->sc_dirblock >= nfileblocks) {
+		sc->sc_dirino = 0;
+	}
+}
+
+/*
+ * Sweep part of the freemap for blocks in use that nothing refers to.
+ */
+static
+void
+scrub_freemap(struct sfs_scrub *sc)
+{
+	struct scrub_stats *st = &sc->sc_stats;
+	uint32_t end;
+
+	end = st->st_freemappos + SCRUB_BITSPERUNIT;
+	if (end > SCRUB_NBLOCKS(sc)) {
+		end = SCRUB_NBLOCKS(sc);
+	}
+	for (; st->st_freemappos < end; st->st_freemappos++) {
+		if (sfs_bused(sc->sc_sfs, st->st_freemappos) &&
+		    !bitmap_isset(sc->sc_seen, st->st_freemappos) &&
+		    !bitmap_isset(sc->sc_new, st->st_freemappos)) {
+			st->st_leaked++;
+			if (scrub_report(sc)) {
+				kprintf("block %u is marked in use but "
+					"not referenced\n", st->st_freemappos);
+			}
+		}
+	}
+	sc->sc_budget--;
+}
+
+/*
+ * Do one batch of work. Returns true when the scrub is finished.
+ */
+static
+bool
+scrub_batch(struct sfs_scrub *sc)
+{
+	struct scrub_stats *st = &sc->sc_stats;
+	uint32_t ino;
+
+	while (sc->sc_budget > 0) {
+		switch (st->st_phase) {
+		    case SCRUB_INODES:
+			if (sc->sc_dirino != 0) {
+				scrub_dir(sc);
+				break;
+			}
+			if (sc->sc_stacknum == 0) {
+				if (st->st_incomplete) {
+					kprintf("sfs: scrub: %s: ran out of "
+						"memory; skipping leak "
+						"check\n", SCRUB_VOLNAME(sc));
+					st->st_phase = SCRUB_DONE;
+					return true;
+				}
+				st->st_phase = SCRUB_FREEMAP;
+				st->st_freemappos = sc->sc_reserved;
+				break;
+			}
+			ino = sc->sc_stack[--sc->sc_stacknum];
+			/*
+			 * Skip it if it was freed after being queued
+			 * (that clears its seen bit) or if it was
+			 * queued twice.
+			 */
+			if (!bitmap_isset(sc->sc_seen, ino) ||
+			    bitmap_isset(sc->sc_visited, ino)) {
+				break;
+			}
+			bitmap_mark(sc->sc_visited, ino);
+			scrub_inode(sc, ino);
+			break;
+		    case SCRUB_FREEMAP:
+			if (st->st_freemappos >= SCRUB_NBLOCKS(sc)) {
+				st->st_phase = SCRUB_DONE;
+				return true;
+			}
+			scrub_freemap(sc);
+			break;
+		    case SCRUB_DONE:
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+// Hooks
+
+/*
+ * Called by sfs_balloc with block newly allocated.
+ */
+void
+sfs_scrub_balloc(struct sfs_fs *sfs, daddr_t block)
+{
+	if (sfs->sfs_scrub != NULL &&
+	    !bitmap_isset(sfs->sfs_scrub->sc_new, block)) {
+		bitmap_mark(sfs->sfs_scrub->sc_new, block);
+	}
+}
+
+/*
+ * Called by sfs_bfree with a block being freed.
+ */
+void
+sfs_scrub_bfree(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_scrub *sc = sfs->sfs_scrub;
+
+	if (sc == NULL) {
+		return;
+	}
+	if (bitmap_isset(sc->sc_seen, block)) {
+		bitmap_unmark(sc->sc_seen, block);
+		sc->sc_stats.st_seen--;
+	}
+	if (bitmap_isset(sc->sc_visited, block)) {
+		bitmap_unmark(sc->sc_visited, block);
+	}
+	/*
+	 * With a journal the block stays marked in use until the free
+	 * commits; count it as changed so the sweep doesn't call it
+	 * leaked.
+	 */
+	if (!bitmap_isset(sc->sc_new, block)) {
+		bitmap_mark(sc->sc_new, block);
+	}
+}
+
+/*
+ * Called when a directory entry for inode INO is added or removed.
+ */
+void
+sfs_scrub_linkchange(struct sfs_fs *sfs, uint32_t ino)
+{
+	if (sfs->sfs_scrub != NULL) {
+		scrub_queue(sfs->sfs_scrub, ino);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Thread
+
+static
+void
+scrub_destroy(struct sfs_scrub *sc)
+{
+	if (sc->sc_seen != NULL) {
+		bitmap_destroy(sc->sc_seen);
+	}
+	if (sc->sc_visited != NULL) {
+		bitmap_destroy(sc->sc_visited);
+	}
+	if (sc->sc_new != NULL) {
+		bitmap_destroy(sc->sc_new);
+	}
+	kfree(sc->sc_stack);
+	kfree(sc);
+}
+
+/*
+ * Finish up: detach from the fs and save the results. Call with the
+ * big lock held.
+ */
+static
+void
+scrub_finish(struct sfs_scrub *sc)
+{
+	sc->sc_sfs->sfs_scrub = NULL;
+	scrub_running = NULL;
+	gettime(&sc->sc_stats.st_end);
+	sc->sc_stats.st_stopped = sc->sc_stats.st_phase != SCRUB_DONE;
+	scrub_last = sc->sc_stats;
+	scrub_havelast = true;
+}
+
+static
+void
+scrub_thread(void *data1, unsigned long unused)
+{
+	struct sfs_scrub *sc = data1;
+	struct sfs_fs *sfs = sc->sc_sfs;
+	unsigned left, backoffs;
+	bool done, wake;
+
+	(void)unused;
+
+	done = false;
+	backoffs = 0;
+	while (!done) {
+		/* Each time around, we may read up to scrub_rate blocks. */
+		for (left = scrub_rate; left > 0 && !done; ) {
+			vfs_biglock_acquire();
+			if (sc->sc_stop) {
+				vfs_biglock_release();
+				done = true;
+				break;
+			}
+			if (sfs->sfs_ioops != sc->sc_ioseen &&
+			    backoffs < SCRUB_MAXBACKOFF) {
+				/* Someone else is using the disk. */
+				sc->sc_ioseen = sfs->sfs_ioops;
+				sc->sc_stats.st_backoffs++;
+				backoffs++;
+				vfs_biglock_release();
+				break;
+			}
+			backoffs = 0;
+			sc->sc_budget = left < SCRUB_BATCHBLOCKS ?
+				left : SCRUB_BATCHBLOCKS;
+			left -= sc->sc_budget;
+			done = scrub_batch(sc);
+			sc->sc_ioseen = sfs->sfs_ioops;
+			vfs_biglock_release();
+
+			thread_yield();
+		}
+		if (!done) {
+			clocksleep(1);
+		}
+	}
+
+	vfs_biglock_acquire();
+	scrub_finish(sc);
+	wake = sc->sc_stop;
+	vfs_biglock_release();
+
+	kprintf("sfs: scrub: %s: %s, %u problem%s\n", SCRUB_VOLNAME(sc),
+		sc->sc_stats.st_stopped ? "stopped" : "done",
+		sc->sc_stats.st_problems,
+		sc->sc_stats.st_problems == 1 ? "" : "s");
+
+	VOP_DECREF(sc->sc_root);
+	scrub_destroy(sc);
+
+	/* If sfs_scrub_stop is waiting for us, let it go. */
+	if (wake) {
+		V(scrub_done);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Control
+
+/*
+ * Start scrubbing the SFS volume mounted on DEVNAME.
+ */
+int
+sfs_scrub_start(const char *devname)
+{
+	struct sfs_scrub *sc;
+	struct sfs_fs *sfs;
+	struct vnode *root;
+	struct sfs_vnode *sv;
+	unsigned i, num;
+	uint32_t block, nblocks;
+	int result;
+
+	if (scrub_done == NULL) {
+		scrub_done = sem_create("sfs_scrub", 0);
+		if (scrub_done == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * Holding a reference to the root directory keeps the volume
+	 * from being unmounted under us. (This has to be done before
+	 * taking the big lock.)
+	 */
+	result = vfs_getroot(devname, &root);
+	if (result) {
+		return result;
+	}
+
+	vfs_biglock_acquire();
+
+	if (scrub_running != NULL) {
+		vfs_biglock_release();
+		VOP_DECREF(root);
+		kprintf("sfs: scrub: already running\n");
+		return EBUSY;
+	}
+	if (root->vn_ops != &sfs_dirops) {
+		vfs_biglock_release();
+		VOP_DECREF(root);
+		kprintf("sfs: scrub: %s is not an sfs volume\n", devname);
+		return EINVAL;
+	}
+	sfs = root->vn_fs->fs_data;
+	nblocks = sfs->sfs_sb.sb_nblocks;
+
+	sc = kmalloc(sizeof(*sc));
+	if (sc == NULL) {
+		vfs_biglock_release();
+		VOP_DECREF(root);
+		return ENOMEM;
+	}
+	bzero(sc, sizeof(*sc));
+	sc->sc_sfs = sfs;
+	sc->sc_root = root;
+	sc->sc_seen = bitmap_create(nblocks);
+	sc->sc_visited = bitmap_create(nblocks);
+	sc->sc_new = bitmap_create(nblocks);
+	sc->sc_stackmax = 64;
+	sc->sc_stack = kmalloc(sc->sc_stackmax * sizeof(uint32_t));
+	if (sc->sc_seen == NULL || sc->sc_visited == NULL ||
+	    sc->sc_new == NULL || sc->sc_stack == NULL) {
+		scrub_destroy(sc);
+		vfs_biglock_release();
+		VOP_DECREF(root);
+		return ENOMEM;
+	}
+	sc->sc_reserved = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks) +
+		sfs->sfs_sb.sb_journalblocks;
+	sc->sc_ioseen = sfs->sfs_ioops;
+	sc->sc_stats.st_phase = SCRUB_INODES;
+	strcpy(sc->sc_stats.st_volname, sfs->sfs_sb.sb_volname);
+	gettime(&sc->sc_stats.st_start);
+
+	/* The superblock, freemap, and journal are accounted for. */
+	for (block=0; block<sc->sc_reserved && block<nblocks; block++) {
+		if (block != SFS_ROOTDIR_INO) {
+			bitmap_mark(sc->sc_seen, block);
+		}
+	}
+	for (block=0; block<nblocks; block++) {
+		if (sfs_bused(sfs, block)) {
+			sc->sc_stats.st_inuse++;
+		}
+	}
+	sc->sc_stats.st_seen = sc->sc_reserved - 1;
+
+	/*
+	 * Start from the root, plus whatever's loaded: files that
+	 * are open but unlinked aren't in any directory.
+	 */
+	scrub_queue(sc, SFS_ROOTDIR_INO);
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		sv = vnodearray_get(sfs->sfs_vnodes, i)->vn_data;
+		scrub_queue(sc, sv->sv_ino);
+	}
+
+	sfs->sfs_scrub = sc;
+	scrub_running = sc;
+	vfs_biglock_release();
+
+	result = thread_fork("sfs_scrub", NULL, scrub_thread, sc, 0);
+	if (result) {
+		vfs_biglock_acquire();
+		sfs->sfs_scrub = NULL;
+		scrub_running = NULL;
+		scrub_destroy(sc);
+		vfs_biglock_release();
+		VOP_DECREF(root);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Stop the running scrub, if any, and wait for it to exit.
+ */
+void
+sfs_scrub_stop(void)
+{
+	vfs_biglock_acquire();
+	if (scrub_running == NULL) {
+		vfs_biglock_release();
+		return;
+	}
+	scrub_running->sc_stop = true;
+	vfs_biglock_release();
+	P(scrub_done);
+}
+
+/*
+ * Set the rate limit, in blocks per second.
+ */
+void
+sfs_scrub_setrate(unsigned blockspersec)
+{
+	if (blockspersec == 0) {
+		blockspersec = 1;
+	}
+	scrub_rate = blockspersec;
+}
+
+/*
+ * Print the progress of the running scrub, or the results of the
+ * last one.
+ */
+void
+sfs_scrub_status(void)
+{
+	struct scrub_stats st;
+	struct timespec now, elapsed;
+	bool running;
+	unsigned pct;
+	const char *what;
+
+	vfs_biglock_acquire();
+	running = scrub_running != NULL;
+	if (running) {
+		st = scrub_running->sc_stats;
+	}
+	else if (scrub_havelast) {
+		st = scrub_last;
+	}
+	vfs_biglock_release();
+
+	if (!running && !scrub_havelast) {
+		kprintf("sfs: scrub: never run (rate %u blocks/s)\n",
+			scrub_rate);
+		return;
+	}
+
+	if (running) {
+		gettime(&now);
+	}
+	else {
+		now = st.st_end;
+	}
+	timespec_sub(&now, &st.st_start, &elapsed);
+
+	switch (st.st_phase) {
+	    case SCRUB_INODES:
+		what = "checking inodes";
+		/* (estimate; the volume may change as we go) */
+		pct = st.st_inuse == 0 ? 0 :
+			(unsigned)((uint64_t)st.st_seen * 100 / st.st_inuse);
+		if (pct > 99) {
+			pct = 99;
+		}
+		break;
+	    case SCRUB_FREEMAP:
+		what = "checking freemap";
+		pct = 0;
+		break;
+	    default:
+		what = "complete";
+		pct = 100;
+		break;
+	}
+
+	kprintf("sfs: scrub of %s: %s, %s", st.st_volname,
+		running ? "running" : st.st_stopped ? "stopped" : "finished",
+		what);
+	if (st.st_phase == SCRUB_FREEMAP) {
+		kprintf(" (block %u)", st.st_freemappos);
+	}
+	else {
+		kprintf(" (%u%%)", pct);
+	}
+	kprintf("\n");
+	kprintf("    %u inodes (%u directories), %u blocks read, "
+		"%llu.%02lu s\n", st.st_inodes, st.st_dirs, st.st_reads,
+		(unsigned long long)elapsed.tv_sec,
+		(unsigned long)(elapsed.tv_nsec / 10000000));
+	kprintf("    %u s yielded to other I/O, rate %u blocks/s\n",
+		st.st_backoffs, scrub_rate);
+	kprintf("    %u problems (%u leaked blocks)%s\n", st.st_problems,
+		st.st_leaked,
+		st.st_incomplete ? ", leak check skipped" : "");
+}
@@ -117,12 +117,14 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
 	result = sfs_io(sv, uio);
+	sfs_jnl_opdone(sfs);
 	vfs_biglock_release();
 
 	return result;
@@ -222,10 +224,22 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
+	if (sfs->sfs_jnl != NULL) {
+		/*
+		 * The inode alone can't be committed without whatever
+		 * else it depends on, so commit everything. Anyone
+		 * else waiting to fsync then finds little or nothing
+		 * left to do.
+		 */
+		result = sfs_syncmeta(sfs);
+	}
+	else {
+		result = sfs_sync_inode(sv);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -250,8 +264,15 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	vfs_biglock_acquire();
+	result = sfs_itrunc(sv, len);
+	sfs_jnl_opdone(sfs);
+	vfs_biglock_release();
+
+	return result;
 }
 
 /*
@@ -342,6 +363,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 
 	*ret = &newguy->sv_absvn;
 
+	sfs_jnl_opdone(sfs);
 	vfs_biglock_release();
 	return 0;
 }
@@ -380,6 +402,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
 
+	sfs_jnl_opdone(dir->vn_fs->fs_data);
 	vfs_biglock_release();
 	return 0;
 }
@@ -417,6 +440,7 @@ sfs_remove(struct vnode *dir, const char *name)
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_absvn);
 
+	sfs_jnl_opdone(dir->vn_fs->fs_data);
 	vfs_biglock_release();
 	return result;
 }
@@ -487,6 +511,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
+	sfs_jnl_opdone(sfs);
 	vfs_biglock_release();
 	return 0;
 
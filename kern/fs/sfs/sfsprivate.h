@@ -43,8 +43,11 @@ extern const struct vnode_ops sfs_dirops;
 
 
 /* Functions in sfs_balloc.c */
+int sfs_freemap_setup(struct sfs_fs *sfs);
+void sfs_freemap_cleanup(struct sfs_fs *sfs);
 int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_brelease(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
 /* Functions in sfs_bmap.c */
@@ -62,6 +65,9 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Functions in sfs_fsops.c */
+int sfs_syncmeta(struct sfs_fs *sfs);
+
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
@@ -70,9 +76,26 @@ int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
+/* Functions in sfs_jnl.c */
+int sfs_jnl_mount(struct sfs_fs *sfs);
+void sfs_jnl_destroy(struct sfs_fs *sfs);
+int sfs_jnl_write(struct sfs_fs *sfs, daddr_t block, const void *data);
+bool sfs_jnl_read(struct sfs_fs *sfs, daddr_t block, void *data);
+void sfs_jnl_forget(struct sfs_fs *sfs, daddr_t block);
+void sfs_jnl_deferfree(struct sfs_fs *sfs, daddr_t block);
+int sfs_jnl_commit(struct sfs_fs *sfs);
+int sfs_jnl_checkpoint(struct sfs_fs *sfs);
+void sfs_jnl_opdone(struct sfs_fs *sfs);
+
+/* Functions in sfs_scrub.c */
+void sfs_scrub_balloc(struct sfs_fs *sfs, daddr_t block);
+void sfs_scrub_bfree(struct sfs_fs *sfs, daddr_t block);
+void sfs_scrub_linkchange(struct sfs_fs *sfs, uint32_t ino);
+
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
@@ -39,6 +39,7 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct dumbvm_text;
 
 
 /*
@@ -57,6 +58,13 @@ struct addrspace {
         paddr_t as_pbase2;
         size_t as_npages2;
         paddr_t as_stackpbase;
+        uint32_t *as_asid;      /* per-cpu ASID, see dumbvm.c */
+        struct dumbvm_text *as_text;    /* shared text region, or NULL */
+        vaddr_t as_heapbase;            /* start of the heap */
+        vaddr_t as_heapend;             /* the break */
+        paddr_t *as_heappages;          /* physical page per heap page */
+        unsigned as_heapalloc;          /* pages allocated in as_heappages */
+        unsigned as_heapslots;          /* size of as_heappages */
 #else
         /* Put stuff here for your VM system */
 #endif
@@ -99,6 +107,10 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes (which may
+ *                be negative) and hand back the old end. Pages that
+ *                fall off the end must stop being accessible.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +129,8 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, ssize_t amount,
+                          vaddr_t *oldbreak);
 
 
 /*
@@ -129,4 +143,29 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
 
 
+#if OPT_DUMBVM
+/*
+ * Extra functions in dumbvm.c:
+ *    as_shootdown - invalidate a range of pages of an address space
+ *                   in the TLB of every CPU that may be caching it,
+ *                   and wait for that to finish. Must not be called
+ *                   holding spinlocks.
+ *
+ *    as_define_text - like as_define_region, for a read-only executable
+ *                   segment of the file V. The segment is shared with
+ *                   other address spaces running the same file, and
+ *                   read in on demand; the caller doesn't load it.
+ *
+ *    dumbvm_printstats - print per-CPU TLB miss and ASID counts, and
+ *                   shared text use.
+ *    dumbvm_resetstats - zero them.
+ */
+void as_shootdown(struct addrspace *as, vaddr_t start, vaddr_t end);
+int as_define_text(struct addrspace *as, struct vnode *v, off_t offset,
+                   vaddr_t vaddr, size_t memsize, size_t filesize);
+void dumbvm_printstats(void);
+void dumbvm_resetstats(void);
+#endif
+
+
 #endif /* _ADDRSPACE_H_ */
@@ -0,0 +1,43 @@
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Packed argument vectors for execv and runprogram.
+ *
+ * All the argument strings are kept back to back at the front of a
+ * single ARG_MAX-sized buffer, and the argv pointer array is kept at
+ * the very end of the same buffer. While the argument vector is in
+ * the kernel the pointer slots hold offsets into the string area;
+ * argbuf_copyout turns them into user addresses in one pass and
+ * moves the strings and the array onto the user stack with one
+ * copyout each. Since ARG_MAX covers both the strings and the
+ * pointers, everything that is legal fits with no further
+ * allocation.
+ */
+
+struct argbuf {
+	char *ab_buf;			/* ARG_MAX bytes */
+	size_t ab_strbytes;		/* bytes of strings at the front */
+	unsigned ab_argc;		/* number of arguments */
+};
+
+/*
+ * Functions.
+ *
+ * argbuf_init	    Allocate the buffer. Returns ENOMEM on failure.
+ * argbuf_cleanup   Free it again.
+ * argbuf_copyin    Fetch the NULL-terminated user argv array UARGV
+ *		    and the strings it points to. E2BIG if too large.
+ * argbuf_fromkernel Same, from an array of kernel strings.
+ * argbuf_copyout   Put the arguments on the new user stack below
+ *		    *STACKPTR. Returns the user address of argv in
+ *		    *UARGV and leaves *STACKPTR below everything,
+ *		    suitably aligned.
+ */
+int argbuf_init(struct argbuf *ab);
+void argbuf_cleanup(struct argbuf *ab);
+int argbuf_copyin(struct argbuf *ab, userptr_t uargv);
+int argbuf_fromkernel(struct argbuf *ab, unsigned nargs, char **args);
+int argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *uargv);
+
+#endif /* _ARGBUF_H_ */
@@ -37,7 +37,13 @@
  *     bitmap_create  - allocate a new bitmap object.
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
+ *     bitmap_refresh - call after changing the raw bit data (e.g. by
+ *                      reading it from disk).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Next-fit: searches onward from the last one found.
+ *     bitmap_alloc_near - same, but search starts at bit NEAR (and wraps).
+ *     bitmap_alloc_range - locate COUNT consecutive cleared bits, set
+ *                      them, and return the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -49,7 +55,12 @@ struct bitmap;  /* Opaque. */
 
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
+void           bitmap_refresh(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_near(struct bitmap *, unsigned near,
+                                 unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned count,
+                                  unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
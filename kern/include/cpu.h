@@ -83,11 +83,19 @@ struct cpu {
 	 *
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
-	 * paddr, or something else.
+	 * paddr, or something else. Requests that can be combined
+	 * (see vm_tlbshootdown_merge) share one slot.
+	 *
+	 * Each request queued gets the next c_shootdown_seq as a
+	 * ticket. After handling everything queued, the cpu copies
+	 * c_shootdown_seq to c_shootdown_done; the sender waits for
+	 * that to reach its ticket (see ipi_tlbshootdown_wait).
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
+	volatile unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -154,6 +162,12 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It returns a ticket to pass to ipi_tlbshootdown_wait, which waits
+ * until the target has done the invalidation.
+ * ipi_tlbshootdown_cpus does a shootdown on every CPU whose number
+ * is set in CPUMASK (including the current one, which is done
+ * directly) and waits for them all. The waiting is done with
+ * interrupts on, so the caller must not hold spinlocks.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,7 +181,11 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
+void ipi_tlbshootdown_cpus(uint32_t cpumask,
+			   const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
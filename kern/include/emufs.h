@@ -45,6 +45,37 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct emufs_cfile *ev_file;	/* cache entry, or NULL if uncached */
+};
+
+/*
+ * Data cache (see emu.c). File contents are cached in chunks of
+ * EMU_MAXIO bytes. The cache entry for a file is found by its path
+ * from the volume root, not by handle, so that it outlives the vnode
+ * and a program that is run over and over only has to be read from
+ * the host once. Chunks come from a fixed pool that is filled as
+ * needed and never freed.
+ */
+struct emufs_chunk {
+	struct emufs_cfile *ck_file;	/* owner, or NULL once dropped */
+	uint32_t ck_index;		/* file offset / EMU_MAXIO */
+	uint32_t ck_len;		/* valid bytes; short means EOF */
+	unsigned ck_refs;		/* readers copying out of ck_data */
+	struct emufs_chunk *ck_next;	/* owner's list, or the free list */
+	struct emufs_chunk *ck_lruprev;	/* cache-wide LRU list */
+	struct emufs_chunk *ck_lrunext;
+	char *ck_data;
+};
+
+struct emufs_cfile {
+	char *cf_path;			/* path from the volume root */
+	unsigned cf_nvnodes;		/* vnodes using this */
+	bool cf_nocache;		/* open under two handles; don't cache */
+	struct emufs_chunk *cf_chunks;	/* cached contents */
+	off_t cf_size;			/* cached file size */
+	bool cf_sizevalid;		/* cf_size is usable */
+	unsigned cf_gen;		/* bumped whenever data is dropped */
+	struct emufs_cfile *cf_next;	/* list of all entries */
 };
 
 struct emufs_fs {
@@ -52,7 +83,21 @@ struct emufs_fs {
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+
+	/* Data cache; ef_cachelock nests inside e_lock */
+	struct lock *ef_cachelock;
+	struct emufs_cfile *ef_files;	/* all cache entries */
+	struct emufs_chunk *ef_lruhead;	/* most recently used */
+	struct emufs_chunk *ef_lrutail;	/* least recently used */
+	struct emufs_chunk *ef_free;	/* unused chunks */
+	unsigned ef_npool;		/* chunks allocated so far */
 };
 
+/*
+ * Cache statistics for all emu devices (kernel menu "emu").
+ */
+void emufs_printstats(void);
+void emufs_resetstats(void);
+
 
 #endif /* _EMUFS_H_ */
@@ -0,0 +1,20 @@
+#ifndef _KERN_FUTEX_H_
+#define _KERN_FUTEX_H_
+
+/*
+ * Operations for futex(), shared between the kernel and userland.
+ *
+ * FUTEX_WAIT: if the 32-bit word at ADDR still holds VAL, sleep
+ *             until woken by FUTEX_WAKE; otherwise fail with EAGAIN.
+ * FUTEX_WAKE: wake up to VAL threads sleeping on ADDR; returns how
+ *             many were woken.
+ *
+ * The word is found by physical address, so it works between any
+ * processes that share the page, not only within one address space.
+ */
+
+#define FUTEX_WAIT	0
+#define FUTEX_WAKE	1
+
+
+#endif /* _KERN_FUTEX_H_ */
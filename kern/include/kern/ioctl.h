@@ -34,6 +34,25 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Console line discipline. The argument is a pointer to an int.
+ *
+ * CONIOC_GETMODE	Get the input mode (CON_COOKED or CON_RAW).
+ * CONIOC_SETMODE	Set the input mode.
+ * CONIOC_SETMIN	In raw mode, the number of bytes a read waits
+ *			for before returning (at least 1).
+ *
+ * In cooked mode, the default, input is echoed as it is typed, CR is
+ * turned into newline, backspace (or DEL) erases the last character
+ * of the line being typed and ^U erases all of it, and a read returns
+ * at most one line, once the whole line has been typed. In raw mode
+ * characters are passed through as they are, without echo.
+ */
+#define CONIOC_GETMODE	1
+#define CONIOC_SETMODE	2
+#define CONIOC_SETMIN	3
+
+#define CON_COOKED	0
+#define CON_RAW		1
 
 #endif /* _KERN_IOCTL_H_*/
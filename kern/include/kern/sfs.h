@@ -74,7 +74,9 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Journal size; 0 if none */
+	uint32_t reserved[116];			/* unused, set to 0 */
 };
 
 /*
@@ -97,5 +99,53 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal.
+ *
+ * A volume may have a journal, which if present lives right after
+ * the freemap. Its first block is a header; the rest is a circular
+ * log of transactions. A transaction is one or more descriptor
+ * blocks, each followed by the block images it lists, and then a
+ * commit block carrying a checksum of everything before it. A
+ * descriptor can also list revoked blocks: blocks freed in that
+ * transaction whose older images must not be replayed.
+ *
+ * The header says where the oldest transaction not yet written in
+ * place starts and what its sequence number is. Replay walks
+ * forward from there until it finds a block that isn't the next
+ * valid piece of the next transaction in sequence.
+ */
+#define SFS_JOURNAL_MINBLOCKS	16		/* smallest usable journal */
+#define SFS_JHEADER_MAGIC	0x4a524e4c	/* "JRNL" */
+#define SFS_JDESC_MAGIC		0x4a445343	/* "JDSC" */
+#define SFS_JCOMMIT_MAGIC	0x4a434d54	/* "JCMT" */
+#define SFS_JDESC_MAX		124		/* block numbers per descriptor */
+
+/* Checksum step: fold the 32-bit word W (in host order) into C. */
+#define SFS_JCSUM(c, w)		((((c) << 1) | ((c) >> 31)) + (w))
+
+struct sfs_jheader {
+	uint32_t jh_magic;		/* SFS_JHEADER_MAGIC */
+	uint32_t jh_seq;		/* sequence number of first transaction */
+	uint32_t jh_start;		/* its offset within the journal */
+	uint32_t jh_reserved[125];	/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;		/* SFS_JDESC_MAGIC */
+	uint32_t jd_seq;		/* transaction sequence number */
+	uint32_t jd_nimages;		/* block images following this block */
+	uint32_t jd_nrevoke;		/* revoked blocks, listed after those */
+	uint32_t jd_blocks[SFS_JDESC_MAX];	/* where the images go */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;		/* SFS_JCOMMIT_MAGIC */
+	uint32_t jc_seq;		/* transaction sequence number */
+	uint32_t jc_nblocks;		/* blocks in transaction before this */
+	uint32_t jc_checksum;		/* SFS_JCSUM over all their words */
+	uint32_t jc_reserved[124];	/* unused, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
@@ -43,9 +43,11 @@
 } while (0)
 #else
 #include <stdio.h>
+/* stdout is line-buffered; progress should show up right away */
 #define __TEST161_PROGRESS_N(iter, mod) do { \
 	if (((iter) % mod) == 0) { \
 		printf("."); \
+		fflush(stdout); \
 	} \
 } while (0)
 #endif
@@ -0,0 +1,76 @@
+#ifndef _KTRACE_H_
+#define _KTRACE_H_
+
+/*
+ * In-kernel event tracing.
+ *
+ * Each CPU has its own ring buffer of fixed-size, timestamped trace
+ * records. Only the owning CPU ever writes to a ring, and it does so
+ * with interrupts off, so recording an event takes no locks and does
+ * not touch any cache line another CPU is writing. The reader (the
+ * dump code or the streaming thread) copies records out and merges
+ * the per-CPU streams by timestamp. If the reader falls behind, the
+ * oldest records are overwritten and counted as lost.
+ *
+ * When tracing is off a tracepoint costs one load and a branch.
+ */
+
+/*
+ * Event codes. The meaning of the two arguments depends on the event.
+ */
+#define KTR_SWITCH	1	/* thread_switch: old thread, new thread */
+#define KTR_SLEEP	2	/* wchan_sleep: wchan, 0 */
+#define KTR_WAKEUP	3	/* wchan_wake*: wchan, thread woken */
+#define KTR_LOCKWAIT	4	/* lock_acquire blocks: lock, holder */
+#define KTR_LOCKACQ	5	/* lock_acquire after blocking: lock, 0 */
+#define KTR_VMFAULT	6	/* vm_fault: fault type, address */
+#define KTR_SYSCALL	7	/* syscall entry: call number, first arg */
+#define KTR_SYSRET	8	/* syscall exit: call number, error */
+#define KTR_DISKIO	9	/* lhd_io sector start: sector, iswrite */
+#define KTR_DISKDONE	10	/* lhd_io sector done: sector, error */
+#define KTR_NEVENTS	11
+
+/*
+ * One trace record. kr_time is in CPU cycles (see mainbus_cycles).
+ */
+struct ktrace_rec {
+	uint64_t kr_time;		/* timestamp */
+	uint16_t kr_cpu;		/* cpu number */
+	uint16_t kr_event;		/* KTR_* code */
+	uint32_t kr_thread;		/* curthread at the time */
+	uint32_t kr_arg0;
+	uint32_t kr_arg1;
+};
+
+/* Nonzero while tracepoints should record. */
+extern volatile bool ktrace_enabled;
+
+/*
+ * Tracepoint. Arguments may be pointers or integers.
+ */
+#define KTRACE(ev, a0, a1) \
+	(ktrace_enabled ? \
+	 ktrace_record(ev, (uint32_t)(uintptr_t)(a0), \
+		       (uint32_t)(uintptr_t)(a1)) : (void)0)
+
+void ktrace_record(unsigned event, uint32_t arg0, uint32_t arg1);
+
+/*
+ * Control, for the kernel menu.
+ *
+ * ktrace_start	 Allocate the ring buffers (first time only) and
+ *		 start recording.
+ * ktrace_stop	 Stop recording, and stop streaming if it's running.
+ * ktrace_dump	 Stop recording and write everything buffered to the
+ *		 file PATH, merged across CPUs in timestamp order.
+ * ktrace_stream Start recording and start a kernel thread that drains
+ *		 the buffers into PATH once a second until ktrace_stop.
+ *
+ * vfs_open is used on PATH, so it is destroyed.
+ */
+int ktrace_start(void);
+void ktrace_stop(void);
+int ktrace_dump(char *path);
+int ktrace_stream(char *path);
+
+#endif /* _KTRACE_H_ */
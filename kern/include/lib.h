@@ -165,6 +165,7 @@ const char *strerror(int errcode);
  */
 void putch(int ch);
 int getch(void);
+int getch_setmode(int mode);
 void beep(void);
 
 /*
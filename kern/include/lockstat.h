@@ -0,0 +1,61 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics ("options lockstat").
+ *
+ * Every sleep lock, and every spinlock that has been given a name
+ * (with spinlock_setname or SPINLOCK_INITIALIZER_NAMED), carries a
+ * struct lockstat. The counters are only ever updated by whoever
+ * holds the lock, so they need no locking of their own.
+ *
+ * Live lockstats are kept on a list so they can be reported; when a
+ * lock is destroyed its counts are folded into a per-name total so
+ * they aren't lost. Reports are aggregated by name, so for example
+ * all the per-cpu run queue locks show up as one line.
+ *
+ * Times are in CPU cycles (see mainbus_cycles).
+ */
+
+struct lockstat {
+	const char *ls_name;		/* NULL if not tracked */
+	bool ls_onlist;			/* registered with lockstat code */
+	struct lockstat *ls_next;	/* list of live lockstats */
+	struct lockstat *ls_prev;
+
+	uint32_t ls_acquires;		/* total acquisitions */
+	uint32_t ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_waitcycles;		/* total time spent waiting */
+	uint64_t ls_maxwait;		/* longest single wait */
+	uint64_t ls_holdcycles;		/* total time held */
+	uint64_t ls_acqtime;		/* when the current holder got it */
+};
+
+#define LOCKSTAT_INITIALIZER(name) \
+	{ name, false, NULL, NULL, 0, 0, 0, 0, 0, 0 }
+
+/*
+ * Functions.
+ *
+ * lockstat_init	Set up a lockstat for a lock called NAME (may
+ *			be NULL for "don't track").
+ * lockstat_cleanup	Fold the counts into the totals and take the
+ *			lockstat off the list.
+ * lockstat_acquired	Called by the new holder right after getting
+ *			the lock. If it had to wait, CONTENDED is true
+ *			and WAITSTART is when it started waiting.
+ * lockstat_released	Called by the holder right before letting go.
+ *
+ * lockstat_print	Print the per-name report (kernel menu "lks").
+ * lockstat_reset	Zero all counts (kernel menu "lksr").
+ */
+void lockstat_init(struct lockstat *ls, const char *name);
+void lockstat_cleanup(struct lockstat *ls);
+void lockstat_acquired(struct lockstat *ls, bool contended,
+		       uint64_t waitstart);
+void lockstat_released(struct lockstat *ls);
+
+void lockstat_print(void);
+void lockstat_reset(void);
+
+#endif /* _LOCKSTAT_H_ */
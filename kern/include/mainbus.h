@@ -55,6 +55,14 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Cycle counter for the current CPU: the number of CPU cycles since
+ * the on-chip timer was started. Cheap enough to call from tracing
+ * and lock-timing code; only differences are meaningful, and only
+ * between readings taken on the same CPU.
+ */
+uint64_t mainbus_cycles(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -36,8 +36,8 @@
 /* The PID of the kernel process */
 #define KERNEL_PID 0
 
-/* MAX PID value */
-#define MAX_PID 512
+/* Number of buckets in the pid -> proc hash table (power of 2) */
+#define PIDHASH_SIZE 256
 
 /*
  * Definition of a process.
@@ -52,6 +52,8 @@
 struct addrspace;
 struct thread;
 struct vnode;
+struct lock;
+struct cv;
 
 /*
  * Process structure.
@@ -88,14 +90,29 @@ struct proc {
 		this id is assigned and recycled.
 	 */
 	pid_t p_pid;
-
-	struct proc *p_parent; /* The parent process, could be NULL */
-
-	// TODO: Add the following later:
-	//struct cv *p_cvWait; /* Condition variable to satisfy _exit<->waitpid condition */
-	//struct lock *p_lockWait /* Lock associated with above CV */
-
-	//volatile int p_num_waiting_procs /* Count of processes waiting on this process to exit */
+	struct proc *p_hashnext;	/* pid hash chain, under the pid lock */
+
+	/*
+	 * waitpid/_exit. p_parent is set when the process is created
+	 * and never changes; the parent's proc structure is kept around
+	 * until none of its children point at it any more (see proc.c).
+	 *
+	 * Each process's p_waitlock protects its own p_children list,
+	 * p_gone and p_released, and also the p_sibprev, p_sibnext,
+	 * p_exited and p_exitstatus fields of each of its children.
+	 * Children broadcast on the parent's p_waitcv when they exit.
+	 */
+	struct proc *p_parent;		/* The parent process, could be NULL */
+	struct lock *p_waitlock;
+	struct cv *p_waitcv;
+	struct proc *p_children;	/* head of list of children */
+	struct proc *p_sibprev;		/* links in parent's p_children */
+	struct proc *p_sibnext;
+	bool p_vfork;			/* running in parent's addrspace */
+	bool p_exited;			/* has called _exit */
+	int p_exitstatus;		/* encoded status for waitpid */
+	bool p_gone;			/* exited; children reap themselves */
+	bool p_released;		/* parent has no further use for us */
 
 	/* File system related data */
 
@@ -128,14 +145,21 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
-/* Assign pids to new processes
- * Assuming that the number of processes will not exceed MAX_PID 
- */
-pid_t proc_assignpid(struct proc *);
+/* Create a child of the current process for fork(), and undo that. */
+int proc_create_fork(const char *name, bool vfork, struct proc **ret);
+void proc_unfork(struct proc *child);
 
-/* Get the process with pid ppid 
- * Return an erro if no such pid exists
- */
-struct proc* get_process(pid_t);
+/* vfork: parent waits for the child to give back its address space. */
+void proc_vforkwait(struct proc *child);
+void proc_vforkdone(struct proc *proc);
+
+/* Look up a child of PARENT by pid. Call with PARENT's p_waitlock held. */
+int proc_findchild(struct proc *parent, pid_t pid, struct proc **ret);
+
+/* Reap an exited child. Call with the parent's p_waitlock held. */
+void proc_reap(struct proc *child);
+
+/* Finish off the current process for _exit. Does not return. */
+__DEAD void proc_exit(int exitstatus);
 
 #endif /* _PROC_H_ */
@@ -0,0 +1,43 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Statistical kernel/user profiler.
+ *
+ * While profiling is on, every timer interrupt on every CPU records
+ * where that CPU was: the interrupted PC, and the pid if it was in
+ * user mode (KERNEL_PID if it was in the kernel). Samples go into a
+ * per-CPU buffer that only its own CPU writes. When a buffer fills up
+ * further samples on that CPU are counted as dropped.
+ *
+ * "prof dump" writes a histogram of (pid, pc) pairs with their sample
+ * counts, along with the name of each process seen. Kernel PCs can be
+ * looked up in the kernel image and user PCs in the matching program,
+ * e.g. with addr2line or by searching the output of objdump -d.
+ *
+ * The sampling rate is HZ per CPU.
+ */
+
+/* Nonzero while the timer interrupt should take samples. */
+extern volatile bool prof_enabled;
+
+/*
+ * Take a sample. Called by the machine-dependent timer interrupt code
+ * with the PC it interrupted and whether it interrupted user mode.
+ */
+void prof_sample(vaddr_t pc, bool user);
+
+/*
+ * Control, for the kernel menu.
+ *
+ * prof_start	Allocate the sample buffers (first time only), empty
+ *		them, and start sampling.
+ * prof_stop	Stop sampling.
+ * prof_dump	Stop sampling and write the histogram to the file PATH.
+ *		vfs_open is used on PATH, so it is destroyed.
+ */
+int prof_start(void);
+void prof_stop(void);
+int prof_dump(char *path);
+
+#endif /* _PROF_H_ */
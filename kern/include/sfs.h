@@ -58,6 +58,9 @@ struct sfs_vnode {
 	bool sv_dirty;                  /* true if sv_i modified */
 };
 
+struct sfs_scrub; /* Opaque; in sfs_scrub.c */
+struct sfs_jnl; /* Opaque; in sfs_jnl.c */
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -69,6 +72,12 @@ struct sfs_fs {
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_freemapdirtyblocks; /* which freemap blocks */
+	uint16_t *sfs_freecounts;       /* free blocks per freemap block */
+	unsigned sfs_freehint;          /* all freemap blocks before are full */
+	struct sfs_jnl *sfs_jnl;        /* metadata journal, if any */
+	struct sfs_scrub *sfs_scrub;    /* online scrub, if running */
+	unsigned sfs_ioops;             /* block I/O count, for the scrub */
 };
 
 /*
@@ -76,5 +85,20 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Online consistency scrub (kernel menu "scrub")
+ *
+ * sfs_scrub_start	Start a background check of the volume mounted
+ *			on DEVNAME. It can't be unmounted until the
+ *			check finishes or is stopped.
+ * sfs_scrub_stop	Stop the running check and wait for it.
+ * sfs_scrub_setrate	Limit the check to BLOCKSPERSEC reads a second.
+ * sfs_scrub_status	Print progress, or the last check's results.
+ */
+int sfs_scrub_start(const char *devname);
+void sfs_scrub_stop(void);
+void sfs_scrub_setrate(unsigned blockspersec);
+void sfs_scrub_status(void);
+
 
 #endif /* _SFS_H_ */
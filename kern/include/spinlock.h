@@ -36,6 +36,11 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+#include <lockstat.h>
+#endif
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -57,18 +62,32 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat splk_stat;	    /* Contention statistics. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * The _NAMED form also gives the lock a name for lock statistics.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER_NAMED(name) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, LOCKSTAT_INITIALIZER(name) }
+#else
+#define SPINLOCK_INITIALIZER_NAMED(name) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
+#define SPINLOCK_INITIALIZER	SPINLOCK_INITIALIZER_NAMED(NULL)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
  * cleanup	Opposite of init. Lock must be unlocked.
+ * setname	Name the lock so it shows up in lock statistics. The
+ *		string is not copied. Does nothing without "options
+ *		lockstat".
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
  * release	Release the lock. May re-enable interrupts.
@@ -78,6 +97,7 @@ struct spinlock {
 
 void spinlock_init(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
+void spinlock_setname(struct spinlock *lk, const char *name);
 
 void spinlock_acquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
@@ -79,6 +79,9 @@ struct lock {
         struct spinlock lk_splock;
         volatile bool lk_locked;
         struct thread *lk_holder;
+#if OPT_LOCKSTAT
+        struct lockstat lk_stat;
+#endif
         // add what you need here
         // (don't forget to mark things volatile as needed)
 };
@@ -152,12 +155,43 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Readers are counted per CPU, each count in its own cache line with
+ * its own spinlock, so readers on different CPUs don't touch any
+ * shared memory that's being written, as long as no writer is
+ * around. The count for a CPU is the number of read acquires done
+ * there minus the number of read releases; since a reader can sleep
+ * and move to another CPU, one CPU's count can go negative, and only
+ * the sum means anything. There is a count for each CPU present
+ * when the lock is made (MAXCPUS if that's before the CPUs have been
+ * counted).
+ *
+ * Writers are preferred: as soon as a writer wants the lock
+ * (rw_writerwait), new readers queue up behind it, and the lock is
+ * only handed back to readers when no writer is waiting. So a steady
+ * stream of writers can hold off readers; this is meant for data
+ * that's read far more often than it's written.
+ *
+ * rw_lock protects the fields above it and serializes writers; the
+ * wait channels go with it.
  */
 
+struct rwlock_cpu;
+
 struct rwlock {
         char *rwlock_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        struct wchan *rw_readwchan;     /* readers waiting for writers */
+        struct wchan *rw_writewchan;    /* writers waiting for a writer */
+        struct wchan *rw_drainwchan;    /* writer waiting for readers */
+        struct thread *rw_writer;       /* thread holding it for write */
+        unsigned rw_writerswaiting;     /* sleeping on rw_writewchan */
+        volatile bool rw_writerwait;    /* a writer holds or wants it */
+        struct spinlock rw_lock;
+        struct rwlock_cpu *rw_cpus;     /* per-cpu reader counts */
+        unsigned rw_ncpus;              /* entries in rw_cpus */
+#if OPT_LOCKSTAT
+        struct lockstat rw_stat;        /* write side only */
+#endif
 };
 
 struct rwlock * rwlock_create(const char *);
@@ -172,7 +206,12 @@ void rwlock_destroy(struct rwlock *);
  *                           hold the write lock at one time.
  *    rwlock_release_write - Free the write lock.
  *
- * These operations must be atomic. You get to write them.
+ * A thread must not ask for the write lock while it holds the same
+ * lock for reading; it will wait for itself forever.
+ *
+ * Unless the kernel is built with "noasserts", each thread keeps
+ * track of the locks it holds for reading, and releasing one it
+ * doesn't hold panics.
  */
 
 void rwlock_acquire_read(struct rwlock *);
@@ -52,6 +52,13 @@ void enter_forked_process(struct trapframe *tf);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Set up the futex wait queues (syscall/futex.c). */
+void futex_bootstrap(void);
+
+/* Wait and wake on the word at physical address KEY (ditto). */
+int futex_wait(paddr_t key, int val);
+int futex_wake(paddr_t key, int max, int *retval);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -60,7 +67,11 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 pid_t sys_getpid(struct proc *curprocess);
-void sys_exit(void);
+__DEAD void sys_exit(int exitcode);
+int sys_fork(struct trapframe *tf, bool vfork, pid_t *retval);
+int sys_execv(userptr_t progname, userptr_t args);
+int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys_sbrk(intptr_t amount, int *retval);
 
 /* File system related prototypes */
 int sys_open(struct fharray *pfhs, userptr_t path, int flags, int* retval);
@@ -69,7 +80,9 @@ int sys_read(int fd, const void *buf, size_t nbytes, int* retval);
 int sys_close(struct fharray *pfhs, int fd);
 int sys_lseek(int fd, off_t pos, int whence, off_t* retval);
 int sys_dup2(int oldfd, int newfd, int* retval);
+int sys_ioctl(int fd, int op, userptr_t data);
 int sys__getcwd(userptr_t buf, size_t nbytes, int* retval);
 int sys_chdir(const_userptr_t userpath);
+int sys_futex(userptr_t uaddr, int op, int val, int *retval);
 
 #endif /* _SYSCALL_H_ */
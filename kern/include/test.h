@@ -51,6 +51,7 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int bitmapbench(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -71,6 +72,8 @@ int rwtest2(int, char **);
 int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
+int rwbench(int, char **);
+int futextest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -117,7 +120,7 @@ int kmalloctest5(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
-int runprogram(char *progname);
+int runprogram(char *progname, unsigned nargs, char **args);
 
 /* Kernel menu system. */
 void menu(char *argstr);
@@ -39,8 +39,10 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-noasserts.h"
 
 struct cpu;
+struct rwlock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +58,9 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Read holds of rwlocks tracked per thread, for checking releases */
+#define THREAD_RWHELD 8
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -115,6 +120,17 @@ struct thread {
 	 * Public fields
 	 */
 
+#if !OPT_NOASSERTS
+	/*
+	 * rwlocks held for reading, so that releasing one this thread
+	 * doesn't hold can be caught. Holds beyond THREAD_RWHELD are
+	 * only counted, in t_rwuntracked.
+	 */
+	struct rwlock *t_rwheld[THREAD_RWHELD];
+	unsigned t_nrwheld;
+	unsigned t_rwuntracked;
+#endif
+
 	/* add more here as needed */
 };
 
@@ -57,6 +57,9 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_sync      - force all dirty buffers to disk
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
  *    vfs_getdevname - get mounted device name for the filesystem passed in
+ *
+ * vfs_getroot and vfs_getdevname must not be called while holding
+ * the VFS big lock (see vfslist.c).
  */
 
 int vfs_setcurdir(struct vnode *dir);
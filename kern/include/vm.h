@@ -51,6 +51,20 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Find the physical address behind a user address in the current
+ * address space, without faulting. Fails with EFAULT for addresses
+ * that aren't mapped writable.
+ */
+int vm_translate(vaddr_t vaddr, paddr_t *ret);
+
+/*
+ * Drop whatever the VM system has cached from files on FS (such as
+ * program text nobody is running), so that it can be unmounted.
+ */
+struct fs;
+void vm_purgetext(struct fs *fs);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
@@ -66,5 +80,13 @@ unsigned int coremap_used_bytes(void);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Called by ipi_tlbshootdown (with the target's IPI lock held) to try
+ * to fold a new request into one already queued. Returns true and
+ * updates INTO if one invalidation can cover both.
+ */
+bool vm_tlbshootdown_merge(struct tlbshootdown *into,
+			   const struct tlbshootdown *ts);
+
 
 #endif /* _VM_H_ */
@@ -52,6 +52,11 @@ struct vnode {
 	int vn_refcount;                /* Reference count */
 	struct spinlock vn_countlock;   /* Lock for vn_refcount */
 
+	/* Also under vn_countlock; see vnode_write and vnode_textref */
+	unsigned vn_textcount;          /* References as program text */
+	unsigned vn_writecount;         /* Writes/truncates in progress */
+	unsigned vn_writegen;           /* Bumped by every write/truncate */
+
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
 	void *vn_data;                  /* Filesystem-specific data */
@@ -231,14 +236,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -266,6 +271,20 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * A file that is running as program text can't be changed under the
+ * processes running it, which may not have read all of it in yet.
+ * VOP_WRITE and VOP_TRUNCATE go through vnode_write and vnode_truncate,
+ * which fail with ETXTBSY while the VM system holds a text reference
+ * (vnode_textref), and bump vn_writegen otherwise so that text cached
+ * from an earlier version of the file can be recognized as stale.
+ * vnode_textref in turn fails with ETXTBSY while a write is going on.
+ */
+int vnode_write(struct vnode *, struct uio *);
+int vnode_truncate(struct vnode *, off_t);
+int vnode_textref(struct vnode *);
+void vnode_textunref(struct vnode *);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -37,55 +37,236 @@
 #include <bitmap.h>
 
 /*
- * It would be a lot more efficient on most platforms to use uint32_t
- * or unsigned long as the base type for holding bits. But we don't,
- * because if one uses any data type more than a single byte wide,
- * bitmap data saved on disk becomes endian-dependent, which is a
- * severe nuisance.
+ * The bits are stored as an array of bytes, with bit N in bit N%8 of
+ * byte N/8, because if the layout depended on a data type more than
+ * a single byte wide, bitmap data saved on disk would become
+ * endian-dependent, which is a severe nuisance.
+ *
+ * The array is allocated in whole 32-bit words, though. Whether a
+ * word is all ones or all zeros doesn't depend on byte order, so
+ * searches can skip 32 bits at a time. Only the last step, finding
+ * the bit inside a word, looks at bytes.
+ *
+ * Bitmaps of SUMMARY_MINWORDS words or more also keep a summary,
+ * one bit per word, set when that word is full. The summary never
+ * goes to disk, so it uses native words, and one summary word lets
+ * a search skip 1024 allocated bits.
+ *
+ * bitmap_alloc is next-fit: it starts looking in the word where
+ * the last allocation was made, so a run of allocations doesn't
+ * rescan the full part of the map every time.
  */
-#define BITS_PER_WORD   (CHAR_BIT)
-#define WORD_TYPE       unsigned char
-#define WORD_ALLBITS    (0xff)
+#define BITS_PER_WORD   32
+#define WORD_TYPE       uint32_t
+#define WORD_ALLBITS    (0xffffffff)
+#define SUMMARY_MINWORDS 64
 
 struct bitmap {
         unsigned nbits;
+        unsigned nwords;
         WORD_TYPE *v;
+        WORD_TYPE *summary;     /* 1 = word full; NULL for small maps */
+        unsigned hint;          /* word where bitmap_alloc starts */
 };
 
+/*
+ * Position (0-7) of the lowest clear bit in a byte that has one.
+ * X+1 carries through the low ones and sets the lowest zero, so
+ * ~X & (X+1) is just that bit; then three masks give its position.
+ */
+static
+inline
+unsigned
+byte_lowzero(unsigned char x)
+{
+        unsigned bit = ~x & (x + 1) & 0xff;
+
+        KASSERT(bit != 0);
+        return ((bit & 0xf0) ? 4 : 0) |
+                ((bit & 0xcc) ? 2 : 0) |
+                ((bit & 0xaa) ? 1 : 0);
+}
+
+/*
+ * Same for a native word (only used for the summary).
+ */
+static
+inline
+unsigned
+word_lowzero(uint32_t x)
+{
+        uint32_t bit = ~x & (x + 1);
+
+        KASSERT(bit != 0);
+        return ((bit & 0xffff0000) ? 16 : 0) |
+                ((bit & 0xff00ff00) ? 8 : 0) |
+                ((bit & 0xf0f0f0f0) ? 4 : 0) |
+                ((bit & 0xcccccccc) ? 2 : 0) |
+                ((bit & 0xaaaaaaaa) ? 1 : 0);
+}
+
+/*
+ * Find the first bit at or after START and before END that is clear
+ * (WANTSET false) or set (WANTSET true). Returns END if there isn't
+ * one. Looking for a set bit is done by flipping each byte and
+ * looking for a clear one.
+ */
+static
+unsigned
+bitmap_find(const struct bitmap *b, unsigned start, unsigned end,
+            bool wantset)
+{
+        const unsigned char *bytes;
+        unsigned char flip = wantset ? 0xff : 0, x;
+        WORD_TYPE skip = wantset ? 0 : WORD_ALLBITS;
+        unsigned ix, endix, k, startbyte, pos;
+        WORD_TYPE sw;
+
+        if (start >= end) {
+                return end;
+        }
+        KASSERT(end <= b->nwords * BITS_PER_WORD);
+
+        /* First finish off the word START is in, a byte at a time. */
+        ix = start / BITS_PER_WORD;
+        bytes = (const unsigned char *)&b->v[ix];
+        startbyte = (start % BITS_PER_WORD) / CHAR_BIT;
+        for (k=startbyte; k<sizeof(WORD_TYPE); k++) {
+                x = bytes[k] ^ flip;
+                if (k == startbyte) {
+                        /* ignore the bits before START */
+                        x |= (1U << (start % CHAR_BIT)) - 1;
+                }
+                if (x != 0xff) {
+                        pos = ix*BITS_PER_WORD + k*CHAR_BIT + byte_lowzero(x);
+                        return pos < end ? pos : end;
+                }
+        }
+
+        /* Then skip whole words, using the summary if there is one. */
+        endix = DIVROUNDUP(end, BITS_PER_WORD);
+        for (ix++; ix < endix; ix++) {
+                if (!wantset && b->summary != NULL) {
+                        sw = b->summary[ix / BITS_PER_WORD] |
+                                (((WORD_TYPE)1 << (ix % BITS_PER_WORD)) - 1);
+                        if (sw == WORD_ALLBITS) {
+                                /* the rest of this summary word is full */
+                                ix = ROUNDUP(ix + 1, BITS_PER_WORD) - 1;
+                                continue;
+                        }
+                        ix = ix - ix % BITS_PER_WORD + word_lowzero(sw);
+                        if (ix >= endix) {
+                                break;
+                        }
+                }
+                if (b->v[ix] != skip) {
+                        break;
+                }
+        }
+        if (ix >= endix) {
+                return end;
+        }
+
+        /* Now find the bit in the word. */
+        bytes = (const unsigned char *)&b->v[ix];
+        for (k=0; k<sizeof(WORD_TYPE); k++) {
+                x = bytes[k] ^ flip;
+                if (x != 0xff) {
+                        pos = ix*BITS_PER_WORD + k*CHAR_BIT + byte_lowzero(x);
+                        return pos < end ? pos : end;
+                }
+        }
+        panic("bitmap: summary for word %u is wrong\n", ix);
+}
+
+/*
+ * Update the summary bit for word IX.
+ */
+static
+inline
+void
+bitmap_sumupdate(struct bitmap *b, unsigned ix)
+{
+        WORD_TYPE mask;
+
+        if (b->summary == NULL) {
+                return;
+        }
+        mask = (WORD_TYPE)1 << (ix % BITS_PER_WORD);
+        if (b->v[ix] == WORD_ALLBITS) {
+                b->summary[ix / BITS_PER_WORD] |= mask;
+        }
+        else {
+                b->summary[ix / BITS_PER_WORD] &= ~mask;
+        }
+}
+
+static
+inline
+void
+bitmap_translate(unsigned bitno, unsigned *ix, unsigned char *mask)
+{
+        *ix = bitno / CHAR_BIT;
+        *mask = 1U << (bitno % CHAR_BIT);
+}
+
+/*
+ * Set or clear a bit, with no checks.
+ */
+static
+inline
+void
+bitmap_set(struct bitmap *b, unsigned index, bool val)
+{
+        unsigned char *bytes = (unsigned char *)b->v;
+        unsigned ix;
+        unsigned char mask;
+
+        bitmap_translate(index, &ix, &mask);
+        if (val) {
+                bytes[ix] |= mask;
+        }
+        else {
+                bytes[ix] &= ~mask;
+        }
+        bitmap_sumupdate(b, index / BITS_PER_WORD);
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b;
-        unsigned words;
+        unsigned j;
 
-        words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
         }
-        b->v = kmalloc(words*sizeof(WORD_TYPE));
+        b->nbits = nbits;
+        b->nwords = DIVROUNDUP(nbits, BITS_PER_WORD);
+        b->v = kmalloc(b->nwords*sizeof(WORD_TYPE));
         if (b->v == NULL) {
                 kfree(b);
                 return NULL;
         }
-
-        bzero(b->v, words*sizeof(WORD_TYPE));
-        b->nbits = nbits;
+        bzero(b->v, b->nwords*sizeof(WORD_TYPE));
+        b->summary = NULL;
 
         /* Mark any leftover bits at the end in use */
-        if (words > nbits / BITS_PER_WORD) {
-                unsigned j, ix = words-1;
-                unsigned overbits = nbits - ix*BITS_PER_WORD;
-
-                KASSERT(nbits / BITS_PER_WORD == words-1);
-                KASSERT(overbits > 0 && overbits < BITS_PER_WORD);
+        for (j=nbits; j<b->nwords*BITS_PER_WORD; j++) {
+                bitmap_set(b, j, true);
+        }
 
-                for (j=overbits; j<BITS_PER_WORD; j++) {
-                        b->v[ix] |= ((WORD_TYPE)1 << j);
+        if (b->nwords >= SUMMARY_MINWORDS) {
+                b->summary = kmalloc(DIVROUNDUP(b->nwords, BITS_PER_WORD) *
+                                     sizeof(WORD_TYPE));
+                if (b->summary == NULL) {
+                        kfree(b->v);
+                        kfree(b);
+                        return NULL;
                 }
         }
-
+        bitmap_refresh(b);
         return b;
 }
 
@@ -95,82 +276,124 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+void
+bitmap_refresh(struct bitmap *b)
+{
+        unsigned ix, nsum;
+
+        if (b->summary != NULL) {
+                nsum = DIVROUNDUP(b->nwords, BITS_PER_WORD);
+                /* summary bits past the last word read as full */
+                for (ix=0; ix<nsum; ix++) {
+                        b->summary[ix] = WORD_ALLBITS;
+                }
+                for (ix=0; ix<b->nwords; ix++) {
+                        bitmap_sumupdate(b, ix);
+                }
+        }
+        b->hint = 0;
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
-
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        unsigned start = b->hint * BITS_PER_WORD;
+        unsigned pos;
+
+        pos = bitmap_find(b, start, b->nbits, false);
+        if (pos == b->nbits) {
+                pos = bitmap_find(b, 0, start, false);
+                if (pos == start) {
+                        return ENOSPC;
                 }
         }
-        return ENOSPC;
+        bitmap_set(b, pos, true);
+        b->hint = pos / BITS_PER_WORD;
+        *index = pos;
+        return 0;
 }
 
-static
-inline
-void
-bitmap_translate(unsigned bitno, unsigned *ix, WORD_TYPE *mask)
+int
+bitmap_alloc_near(struct bitmap *b, unsigned near, unsigned *index)
 {
-        unsigned offset;
-        *ix = bitno / BITS_PER_WORD;
-        offset = bitno % BITS_PER_WORD;
-        *mask = ((WORD_TYPE)1) << offset;
+        unsigned pos;
+
+        KASSERT(near < b->nbits);
+
+        pos = bitmap_find(b, near, b->nbits, false);
+        if (pos == b->nbits) {
+                pos = bitmap_find(b, 0, near, false);
+                if (pos == near) {
+                        return ENOSPC;
+                }
+        }
+        bitmap_set(b, pos, true);
+        *index = pos;
+        return 0;
+}
+
+int
+bitmap_alloc_range(struct bitmap *b, unsigned count, unsigned *index)
+{
+        unsigned start, end, i;
+
+        KASSERT(count > 0);
+
+        start = 0;
+        while (1) {
+                start = bitmap_find(b, start, b->nbits, false);
+                if (count > b->nbits - start) {
+                        return ENOSPC;
+                }
+                end = bitmap_find(b, start, start + count, true);
+                if (end == start + count) {
+                        break;
+                }
+                /* Too short; carry on after the bit that stopped it. */
+                start = end;
+        }
+
+        for (i=start; i<start+count; i++) {
+                bitmap_set(b, i, true);
+        }
+        *index = start;
+        return 0;
 }
 
 void
 bitmap_mark(struct bitmap *b, unsigned index)
 {
-        unsigned ix;
-        WORD_TYPE mask;
-
         KASSERT(index < b->nbits);
-        bitmap_translate(index, &ix, &mask);
-
-        KASSERT((b->v[ix] & mask)==0);
-        b->v[ix] |= mask;
+        KASSERT(!bitmap_isset(b, index));
+        bitmap_set(b, index, true);
 }
 
 void
 bitmap_unmark(struct bitmap *b, unsigned index)
 {
-        unsigned ix;
-        WORD_TYPE mask;
-
         KASSERT(index < b->nbits);
-        bitmap_translate(index, &ix, &mask);
-
-        KASSERT((b->v[ix] & mask)!=0);
-        b->v[ix] &= ~mask;
+        KASSERT(bitmap_isset(b, index));
+        bitmap_set(b, index, false);
 }
 
 
 int
 bitmap_isset(struct bitmap *b, unsigned index)
 {
+        const unsigned char *bytes = (const unsigned char *)b->v;
         unsigned ix;
-        WORD_TYPE mask;
+        unsigned char mask;
 
         bitmap_translate(index, &ix, &mask);
-        return (b->v[ix] & mask);
+        return (bytes[ix] & mask);
 }
 
 void
 bitmap_destroy(struct bitmap *b)
 {
+        if (b->summary != NULL) {
+                kfree(b->summary);
+        }
         kfree(b->v);
         kfree(b);
 }
@@ -29,6 +29,7 @@
 
 
 #include <types.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 
 /*
@@ -48,14 +49,16 @@ backsp(void)
 /*
  * Read a string off the console. Support a few of the more useful
  * common control characters. Do not include the terminating newline
- * in the buffer passed back.
+ * in the buffer passed back. We do our own echo and editing, so the
+ * console's has to be off meanwhile.
  */
 void
 kgets(char *buf, size_t maxlen)
 {
 	size_t pos = 0;
-	int ch;
+	int ch, mode;
 
+	mode = getch_setmode(CON_RAW);
 	while (1) {
 		ch = getch();
 		if (ch=='\n' || ch=='\r') {
@@ -110,4 +113,5 @@ kgets(char *buf, size_t maxlen)
 	}
 
 	buf[pos] = 0;
+	getch_setmode(mode);
 }
@@ -39,13 +39,25 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <emufs.h>
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
+#include <ktrace.h>
+#include <prof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
 #include "opt-automationtest.h"
+#include "opt-lockstat.h"
+#include "opt-dumbvm.h"
+
+#if OPT_LOCKSTAT
+#include <lockstat.h>
+#endif
+#if OPT_DUMBVM
+#include <addrspace.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -63,10 +75,6 @@
  * Function for a thread that runs an arbitrary userlevel program by
  * name.
  *
- * Note: this cannot pass arguments to the program. You may wish to
- * change it so it can, because that will make testing much easier
- * in the future.
- *
  * It copies the program name because runprogram destroys the copy
  * it gets by passing it to vfs_open().
  */
@@ -80,16 +88,12 @@ cmd_progthread(void *ptr, unsigned long nargs)
 
 	KASSERT(nargs >= 1);
 
-	if (nargs > 2) {
-		kprintf("Warning: argument passing from menu not supported\n");
-	}
-
 	/* Hope we fit. */
 	KASSERT(strlen(args[0]) < sizeof(progname));
 
 	strcpy(progname, args[0]);
 
-	result = runprogram(progname);
+	result = runprogram(progname, nargs, args);
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
 			strerror(result));
@@ -424,6 +428,152 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_LOCKSTAT
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_print();
+
+	return 0;
+}
+
+static
+int
+cmd_lockstatreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_reset();
+
+	return 0;
+}
+#endif
+
+#if OPT_DUMBVM
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		dumbvm_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		dumbvm_resetstats();
+	}
+	else {
+		kprintf("Usage: tlb [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_emustats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		emufs_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		emufs_resetstats();
+	}
+	else {
+		kprintf("Usage: emu [reset]\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Command for kernel event tracing.
+ */
+static
+int
+cmd_ktrace(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return ktrace_start();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		ktrace_stop();
+		return 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "dump")) {
+		return ktrace_dump(args[2]);
+	}
+	else if (nargs == 3 && !strcmp(args[1], "stream")) {
+		return ktrace_stream(args[2]);
+	}
+
+	kprintf("Usage: ktrace on | off | dump file | stream file\n");
+	return EINVAL;
+}
+
+#if OPT_SFS
+/*
+ * Command for the online SFS scrub.
+ */
+static
+int
+cmd_scrub(int nargs, char **args)
+{
+	char *device;
+
+	if (nargs == 1) {
+		sfs_scrub_status();
+		return 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "start")) {
+		device = args[2];
+
+		/* Allow (but do not require) colon after device name */
+		if (device[strlen(device)-1]==':') {
+			device[strlen(device)-1] = 0;
+		}
+		return sfs_scrub_start(device);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "stop")) {
+		sfs_scrub_stop();
+		return 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "rate")) {
+		sfs_scrub_setrate(atoi(args[2]));
+		return 0;
+	}
+
+	kprintf("Usage: scrub [start device: | stop | rate blocks/sec]\n");
+	return EINVAL;
+}
+#endif
+
+/*
+ * Command for the sampling profiler.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "start")) {
+		return prof_start();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "stop")) {
+		prof_stop();
+		return 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "dump")) {
+		return prof_dump(args[2]);
+	}
+
+	kprintf("Usage: prof start | stop | dump file\n");
+	return EINVAL;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -463,6 +613,11 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[ktrace]  Kernel event tracing      ",
+	"[prof]    Sampling profiler         ",
+#if OPT_SFS
+	"[scrub]   Online SFS check          ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -483,6 +638,7 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[btb] Bitmap benchmark              ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -504,11 +660,13 @@ static const char *testmenu[] = {
 	"[cvt3] CV test 3             (1*)   ",
 	"[cvt4] CV test 4             (1*)   ",
 	"[cvt5] CV test 5             (1)    ",
-	"[rwt1] RW lock test          (1?)   ",
-	"[rwt2] RW lock test 2        (1?)   ",
-	"[rwt3] RW lock test 3        (1?)   ",
-	"[rwt4] RW lock test 4        (1?)   ",
-	"[rwt5] RW lock test 5        (1?)   ",
+	"[rwt1] RW lock test          (1)    ",
+	"[rwt2] RW lock test 2        (1)    ",
+	"[rwt3] RW lock test 3        (1*)   ",
+	"[rwt4] RW lock test 4        (1*)   ",
+	"[rwt5] RW lock test 5        (1*)   ",
+	"[rwb]  RW lock benchmark            ",
+	"[fxt1] Futex handoff test          ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
@@ -571,6 +729,14 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_LOCKSTAT
+	"[lks] Lock statistics               ",
+	"[lksr] Reset lock statistics        ",
+#endif
+#if OPT_DUMBVM
+	"[tlb] TLB statistics                ",
+#endif
+	"[emu] emufs cache statistics        ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -614,6 +780,11 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "ktrace",	cmd_ktrace },
+	{ "prof",	cmd_prof },
+#if OPT_SFS
+	{ "scrub",	cmd_scrub },
+#endif
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -624,11 +795,20 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_LOCKSTAT
+	{ "lks",        cmd_lockstats },
+	{ "lksr",       cmd_lockstatreset },
+#endif
+#if OPT_DUMBVM
+	{ "tlb",        cmd_tlbstats },
+#endif
+	{ "emu",        cmd_emustats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "btb",	bitmapbench },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
@@ -657,6 +837,8 @@ static struct {
 	{ "rwt3",	rwtest3 },
 	{ "rwt4",	rwtest4 },
 	{ "rwt5",	rwtest5 },
+	{ "rwb",	rwbench },
+	{ "fxt1",	futextest },
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
@@ -52,7 +52,12 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <thread.h>
+#include <kern/errno.h>
 #include <kern/unistd.h>
+#include <limits.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -60,50 +65,124 @@
 struct proc *kproc;
 
 /*
- * The master array of all processes
+ * Pid management.
+ *
+ * Free pids are tracked in a bitmap with one bit per pid. Allocation
+ * starts from a rotor just past the last pid handed out, so a pid is
+ * not reused until the rest of the pid space has been cycled through,
+ * and since pids are handed out in order the search normally stops at
+ * the first bit it looks at.
+ *
+ * Live processes are found by pid through a small chained hash table.
+ * The pid of a process stays allocated, and the process stays in the
+ * hash, until its proc structure is destroyed; for a process with a
+ * parent that is when the parent has collected its exit status (or
+ * has itself exited), so the pid cannot be recycled out from under a
+ * waitpid.
+ *
+ * All of this is protected by pidlock. Nothing that can sleep is done
+ * while holding it.
  */
- DECLARRAY(proc,static __UNUSED inline);
- DEFARRAY(proc,static __UNUSED inline);
- static struct procarray allprocs;
- static volatile unsigned numprocs;
- static volatile unsigned next_pid;
+static struct spinlock pidlock;
+static struct bitmap *pidmap;
+static pid_t pid_next;
+static unsigned numpids;
+static struct proc *pidhash[PIDHASH_SIZE];
 
-/* spinlocks used to protect numprocs and allprocs */
- static struct spinlock sp_numprocs;
- static struct spinlock sp_allprocs; // protect allprocs and next_pid
+#define PIDHASH(pid) ((unsigned)(pid) & (PIDHASH_SIZE - 1))
 
 /*
- * Create a proc structure.
+ * Allocate a pid for PROC and enter it in the hash.
+ */
+static
+int
+pid_alloc(struct proc *proc)
+{
+	unsigned pid;
+	unsigned bucket;
+	int result;
+
+	spinlock_acquire(&pidlock);
+	if (numpids >= PID_MAX - PID_MIN + 1) {
+		spinlock_release(&pidlock);
+		return ENPROC;
+	}
+	/* The pids below PID_MIN are marked, so this wraps to PID_MIN. */
+	result = bitmap_alloc_near(pidmap, pid_next, &pid);
+	KASSERT(result == 0);
+	numpids++;
+	pid_next = (pid == PID_MAX) ? PID_MIN : pid + 1;
+
+	proc->p_pid = pid;
+	bucket = PIDHASH(pid);
+	proc->p_hashnext = pidhash[bucket];
+	pidhash[bucket] = proc;
+	spinlock_release(&pidlock);
+	return 0;
+}
+
+/*
+ * Take PROC out of the hash and release its pid.
+ */
+static
+void
+pid_free(struct proc *proc)
+{
+	struct proc **pp;
+
+	spinlock_acquire(&pidlock);
+	for (pp = &pidhash[PIDHASH(proc->p_pid)]; *pp != proc;
+	     pp = &(*pp)->p_hashnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = proc->p_hashnext;
+	proc->p_hashnext = NULL;
+	bitmap_unmark(pidmap, proc->p_pid);
+	KASSERT(numpids > 0);
+	numpids--;
+	spinlock_release(&pidlock);
+}
+
+/*
+ * Find a process by pid. Call with pidlock held.
  */
 static
 struct proc *
-proc_create(const char *name)
+pid_lookup(pid_t pid)
 {
-	spinlock_acquire(&sp_numprocs);
-	if(numprocs >= MAX_PID){
-		spinlock_release(&sp_numprocs);
-		return NULL;
-	}else{
-		numprocs++;
+	struct proc *proc;
+
+	KASSERT(spinlock_do_i_hold(&pidlock));
+	for (proc = pidhash[PIDHASH(pid)]; proc != NULL;
+	     proc = proc->p_hashnext) {
+		if (proc->p_pid == pid) {
+			return proc;
+		}
 	}
-	spinlock_release(&sp_numprocs);
+	return NULL;
+}
 
+/*
+ * Create a proc structure.
+ *
+ * Every process except the kernel process gets a pid, is entered in
+ * the pid hash, and gets the lock and CV its children use to report
+ * their exit. The caller fills in the file table.
+ */
+static
+struct proc *
+proc_create(const char *name)
+{
 	struct proc *proc;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
-		spinlock_acquire(&sp_numprocs);
-		numprocs--;
-		spinlock_release(&sp_numprocs);
 		return NULL;
 	}
 
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
 		kfree(proc);
-		spinlock_acquire(&sp_numprocs);
-		numprocs--;
-		spinlock_release(&sp_numprocs);
 		return NULL;
 	}
 
@@ -115,63 +194,62 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	fharray_init(&proc->p_fhs);
 
-	/* parent process is NULL by default. Assign the parent inside fork */
+	/* parent process is NULL by default. proc_create_fork sets it */
+	proc->p_pid = KERNEL_PID;
+	proc->p_hashnext = NULL;
 	proc->p_parent = NULL;
+	proc->p_waitlock = NULL;
+	proc->p_waitcv = NULL;
+	proc->p_children = NULL;
+	proc->p_sibprev = NULL;
+	proc->p_sibnext = NULL;
+	proc->p_vfork = false;
+	proc->p_exited = false;
+	proc->p_exitstatus = 0;
+	proc->p_gone = false;
+	proc->p_released = false;
 
 	DEBUG(DB_VFS, "Bootstrapping for process : %s\n", proc->p_name);
 
-	/* The kernel process has a pid of 0 and add it to allprocs array */
-	if(strcmp(name,KERNELPROC) == 0){
-		KASSERT(numprocs == 1);
-		proc->p_pid = KERNEL_PID;
-		procarray_add(&allprocs,proc,(unsigned int *)&proc->p_pid); // does not need to be protected since no other process exists yet?
-		KASSERT(proc->p_pid == KERNEL_PID);
-	}else{
-	/* Otherwise, assign the pid from the available pids */
-	/* bootstrap the console file handles */
-
-	/* In main.c the kernel process is bootstrapped before the vfs is bootstrapped,
-		this means that we can't create file handles using _fh_create. Soln => Kernel process
-		does not need these syscalls? */
-		int ret = _fh_bootstrap(&proc->p_fhs);
-		if(ret != 0){
-			kfree(proc);
-			spinlock_acquire(&sp_numprocs);
-			numprocs--;
-			spinlock_release(&sp_numprocs);
-			return NULL;
-		}
-		
-		if(fharray_get(&proc->p_fhs,0) == NULL || 
-		fharray_get(&proc->p_fhs,1) == NULL || 
-		fharray_get(&proc->p_fhs,2) == NULL ){
-			
-			kfree(proc);
-			spinlock_acquire(&sp_numprocs);
-			numprocs--;
-			spinlock_release(&sp_numprocs);
-			return NULL;
-		}
-
-		spinlock_acquire(&sp_allprocs);
-
-		pid_t newpid = proc_assignpid(proc);
-		proc->p_pid = newpid;
-		procarray_set(&allprocs,newpid,proc);
-		KASSERT(procarray_get(&allprocs,newpid) == proc);
-		
-		spinlock_release(&sp_allprocs);
+	/* The kernel process has a pid of 0 and is not in the pid hash */
+	if (strcmp(name, KERNELPROC) == 0) {
+		return proc;
 	}
 
+	proc->p_waitlock = lock_create(name);
+	if (proc->p_waitlock == NULL) {
+		goto fail;
+	}
+	proc->p_waitcv = cv_create(name);
+	if (proc->p_waitcv == NULL) {
+		goto fail;
+	}
+	if (pid_alloc(proc)) {
+		goto fail;
+	}
 	return proc;
+
+ fail:
+	if (proc->p_waitcv != NULL) {
+		cv_destroy(proc->p_waitcv);
+	}
+	if (proc->p_waitlock != NULL) {
+		lock_destroy(proc->p_waitlock);
+	}
+	fharray_cleanup(&proc->p_fhs);
+	spinlock_cleanup(&proc->p_lock);
+	kfree(proc->p_name);
+	kfree(proc);
+	return NULL;
 }
 
 /*
  * Destroy a proc structure.
  *
- * Note: nothing currently calls this. Your wait/exit code will
- * probably want to do so.
+ * For processes that ran, this is called from the exit/wait code
+ * (see proc_release) once nothing refers to the proc any more.
  */
 void
 proc_destroy(struct proc *proc)
@@ -250,14 +328,10 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc->p_numthreads == 0);
 	spinlock_cleanup(&proc->p_lock);
 
-	//TODO: decrement the number of processes and remove from allprocs
-	spinlock_acquire(&sp_allprocs);
-	procarray_set(&allprocs,proc->p_pid,NULL);
-	spinlock_acquire(&sp_allprocs);
-
-	spinlock_acquire(&sp_numprocs);
-	numprocs--;
-	spinlock_release(&sp_numprocs);
+	KASSERT(proc->p_children == NULL);
+	pid_free(proc);
+	cv_destroy(proc->p_waitcv);
+	lock_destroy(proc->p_waitlock);
 
 	/* All elements inside p_fhs need to be deallocated */
 	int idx = 0;
@@ -273,22 +347,28 @@ proc_destroy(struct proc *proc)
 }
 
 /*
- * Create the process structure for the kernel. Initialize the master process array, allprocs
+ * Set up the pid table, then create the process structure for the
+ * kernel.
  */
 void
 proc_bootstrap(void)
 {
+	spinlock_init(&pidlock);
+	spinlock_setname(&pidlock, "pids");
+	pidmap = bitmap_create(PID_MAX + 1);
+	if (pidmap == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+	/* pids below PID_MIN are never handed out */
+	for (pid_next = 0; pid_next < PID_MIN; pid_next++) {
+		bitmap_mark(pidmap, pid_next);
+	}
+	numpids = 0;
+
 	kproc = proc_create(KERNELPROC);
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
-
-	procarray_init(&allprocs);
-	procarray_setsize(&allprocs,MAX_PID);
-	spinlock_init(&sp_numprocs);
-	spinlock_init(&sp_allprocs);
-	numprocs = 1;
-	next_pid = 1;
 }
 
 /*
@@ -307,6 +387,15 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
+	/* bootstrap the console file handles */
+	if (_fh_bootstrap(&newproc->p_fhs) != 0 ||
+	    fharray_get(&newproc->p_fhs, 0) == NULL ||
+	    fharray_get(&newproc->p_fhs, 1) == NULL ||
+	    fharray_get(&newproc->p_fhs, 2) == NULL) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
 	/* VM fields */
 
 	newproc->p_addrspace = NULL;
@@ -427,41 +516,308 @@ proc_setas(struct addrspace *newas)
 }
 
 /*
- * Assign an available pid to the process passed as argument
- * Since the pid assigned is incremented for the next process,
- * it is possible that we may reach the end of the pid_t type.
- * In such a case, reset to 0 and assign the smallest unassigned number.
+ * Create a child of the current process for fork. The child shares
+ * the parent's open files and current directory and gets a copy of
+ * its address space; it is on the parent's list of children when
+ * this returns. If the child never gets to run, undo this with
+ * proc_unfork.
+ *
+ * For vfork the child borrows the parent's address space instead of
+ * copying it, until it calls execv or _exit. The parent must not
+ * return to user mode before then; see proc_vforkwait.
  */
-pid_t // TODO: test this function
-proc_assignpid(struct proc *newproc){
-	// use the value of next_pid, if overflow then set to 0 for the next process.
-	KASSERT(newproc != NULL);
-	
-	// make sure that the number of processes is less than MAX_PID 
-	KASSERT(numprocs < MAX_PID);
-
-	pid_t ret = 0;
-	for(ret = 1;ret < MAX_PID; ret++){
-		if(procarray_get(&allprocs,ret) == NULL){
-			break;
+int
+proc_create_fork(const char *name, bool vfork, struct proc **ret)
+{
+	struct proc *parent = curproc;
+	struct proc *newproc;
+	int result;
+
+	newproc = proc_create(name);
+	if (newproc == NULL) {
+		return ENPROC;
+	}
+
+	result = _fh_copy(&newproc->p_fhs, &parent->p_fhs);
+	if (result) {
+		proc_destroy(newproc);
+		return result;
+	}
+
+	if (vfork) {
+		newproc->p_addrspace = proc_getas();
+		newproc->p_vfork = true;
+	}
+	else {
+		result = as_copy(proc_getas(), &newproc->p_addrspace);
+		if (result) {
+			proc_destroy(newproc);
+			return result;
 		}
 	}
 
-	/* proc_create will call this function only when numprocs < MAX_PID */
-	KASSERT(ret != MAX_PID);
-	KASSERT(procarray_get(&allprocs,ret) == NULL);
+	spinlock_acquire(&parent->p_lock);
+	if (parent->p_cwd != NULL) {
+		VOP_INCREF(parent->p_cwd);
+		newproc->p_cwd = parent->p_cwd;
+	}
+	spinlock_release(&parent->p_lock);
 
-	return ret;
+	newproc->p_parent = parent;
+	lock_acquire(parent->p_waitlock);
+	newproc->p_sibnext = parent->p_children;
+	if (parent->p_children != NULL) {
+		parent->p_children->p_sibprev = newproc;
+	}
+	parent->p_children = newproc;
+	lock_release(parent->p_waitlock);
+
+	*ret = newproc;
+	return 0;
 }
 
 /*
- * Return the process with process id ppid
+ * Take CHILD off its parent's list of children. Call with the
+ * parent's p_waitlock held.
  */
-struct proc*
-get_process(pid_t ppid){
-	if(ppid < 0 || ppid >= MAX_PID){
-		return NULL;
+static
+void
+proc_unlink(struct proc *child)
+{
+	struct proc *parent = child->p_parent;
+
+	KASSERT(lock_do_i_hold(parent->p_waitlock));
+
+	if (child->p_sibprev != NULL) {
+		child->p_sibprev->p_sibnext = child->p_sibnext;
 	}
+	else {
+		KASSERT(parent->p_children == child);
+		parent->p_children = child->p_sibnext;
+	}
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibprev = child->p_sibprev;
+	}
+	child->p_sibprev = NULL;
+	child->p_sibnext = NULL;
+}
+
+/*
+ * Undo proc_create_fork after thread_fork failed.
+ */
+void
+proc_unfork(struct proc *child)
+{
+	struct proc *parent = child->p_parent;
 
-	return procarray_get(&allprocs,ppid);
+	KASSERT(parent == curproc);
+
+	lock_acquire(parent->p_waitlock);
+	proc_unlink(child);
+	lock_release(parent->p_waitlock);
+	if (child->p_vfork) {
+		/* not ours to destroy */
+		child->p_addrspace = NULL;
+	}
+	proc_destroy(child);
+}
+
+/*
+ * Wait for a vfork child to be done with our address space.
+ *
+ * The child can't go away meanwhile: it won't be destroyed until we
+ * reap it.
+ */
+void
+proc_vforkwait(struct proc *child)
+{
+	struct proc *parent = child->p_parent;
+
+	KASSERT(parent == curproc);
+
+	lock_acquire(parent->p_waitlock);
+	while (child->p_vfork) {
+		cv_wait(parent->p_waitcv, parent->p_waitlock);
+	}
+	lock_release(parent->p_waitlock);
+}
+
+/*
+ * Give the borrowed address space back to the parent of a vfork
+ * child. The caller has already switched away from it.
+ */
+void
+proc_vforkdone(struct proc *proc)
+{
+	struct proc *parent = proc->p_parent;
+
+	KASSERT(proc->p_vfork);
+	KASSERT(proc->p_addrspace != proc->p_parent->p_addrspace);
+
+	lock_acquire(parent->p_waitlock);
+	proc->p_vfork = false;
+	cv_broadcast(parent->p_waitcv, parent->p_waitlock);
+	lock_release(parent->p_waitlock);
+}
+
+/*
+ * Note that nobody will wait for PROC any more, and destroy it if
+ * it has also exited and has no children left pointing at it.
+ *
+ * A proc structure can go away once three things have happened: it
+ * has exited (p_gone), its parent has collected it or gone away
+ * itself (p_released), and every one of its own children has been
+ * unlinked from it. Each of these is recorded under the proc's own
+ * p_waitlock, and whoever records the last one destroys it.
+ */
+static
+void
+proc_release(struct proc *proc)
+{
+	bool dead;
+
+	lock_acquire(proc->p_waitlock);
+	KASSERT(!proc->p_released);
+	proc->p_released = true;
+	dead = proc->p_gone && proc->p_children == NULL;
+	lock_release(proc->p_waitlock);
+
+	if (dead) {
+		proc_destroy(proc);
+	}
+}
+
+/*
+ * Look up the child of PARENT with pid PID. Fails with ESRCH if
+ * there is no such process and ECHILD if it isn't PARENT's child.
+ *
+ * Holding the parent's p_waitlock keeps the child from being
+ * destroyed after we return it, since only the parent can reap it
+ * while the parent hasn't exited.
+ */
+int
+proc_findchild(struct proc *parent, pid_t pid, struct proc **ret)
+{
+	struct proc *proc;
+	int result;
+
+	KASSERT(lock_do_i_hold(parent->p_waitlock));
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return ESRCH;
+	}
+
+	spinlock_acquire(&pidlock);
+	proc = pid_lookup(pid);
+	if (proc == NULL) {
+		result = ESRCH;
+	}
+	else if (proc->p_parent != parent) {
+		result = ECHILD;
+	}
+	else {
+		*ret = proc;
+		result = 0;
+	}
+	spinlock_release(&pidlock);
+	return result;
+}
+
+/*
+ * Collect an exited child. Call with the parent's p_waitlock held.
+ */
+void
+proc_reap(struct proc *child)
+{
+	KASSERT(child->p_exited);
+
+	proc_unlink(child);
+	proc_release(child);
+}
+
+/*
+ * Exit the current process with (already encoded) status EXITSTATUS.
+ *
+ * The address space, open files, and current directory are dropped
+ * right away; what's left of the proc structure only carries the
+ * exit status until the parent collects it. Exited children are
+ * reaped now; children still running will clean up after themselves
+ * when they exit, since there is no longer anyone to wait for them.
+ * Finally we tell our parent, waking it up if it's in waitpid.
+ *
+ * The thread is detached from the process before any of the
+ * parent/child bookkeeping, because as soon as the parent is told
+ * we've exited it may destroy the proc structure.
+ */
+void
+proc_exit(int exitstatus)
+{
+	struct proc *proc = curproc;
+	struct proc *parent = proc->p_parent;
+	struct proc *child, *next;
+	struct addrspace *as;
+	bool orphan, parentdead;
+	int idx;
+
+	KASSERT(proc != kproc);
+
+	as = proc_setas(NULL);
+	as_deactivate();
+	if (proc->p_vfork) {
+		proc_vforkdone(proc);
+	}
+	else if (as != NULL) {
+		as_destroy(as);
+	}
+
+	for (idx = 0; idx < (int)fharray_num(&proc->p_fhs); idx++) {
+		_fhs_close(idx, &proc->p_fhs);
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_cwd != NULL) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
+	spinlock_release(&proc->p_lock);
+
+	proc_remthread(curthread);
+
+	lock_acquire(proc->p_waitlock);
+	proc->p_gone = true;
+	for (child = proc->p_children; child != NULL; child = next) {
+		next = child->p_sibnext;
+		if (child->p_exited) {
+			proc_reap(child);
+		}
+	}
+	lock_release(proc->p_waitlock);
+
+	if (parent == NULL) {
+		/* Nobody to wait for us */
+		proc_release(proc);
+		thread_exit();
+	}
+
+	lock_acquire(parent->p_waitlock);
+	proc->p_exitstatus = exitstatus;
+	proc->p_exited = true;
+	orphan = parent->p_gone;
+	parentdead = false;
+	if (orphan) {
+		proc_unlink(proc);
+		parentdead = parent->p_released && parent->p_children == NULL;
+	}
+	else {
+		cv_broadcast(parent->p_waitcv, parent->p_waitlock);
+	}
+	lock_release(parent->p_waitlock);
+
+	if (orphan) {
+		proc_release(proc);
+	}
+	if (parentdead) {
+		proc_destroy(parent);
+	}
+	thread_exit();
 }
@@ -0,0 +1,197 @@
+/*
+ * Packed argument vectors for execv and runprogram. See argbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <argbuf.h>
+
+/* Number of pointer-sized slots the whole buffer can hold. */
+#define ARGBUF_MAXSLOTS (ARG_MAX / sizeof(vaddr_t))
+
+/*
+ * Return the argv slots, which live at the end of the buffer. There
+ * are argc+1 of them, the last being the terminating NULL.
+ */
+static
+vaddr_t *
+argbuf_slots(struct argbuf *ab, unsigned argc)
+{
+	return (vaddr_t *)(ab->ab_buf + ARG_MAX) - (argc + 1);
+}
+
+int
+argbuf_init(struct argbuf *ab)
+{
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
+	}
+	ab->ab_strbytes = 0;
+	ab->ab_argc = 0;
+	return 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	ab->ab_buf = NULL;
+}
+
+/*
+ * Fetch the user's argv array. We don't know how long it is, so
+ * read it in a page at a time (the first pointer on a page being
+ * readable means the rest of the page is too) and stop at the NULL.
+ * The array is collected at the front of the buffer and then moved
+ * to the end where it belongs.
+ */
+static
+int
+argbuf_getvec(struct argbuf *ab, userptr_t uargv, unsigned *argcret)
+{
+	vaddr_t *vec = (vaddr_t *)ab->ab_buf;
+	vaddr_t uaddr = (vaddr_t)uargv;
+	unsigned n, i, nslots;
+	int result;
+
+	n = 0;
+	while (1) {
+		if (n == ARGBUF_MAXSLOTS) {
+			return E2BIG;
+		}
+		nslots = (PAGE_SIZE - uaddr % PAGE_SIZE) / sizeof(vaddr_t);
+		if (nslots == 0) {
+			/* misaligned pointer straddling a page boundary */
+			nslots = 1;
+		}
+		if (nslots > ARGBUF_MAXSLOTS - n) {
+			nslots = ARGBUF_MAXSLOTS - n;
+		}
+		result = copyin((const_userptr_t)uaddr, &vec[n],
+				nslots * sizeof(vaddr_t));
+		if (result) {
+			return result;
+		}
+		for (i = n; i < n + nslots; i++) {
+			if (vec[i] == 0) {
+				memmove(argbuf_slots(ab, i), vec,
+					(i + 1) * sizeof(vaddr_t));
+				*argcret = i;
+				return 0;
+			}
+		}
+		n += nslots;
+		uaddr += nslots * sizeof(vaddr_t);
+	}
+}
+
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv)
+{
+	vaddr_t *slots;
+	size_t space, pos, len;
+	unsigned argc, i;
+	int result;
+
+	result = argbuf_getvec(ab, uargv, &argc);
+	if (result) {
+		return result;
+	}
+	slots = argbuf_slots(ab, argc);
+
+	/*
+	 * Copy each string straight into place behind the previous
+	 * one, replacing its user pointer with its offset.
+	 */
+	space = ARG_MAX - (argc + 1) * sizeof(vaddr_t);
+	pos = 0;
+	for (i = 0; i < argc; i++) {
+		if (pos == space) {
+			return E2BIG;
+		}
+		result = copyinstr((const_userptr_t)slots[i], ab->ab_buf + pos,
+				   space - pos, &len);
+		if (result == ENAMETOOLONG) {
+			return E2BIG;
+		}
+		if (result) {
+			return result;
+		}
+		slots[i] = pos;
+		pos += len;
+	}
+
+	ab->ab_strbytes = pos;
+	ab->ab_argc = argc;
+	return 0;
+}
+
+int
+argbuf_fromkernel(struct argbuf *ab, unsigned nargs, char **args)
+{
+	vaddr_t *slots;
+	size_t space, pos, len;
+	unsigned i;
+
+	if (nargs >= ARGBUF_MAXSLOTS) {
+		return E2BIG;
+	}
+	slots = argbuf_slots(ab, nargs);
+
+	space = ARG_MAX - (nargs + 1) * sizeof(vaddr_t);
+	pos = 0;
+	for (i = 0; i < nargs; i++) {
+		len = strlen(args[i]) + 1;
+		if (len > space - pos) {
+			return E2BIG;
+		}
+		memcpy(ab->ab_buf + pos, args[i], len);
+		slots[i] = pos;
+		pos += len;
+	}
+	slots[nargs] = 0;
+
+	ab->ab_strbytes = pos;
+	ab->ab_argc = nargs;
+	return 0;
+}
+
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *uargv)
+{
+	vaddr_t *slots;
+	vaddr_t sp, strbase;
+	unsigned i;
+	int result;
+
+	slots = argbuf_slots(ab, ab->ab_argc);
+
+	sp = *stackptr - ROUNDUP(ab->ab_strbytes, sizeof(vaddr_t));
+	strbase = sp;
+	result = copyout(ab->ab_buf, (userptr_t)sp, ab->ab_strbytes);
+	if (result) {
+		return result;
+	}
+
+	for (i = 0; i < ab->ab_argc; i++) {
+		slots[i] += strbase;
+	}
+	slots[ab->ab_argc] = 0;
+
+	sp -= (ab->ab_argc + 1) * sizeof(vaddr_t);
+	result = copyout(slots, (userptr_t)sp,
+			 (ab->ab_argc + 1) * sizeof(vaddr_t));
+	if (result) {
+		return result;
+	}
+
+	/* The stack pointer has to stay 8-byte aligned. */
+	*uargv = (userptr_t)sp;
+	*stackptr = sp & ~(vaddr_t)7;
+	return 0;
+}
@@ -9,6 +9,7 @@
 #include <copyinout.h>
 #include <uio.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <spinlock.h>
 #include <limits.h>
 
@@ -146,21 +147,34 @@ int sys_dup2(int oldfd, int newfd, int* retval){
     return _fh_dup2(oldfd, newfd, &curproc->p_fhs, retval);
 }
 
+int sys_ioctl(int fd, int op, userptr_t data){
+
+    struct fh *handle = _get_fh(fd,&curproc->p_fhs);
+    if(handle == NULL){
+        return EBADF;
+    }
+
+    // the device checks op and copies data in/out itself
+    return VOP_IOCTL(*handle->fh_vnode, op, data);
+}
+
 int sys_chdir(const_userptr_t userpath){
     
     char* pathname = kmalloc(__PATH_MAX);
+    if(pathname == NULL){
+        return ENOMEM;
+    }
 
     int ret;
-    void* dest = kmalloc(1);
-    ret = copyin(pathname,dest,1);
-    kfree(dest);
+    ret = copyinstr(userpath,pathname,__PATH_MAX,NULL);
     if(ret){
+        kfree(pathname);
         return ret;
     }
 
     ret = vfs_chdir(pathname);
 
-    kfree(pathname)
+    kfree(pathname);
 
     return ret;
 }
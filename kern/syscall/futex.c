@@ -0,0 +1,171 @@
+/*
+ * futex: wait and wake on a word of user memory.
+ *
+ * A userland lock only needs the kernel when there's someone to wait
+ * for or wake up; the uncontended paths are a compare-and-swap in
+ * userland (see libusync). Waiters are kept in a hash table of wait
+ * queues keyed on the physical address of the word, so that any
+ * processes mapping the same page see the same futex.
+ *
+ * Each bucket has a spinlock, a wait channel, and a list of waiters.
+ * FUTEX_WAKE marks the waiters it picks and removes them from the
+ * list; since a bucket's wait channel is shared by all the futexes
+ * that hash there, it then wakes the whole channel and anyone not
+ * marked goes back to sleep. With enough buckets that's rare.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <syscall.h>
+
+#define FUTEX_HASHBITS	6
+#define FUTEX_HASHSIZE	(1 << FUTEX_HASHBITS)
+
+struct futex_waiter {
+	paddr_t fw_key;			/* physical address waited on */
+	bool fw_woken;			/* set by FUTEX_WAKE */
+	struct futex_waiter *fw_next;	/* bucket list */
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+/*
+ * Set up the table. Called once during boot.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		spinlock_setname(&futex_table[i].fb_lock, "futex");
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Pick the bucket for a key. The low two bits are always zero.
+ */
+static
+struct futex_bucket *
+futex_hash(paddr_t key)
+{
+	uint32_t h;
+
+	h = (uint32_t)(key >> 2) * 2654435761U;
+	return &futex_table[h >> (32 - FUTEX_HASHBITS)];
+}
+
+/*
+ * FUTEX_WAIT. Also called directly by the kernel futex test.
+ */
+int
+futex_wait(paddr_t key, int val)
+{
+	struct futex_bucket *fb = futex_hash(key);
+	struct futex_waiter fw;
+	volatile int *word;
+
+	/*
+	 * Check the word through its kernel address. This can't
+	 * fault, so we can do it with the bucket locked; and holding
+	 * the lock across the check and the sleep means a FUTEX_WAKE
+	 * issued after the word changes can't miss us.
+	 */
+	word = (volatile int *)PADDR_TO_KVADDR(key);
+
+	spinlock_acquire(&fb->fb_lock);
+	if (*word != val) {
+		spinlock_release(&fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fw.fw_key = key;
+	fw.fw_woken = false;
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+
+	while (!fw.fw_woken) {
+		wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+	return 0;
+}
+
+/*
+ * FUTEX_WAKE. Also called directly by the kernel futex test.
+ */
+int
+futex_wake(paddr_t key, int max, int *retval)
+{
+	struct futex_bucket *fb = futex_hash(key);
+	struct futex_waiter **pp, *fw;
+	int count = 0;
+
+	if (max < 0) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	pp = &fb->fb_waiters;
+	while (*pp != NULL && count < max) {
+		fw = *pp;
+		if (fw->fw_key != key) {
+			pp = &fw->fw_next;
+			continue;
+		}
+		*pp = fw->fw_next;
+		fw->fw_woken = true;
+		count++;
+	}
+	if (count > 0) {
+		wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = count;
+	return 0;
+}
+
+/*
+ * The system call.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, int *retval)
+{
+	paddr_t key;
+	int result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	result = vm_translate((vaddr_t)uaddr, &key);
+	if (result) {
+		return result;
+	}
+
+	*retval = 0;
+	switch (op) {
+	    case FUTEX_WAIT:
+		return futex_wait(key, val);
+	    case FUTEX_WAKE:
+		return futex_wake(key, val, retval);
+	}
+	return EINVAL;
+}
@@ -59,6 +59,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -156,6 +157,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
+	int textseg = -1;	/* segment set up as shared text */
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
@@ -243,6 +245,24 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
+		/*
+		 * A read-only code segment can be shared with everyone
+		 * else running this file, and paged in as it's used.
+		 */
+		if (textseg < 0 && (ph.p_flags & PF_X) &&
+		    !(ph.p_flags & PF_W)) {
+			result = as_define_text(as, v, ph.p_offset,
+						ph.p_vaddr, ph.p_memsz,
+						ph.p_filesz);
+			if (result) {
+				return result;
+			}
+			textseg = i;
+			continue;
+		}
+#endif
+
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
@@ -264,6 +284,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
+
+		if (i == textseg) {
+			/* shared text is read in on demand */
+			continue;
+		}
+
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
 
 		result = VOP_READ(v, &ku);
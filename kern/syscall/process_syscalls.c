@@ -7,6 +7,14 @@
 #include <current.h>
 #include <copyinout.h>
 #include <spinlock.h>
+#include <synch.h>
+#include <mips/trapframe.h>
+#include <kern/wait.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <addrspace.h>
+#include <vfs.h>
+#include <argbuf.h>
 
 /*
  * get process id of the current process
@@ -15,62 +23,235 @@ pid_t sys_getpid(struct proc *curprocess){
     return curprocess->p_pid;
 }
 
-void sys_exit(){
-    // call thread_exit 
-    // wait for number of processes waiting to be 0 before calling proc_destroy and pass the exitcode
+/*
+ * _exit: the status is encoded for waitpid here. Does not return.
+ */
+void sys_exit(int exitcode){
+    proc_exit(_MKWVAL(exitcode) | __WEXITED);
+}
+
+/*
+ * The new thread for a forked child starts here. The trapframe has to
+ * be copied onto our own stack before going to user mode.
+ */
+static void fork_entry(void *data1, unsigned long data2){
+    struct trapframe *ptf = data1;
+    struct trapframe tf;
+
+    (void)data2;
 
-    // get a reference to the current proc before destroying curthread
-    struct proc *current_proc = curproc;
-    thread_exit();
-    proc_destroy(current_proc); 
+    tf = *ptf;
+    kfree(ptf);
+    enter_forked_process(&tf);
 }
 
 /*
-pid_t sys_waitpid(pid_t chpid, userptr_t status, int option, int *retval){
-    // invalid status pointer == address value if outside the address space of the program?
-    // invalid option ==
-    // childproc is not a child of the current process
-    // childproc does not exist
-    // childproc has already exited.
-    // status pointer is NULL (still valid!!)
+ * fork and vfork: returns the child's pid in the parent; the child
+ * returns 0 through enter_forked_process. A vfork child runs in the
+ * parent's address space, so the parent sleeps until the child has
+ * called execv or _exit.
+ */
+int sys_fork(struct trapframe *tf, bool vfork, pid_t *retval){
+    struct proc *child;
+    struct trapframe *childtf;
+    pid_t pid;
+    int ret;
+
+    ret = proc_create_fork(curproc->p_name, vfork, &child);
+    if(ret != 0){
+        return ret;
+    }
+    pid = child->p_pid;
+
+    childtf = kmalloc(sizeof(*childtf));
+    if(childtf == NULL){
+        proc_unfork(child);
+        return ENOMEM;
+    }
+    *childtf = *tf;
+
+    ret = thread_fork(curthread->t_name, child, fork_entry, childtf, 0);
+    if(ret != 0){
+        kfree(childtf);
+        proc_unfork(child);
+        return ret;
+    }
+
+    if(vfork){
+        proc_vforkwait(child);
+    }
 
-    // use copyin to copy from user address space status to a dummy kernel address space
-    // if this fails then status ptr is an invalid userspace address
+    *retval = pid;
+    return SUCC;
+}
 
+/*
+ * waitpid: only explicit pids of our own children are supported.
+ * The status is copied out before the child is reaped, so a bad
+ * status pointer leaves the child to be waited for again.
+ */
+int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval){
+    struct proc *proc = curproc;
+    struct proc *child;
+    int exitstatus;
     int ret;
-    int* dummy = kmalloc(sizeof(int));
-    ret = copyin(status,dummy,sizeof(int));
-    if(ret == EFAULT){
-        //invalid status pointer
-        *retval = EINVAL;
-        ret = 1;
+
+    if(options != 0 && options != WNOHANG){
+        return EINVAL;
     }
 
-    struct proc *chproc;
-    chproc = get_process(chpid); // child does not exist
-    if(chproc == NULL){
-        *retval = ESRCH;
-        ret = 1;
+    lock_acquire(proc->p_waitlock);
+
+    ret = proc_findchild(proc, pid, &child);
+    if(ret != 0){
+        lock_release(proc->p_waitlock);
+        return ret;
+    }
+
+    if(!child->p_exited && options == WNOHANG){
+        lock_release(proc->p_waitlock);
+        *retval = 0;
+        return SUCC;
     }
 
-    if(chproc->p_parent != curproc){ // curproc is not the parent
-        *retval = ECHILD;
-        ret = 1;
+    while(!child->p_exited){
+        cv_wait(proc->p_waitcv, proc->p_waitlock);
     }
 
-    spinlock_acquire(&chproc->p_lock);
-    if(chproc->p_numthreads == 0){
-        // process has already exited so its pid cannot be collected anymore
-        *retval = ESRCH;
-        ret = 1;
+    exitstatus = child->p_exitstatus;
+    if(status != NULL){
+        ret = copyout(&exitstatus, status, sizeof(int));
+        if(ret != 0){
+            lock_release(proc->p_waitlock);
+            return ret;
+        }
     }
-    spinlock_release(&chproc->p_lock);
 
-    KASSERT(chproc->p_parent == curproc);
-    KASSERT(chproc->p_numthreads > 0);
+    proc_reap(child);
+    lock_release(proc->p_waitlock);
 
+    *retval = pid;
+    return SUCC;
 }
-*/
 
+/*
+ * execv: replace the current program. The old address space is only
+ * given up once the new program is loaded and its arguments are in
+ * place, so on failure we return to the old program. A vfork child
+ * hands the address space back to its parent instead of destroying
+ * it.
+ */
+int sys_execv(userptr_t progname, userptr_t uargs){
+    struct proc *proc = curproc;
+    struct addrspace *oldas, *newas;
+    struct vnode *v;
+    vaddr_t entrypoint, stackptr;
+    userptr_t uargv;
+    char *kprogname, *newname, *oldname;
+    struct argbuf args;
+    int ret;
 
+    kprogname = kmalloc(PATH_MAX);
+    if(kprogname == NULL){
+        return ENOMEM;
+    }
+    ret = copyinstr((const_userptr_t)progname, kprogname, PATH_MAX, NULL);
+    if(ret != 0){
+        kfree(kprogname);
+        return ret;
+    }
+
+    ret = argbuf_init(&args);
+    if(ret != 0){
+        kfree(kprogname);
+        return ret;
+    }
+    ret = argbuf_copyin(&args, uargs);
+    if(ret != 0){
+        argbuf_cleanup(&args);
+        kfree(kprogname);
+        return ret;
+    }
+
+    /* vfs_open destroys the path, so keep a copy for the new name */
+    newname = kstrdup(kprogname);
+    if(newname == NULL){
+        argbuf_cleanup(&args);
+        kfree(kprogname);
+        return ENOMEM;
+    }
+    ret = vfs_open(kprogname, O_RDONLY, 0, &v);
+    kfree(kprogname);
+    if(ret != 0){
+        argbuf_cleanup(&args);
+        kfree(newname);
+        return ret;
+    }
+
+    newas = as_create();
+    if(newas == NULL){
+        vfs_close(v);
+        argbuf_cleanup(&args);
+        kfree(newname);
+        return ENOMEM;
+    }
+
+    oldas = proc_setas(newas);
+    as_activate();
+
+    ret = load_elf(v, &entrypoint);
+    vfs_close(v);
+    if(ret == 0){
+        ret = as_define_stack(newas, &stackptr);
+    }
+    if(ret == 0){
+        ret = argbuf_copyout(&args, &stackptr, &uargv);
+    }
+    argbuf_cleanup(&args);
+    if(ret != 0){
+        proc_setas(oldas);
+        as_activate();
+        as_destroy(newas);
+        kfree(newname);
+        return ret;
+    }
 
+    /* the profiler reads p_name from the timer interrupt */
+    spinlock_acquire(&proc->p_lock);
+    oldname = proc->p_name;
+    proc->p_name = newname;
+    spinlock_release(&proc->p_lock);
+    kfree(oldname);
+
+    if(proc->p_vfork){
+        proc_vforkdone(proc);
+    }else{
+        as_destroy(oldas);
+    }
+
+    enter_new_process(args.ab_argc, uargv, NULL, stackptr, entrypoint);
+
+    /* enter_new_process does not return. */
+    panic("enter_new_process returned\n");
+    return EINVAL;
+}
+
+/*
+ * sbrk: the heap itself is the VM system's business (as_sbrk).
+ */
+int sys_sbrk(intptr_t amount, int *retval){
+    struct addrspace *as;
+    vaddr_t oldbreak;
+    int ret;
+
+    as = proc_getas();
+    if(as == NULL){
+        return EFAULT;
+    }
+    ret = as_sbrk(as, amount, &oldbreak);
+    if(ret != 0){
+        return ret;
+    }
+    *retval = (int)oldbreak;
+    return 0;
+}
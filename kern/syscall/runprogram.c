@@ -44,24 +44,39 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <argbuf.h>
 
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load program "progname" and start running it in usermode, with the
+ * NARGS strings in ARGS as its argv. Does not return except on error.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
 int
-runprogram(char *progname)
+runprogram(char *progname, unsigned nargs, char **args)
 {
 	struct addrspace *as;
 	struct vnode *v;
+	struct argbuf ab;
 	vaddr_t entrypoint, stackptr;
+	userptr_t uargv;
 	int result;
 
+	/* Pack the arguments. */
+	result = argbuf_init(&ab);
+	if (result) {
+		return result;
+	}
+	result = argbuf_fromkernel(&ab, nargs, args);
+	if (result) {
+		argbuf_cleanup(&ab);
+		return result;
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
@@ -72,6 +87,7 @@ runprogram(char *progname)
 	as = as_create();
 	if (as == NULL) {
 		vfs_close(v);
+		argbuf_cleanup(&ab);
 		return ENOMEM;
 	}
 
@@ -84,6 +100,7 @@ runprogram(char *progname)
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
@@ -94,11 +111,19 @@ runprogram(char *progname)
 	result = as_define_stack(as, &stackptr);
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
+		argbuf_cleanup(&ab);
+		return result;
+	}
+
+	/* Put the arguments on the stack. */
+	result = argbuf_copyout(&ab, &stackptr, &uargv);
+	argbuf_cleanup(&ab);
+	if (result) {
 		return result;
 	}
 
 	/* Warp to user mode. */
-	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
+	enter_new_process(nargs, uargv,
 			  NULL /*userspace addr of environment*/,
 			  stackptr, entrypoint);
 
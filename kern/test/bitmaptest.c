@@ -29,11 +29,120 @@
 
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
 
+/* Big enough to get a summary level */
+#define BIGSIZE 40000
+#define BIGOPS 20000
+
+/* Benchmark: map size, how full to keep it, and allocations to time */
+#define BENCHSIZE 262144
+#define BENCHFREE 256
+#define BENCHOPS 20000
+
+/*
+ * Check bitmap_alloc_near and bitmap_alloc_range, and all the
+ * allocators on a map large enough to have a summary, against a
+ * plain array of flags.
+ */
+static
+void
+bitmaptest_big(void)
+{
+	struct bitmap *b;
+	char *ref;
+	unsigned i, j, x, near, count, expect;
+	int result;
+
+	kprintf("Starting large bitmap test...\n");
+
+	b = bitmap_create(BIGSIZE);
+	ref = kmalloc(BIGSIZE);
+	KASSERT(b != NULL && ref != NULL);
+	bzero(ref, BIGSIZE);
+
+	for (i=0; i<BIGOPS; i++) {
+		switch (random() % 5) {
+		    case 0:
+			result = bitmap_alloc(b, &x);
+			if (result == 0) {
+				KASSERT(x < BIGSIZE && ref[x] == 0);
+				ref[x] = 1;
+			}
+			break;
+		    case 1:
+			near = random() % BIGSIZE;
+			expect = BIGSIZE;
+			for (j=0; j<BIGSIZE; j++) {
+				if (ref[(near + j) % BIGSIZE] == 0) {
+					expect = (near + j) % BIGSIZE;
+					break;
+				}
+			}
+			result = bitmap_alloc_near(b, near, &x);
+			if (expect == BIGSIZE) {
+				KASSERT(result != 0);
+				break;
+			}
+			KASSERT(result == 0 && x == expect);
+			ref[x] = 1;
+			break;
+		    case 2:
+			/* find the first run that fits */
+			count = 1 + random() % 40;
+			expect = BIGSIZE;
+			for (j=0, near=0; j<BIGSIZE; j++) {
+				near = ref[j] ? 0 : near + 1;
+				if (near == count) {
+					expect = j + 1 - count;
+					break;
+				}
+			}
+			result = bitmap_alloc_range(b, count, &x);
+			if (expect == BIGSIZE) {
+				KASSERT(result != 0);
+				break;
+			}
+			KASSERT(result == 0 && x == expect);
+			for (j=0; j<count; j++) {
+				ref[x + j] = 1;
+			}
+			break;
+		    default:
+			x = random() % BIGSIZE;
+			for (j=0; j<16 && x+j<BIGSIZE; j++) {
+				if (ref[x + j]) {
+					bitmap_unmark(b, x + j);
+					ref[x + j] = 0;
+				}
+			}
+			break;
+		}
+	}
+
+	for (i=0; i<BIGSIZE; i++) {
+		KASSERT((bitmap_isset(b, i) != 0) == (ref[i] != 0));
+	}
+
+	/* Fill it up; everything left should be found, then ENOSPC. */
+	while (bitmap_alloc(b, &x) == 0) {
+		KASSERT(ref[x] == 0);
+		ref[x] = 1;
+	}
+	for (i=0; i<BIGSIZE; i++) {
+		KASSERT(ref[i] == 1);
+	}
+	KASSERT(bitmap_alloc_range(b, 1, &x) != 0);
+
+	kfree(ref);
+	bitmap_destroy(b);
+	kprintf("Large bitmap test complete\n");
+}
+
 int
 bitmaptest(int nargs, char **args)
 {
@@ -101,6 +210,62 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	bitmap_destroy(b);
 	kprintf("Bitmap test complete\n");
+
+	bitmaptest_big();
+	return 0;
+}
+
+/*
+ * Allocation throughput on a nearly full map: keep BENCHFREE bits
+ * clear, scattered at random, and time BENCHOPS allocations, each
+ * followed by freeing a random bit so the count stays the same.
+ */
+int
+bitmapbench(int nargs, char **args)
+{
+	struct bitmap *b;
+	struct timespec before, after;
+	uint64_t ns;
+	unsigned i, x, victim;
+
+	(void)nargs;
+	(void)args;
+
+	b = bitmap_create(BENCHSIZE);
+	if (b == NULL) {
+		kprintf("bitmapbench: Out of memory\n");
+		return 0;
+	}
+	while (bitmap_alloc(b, &x) == 0) {
+		/* fill it */
+	}
+	for (i=0; i<BENCHFREE; i++) {
+		do {
+			victim = random() % BENCHSIZE;
+		} while (!bitmap_isset(b, victim));
+		bitmap_unmark(b, victim);
+	}
+
+	gettime(&before);
+	for (i=0; i<BENCHOPS; i++) {
+		if (bitmap_alloc(b, &x)) {
+			panic("bitmapbench: bitmap unexpectedly full\n");
+		}
+		do {
+			victim = random() % BENCHSIZE;
+		} while (!bitmap_isset(b, victim));
+		bitmap_unmark(b, victim);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &after);
+
+	ns = after.tv_sec * 1000000000ULL + after.tv_nsec;
+	kprintf("bitmapbench: %u allocations in a %u-bit map with %u free: "
+		"%llu ns each\n", BENCHOPS, BENCHSIZE, BENCHFREE,
+		ns / BENCHOPS);
+
+	bitmap_destroy(b);
 	return 0;
 }
@@ -0,0 +1,133 @@
+/*
+ * Futex handoff test.
+ *
+ * Two kernel threads take turns on one futex word, which counts the
+ * turns taken: thread N goes when the count is N mod 2, bumps it, and
+ * wakes the other. A thread whose turn it isn't waits on the value it
+ * saw, so nearly every turn is a sleep in futex_wait and a wakeup
+ * from futex_wake. A lost wakeup hangs the test; a wait that returns
+ * 0 without the word having changed, or a count that comes out
+ * wrong, fails it.
+ *
+ * Kernel threads have no user address space, so this calls
+ * futex_wait and futex_wake directly, keyed on the physical address
+ * of a kmalloc'd word.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <syscall.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define NTURNS		200
+
+static volatile int *fxt_word;
+static paddr_t fxt_key;
+static struct semaphore *fxt_done;
+static volatile unsigned fxt_sleeps;
+
+static struct spinlock status_lock;
+static bool test_status = TEST161_FAIL;
+
+static
+bool
+failif(bool condition) {
+	if (condition) {
+		spinlock_acquire(&status_lock);
+		test_status = TEST161_FAIL;
+		spinlock_release(&status_lock);
+	}
+	return condition;
+}
+
+static
+void
+fxtthread(void *junk, unsigned long num)
+{
+	int i, cur, woken, result;
+
+	(void)junk;
+
+	for (i=0; i<NTURNS; i++) {
+		while ((cur = *fxt_word) % 2 != (int)num) {
+			result = futex_wait(fxt_key, cur);
+			if (result == 0) {
+				/* only the other thread's turn wakes us */
+				failif(*fxt_word == cur);
+				spinlock_acquire(&status_lock);
+				fxt_sleeps++;
+				spinlock_release(&status_lock);
+			}
+			else {
+				failif(result != EAGAIN);
+			}
+		}
+
+		*fxt_word = cur + 1;
+		result = futex_wake(fxt_key, 1, &woken);
+		failif(result != 0 || woken < 0 || woken > 1);
+
+		if (random() % 8 == 0) {
+			random_yielder(4);
+		}
+	}
+
+	V(fxt_done);
+}
+
+int
+futextest(int nargs, char **args)
+{
+	int i, woken, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting fxt1...\n");
+
+	fxt_word = kmalloc(sizeof(int));
+	fxt_done = sem_create("fxt_done", 0);
+	if (fxt_word == NULL || fxt_done == NULL) {
+		panic("fxt1: out of memory\n");
+	}
+	*fxt_word = 0;
+	fxt_key = KVADDR_TO_PADDR((vaddr_t)fxt_word);
+	fxt_sleeps = 0;
+	spinlock_init(&status_lock);
+	test_status = TEST161_SUCCESS;
+
+	/* The easy cases: a stale value, and a wake with no waiters. */
+	failif(futex_wait(fxt_key, 1) != EAGAIN);
+	result = futex_wake(fxt_key, 1, &woken);
+	failif(result != 0 || woken != 0);
+
+	for (i=0; i<2; i++) {
+		result = thread_fork("fxt1", NULL, fxtthread, NULL, i);
+		if (result) {
+			panic("fxt1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<2; i++) {
+		P(fxt_done);
+	}
+
+	failif(*fxt_word != 2 * NTURNS);
+	failif(fxt_sleeps == 0);
+	kprintf_n("fxt1: %u turns, %u sleeps\n", 2 * NTURNS, fxt_sleeps);
+
+	sem_destroy(fxt_done);
+	kfree((void *)fxt_word);
+	fxt_done = NULL;
+	fxt_word = NULL;
+	spinlock_cleanup(&status_lock);
+
+	success(test_status, SECRET, "fxt1");
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Reader-writer lock benchmark.
+ *
+ * NTHREADS threads each do OPS passes over a small shared table,
+ * one pass in WRITEEVERY updating it and the rest just reading it:
+ * the pattern of a lookup table like the VFS device list. This is
+ * done once with a struct rwlock and once with a plain struct lock,
+ * and the time per pass is reported for each. With several CPUs the
+ * rwlock should let the readers run in parallel.
+ *
+ * Usage: rwb [threads [passes]]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define DEFTHREADS	8
+#define DEFOPS		20000
+#define WRITEEVERY	100
+#define TABLESIZE	16
+
+static volatile unsigned table[TABLESIZE];
+static struct rwlock *bench_rw;
+static struct lock *bench_lock;
+static struct semaphore *bench_go;
+static struct semaphore *bench_done;
+static unsigned bench_ops;
+static volatile unsigned bench_bad;
+
+/*
+ * One pass, reading or writing. Writers keep every entry equal, so a
+ * reader that sees two different values got in during a write.
+ */
+static
+void
+rwbench_pass(unsigned pass, bool write)
+{
+	unsigned i, v;
+
+	if (write) {
+		for (i=0; i<TABLESIZE; i++) {
+			table[i] = pass;
+		}
+	}
+	else {
+		v = table[0];
+		for (i=1; i<TABLESIZE; i++) {
+			if (table[i] != v) {
+				bench_bad++;
+			}
+		}
+	}
+}
+
+static
+void
+rwbench_thread(void *junk, unsigned long userw)
+{
+	unsigned i;
+	bool write;
+
+	(void)junk;
+
+	P(bench_go);
+	for (i=0; i<bench_ops; i++) {
+		write = (i % WRITEEVERY == 0);
+		if (!userw) {
+			lock_acquire(bench_lock);
+			rwbench_pass(i, write);
+			lock_release(bench_lock);
+		}
+		else if (write) {
+			rwlock_acquire_write(bench_rw);
+			rwbench_pass(i, true);
+			rwlock_release_write(bench_rw);
+		}
+		else {
+			rwlock_acquire_read(bench_rw);
+			rwbench_pass(i, false);
+			rwlock_release_read(bench_rw);
+		}
+	}
+	V(bench_done);
+}
+
+static
+void
+rwbench_run(const char *name, unsigned nthreads, bool userw)
+{
+	struct timespec before, after;
+	uint64_t ns;
+	unsigned i;
+	int result;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("rwbench", NULL, rwbench_thread, NULL,
+				     userw);
+		if (result) {
+			panic("rwbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		V(bench_go);
+	}
+	for (i=0; i<nthreads; i++) {
+		P(bench_done);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &after);
+
+	ns = after.tv_sec * 1000000000ULL + after.tv_nsec;
+	kprintf("rwbench: %-6s %u threads x %u passes: %llu.%03llu s, "
+		"%llu ns/pass\n", name, nthreads, bench_ops,
+		ns / 1000000000ULL, (ns / 1000000) % 1000,
+		ns / ((uint64_t)nthreads * bench_ops));
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	int nthreads, ops;
+
+	nthreads = nargs > 1 ? atoi(args[1]) : DEFTHREADS;
+	ops = nargs > 2 ? atoi(args[2]) : DEFOPS;
+	if (nthreads < 1 || ops < 1) {
+		kprintf("Usage: rwb [threads [passes]]\n");
+		return EINVAL;
+	}
+	bench_ops = ops;
+
+	bench_rw = rwlock_create("rwbench");
+	bench_lock = lock_create("rwbench");
+	bench_go = sem_create("rwbench go", 0);
+	bench_done = sem_create("rwbench done", 0);
+	if (bench_rw == NULL || bench_lock == NULL || bench_go == NULL ||
+	    bench_done == NULL) {
+		panic("rwbench: Out of memory\n");
+	}
+	bench_bad = 0;
+
+	rwbench_run("rwlock", nthreads, true);
+	rwbench_run("lock", nthreads, false);
+
+	if (bench_bad > 0) {
+		kprintf("rwbench: FAILED: %u torn reads\n", bench_bad);
+	}
+
+	sem_destroy(bench_done);
+	sem_destroy(bench_go);
+	lock_destroy(bench_lock);
+	rwlock_destroy(bench_rw);
+	return 0;
+}
@@ -12,26 +12,229 @@
 #include <kern/test161.h>
 #include <spinlock.h>
 
+#define CREATELOOPS	8
+#define NRWLOOPS	120
+#define NTHREADS	32
+#define NEARLYREADERS	8
+
+static volatile unsigned long testval1;
+static volatile unsigned long testval2;
+static volatile unsigned testreaders;
+static volatile unsigned testmaxreaders;
+static volatile bool testwriterdone;
+
+static struct rwlock *testrw = NULL;
+static struct semaphore *donesem = NULL;
+
+static struct spinlock status_lock;
+static bool test_status = TEST161_FAIL;
+
+static
+bool
+failif(bool condition) {
+	if (condition) {
+		spinlock_acquire(&status_lock);
+		test_status = TEST161_FAIL;
+		spinlock_release(&status_lock);
+	}
+	return condition;
+}
+
 /*
- * Use these stubs to test your reader-writer locks.
+ * Readers check that testval2 is always testval1 squared; writers
+ * change both, yielding in between, and check that no reader is in.
+ * Roughly one pass in eight writes.
  */
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	int i;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		kprintf_t(".");
+		if (random() % 8 == 0) {
+			rwlock_acquire_write(testrw);
+			failif(testreaders != 0);
+			testval1 = num;
+			random_yielder(4);
+			testval2 = num*num;
+			random_yielder(4);
+			failif(testval1 != num || testval2 != num*num);
+			failif(testreaders != 0);
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spinlock_acquire(&status_lock);
+			testreaders++;
+			if (testreaders > testmaxreaders) {
+				testmaxreaders = testreaders;
+			}
+			spinlock_release(&status_lock);
+
+			failif(testval2 != testval1*testval1);
+			random_yielder(4);
+			failif(testval2 != testval1*testval1);
+
+			spinlock_acquire(&status_lock);
+			testreaders--;
+			spinlock_release(&status_lock);
+			rwlock_release_read(testrw);
+		}
+		random_yielder(4);
+	}
+
+	V(donesem);
+}
 
 int rwtest(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt1 unimplemented\n");
-	success(TEST161_FAIL, SECRET, "rwt1");
+	int i, result;
+
+	kprintf_n("Starting rwt1...\n");
+	for (i=0; i<CREATELOOPS; i++) {
+		kprintf_t(".");
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwt1: rwlock_create failed\n");
+		}
+		donesem = sem_create("donesem", 0);
+		if (donesem == NULL) {
+			panic("rwt1: sem_create failed\n");
+		}
+		if (i != CREATELOOPS - 1) {
+			rwlock_destroy(testrw);
+			sem_destroy(donesem);
+		}
+	}
+	spinlock_init(&status_lock);
+	test_status = TEST161_SUCCESS;
+	testval1 = 0;
+	testval2 = 0;
+	testreaders = 0;
+	testmaxreaders = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		kprintf_t(".");
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwt1: thread_fork failed: %s\n", strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		kprintf_t(".");
+		P(donesem);
+	}
+
+	rwlock_destroy(testrw);
+	sem_destroy(donesem);
+	testrw = NULL;
+	donesem = NULL;
+
+	kprintf_t("\n");
+	kprintf_n("rwt1: at most %u readers at once\n", testmaxreaders);
+	success(test_status, SECRET, "rwt1");
 
 	return 0;
 }
 
+/*
+ * rwt2 threads. Early readers get in while the main thread holds a
+ * read lock; the writer then has to wait for the main thread, and
+ * the late reader, which arrives while the writer is waiting, has to
+ * wait for the writer.
+ */
+static
+void
+rwt2reader(void *junk, unsigned long late)
+{
+	(void)junk;
+
+	rwlock_acquire_read(testrw);
+	if (late) {
+		failif(!testwriterdone);
+	}
+	else {
+		failif(testwriterdone);
+	}
+	rwlock_release_read(testrw);
+	V(donesem);
+}
+
+static
+void
+rwt2writer(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_write(testrw);
+	testwriterdone = true;
+	rwlock_release_write(testrw);
+	V(donesem);
+}
+
 int rwtest2(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt2 unimplemented\n");
-	success(TEST161_FAIL, SECRET, "rwt2");
+	int i, result;
+
+	kprintf_n("Starting rwt2...\n");
+	testrw = rwlock_create("testrw");
+	donesem = sem_create("donesem", 0);
+	if (testrw == NULL || donesem == NULL) {
+		panic("rwt2: create failed\n");
+	}
+	spinlock_init(&status_lock);
+	test_status = TEST161_SUCCESS;
+	testwriterdone = false;
+
+	rwlock_acquire_read(testrw);
+
+	/* Readers share: these all finish while we still hold it. */
+	for (i=0; i<NEARLYREADERS; i++) {
+		result = thread_fork("rwt2", NULL, rwt2reader, NULL, 0);
+		if (result) {
+			panic("rwt2: thread_fork failed: %s\n", strerror(result));
+		}
+	}
+	for (i=0; i<NEARLYREADERS; i++) {
+		P(donesem);
+	}
+
+	result = thread_fork("rwt2", NULL, rwt2writer, NULL, 0);
+	if (result) {
+		panic("rwt2: thread_fork failed: %s\n", strerror(result));
+	}
+	while (!testrw->rw_writerwait) {
+		thread_yield();
+	}
+
+	/* Writers first: this one must wait for the writer. */
+	result = thread_fork("rwt2", NULL, rwt2reader, NULL, 1);
+	if (result) {
+		panic("rwt2: thread_fork failed: %s\n", strerror(result));
+	}
+	clocksleep(1);
+	failif(testwriterdone);
+
+	rwlock_release_read(testrw);
+	P(donesem);
+	P(donesem);
+	failif(!testwriterdone);
+
+	rwlock_destroy(testrw);
+	sem_destroy(donesem);
+	testrw = NULL;
+	donesem = NULL;
+
+	success(test_status, SECRET, "rwt2");
 
 	return 0;
 }
@@ -40,9 +243,24 @@ int rwtest3(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt3 unimplemented\n");
+	kprintf_n("Starting rwt3...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt3: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt3");
+	rwlock_release_read(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt3");
 
+	rwlock_destroy(testrw);
+	testrw = NULL;
+
 	return 0;
 }
 
@@ -50,9 +268,24 @@ int rwtest4(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt4 unimplemented\n");
+	kprintf_n("Starting rwt4...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt4: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt4");
+	rwlock_release_write(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt4");
 
+	rwlock_destroy(testrw);
+	testrw = NULL;
+
 	return 0;
 }
 
@@ -60,8 +293,23 @@ int rwtest5(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt5 unimplemented\n");
+	kprintf_n("Starting rwt5...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt5: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt5");
+	rwlock_acquire_read(testrw);
+	rwlock_destroy(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt5");
 
+	testrw = NULL;
+
 	return 0;
 }
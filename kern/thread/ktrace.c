@@ -0,0 +1,544 @@
+/*
+ * Kernel event tracing. See ktrace.h for the overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <membar.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <mainbus.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <ktrace.h>
+
+/*
+ * Records per CPU. The rings are allocated the first time tracing is
+ * turned on and never freed, because a CPU might still be in the
+ * middle of a tracepoint when we turn tracing off.
+ */
+#define KTRACE_RINGSIZE  1024
+
+/*
+ * Per-CPU ring.
+ *
+ * kr_head counts every record ever written; the record goes in slot
+ * kr_head % KTRACE_RINGSIZE and kr_head is bumped only after the
+ * record is complete. kr_tail is the reader's position and is only
+ * touched with ktrace_lock held.
+ */
+struct ktrace_ring {
+	volatile uint32_t kr_head;
+	uint32_t kr_tail;
+	uint64_t kr_lasttime;		/* keeps timestamps monotonic */
+	struct ktrace_rec kr_recs[KTRACE_RINGSIZE];
+};
+
+volatile bool ktrace_enabled;
+
+static struct ktrace_ring **ktrace_rings;
+static unsigned ktrace_nrings;
+
+/*
+ * Reader side: ktrace_lock serializes dumping and streaming.
+ * ktrace_snap[] holds one drained ring each while merging.
+ */
+static struct lock *ktrace_lock;
+static struct ktrace_rec **ktrace_snap;
+static unsigned *ktrace_snapcount;
+static unsigned ktrace_lost;
+
+/*
+ * Streaming state. ktrace_streaming, ktrace_streamstop, and
+ * ktrace_streampos are protected by ktrace_lock; ktrace_streamthread
+ * is only for ktrace_record to check.
+ */
+static bool ktrace_streaming;
+static bool ktrace_streamstop;
+static off_t ktrace_streampos;
+static struct thread *volatile ktrace_streamthread;
+static struct semaphore *ktrace_streamdone;
+
+static const char *const ktrace_eventnames[KTR_NEVENTS] = {
+	"?",
+	"switch",
+	"sleep",
+	"wakeup",
+	"lockwait",
+	"lockacq",
+	"vmfault",
+	"syscall",
+	"sysret",
+	"diskio",
+	"diskdone",
+};
+
+////////////////////////////////////////////////////////////
+//
+// Recording
+
+/*
+ * Append a record to the current CPU's ring.
+ */
+void
+ktrace_record(unsigned event, uint32_t arg0, uint32_t arg1)
+{
+	struct ktrace_ring *kr;
+	struct ktrace_rec *rec;
+	uint64_t now;
+	uint32_t head;
+	int spl;
+
+	if (!CURCPU_EXISTS() || curthread == ktrace_streamthread) {
+		return;
+	}
+
+	spl = splhigh();
+	if (curcpu->c_number >= ktrace_nrings) {
+		/* not set up (can't happen once all cpus are online) */
+		splx(spl);
+		return;
+	}
+	kr = ktrace_rings[curcpu->c_number];
+
+	now = mainbus_cycles();
+	if (now < kr->kr_lasttime) {
+		now = kr->kr_lasttime;
+	}
+	kr->kr_lasttime = now;
+
+	head = kr->kr_head;
+	rec = &kr->kr_recs[head % KTRACE_RINGSIZE];
+	rec->kr_time = now;
+	rec->kr_cpu = curcpu->c_number;
+	rec->kr_event = event;
+	rec->kr_thread = (uint32_t)(uintptr_t)curthread;
+	rec->kr_arg0 = arg0;
+	rec->kr_arg1 = arg1;
+
+	/* publish the record before the new head */
+	membar_store_store();
+	kr->kr_head = head + 1;
+
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reading
+
+/*
+ * Copy everything not yet read out of ring KR into OUT. Returns the
+ * number of records copied. Must hold ktrace_lock.
+ *
+ * The owning CPU may be writing while we copy. After copying, reread
+ * the head: any slot the writer has come back around to since we
+ * started may have been overwritten mid-copy, so throw those away.
+ */
+static
+unsigned
+ktrace_drain(struct ktrace_ring *kr, struct ktrace_rec *out)
+{
+	uint32_t head, tail, newhead, i;
+	unsigned n, skip;
+
+	KASSERT(lock_do_i_hold(ktrace_lock));
+
+	head = kr->kr_head;
+	membar_load_load();
+
+	tail = kr->kr_tail;
+	if (head - tail > KTRACE_RINGSIZE) {
+		ktrace_lost += head - tail - KTRACE_RINGSIZE;
+		tail = head - KTRACE_RINGSIZE;
+	}
+
+	n = 0;
+	for (i = tail; i != head; i++) {
+		out[n++] = kr->kr_recs[i % KTRACE_RINGSIZE];
+	}
+
+	membar_load_load();
+	newhead = kr->kr_head;
+	skip = 0;
+	if (newhead - tail > KTRACE_RINGSIZE) {
+		skip = newhead - tail - KTRACE_RINGSIZE;
+		if (skip > n) {
+			skip = n;
+		}
+		ktrace_lost += skip;
+		memmove(out, out + skip, (n - skip) * sizeof(*out));
+	}
+
+	kr->kr_tail = head;
+	return n - skip;
+}
+
+/*
+ * Write LEN bytes of BUF to VN at *POS.
+ */
+static
+int
+ktrace_write(struct vnode *vn, off_t *pos, char *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	*pos = ku.uio_offset;
+	if (ku.uio_resid > 0) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+/*
+ * Drain all the rings and write the records to VN in timestamp order,
+ * one line per record. Since each ring is already in time order, this
+ * is a straightforward n-way merge. Must hold ktrace_lock.
+ */
+static
+int
+ktrace_flush(struct vnode *vn, off_t *pos)
+{
+	char buf[512];
+	size_t len;
+	unsigned i, best, *next;
+	const struct ktrace_rec *rec;
+	const char *name;
+	int result;
+
+	KASSERT(lock_do_i_hold(ktrace_lock));
+
+	next = kmalloc(ktrace_nrings * sizeof(next[0]));
+	if (next == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<ktrace_nrings; i++) {
+		ktrace_snapcount[i] = ktrace_drain(ktrace_rings[i],
+						   ktrace_snap[i]);
+		next[i] = 0;
+	}
+
+	result = 0;
+	len = 0;
+	while (1) {
+		best = ktrace_nrings;
+		for (i=0; i<ktrace_nrings; i++) {
+			if (next[i] == ktrace_snapcount[i]) {
+				continue;
+			}
+			if (best == ktrace_nrings ||
+			    ktrace_snap[i][next[i]].kr_time <
+			    ktrace_snap[best][next[best]].kr_time) {
+				best = i;
+			}
+		}
+		if (best == ktrace_nrings) {
+			break;
+		}
+		rec = &ktrace_snap[best][next[best]++];
+
+		/* flush if the next line might not fit */
+		if (len + 80 > sizeof(buf)) {
+			result = ktrace_write(vn, pos, buf, len);
+			if (result) {
+				break;
+			}
+			len = 0;
+		}
+		name = rec->kr_event < KTR_NEVENTS ?
+			ktrace_eventnames[rec->kr_event] : "?";
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"%llu %u %s 0x%x 0x%x 0x%x\n",
+				(unsigned long long)rec->kr_time,
+				rec->kr_cpu, name, rec->kr_thread,
+				rec->kr_arg0, rec->kr_arg1);
+	}
+	if (result == 0 && len > 0) {
+		result = ktrace_write(vn, pos, buf, len);
+	}
+
+	kfree(next);
+	return result;
+}
+
+/*
+ * Open PATH for writing a trace and put the header line on it.
+ */
+static
+int
+ktrace_open(char *path, struct vnode **ret, off_t *pos)
+{
+	char buf[64];
+	int result;
+
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, ret);
+	if (result) {
+		return result;
+	}
+	*pos = 0;
+	snprintf(buf, sizeof(buf), "# cycles cpu event thread arg0 arg1\n");
+	result = ktrace_write(*ret, pos, buf, strlen(buf));
+	if (result) {
+		vfs_close(*ret);
+		return result;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Control
+
+/*
+ * Allocate rings and reader-side buffers for every CPU. Called the
+ * first time tracing is started; by then all CPUs are online.
+ */
+static
+int
+ktrace_setup(void)
+{
+	unsigned i, n;
+
+	if (ktrace_rings != NULL) {
+		return 0;
+	}
+
+	n = num_cpus;
+	ktrace_lock = lock_create("ktrace");
+	ktrace_streamdone = sem_create("ktrace_stream", 0);
+	ktrace_rings = kmalloc(n * sizeof(ktrace_rings[0]));
+	ktrace_snap = kmalloc(n * sizeof(ktrace_snap[0]));
+	ktrace_snapcount = kmalloc(n * sizeof(ktrace_snapcount[0]));
+	if (ktrace_lock == NULL || ktrace_streamdone == NULL ||
+	    ktrace_rings == NULL || ktrace_snap == NULL ||
+	    ktrace_snapcount == NULL) {
+		goto fail;
+	}
+	for (i=0; i<n; i++) {
+		ktrace_rings[i] = NULL;
+		ktrace_snap[i] = NULL;
+	}
+	for (i=0; i<n; i++) {
+		ktrace_rings[i] = kmalloc(sizeof(struct ktrace_ring));
+		ktrace_snap[i] = kmalloc(KTRACE_RINGSIZE *
+					 sizeof(struct ktrace_rec));
+		if (ktrace_rings[i] == NULL || ktrace_snap[i] == NULL) {
+			goto fail;
+		}
+		ktrace_rings[i]->kr_head = 0;
+		ktrace_rings[i]->kr_tail = 0;
+		ktrace_rings[i]->kr_lasttime = 0;
+	}
+
+	/* make the rings visible before anyone can use them */
+	membar_store_store();
+	ktrace_nrings = n;
+	return 0;
+
+ fail:
+	/* Undo everything, so a later "ktrace on" can try again. */
+	if (ktrace_rings != NULL && ktrace_snap != NULL &&
+	    ktrace_snapcount != NULL) {
+		for (i=0; i<n; i++) {
+			if (ktrace_rings[i] != NULL) {
+				kfree(ktrace_rings[i]);
+			}
+			if (ktrace_snap[i] != NULL) {
+				kfree(ktrace_snap[i]);
+			}
+		}
+	}
+	if (ktrace_snapcount != NULL) {
+		kfree(ktrace_snapcount);
+		ktrace_snapcount = NULL;
+	}
+	if (ktrace_snap != NULL) {
+		kfree(ktrace_snap);
+		ktrace_snap = NULL;
+	}
+	if (ktrace_rings != NULL) {
+		kfree(ktrace_rings);
+		ktrace_rings = NULL;
+	}
+	if (ktrace_streamdone != NULL) {
+		sem_destroy(ktrace_streamdone);
+		ktrace_streamdone = NULL;
+	}
+	if (ktrace_lock != NULL) {
+		lock_destroy(ktrace_lock);
+		ktrace_lock = NULL;
+	}
+	return ENOMEM;
+}
+
+int
+ktrace_start(void)
+{
+	int result;
+
+	result = ktrace_setup();
+	if (result) {
+		return result;
+	}
+	ktrace_enabled = true;
+	return 0;
+}
+
+void
+ktrace_stop(void)
+{
+	ktrace_enabled = false;
+
+	if (ktrace_rings == NULL) {
+		return;
+	}
+
+	lock_acquire(ktrace_lock);
+	if (ktrace_streaming) {
+		ktrace_streamstop = true;
+		lock_release(ktrace_lock);
+		P(ktrace_streamdone);
+		return;
+	}
+	lock_release(ktrace_lock);
+}
+
+int
+ktrace_dump(char *path)
+{
+	struct vnode *vn;
+	off_t pos;
+	int result;
+
+	if (ktrace_rings == NULL) {
+		kprintf("ktrace: nothing recorded\n");
+		return 0;
+	}
+
+	lock_acquire(ktrace_lock);
+	if (ktrace_streaming) {
+		lock_release(ktrace_lock);
+		kprintf("ktrace: already streaming\n");
+		return EBUSY;
+	}
+
+	/* Don't trace the dump itself. */
+	ktrace_enabled = false;
+
+	result = ktrace_open(path, &vn, &pos);
+	if (result) {
+		lock_release(ktrace_lock);
+		return result;
+	}
+	ktrace_lost = 0;
+	result = ktrace_flush(vn, &pos);
+	vfs_close(vn);
+	if (ktrace_lost > 0) {
+		kprintf("ktrace: %u records lost\n", ktrace_lost);
+	}
+	lock_release(ktrace_lock);
+
+	return result;
+}
+
+/*
+ * Thread that drains the rings into the trace file once a second
+ * until ktrace_stop asks it to quit. Its own activity isn't recorded
+ * (see ktrace_record).
+ */
+static
+void
+ktrace_streamer(void *data1, unsigned long unused)
+{
+	struct vnode *vn = data1;
+	bool done, wake;
+	int result;
+
+	(void)unused;
+
+	ktrace_streamthread = curthread;
+
+	do {
+		clocksleep(1);
+
+		lock_acquire(ktrace_lock);
+		done = ktrace_streamstop;
+		result = ktrace_flush(vn, &ktrace_streampos);
+		lock_release(ktrace_lock);
+		if (result) {
+			kprintf("ktrace: stream: %s\n", strerror(result));
+			ktrace_enabled = false;
+			break;
+		}
+	} while (!done);
+
+	lock_acquire(ktrace_lock);
+	vfs_close(vn);
+	if (ktrace_lost > 0) {
+		kprintf("ktrace: %u records lost\n", ktrace_lost);
+	}
+	ktrace_streamthread = NULL;
+	ktrace_streaming = false;
+	wake = ktrace_streamstop;
+	ktrace_streamstop = false;
+	lock_release(ktrace_lock);
+
+	/* If ktrace_stop is waiting for us, let it go. */
+	if (wake) {
+		V(ktrace_streamdone);
+	}
+}
+
+int
+ktrace_stream(char *path)
+{
+	struct vnode *vn;
+	int result;
+
+	result = ktrace_setup();
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(ktrace_lock);
+	if (ktrace_streaming) {
+		lock_release(ktrace_lock);
+		kprintf("ktrace: already streaming\n");
+		return EBUSY;
+	}
+	result = ktrace_open(path, &vn, &ktrace_streampos);
+	if (result) {
+		lock_release(ktrace_lock);
+		return result;
+	}
+	ktrace_lost = 0;
+	ktrace_streaming = true;
+	ktrace_streamstop = false;
+	lock_release(ktrace_lock);
+
+	result = thread_fork("ktrace", NULL, ktrace_streamer, vn, 0);
+	if (result) {
+		lock_acquire(ktrace_lock);
+		ktrace_streaming = false;
+		vfs_close(vn);
+		lock_release(ktrace_lock);
+		return result;
+	}
+
+	ktrace_enabled = true;
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * Lock contention statistics. See lockstat.h for the overview.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <mainbus.h>
+#include <lockstat.h>
+
+/*
+ * Per-name totals. Each slot holds the counts of every lock of that
+ * name that has been destroyed. When the table is full, further names
+ * get lumped together under "(other)".
+ */
+#define LOCKSTAT_NTOTALS	64
+#define LOCKSTAT_NAMELEN	24
+
+struct lockstat_total {
+	char lt_name[LOCKSTAT_NAMELEN];
+	unsigned lt_nlocks;
+	uint32_t lt_acquires;
+	uint32_t lt_contended;
+	uint64_t lt_waitcycles;
+	uint64_t lt_maxwait;
+	uint64_t lt_holdcycles;
+};
+
+/*
+ * lockstat_lock protects the list of live lockstats and both tables.
+ * It is unnamed, so it is not itself tracked, and nothing else is
+ * acquired while holding it (except by kprintf while printing).
+ *
+ * lockstat_report is scratch space for lockstat_print, and is static
+ * because it's too big for a kernel stack.
+ */
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+static struct lockstat *lockstat_list;
+static struct lockstat_total lockstat_totals[LOCKSTAT_NTOTALS];
+static struct lockstat_total lockstat_report[LOCKSTAT_NTOTALS];
+
+////////////////////////////////////////////////////////////
+// Tables
+
+/*
+ * Find the slot for NAME in TABLE, making one if needed. The last
+ * slot is the overflow bucket.
+ */
+static
+struct lockstat_total *
+lockstat_findtotal(struct lockstat_total *table, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NTOTALS-1; i++) {
+		if (table[i].lt_name[0] == '\0') {
+			snprintf(table[i].lt_name, LOCKSTAT_NAMELEN,
+				 "%s", name);
+			return &table[i];
+		}
+		if (!strcmp(table[i].lt_name, name)) {
+			return &table[i];
+		}
+	}
+	if (table[i].lt_name[0] == '\0') {
+		strcpy(table[i].lt_name, "(other)");
+	}
+	return &table[i];
+}
+
+/*
+ * Add the counts from LS into the right slot of TABLE.
+ *
+ * (Note that names longer than LOCKSTAT_NAMELEN-1 get truncated, so
+ * we compare the truncated form.)
+ */
+static
+void
+lockstat_addtotal(struct lockstat_total *table, const struct lockstat *ls)
+{
+	char name[LOCKSTAT_NAMELEN];
+	struct lockstat_total *lt;
+
+	snprintf(name, sizeof(name), "%s", ls->ls_name);
+	lt = lockstat_findtotal(table, name);
+
+	lt->lt_nlocks++;
+	lt->lt_acquires += ls->ls_acquires;
+	lt->lt_contended += ls->ls_contended;
+	lt->lt_waitcycles += ls->ls_waitcycles;
+	if (ls->ls_maxwait > lt->lt_maxwait) {
+		lt->lt_maxwait = ls->ls_maxwait;
+	}
+	lt->lt_holdcycles += ls->ls_holdcycles;
+}
+
+////////////////////////////////////////////////////////////
+// Per-lock hooks
+
+void
+lockstat_init(struct lockstat *ls, const char *name)
+{
+	ls->ls_name = name;
+	ls->ls_onlist = false;
+	ls->ls_next = ls->ls_prev = NULL;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitcycles = 0;
+	ls->ls_maxwait = 0;
+	ls->ls_holdcycles = 0;
+	ls->ls_acqtime = 0;
+}
+
+void
+lockstat_cleanup(struct lockstat *ls)
+{
+	if (!ls->ls_onlist) {
+		return;
+	}
+
+	spinlock_acquire(&lockstat_lock);
+	lockstat_addtotal(lockstat_totals, ls);
+	if (ls->ls_prev != NULL) {
+		ls->ls_prev->ls_next = ls->ls_next;
+	}
+	else {
+		lockstat_list = ls->ls_next;
+	}
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prev = ls->ls_prev;
+	}
+	ls->ls_onlist = false;
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Called with the lock just acquired. Locks are put on the list the
+ * first time they're taken, which lets static spinlocks work without
+ * any setup call.
+ */
+void
+lockstat_acquired(struct lockstat *ls, bool contended, uint64_t waitstart)
+{
+	uint64_t now, wait;
+
+	if (!ls->ls_onlist) {
+		spinlock_acquire(&lockstat_lock);
+		ls->ls_prev = NULL;
+		ls->ls_next = lockstat_list;
+		if (lockstat_list != NULL) {
+			lockstat_list->ls_prev = ls;
+		}
+		lockstat_list = ls;
+		ls->ls_onlist = true;
+		spinlock_release(&lockstat_lock);
+	}
+
+	now = mainbus_cycles();
+	ls->ls_acquires++;
+	if (contended) {
+		/* cycle counts are per-cpu; don't trust a negative wait */
+		wait = now > waitstart ? now - waitstart : 0;
+		ls->ls_contended++;
+		ls->ls_waitcycles += wait;
+		if (wait > ls->ls_maxwait) {
+			ls->ls_maxwait = wait;
+		}
+	}
+	ls->ls_acqtime = now;
+}
+
+/*
+ * Called with the lock still held. A zero ls_acqtime means the lock
+ * was taken before it was being tracked.
+ */
+void
+lockstat_released(struct lockstat *ls)
+{
+	uint64_t now;
+
+	if (ls->ls_acqtime == 0) {
+		return;
+	}
+	now = mainbus_cycles();
+	if (now > ls->ls_acqtime) {
+		ls->ls_holdcycles += now - ls->ls_acqtime;
+	}
+	ls->ls_acqtime = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Print totals by lock name, worst total wait first. The counts of
+ * live locks are read without holding those locks, so a line may be
+ * off by an acquisition or so.
+ */
+void
+lockstat_print(void)
+{
+	struct lockstat *ls;
+	struct lockstat_total *lt, tmp;
+	unsigned i, j, n;
+
+	/* print the whole thing with interrupts off, like kheap_printstats */
+	spinlock_acquire(&lockstat_lock);
+
+	memcpy(lockstat_report, lockstat_totals, sizeof(lockstat_report));
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		lockstat_addtotal(lockstat_report, ls);
+	}
+
+	for (n=0; n<LOCKSTAT_NTOTALS; n++) {
+		if (lockstat_report[n].lt_name[0] == '\0') {
+			break;
+		}
+	}
+	/* insertion sort; there are at most LOCKSTAT_NTOTALS of them */
+	for (i=1; i<n; i++) {
+		tmp = lockstat_report[i];
+		for (j=i; j>0; j--) {
+			if (lockstat_report[j-1].lt_waitcycles >=
+			    tmp.lt_waitcycles) {
+				break;
+			}
+			lockstat_report[j] = lockstat_report[j-1];
+		}
+		lockstat_report[j] = tmp;
+	}
+
+	kprintf("Lock statistics (times in cycles):\n");
+	kprintf("%-23s %5s %9s %9s %12s %10s %12s\n", "name", "locks",
+		"acquires", "contended", "wait total", "wait max",
+		"hold total");
+	for (i=0; i<n; i++) {
+		lt = &lockstat_report[i];
+		kprintf("%-23s %5u %9u %9u %12llu %10llu %12llu\n",
+			lt->lt_name, lt->lt_nlocks, lt->lt_acquires,
+			lt->lt_contended,
+			(unsigned long long)lt->lt_waitcycles,
+			(unsigned long long)lt->lt_maxwait,
+			(unsigned long long)lt->lt_holdcycles);
+	}
+
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * Zero everything. Hold times in progress are left alone so they get
+ * charged correctly when the holder lets go.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+
+	spinlock_acquire(&lockstat_lock);
+	bzero(lockstat_totals, sizeof(lockstat_totals));
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitcycles = 0;
+		ls->ls_maxwait = 0;
+		ls->ls_holdcycles = 0;
+	}
+	spinlock_release(&lockstat_lock);
+}
@@ -0,0 +1,494 @@
+/*
+ * Sampling profiler. See prof.h for the overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <cpu.h>
+#include <membar.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <prof.h>
+
+/*
+ * Samples per CPU; at HZ=100 this is a bit over a minute of run time.
+ * Like the ktrace rings, the buffers are allocated the first time
+ * they're needed and never freed.
+ */
+#define PROF_NSAMPLES	8192
+
+/* Longest process name kept for the dump. */
+#define PROF_NAMELEN	32
+
+/* Slots in the process name table (power of 2), hashed by pid. */
+#define PROF_NPIDS	512
+#define PROF_PIDSLOT(pid) ((unsigned)(pid) & (PROF_NPIDS - 1))
+
+struct prof_rec {
+	uint32_t pr_pid;
+	uint32_t pr_pc;
+};
+
+/*
+ * Per-CPU sample buffer.
+ *
+ * pb_busy is set while the owning CPU is in prof_sample, so prof_stop
+ * can wait for samples in progress to finish before anyone reads the
+ * buffers. pb_count and pb_dropped are only written by the owning CPU
+ * while sampling is on, and only by prof_start while it's off.
+ */
+struct prof_buf {
+	volatile bool pb_busy;
+	volatile unsigned pb_count;
+	unsigned pb_dropped;
+	struct prof_rec pb_recs[PROF_NSAMPLES];
+};
+
+volatile bool prof_enabled;
+
+static struct prof_buf **prof_bufs;
+static unsigned prof_nbufs;
+
+/* Serializes the control functions. */
+static struct lock *prof_lock;
+
+/*
+ * Names of the processes seen while sampling, in slots hashed by pid.
+ * prof_nameproc remembers which process the name was taken from, so
+ * a recycled pid, or another pid hashing to the same slot, gets the
+ * slot updated; so does a process that has since exec'd something
+ * else. A pid whose slot was taken over during the run shows up
+ * without a name, and a reused pid under the last name it had.
+ */
+static char prof_names[PROF_NPIDS][PROF_NAMELEN];
+static struct proc *prof_nameproc[PROF_NPIDS];
+static uint32_t prof_namepid[PROF_NPIDS];
+
+/* Slots that appear in the dump; used by prof_flush under prof_lock. */
+static bool prof_seen[PROF_NPIDS];
+
+////////////////////////////////////////////////////////////
+//
+// Sampling
+
+/*
+ * Remember the name of process P.
+ */
+static
+void
+prof_notename(struct proc *p)
+{
+	const char *src;
+	char *dest;
+	unsigned slot, i;
+
+	slot = PROF_PIDSLOT(p->p_pid);
+	if (p->p_pid < 0) {
+		return;
+	}
+	src = p->p_name != NULL ? p->p_name : "?";
+	dest = prof_names[slot];
+	if (prof_nameproc[slot] == p) {
+		/* same process; see if it still has the same name */
+		for (i=0; i<PROF_NAMELEN-1 && src[i] != '\0' &&
+			     dest[i] == src[i]; i++) {
+			/* nothing */
+		}
+		if (dest[i] == '\0' &&
+		    (i == PROF_NAMELEN-1 || src[i] == '\0')) {
+			return;
+		}
+	}
+	prof_nameproc[slot] = p;
+	prof_namepid[slot] = p->p_pid;
+
+	for (i=0; i<PROF_NAMELEN-1 && src[i] != '\0'; i++) {
+		dest[i] = src[i];
+	}
+	dest[i] = '\0';
+}
+
+/*
+ * Record one sample. Called from the timer interrupt, so interrupts
+ * are already off and we can't be preempted off this CPU.
+ */
+void
+prof_sample(vaddr_t pc, bool user)
+{
+	struct prof_buf *pb;
+	struct proc *p;
+	uint32_t pid;
+	unsigned n;
+
+	if (curcpu->c_number >= prof_nbufs) {
+		return;
+	}
+	pb = prof_bufs[curcpu->c_number];
+
+	/* pairs with prof_stop: clear prof_enabled, then check pb_busy */
+	pb->pb_busy = true;
+	membar_any_any();
+	if (!prof_enabled) {
+		pb->pb_busy = false;
+		return;
+	}
+
+	pid = KERNEL_PID;
+	if (user) {
+		p = curthread->t_proc;
+		if (p != NULL) {
+			pid = p->p_pid;
+			prof_notename(p);
+		}
+	}
+
+	n = pb->pb_count;
+	if (n < PROF_NSAMPLES) {
+		pb->pb_recs[n].pr_pid = pid;
+		pb->pb_recs[n].pr_pc = pc;
+		pb->pb_count = n + 1;
+	}
+	else {
+		pb->pb_dropped++;
+	}
+
+	membar_any_store();
+	pb->pb_busy = false;
+}
+
+/*
+ * Turn sampling off and wait for any CPU that's in the middle of
+ * taking a sample to finish.
+ */
+static
+void
+prof_quiesce(void)
+{
+	unsigned i;
+
+	prof_enabled = false;
+	membar_any_any();
+	for (i=0; i<prof_nbufs; i++) {
+		while (prof_bufs[i]->pb_busy) {
+			membar_load_load();
+		}
+	}
+	membar_any_any();
+}
+
+////////////////////////////////////////////////////////////
+//
+// Dumping
+
+static
+bool
+prof_less(const struct prof_rec *a, const struct prof_rec *b)
+{
+	if (a->pr_pid != b->pr_pid) {
+		return a->pr_pid < b->pr_pid;
+	}
+	return a->pr_pc < b->pr_pc;
+}
+
+/*
+ * Sort a buffer by pid, then pc. Shell sort; it's in place and the
+ * buffers are not very big.
+ */
+static
+void
+prof_sort(struct prof_rec *recs, unsigned n)
+{
+	static const unsigned gaps[] = { 3905, 1073, 281, 77, 23, 8, 1 };
+	struct prof_rec tmp;
+	unsigned g, gap, i, j;
+
+	for (g=0; g<sizeof(gaps)/sizeof(gaps[0]); g++) {
+		gap = gaps[g];
+		for (i=gap; i<n; i++) {
+			tmp = recs[i];
+			for (j=i; j>=gap && prof_less(&tmp, &recs[j-gap]);
+			     j-=gap) {
+				recs[j] = recs[j-gap];
+			}
+			recs[j] = tmp;
+		}
+	}
+}
+
+/*
+ * Write LEN bytes of BUF to VN at *POS.
+ */
+static
+int
+prof_write(struct vnode *vn, off_t *pos, char *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	*pos = ku.uio_offset;
+	if (ku.uio_resid > 0) {
+		return ENOSPC;
+	}
+	return 0;
+}
+
+/*
+ * Write the histogram. Each buffer is sorted, and then they're merged,
+ * adding up the counts for equal (pid, pc) pairs. Must hold prof_lock
+ * with sampling stopped.
+ */
+static
+int
+prof_flush(struct vnode *vn, off_t *pos)
+{
+	char buf[512];
+	size_t len;
+	unsigned i, best, count, total, user, dropped, *next;
+	struct prof_rec cur;
+	int result;
+
+	KASSERT(lock_do_i_hold(prof_lock));
+
+	next = kmalloc(prof_nbufs * sizeof(next[0]));
+	if (next == NULL) {
+		return ENOMEM;
+	}
+
+	total = user = dropped = 0;
+	bzero(prof_seen, sizeof(prof_seen));
+	for (i=0; i<prof_nbufs; i++) {
+		prof_sort(prof_bufs[i]->pb_recs, prof_bufs[i]->pb_count);
+		next[i] = 0;
+		dropped += prof_bufs[i]->pb_dropped;
+	}
+
+	len = snprintf(buf, sizeof(buf), "# prof: %u cpus, %u Hz\n",
+		       prof_nbufs, HZ);
+	result = prof_write(vn, pos, buf, len);
+	if (result) {
+		goto done;
+	}
+
+	len = 0;
+	count = 0;
+	cur.pr_pid = cur.pr_pc = 0;
+	while (1) {
+		best = prof_nbufs;
+		for (i=0; i<prof_nbufs; i++) {
+			if (next[i] == prof_bufs[i]->pb_count) {
+				continue;
+			}
+			if (best == prof_nbufs ||
+			    prof_less(&prof_bufs[i]->pb_recs[next[i]],
+				      &prof_bufs[best]->pb_recs[next[best]])) {
+				best = i;
+			}
+		}
+		if (best < prof_nbufs) {
+			const struct prof_rec *rec;
+
+			rec = &prof_bufs[best]->pb_recs[next[best]++];
+			if (count > 0 && rec->pr_pid == cur.pr_pid &&
+			    rec->pr_pc == cur.pr_pc) {
+				count++;
+				continue;
+			}
+		}
+
+		/* emit the previous run, if any */
+		if (count > 0) {
+			if (len + 40 > sizeof(buf)) {
+				result = prof_write(vn, pos, buf, len);
+				if (result) {
+					goto done;
+				}
+				len = 0;
+			}
+			len += snprintf(buf + len, sizeof(buf) - len,
+					"%u %u 0x%08x\n",
+					count, cur.pr_pid, cur.pr_pc);
+			total += count;
+			if (cur.pr_pid != KERNEL_PID) {
+				user += count;
+			}
+			if (prof_nameproc[PROF_PIDSLOT(cur.pr_pid)] != NULL &&
+			    prof_namepid[PROF_PIDSLOT(cur.pr_pid)] ==
+			    cur.pr_pid) {
+				prof_seen[PROF_PIDSLOT(cur.pr_pid)] = true;
+			}
+		}
+
+		if (best == prof_nbufs) {
+			break;
+		}
+		cur = prof_bufs[best]->pb_recs[next[best] - 1];
+		count = 1;
+	}
+
+	/*
+	 * Process names, so user PCs can be matched with programs.
+	 * Kernel samples never go through prof_notename, so the
+	 * kernel gets its line here.
+	 */
+	if (total > user) {
+		if (len + PROF_NAMELEN + 20 > sizeof(buf)) {
+			result = prof_write(vn, pos, buf, len);
+			if (result) {
+				goto done;
+			}
+			len = 0;
+		}
+		len += snprintf(buf + len, sizeof(buf) - len, "# pid %u %s\n",
+				KERNEL_PID, KERNELPROC);
+	}
+	for (i=0; i<PROF_NPIDS; i++) {
+		if (!prof_seen[i]) {
+			continue;
+		}
+		if (len + PROF_NAMELEN + 20 > sizeof(buf)) {
+			result = prof_write(vn, pos, buf, len);
+			if (result) {
+				goto done;
+			}
+			len = 0;
+		}
+		len += snprintf(buf + len, sizeof(buf) - len, "# pid %u %s\n",
+				prof_namepid[i], prof_names[i]);
+	}
+	if (len > 0) {
+		result = prof_write(vn, pos, buf, len);
+	}
+
+	kprintf("prof: %u samples (%u kernel, %u user), %u dropped\n",
+		total, total - user, user, dropped);
+
+ done:
+	kfree(next);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Control
+
+/*
+ * Allocate the sample buffers. Called the first time profiling is
+ * started; by then all CPUs are online.
+ */
+static
+int
+prof_setup(void)
+{
+	unsigned i, n;
+
+	if (prof_bufs != NULL) {
+		return 0;
+	}
+
+	n = num_cpus;
+	prof_lock = lock_create("prof");
+	prof_bufs = kmalloc(n * sizeof(prof_bufs[0]));
+	if (prof_lock == NULL || prof_bufs == NULL) {
+		goto fail;
+	}
+	for (i=0; i<n; i++) {
+		prof_bufs[i] = kmalloc(sizeof(struct prof_buf));
+		if (prof_bufs[i] == NULL) {
+			goto fail;
+		}
+		prof_bufs[i]->pb_busy = false;
+		prof_bufs[i]->pb_count = 0;
+		prof_bufs[i]->pb_dropped = 0;
+	}
+
+	/* make the buffers visible before anyone can use them */
+	membar_store_store();
+	prof_nbufs = n;
+	return 0;
+
+ fail:
+	/* As with ktrace, don't bother unwinding. */
+	prof_bufs = NULL;
+	return ENOMEM;
+}
+
+int
+prof_start(void)
+{
+	unsigned i;
+	int result;
+
+	result = prof_setup();
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(prof_lock);
+	prof_quiesce();
+	for (i=0; i<prof_nbufs; i++) {
+		prof_bufs[i]->pb_count = 0;
+		prof_bufs[i]->pb_dropped = 0;
+	}
+	for (i=0; i<PROF_NPIDS; i++) {
+		prof_nameproc[i] = NULL;
+	}
+	membar_store_store();
+	prof_enabled = true;
+	lock_release(prof_lock);
+
+	return 0;
+}
+
+void
+prof_stop(void)
+{
+	if (prof_bufs == NULL) {
+		return;
+	}
+
+	lock_acquire(prof_lock);
+	prof_quiesce();
+	lock_release(prof_lock);
+}
+
+int
+prof_dump(char *path)
+{
+	struct vnode *vn;
+	off_t pos;
+	int result;
+
+	if (prof_bufs == NULL) {
+		kprintf("prof: nothing recorded\n");
+		return 0;
+	}
+
+	lock_acquire(prof_lock);
+	prof_quiesce();
+
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		lock_release(prof_lock);
+		return result;
+	}
+	pos = 0;
+	result = prof_flush(vn, &pos);
+	vfs_close(vn);
+	lock_release(prof_lock);
+
+	return result;
+}
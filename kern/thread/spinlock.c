@@ -38,6 +38,11 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+#include <mainbus.h>	/* for mainbus_cycles */
+#endif
 
 /*
  * Spinlocks.
@@ -52,6 +57,9 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&splk->splk_stat, NULL);
+#endif
 }
 
 /*
@@ -62,6 +70,24 @@ spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&splk->splk_stat);
+#endif
+}
+
+/*
+ * Give the lock a name for the lock statistics code. Unnamed spinlocks
+ * are not tracked.
+ */
+void
+spinlock_setname(struct spinlock *splk, const char *name)
+{
+#if OPT_LOCKSTAT
+	splk->splk_stat.ls_name = name;
+#else
+	(void)splk;
+	(void)name;
+#endif
 }
 
 /*
@@ -75,6 +101,10 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTAT
+	bool contended = false;
+	uint64_t waitstart = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -102,6 +132,13 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			if (!contended && mycpu != NULL &&
+			    splk->splk_stat.ls_name != NULL) {
+				contended = true;
+				waitstart = mainbus_cycles();
+			}
+#endif
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
@@ -112,6 +149,12 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (mycpu != NULL && splk->splk_stat.ls_name != NULL) {
+		lockstat_acquired(&splk->splk_stat, contended, waitstart);
+	}
+#endif
 }
 
 /*
@@ -125,6 +168,11 @@ spinlock_release(struct spinlock *splk)
 		KASSERT(splk->splk_holder == curcpu->c_self);
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
+#if OPT_LOCKSTAT
+		if (splk->splk_stat.ls_name != NULL) {
+			lockstat_released(&splk->splk_stat);
+		}
+#endif
 	}
 
 	splk->splk_holder = NULL;
@@ -38,7 +38,15 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
+#include <ktrace.h>
+#include <platform/maxcpus.h>
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+#include <mainbus.h>
+#endif
 
 ////////////////////////////////////////////////////////////
 //
@@ -164,6 +172,9 @@ lock_create(const char *name)
 	spinlock_init(&lock->lk_splock);
 	lock->lk_locked = false;
 	lock->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&lock->lk_stat, lock->lk_name);
+#endif
 
 	return lock;
 }
@@ -174,6 +185,9 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock->lk_holder == NULL);
 
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&lock->lk_stat);
+#endif
 	spinlock_cleanup(&lock->lk_splock);
 	wchan_destroy(lock->lk_wchan);
 	kfree(lock->lk_name);
@@ -183,18 +197,36 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	bool contended;
+#if OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+#endif
+
 	KASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&lock->lk_splock);
+	contended = lock->lk_locked;
+	if (contended) {
+		KTRACE(KTR_LOCKWAIT, lock, lock->lk_holder);
+#if OPT_LOCKSTAT
+		waitstart = mainbus_cycles();
+#endif
+	}
 	while(lock->lk_locked){
 		wchan_sleep(lock->lk_wchan,&lock->lk_splock);
 	}
+	if (contended) {
+		KTRACE(KTR_LOCKACQ, lock, 0);
+	}
 	
 	KASSERT(lock->lk_locked == false);
 	KASSERT(lock->lk_holder == NULL);
 	lock->lk_locked = true;
 	lock->lk_holder = curthread;
+#if OPT_LOCKSTAT
+	lockstat_acquired(&lock->lk_stat, contended, waitstart);
+#endif
 	spinlock_release(&lock->lk_splock);
 }
 
@@ -206,6 +238,9 @@ lock_release(struct lock *lock)
 	KASSERT(lock->lk_holder == curthread);
 
 	spinlock_acquire(&lock->lk_splock);
+#if OPT_LOCKSTAT
+	lockstat_released(&lock->lk_stat);
+#endif
 	
 	lock->lk_locked = false;
 	lock->lk_holder = NULL;
@@ -316,3 +351,336 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(spinlock_do_i_hold(&cv->cv_splock) == false);
 	KASSERT(lock_do_i_hold(lock));
 }
+
+////////////////////////////////////////////////////////////
+//
+// RW lock.
+
+/*
+ * One CPU's reader count. These are spaced RWLOCK_CPUSTRIDE bytes
+ * apart so that each has a cache line to itself. The readers counted
+ * here are not necessarily on this CPU any more (see synch.h); the
+ * CPU only decides which count a reader uses.
+ */
+struct rwlock_cpu {
+	struct spinlock rc_lock;
+	volatile int rc_readers;
+};
+
+#define RWLOCK_CACHELINE	64
+#define RWLOCK_CPUSTRIDE \
+	ROUNDUP(sizeof(struct rwlock_cpu), RWLOCK_CACHELINE)
+
+static
+struct rwlock_cpu *
+rwlock_getcpu(struct rwlock *rw, unsigned num)
+{
+	KASSERT(num < rw->rw_ncpus);
+	return (struct rwlock_cpu *)((char *)rw->rw_cpus +
+				     num * RWLOCK_CPUSTRIDE);
+}
+
+/*
+ * The count for the CPU we're on. If we're preempted and moved right
+ * after looking, we just use another CPU's count.
+ */
+static
+struct rwlock_cpu *
+rwlock_mycpu(struct rwlock *rw)
+{
+	return rwlock_getcpu(rw, CURCPU_EXISTS() ? curcpu->c_number : 0);
+}
+
+/*
+ * Add up the readers. A reader changes its count only while holding
+ * that count's spinlock, and checks rw_writerwait while it does; so
+ * if rw_writerwait was set before we call this, any reader we don't
+ * see here will see it.
+ *
+ * Only the counts of CPUs that exist are ever used, so once the CPUs
+ * have been counted that's all we look at, even for a lock made
+ * before then with room for MAXCPUS.
+ */
+static
+int
+rwlock_readers(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+	unsigned i, n;
+	int total;
+
+	n = rw->rw_ncpus;
+	if (num_cpus > 0 && num_cpus < n) {
+		n = num_cpus;
+	}
+
+	total = 0;
+	for (i=0; i<n; i++) {
+		rc = rwlock_getcpu(rw, i);
+		spinlock_acquire(&rc->rc_lock);
+		total += rc->rc_readers;
+		spinlock_release(&rc->rc_lock);
+	}
+	KASSERT(total >= 0);
+	return total;
+}
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+	struct rwlock_cpu *rc;
+	unsigned i;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		goto fail;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rwlock_name);
+	rw->rw_writewchan = wchan_create(rw->rwlock_name);
+	rw->rw_drainwchan = wchan_create(rw->rwlock_name);
+	/* Before thread_start_cpus we don't know how many there are. */
+	rw->rw_ncpus = num_cpus > 0 ? num_cpus : MAXCPUS;
+	rw->rw_cpus = kmalloc(rw->rw_ncpus * RWLOCK_CPUSTRIDE);
+	if (rw->rw_readwchan == NULL || rw->rw_writewchan == NULL ||
+	    rw->rw_drainwchan == NULL || rw->rw_cpus == NULL) {
+		goto fail;
+	}
+
+	for (i=0; i<rw->rw_ncpus; i++) {
+		rc = rwlock_getcpu(rw, i);
+		spinlock_init(&rc->rc_lock);
+		rc->rc_readers = 0;
+	}
+	rw->rw_writer = NULL;
+	rw->rw_writerswaiting = 0;
+	rw->rw_writerwait = false;
+	spinlock_init(&rw->rw_lock);
+#if OPT_LOCKSTAT
+	lockstat_init(&rw->rw_stat, rw->rwlock_name);
+#endif
+
+	return rw;
+
+ fail:
+	if (rw->rwlock_name != NULL) {
+		if (rw->rw_readwchan != NULL) {
+			wchan_destroy(rw->rw_readwchan);
+		}
+		if (rw->rw_writewchan != NULL) {
+			wchan_destroy(rw->rw_writewchan);
+		}
+		if (rw->rw_drainwchan != NULL) {
+			wchan_destroy(rw->rw_drainwchan);
+		}
+		if (rw->rw_cpus != NULL) {
+			kfree(rw->rw_cpus);
+		}
+		kfree(rw->rwlock_name);
+	}
+	kfree(rw);
+	return NULL;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	unsigned i;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writerswaiting == 0);
+	KASSERT(rwlock_readers(rw) == 0);
+
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&rw->rw_stat);
+#endif
+	for (i=0; i<rw->rw_ncpus; i++) {
+		spinlock_cleanup(&rwlock_getcpu(rw, i)->rc_lock);
+	}
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_readwchan);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_drainwchan);
+	kfree(rw->rw_cpus);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+#if OPT_NOASSERTS
+#define rwlock_addhold(rw) ((void)(rw))
+#define rwlock_removehold(rw) ((void)(rw))
+#else
+/*
+ * Record that curthread holds RW for reading.
+ */
+static
+void
+rwlock_addhold(struct rwlock *rw)
+{
+	struct thread *t = curthread;
+
+	if (t->t_nrwheld < THREAD_RWHELD) {
+		t->t_rwheld[t->t_nrwheld++] = rw;
+	}
+	else {
+		t->t_rwuntracked++;
+	}
+}
+
+/*
+ * Forget one read hold of RW by curthread, which had better have one.
+ * If some holds weren't tracked, one of those might be it.
+ */
+static
+void
+rwlock_removehold(struct rwlock *rw)
+{
+	struct thread *t = curthread;
+	unsigned i;
+
+	for (i=0; i<t->t_nrwheld; i++) {
+		if (t->t_rwheld[i] == rw) {
+			t->t_rwheld[i] = t->t_rwheld[--t->t_nrwheld];
+			return;
+		}
+	}
+	KASSERT(t->t_rwuntracked > 0);
+	t->t_rwuntracked--;
+}
+#endif
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/* Fast path: no writer around, just count ourselves. */
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	if (!rw->rw_writerwait) {
+		rc->rc_readers++;
+		spinlock_release(&rc->rc_lock);
+		rwlock_addhold(rw);
+		return;
+	}
+	spinlock_release(&rc->rc_lock);
+
+	/*
+	 * Wait until no writer holds or wants the lock. Writers only
+	 * set rw_writerwait while holding rw_lock, so counting
+	 * ourselves before letting go of rw_lock means the next
+	 * writer will see us.
+	 */
+	spinlock_acquire(&rw->rw_lock);
+	while (rw->rw_writerwait) {
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+	}
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	rc->rc_readers++;
+	spinlock_release(&rc->rc_lock);
+	spinlock_release(&rw->rw_lock);
+	rwlock_addhold(rw);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+	bool writerwait;
+
+	KASSERT(rw != NULL);
+
+	rwlock_removehold(rw);
+
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	rc->rc_readers--;
+	writerwait = rw->rw_writerwait;
+	spinlock_release(&rc->rc_lock);
+
+	if (writerwait) {
+		/* The writer rechecks the total. */
+		spinlock_acquire(&rw->rw_lock);
+		wchan_wakeall(rw->rw_drainwchan, &rw->rw_lock);
+		spinlock_release(&rw->rw_lock);
+	}
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	bool contended;
+#if OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+#endif
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	/* Hold off new readers from here on. */
+	rw->rw_writerwait = true;
+
+	contended = rw->rw_writer != NULL || rwlock_readers(rw) > 0;
+	if (contended) {
+		KTRACE(KTR_LOCKWAIT, rw, rw->rw_writer);
+#if OPT_LOCKSTAT
+		waitstart = mainbus_cycles();
+#endif
+	}
+
+	while (rw->rw_writer != NULL) {
+		rw->rw_writerswaiting++;
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+		rw->rw_writerswaiting--;
+	}
+	rw->rw_writer = curthread;
+
+	/* Wait for the readers already in to leave. */
+	while (rwlock_readers(rw) > 0) {
+		wchan_sleep(rw->rw_drainwchan, &rw->rw_lock);
+	}
+
+	if (contended) {
+		KTRACE(KTR_LOCKACQ, rw, 0);
+	}
+#if OPT_LOCKSTAT
+	lockstat_acquired(&rw->rw_stat, contended, waitstart);
+#endif
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+#if OPT_LOCKSTAT
+	lockstat_released(&rw->rw_stat);
+#endif
+	rw->rw_writer = NULL;
+	if (rw->rw_writerswaiting > 0) {
+		/* Writers first; rw_writerwait stays set. */
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	else {
+		rw->rw_writerwait = false;
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
@@ -50,6 +50,8 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <ktrace.h>
+#include <membar.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -151,6 +153,12 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+#if !OPT_NOASSERTS
+	thread->t_nrwheld = 0;
+	thread->t_rwuntracked = 0;
+#endif
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -187,10 +195,14 @@ cpu_create(unsigned hardware_number)
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
@@ -665,6 +677,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	KTRACE(KTR_SWITCH, cur, next);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -805,10 +819,13 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process. proc_exit has already done this
+	 * for user processes, since the parent may destroy the proc
+	 * as soon as it learns we've exited.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -1038,6 +1055,7 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+	KTRACE(KTR_SLEEP, wc, 0);
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
 }
@@ -1060,6 +1078,8 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		return;
 	}
 
+	KTRACE(KTR_WAKEUP, wc, target);
+
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
 	 * while we're holding LK. This is ok; all spinlocks
@@ -1098,6 +1118,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		KTRACE(KTR_WAKEUP, wc, target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1153,26 +1174,122 @@ ipi_broadcast(int code)
 	}
 }
 
-void
+/*
+ * Queue a TLB shootdown on another CPU. If it can be combined with
+ * one already queued there, it is; if the queue is full, the target
+ * flushes everything instead. Returns a ticket for
+ * ipi_tlbshootdown_wait.
+ */
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	int i, n;
+	unsigned ticket;
+
+	KASSERT(target != curcpu->c_self);
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	if (n != TLBSHOOTDOWN_ALL) {
+		for (i=0; i<n; i++) {
+			if (vm_tlbshootdown_merge(&target->c_shootdown[i],
+						  mapping)) {
+				break;
+			}
+		}
+		if (i < n) {
+			/* merged */
+		}
+		else if (n == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+		}
+		else {
+			target->c_shootdown[n] = *mapping;
+			target->c_numshootdown = n+1;
+		}
 	}
+	ticket = ++target->c_shootdown_seq;
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	if ((target->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN)) == 0) {
+		/* otherwise an IPI is already on its way */
+		target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+		mainbus_send_ipi(target);
+	}
 
 	spinlock_release(&target->c_ipi_lock);
+	return ticket;
+}
+
+/*
+ * Wait for TARGET to finish the shootdown that returned TICKET. This
+ * just watches TARGET's acknowledgment count; no locks are taken.
+ * Interrupts must be on so that we can in turn answer shootdowns
+ * aimed at us while we wait; otherwise two CPUs shooting at each
+ * other would deadlock.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	KASSERT(curcpu->c_spinlocks == 0);
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	/* (the subtraction handles wraparound) */
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		/* spin */
+	}
+	membar_any_any();
+}
+
+/*
+ * Shoot down MAPPING on every CPU in CPUMASK, then wait for all of
+ * them. All the IPIs are sent before any waiting so the targets work
+ * in parallel.
+ *
+ * Sending and the local shootdown are done at splhigh so we can't
+ * migrate in the middle: otherwise we might skip the CPU we started
+ * on, or send an IPI to the one we end up on. The wait has to be done
+ * with interrupts on (see ipi_tlbshootdown_wait), so it only looks at
+ * the CPUs that were actually sent to, and doesn't care where we are
+ * by then.
+ */
+void
+ipi_tlbshootdown_cpus(uint32_t cpumask, const struct tlbshootdown *mapping)
+{
+	unsigned i, num, self;
+	unsigned tickets[32];
+	uint32_t sent;
+	struct cpu *c;
+	int spl;
+
+	num = cpuarray_num(&allcpus);
+	KASSERT(num <= 32);
+
+	/* make the caller's mapping changes visible before we look */
+	membar_any_any();
+
+	sent = 0;
+	spl = splhigh();
+	self = curcpu->c_number;
+	for (i=0; i<num; i++) {
+		if ((cpumask & ((uint32_t)1 << i)) == 0 || i == self) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		tickets[i] = ipi_tlbshootdown(c, mapping);
+		sent |= (uint32_t)1 << i;
+	}
+	if (cpumask & ((uint32_t)1 << self)) {
+		vm_tlbshootdown(mapping);
+	}
+	splx(spl);
+
+	for (i=0; i<num; i++) {
+		if (sent & ((uint32_t)1 << i)) {
+			ipi_tlbshootdown_wait(cpuarray_get(&allcpus, i),
+					      tickets[i]);
+		}
+	}
 }
 
 void
@@ -1216,6 +1333,9 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		/* acknowledge everything that was queued */
+		membar_any_any();
+		curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <vm.h>
 
 /*
  * Structure for a single named device.
@@ -87,6 +88,18 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * knowndevs_lock protects knowndevs and what's in it, including which
+ * filesystem is mounted where. Name lookups (vfs_getroot, which every
+ * device:path lookup goes through, and vfs_getdevname) only read it,
+ * and adding devices and mounting and unmounting are rare, so it is
+ * a reader-writer lock.
+ *
+ * It comes before vfs_biglock: don't look up devices while holding
+ * the big lock, and take the write lock before the big lock.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -102,6 +115,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -155,6 +172,7 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+	rwlock_acquire_read(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -166,22 +184,22 @@ vfs_sync(void)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_read(knowndevs_lock);
 
 	return 0;
 }
 
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * back an appropriate vnode. Call with knowndevs_lock held.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **ret)
+vfs_dogetroot(const char *devname, struct vnode **ret)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -250,6 +268,19 @@ vfs_getroot(const char *devname, struct vnode **ret)
 	return ENODEV;
 }
 
+int
+vfs_getroot(const char *devname, struct vnode **ret)
+{
+	int result;
+
+	KASSERT(!vfs_biglock_do_i_hold());
+
+	rwlock_acquire_read(knowndevs_lock);
+	result = vfs_dogetroot(devname, ret);
+	rwlock_release_read(knowndevs_lock);
+	return result;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
@@ -257,12 +288,15 @@ const char *
 vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
+	const char *name;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(!vfs_biglock_do_i_hold());
 
+	name = NULL;
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -274,11 +308,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -378,6 +414,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	unsigned index;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	name = kstrdup(dname);
@@ -431,6 +468,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return 0;
 
  fail:
@@ -448,6 +486,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -520,16 +559,19 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
 	if (result) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return EBUSY;
 	}
 	KASSERT(kd->kd_rawname != NULL);
@@ -538,6 +580,7 @@ vfs_mount(const char *devname, void *data,
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
 		vfs_biglock_release();
+		rwlock_release_write(knowndevs_lock);
 		return result;
 	}
 
@@ -550,12 +593,14 @@ vfs_mount(const char *devname, void *data,
 		volname ? volname : kd->kd_name, kd->kd_name);
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return 0;
 }
 
 /*
  * Unmount a filesystem/device by name.
- * First calls FSOP_SYNC on the filesystem; then calls FSOP_UNMOUNT.
+ * First drops cached program text from it (vm_purgetext) and calls
+ * FSOP_SYNC on the filesystem; then calls FSOP_UNMOUNT.
  */
 int
 vfs_unmount(const char *devname)
@@ -563,6 +608,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -577,6 +623,12 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/*
+	 * Let go of cached program text, which holds vnodes. Do it
+	 * first, since reclaiming them may change the fs.
+	 */
+	vm_purgetext(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -597,6 +649,7 @@ vfs_unmount(const char *devname)
 
  fail:
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -610,6 +663,7 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	rwlock_acquire_write(knowndevs_lock);
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -626,6 +680,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vm_purgetext(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -662,6 +718,7 @@ vfs_unmountall(void)
 	}
 
 	vfs_biglock_release();
+	rwlock_release_write(knowndevs_lock);
 
 	return 0;
 }
@@ -50,6 +50,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	spinlock_init(&vn->vn_countlock);
+	vn->vn_textcount = 0;
+	vn->vn_writecount = 0;
+	vn->vn_writegen = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -62,6 +65,8 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	KASSERT(vn->vn_textcount == 0);
+	KASSERT(vn->vn_writecount == 0);
 
 	spinlock_cleanup(&vn->vn_countlock);
 
@@ -122,6 +127,104 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Start a write or truncate: refuse if the file is running as text.
+ */
+static
+int
+vnode_startwrite(struct vnode *vn)
+{
+	int result = 0;
+
+	spinlock_acquire(&vn->vn_countlock);
+	if (vn->vn_textcount > 0) {
+		result = ETXTBSY;
+	}
+	else {
+		vn->vn_writecount++;
+	}
+	spinlock_release(&vn->vn_countlock);
+	return result;
+}
+
+/*
+ * Finish a write or truncate. Whether or not it succeeded, it may
+ * have changed the file.
+ */
+static
+void
+vnode_endwrite(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	KASSERT(vn->vn_writecount > 0);
+	vn->vn_writecount--;
+	vn->vn_writegen++;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = vnode_startwrite(vn);
+	if (result) {
+		return result;
+	}
+	result = __VOP(vn, write)(vn, uio);
+	vnode_endwrite(vn);
+	return result;
+}
+
+/*
+ * VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = vnode_startwrite(vn);
+	if (result) {
+		return result;
+	}
+	result = __VOP(vn, truncate)(vn, pos);
+	vnode_endwrite(vn);
+	return result;
+}
+
+/*
+ * Mark the file busy as program text. While it is, vn_writegen can't
+ * change.
+ */
+int
+vnode_textref(struct vnode *vn)
+{
+	int result = 0;
+
+	spinlock_acquire(&vn->vn_countlock);
+	if (vn->vn_writecount > 0) {
+		result = ETXTBSY;
+	}
+	else {
+		vn->vn_textcount++;
+	}
+	spinlock_release(&vn->vn_countlock);
+	return result;
+}
+
+void
+vnode_textunref(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	KASSERT(vn->vn_textcount > 0);
+	vn->vn_textcount--;
+	spinlock_release(&vn->vn_countlock);
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
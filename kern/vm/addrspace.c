@@ -180,3 +180,25 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, ssize_t amount, vaddr_t *oldbreak)
+{
+	/*
+	 * Write this.
+	 */
+
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
+void
+vm_purgetext(struct fs *fs)
+{
+	/*
+	 * Write this, if you cache anything from files.
+	 */
+
+	(void)fs;
+}
@@ -0,0 +1,13 @@
+---
+name: "Futex Handoff Test"
+description:
+  Two kernel threads take turns on one futex word, sleeping in futex_wait
+  and waking each other with futex_wake.
+tags: [synch, futex, kleaks]
+depends: [boot, semaphores]
+sys161:
+  cpus: 2
+---
+khu
+fxt1
+khu
@@ -0,0 +1,12 @@
+---
+name: "ASID Test"
+description: >
+  Checks that processes running one after another, or taking turns,
+  never see each other's memory through stale TLB entries.
+tags: [vm]
+depends: [console]
+sys161:
+  cpus: 2
+  ram: 4M
+---
+p /testbin/asidtest
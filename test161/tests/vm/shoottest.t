@@ -0,0 +1,12 @@
+---
+name: "TLB Shootdown Test"
+description: >
+  Checks that heap pages given back with sbrk can no longer be touched,
+  whichever CPUs the process ran on while it was using them.
+tags: [vm]
+depends: [console]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+p /testbin/shoottest
@@ -0,0 +1,11 @@
+---
+name: "Text Busy Test"
+description: >
+  Checks that a program can't be written to or truncated while it is
+  running, and that its cached text isn't reused once it has changed.
+tags: [vm]
+depends: [console]
+sys161:
+  ram: 4M
+---
+p /testbin/txtbusy
@@ -27,7 +27,7 @@
  * SUCH DAMAGE.
  */
 
-#include <unistd.h>
+#include <stdio.h>
 #include <string.h>
 #include <err.h>
 
@@ -41,35 +41,25 @@
 /* Print a file that's already been opened. */
 static
 void
-docat(const char *name, int fd)
+docat(const char *name, FILE *f)
 {
-	char buf[1024];
-	int len, wr, wrtot;
+	char buf[BUFSIZ];
+	size_t len;
 
 	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * fread only comes back short at EOF or on an error, and fwrite
+	 * only comes back short on an error; stdio takes care of
+	 * looping over partial reads and writes.
 	 */
-	while ((len = read(fd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+		if (fwrite(buf, 1, len, stdout) != len) {
+			err(1, "stdout");
 		}
 	}
 	/*
 	 * If we got a read error, print it and exit.
 	 */
-	if (len<0) {
+	if (ferror(f)) {
 		err(1, "%s", name);
 	}
 }
@@ -79,13 +69,13 @@ static
 void
 cat(const char *file)
 {
-	int fd;
+	FILE *f;
 
 	/*
 	 * "-" means print stdin.
 	 */
 	if (!strcmp(file, "-")) {
-		docat("stdin", STDIN_FILENO);
+		docat("stdin", stdin);
 		return;
 	}
 
@@ -93,12 +83,12 @@ cat(const char *file)
 	 * Open the file, print it, and close it.
 	 * Bail out if we can't open it.
 	 */
-	fd = open(file, O_RDONLY);
-	if (fd<0) {
+	f = fopen(file, "r");
+	if (f == NULL) {
 		err(1, "%s", file);
 	}
-	docat(file, fd);
-	close(fd);
+	docat(file, f);
+	fclose(f);
 }
 
 
@@ -107,7 +97,7 @@ main(int argc, char *argv[])
 {
 	if (argc==1) {
 		/* No args - just do stdin */
-		docat("stdin", STDIN_FILENO);
+		docat("stdin", stdin);
 	}
 	else {
 		/* Print all the files specified on the command line. */
@@ -116,5 +106,8 @@ main(int argc, char *argv[])
 			cat(argv[i]);
 		}
 	}
+	if (fflush(stdout)) {
+		err(1, "stdout");
+	}
 	return 0;
 }
@@ -421,11 +421,15 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child only execs, so there's no need to copy our
+	 * address space for it.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
@@ -483,6 +487,10 @@ docommand(char *buf, struct exitinfo *ei)
  *
  * if there's an invalid character or a backspace when there's nothing
  * in the buffer, putchars an alert (bell).
+ *
+ * The console normally hands out input a line at a time, which would
+ * keep us from echoing as the user types; so put it in raw mode while
+ * we're reading, and back in cooked mode for the command we run.
  */
 static
 void
@@ -490,6 +498,12 @@ getcmd(char *buf, size_t len)
 {
 	size_t pos = 0;
 	int done=0, ch;
+#ifdef CONIOC_SETMODE
+	int mode, raw;
+
+	mode = CON_RAW;
+	raw = ioctl(STDIN_FILENO, CONIOC_SETMODE, &mode) == 0;
+#endif
 
 	/*
 	 * In the absence of a <ctype.h>, assume input is 7-bit ASCII.
@@ -518,6 +532,13 @@ getcmd(char *buf, size_t len)
 		}
 	}
 	buf[pos] = 0;
+
+#ifdef CONIOC_SETMODE
+	if (raw) {
+		mode = CON_COOKED;
+		ioctl(STDIN_FILENO, CONIOC_SETMODE, &mode);
+	}
+#endif
 }
 
 /*
@@ -41,8 +41,12 @@
  * behind. To avoid unnecessary noise (e.g. on emufs) we won't
  * complain about this.
  *
+ * Input, output, and the index notes go through stdio; the data
+ * scratch file is read and written in big blocks anyway, and is
+ * accessed with plain system calls.
+ *
  * This program uses these system calls:
- *    getpid open read write lseek close remove _exit
+ *    getpid open read write lseek fstat close remove _exit
  */
 
 #include <stdio.h>
@@ -59,6 +63,7 @@ struct indexentry {
 };
 
 static int datafd = -1, indexfd = -1;
+static FILE *indexf;
 static char dataname[64], indexname[64];
 
 static char buf[4096];
@@ -115,6 +120,15 @@ dowrite(int fd, const char *name, const void *buf, size_t len)
 	}
 }
 
+static
+void
+writeindex(const struct indexentry *x)
+{
+	if (fwrite(x, sizeof(*x), 1, indexf) != 1) {
+		err(1, "%s: write", indexname);
+	}
+}
+
 static
 off_t
 dolseek(int fd, const char *name, off_t pos, int whence)
@@ -135,28 +149,30 @@ static
 void
 readfile(const char *name)
 {
-	int fd, closefd;
+	FILE *f;
 	struct indexentry x;
 	size_t len, remaining, here;
 	const char *s, *t;
 	
 	if (name == NULL || !strcmp(name, "-")) {
-		fd = STDIN_FILENO;
-		closefd = -1;
+		name = "stdin";
+		f = stdin;
 	}
 	else {
-		fd = open(name, O_RDONLY);
-		if (fd < 0) {
+		f = fopen(name, "r");
+		if (f == NULL) {
 			err(1, "%s", name);
 		}
-		closefd = fd;
 	}
 
 	x.pos = 0;
 	x.len = 0;
 	while (1) {
-		len = doread(fd, name, buf, sizeof(buf));
+		len = fread(buf, 1, sizeof(buf), f);
 		if (len == 0) {
+			if (ferror(f)) {
+				err(1, "%s: read", name);
+			}
 			break;
 		}
 
@@ -168,7 +184,7 @@ readfile(const char *name)
 				here = (t - s);
 				x.len += here;
 				remaining -= here;
-				dowrite(indexfd, indexname, &x, sizeof(x));
+				writeindex(&x);
 				x.pos += x.len;
 				x.len = 0;
 			}
@@ -179,11 +195,11 @@ readfile(const char *name)
 		dowrite(datafd, dataname, buf, len);
 	}
 	if (x.len > 0) {
-		dowrite(indexfd, indexname, &x, sizeof(x));
+		writeindex(&x);
 	}
 
-	if (closefd != -1) {
-		close(closefd);
+	if (f != stdin) {
+		fclose(f);
 	}
 }
 
@@ -195,6 +211,10 @@ dumpdata(void)
 	off_t indexsize, pos, done;
 	size_t amount, len;
 
+	/* from here on the index is read with system calls */
+	if (fflush(indexf)) {
+		err(1, "%s: write", indexname);
+	}
 	indexsize = dolseek(indexfd, indexname, 0, SEEK_CUR);
 	pos = indexsize;
 	while (1) {
@@ -221,9 +241,14 @@ dumpdata(void)
 				errx(1, "%s: read: Unexpected short count"
 				     " %zu of %zu", dataname, len, amount);
 			}
-			dowrite(STDOUT_FILENO, "stdout", buf, len);
+			if (fwrite(buf, 1, len, stdout) != len) {
+				err(1, "stdout");
+			}
 		}
 	}
+	if (fflush(stdout)) {
+		err(1, "stdout");
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -260,6 +285,10 @@ openfiles(void)
 
 	snprintf(indexname, sizeof(indexname), ".tmp.tacindex.%d", (int)pid);
 	indexfd = openscratch(indexname, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	indexf = fdopen(indexfd, "r+");
+	if (indexf == NULL) {
+		err(1, "%s", indexname);
+	}
 }
 
 static
@@ -267,7 +296,8 @@ void
 closefiles(void)
 {
 	close(datafd);
-	close(indexfd);
+	fclose(indexf);		/* closes indexfd */
+	indexf = NULL;
 	indexfd = datafd = -1;
 }
 
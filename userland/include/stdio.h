@@ -41,6 +41,91 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Buffered I/O streams.
+ *
+ * stdout is line-buffered unless it turns out to be a regular file,
+ * in which case it's fully buffered; stderr is unbuffered; streams
+ * from fopen are fully buffered. Reading from any stream first
+ * flushes stdout if it's line-buffered, so prompts appear. All
+ * streams are flushed by exit(), and by fork() so that the child
+ * doesn't inherit a copy of pending output.
+ *
+ * The fields are for libc internal use only.
+ */
+struct __file {
+	int f_fd;			/* file handle */
+	unsigned f_flags;		/* __SRD etc.; 0 if slot unused */
+	char *f_buf;			/* buffer */
+	size_t f_bufsize;		/* size of buffer */
+	size_t f_pos;			/* next byte to read, or bytes to write */
+	size_t f_len;			/* bytes in buffer when reading */
+	char f_nbuf[1];			/* buffer for unbuffered streams */
+};
+typedef struct __file FILE;
+
+#define __SRD	0x0001		/* may read */
+#define __SWR	0x0002		/* may write */
+#define __SREADING 0x0004	/* buffer holds read-ahead */
+#define __SWRITING 0x0008	/* buffer holds unwritten output */
+#define __SEOF	0x0010		/* hit end of file */
+#define __SERR	0x0020		/* hit an error */
+#define __SLBF	0x0040		/* line-buffered */
+#define __SNBF	0x0080		/* unbuffered */
+#define __SMBF	0x0100		/* f_buf came from malloc */
+#define __SPROBE 0x0200		/* check with fstat before first use */
+
+extern FILE __stdio_files[];
+#define stdin	(&__stdio_files[0])
+#define stdout	(&__stdio_files[1])
+#define stderr	(&__stdio_files[2])
+
+#define BUFSIZ		4096	/* default buffer size */
+#define FOPEN_MAX	20	/* max open streams, including the std ones */
+
+/* Arguments for setvbuf */
+#define _IOFBF	0		/* fully buffered */
+#define _IOLBF	1		/* line-buffered */
+#define _IONBF	2		/* unbuffered */
+
+FILE *fopen(const char *path, const char *mode);
+FILE *fdopen(int fd, const char *mode);
+int fclose(FILE *f);
+int fflush(FILE *f);			/* NULL means all streams */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+
+size_t fread(void *buf, size_t size, size_t nitems, FILE *f);
+size_t fwrite(const void *buf, size_t size, size_t nitems, FILE *f);
+int fgetc(FILE *f);
+int fputc(int ch, FILE *f);
+char *fgets(char *buf, int len, FILE *f);
+int fputs(const char *str, FILE *f);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
+
+int feof(FILE *f);
+int ferror(FILE *f);
+void clearerr(FILE *f);
+int fileno(FILE *f);
+
+#define getc(f) fgetc(f)
+#define putc(ch, f) fputc(ch, f)
+
+/*
+ * Stream internals
+ * (for libc internal use only)
+ *    __stdio_setup   - finish setting up a stream before its first use.
+ *    __stdio_fill    - refill a stream's read buffer; returns the
+ *                      number of bytes now buffered, 0 at EOF or error.
+ *    __stdio_flush   - write out a stream's output buffer, or drop its
+ *                      read-ahead; returns 0 or EOF.
+ *    __stdio_exit    - flush everything, for exit().
+ */
+void __stdio_setup(FILE *f);
+size_t __stdio_fill(FILE *f);
+int __stdio_flush(FILE *f);
+void __stdio_exit(void);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -39,6 +39,7 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
@@ -141,6 +142,13 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+/*
+ * vfork: the child runs in the parent's memory, and the parent is
+ * suspended, until the child calls execv or _exit. The child must not
+ * return from the function that called vfork, and should leave stdio
+ * alone.
+ */
+pid_t vfork(void);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
@@ -148,6 +156,11 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+/*
+ * futex: FUTEX_WAIT or FUTEX_WAKE on the word at ADDR (see
+ * kern/futex.h). Meant to be used through the locks in <usync.h>.
+ */
+int futex(volatile int *addr, int op, int val);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -159,4 +172,11 @@ int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
+/*
+ * fork (above) is also a wrapper: it flushes stdio so the child
+ * doesn't inherit a copy of pending output, then calls the real
+ * system call, __fork.
+ */
+pid_t __fork(void);
+
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,38 @@
+#ifndef _USYNC_H_
+#define _USYNC_H_
+
+/*
+ * Userland mutexes and condition variables (libusync).
+ *
+ * These live in ordinary memory and only call into the kernel (with
+ * futex()) when a thread actually has to wait or be woken, so taking
+ * and releasing an uncontended mutex costs no system calls. Any
+ * processes that share the memory can use them.
+ *
+ * A mutex's state is 0 (unlocked), 1 (locked), or 2 (locked, and
+ * there may be waiters). A condition variable is a sequence number
+ * that's bumped on every signal.
+ */
+
+struct umutex {
+	volatile int um_state;
+};
+
+struct ucond {
+	volatile int uc_seq;
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+#define UCOND_INITIALIZER	{ 0 }
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+int umutex_trylock(struct umutex *m);	/* 0 on success, else EBUSY */
+void umutex_unlock(struct umutex *m);
+
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+void ucond_signal(struct ucond *c);
+void ucond_broadcast(struct ucond *c);
+
+#endif /* _USYNC_H_ */
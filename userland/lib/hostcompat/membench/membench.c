@@ -0,0 +1,352 @@
+/*
+ * membench - host-side check and benchmark for the OS/161 memcpy,
+ * memmove, and memset in common/libc/string.
+ *
+ * The OS/161 versions are compiled in under other names so they can
+ * be run side by side with the host C library and a plain byte loop.
+ * First every function is checked against the byte loop over a range
+ * of lengths, alignments, and (for memmove) overlaps; then throughput
+ * is measured for each size class and alignment case.
+ *
+ * Usage: membench [-q]
+ *    -q   quick run (fewer iterations)
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>	/* must come before the renames below */
+#include <err.h>
+
+#include "hostcompat.h"
+
+void *os161_memcpy(void *dst, const void *src, size_t len);
+void *os161_memmove(void *dst, const void *src, size_t len);
+void *os161_memset(void *ptr, int ch, size_t len);
+
+#define memcpy os161_memcpy
+#define memmove os161_memmove
+#define memset os161_memset
+#include "../../../../common/libc/string/memcpy.c"
+#undef WSIZE
+#undef WMASK
+#undef WBITS
+#undef BLOCK
+#undef MERGE
+#include "../../../../common/libc/string/memmove.c"
+#undef WSIZE
+#undef BLOCK
+#include "../../../../common/libc/string/memset.c"
+#undef memcpy
+#undef memmove
+#undef memset
+
+/* Largest size class, plus slop for misalignment and guard bytes. */
+#define MAXSIZE		65536
+#define BUFSIZE		(MAXSIZE + 64)
+
+static unsigned char *srcbuf, *dstbuf, *refbuf;
+
+/*
+ * Byte-at-a-time reference versions. These are also what the old
+ * code did for anything not entirely word-aligned.
+ */
+static
+void *
+byte_memcpy(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		d[i] = s[i];
+	}
+	return dst;
+}
+
+static
+void *
+byte_memmove(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	size_t i;
+
+	if ((uintptr_t)d < (uintptr_t)s) {
+		return byte_memcpy(dst, src, len);
+	}
+	for (i=len; i>0; i--) {
+		d[i-1] = s[i-1];
+	}
+	return dst;
+}
+
+static
+void *
+byte_memset(void *ptr, int ch, size_t len)
+{
+	unsigned char *p = ptr;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = ch;
+	}
+	return ptr;
+}
+
+static
+void
+fill(unsigned char *buf, size_t len, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[i] = (unsigned char)(seed + i * 7 + (i >> 8));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// correctness
+
+static
+void
+check_memcpy(void)
+{
+	size_t len;
+	unsigned so, doff;
+
+	for (len=0; len<300; len++) {
+		for (so=0; so<8; so++) {
+			for (doff=0; doff<8; doff++) {
+				fill(srcbuf, BUFSIZE, len + so);
+				fill(dstbuf, BUFSIZE, 99);
+				fill(refbuf, BUFSIZE, 99);
+				if (os161_memcpy(dstbuf + doff, srcbuf + so, len)
+				    != dstbuf + doff) {
+					errx(1, "memcpy: wrong return value");
+				}
+				byte_memcpy(refbuf + doff, srcbuf + so, len);
+				if (memcmp(dstbuf, refbuf, 400) != 0) {
+					errx(1, "memcpy: wrong result for "
+					     "len %zu src+%u dst+%u",
+					     len, so, doff);
+				}
+			}
+		}
+	}
+}
+
+static
+void
+check_memmove(void)
+{
+	size_t len;
+	unsigned so, doff;
+
+	/* both directions, all overlaps up to 300 bytes apart */
+	for (len=0; len<300; len++) {
+		for (so=0; so<300; so += (so < 20 ? 1 : 37)) {
+			for (doff=0; doff<300; doff += (doff < 20 ? 1 : 41)) {
+				fill(dstbuf, BUFSIZE, len);
+				fill(refbuf, BUFSIZE, len);
+				if (os161_memmove(dstbuf + doff, dstbuf + so, len)
+				    != dstbuf + doff) {
+					errx(1, "memmove: wrong return value");
+				}
+				byte_memmove(refbuf + doff, refbuf + so, len);
+				if (memcmp(dstbuf, refbuf, 700) != 0) {
+					errx(1, "memmove: wrong result for "
+					     "len %zu src+%u dst+%u",
+					     len, so, doff);
+				}
+			}
+		}
+	}
+}
+
+static
+void
+check_memset(void)
+{
+	size_t len;
+	unsigned off;
+
+	for (len=0; len<300; len++) {
+		for (off=0; off<8; off++) {
+			fill(dstbuf, BUFSIZE, 5);
+			fill(refbuf, BUFSIZE, 5);
+			if (os161_memset(dstbuf + off, 0x1a5, len)
+			    != dstbuf + off) {
+				errx(1, "memset: wrong return value");
+			}
+			byte_memset(refbuf + off, 0x1a5, len);
+			if (memcmp(dstbuf, refbuf, 400) != 0) {
+				errx(1, "memset: wrong result for "
+				     "len %zu ptr+%u", len, off);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// benchmark
+
+static const size_t sizes[] = { 8, 64, 512, 4096, 65536 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* alignment cases: offsets of src and dst from an aligned address */
+static const struct {
+	const char *name;
+	unsigned soff, doff;
+} aligns[] = {
+	{ "aligned", 0, 0 },
+	{ "src+1",   1, 0 },
+	{ "dst+3",   0, 3 },
+	{ "both+2",  2, 2 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(aligns[0]))
+
+static unsigned long bytes_per_size;
+
+static
+double
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs + nsecs / 1000000000.0;
+}
+
+/*
+ * Return throughput in MB/s of FUNC copying LEN bytes.
+ */
+static
+double
+runcopy(void *(*func)(void *, const void *, size_t),
+	unsigned char *d, const unsigned char *s, size_t len)
+{
+	unsigned long i, iters;
+	double start, end;
+
+	iters = bytes_per_size / len;
+	start = now();
+	for (i=0; i<iters; i++) {
+		func(d, s, len);
+		/* keep the compiler from deciding the copies are dead */
+		__asm volatile("" : : "r" (d) : "memory");
+	}
+	end = now();
+	if (end <= start) {
+		end = start + 1e-6;
+	}
+	return (iters * (double)len) / (end - start) / 1048576.0;
+}
+
+static
+double
+runset(void *(*func)(void *, int, size_t), unsigned char *d, size_t len)
+{
+	unsigned long i, iters;
+	double start, end;
+
+	iters = bytes_per_size / len;
+	start = now();
+	for (i=0; i<iters; i++) {
+		func(d, (int)i, len);
+		__asm volatile("" : : "r" (d) : "memory");
+	}
+	end = now();
+	if (end <= start) {
+		end = start + 1e-6;
+	}
+	return (iters * (double)len) / (end - start) / 1048576.0;
+}
+
+static
+void
+bench_copy(const char *title,
+	   void *(*os161)(void *, const void *, size_t),
+	   void *(*bytes)(void *, const void *, size_t),
+	   void *(*host)(void *, const void *, size_t))
+{
+	unsigned a, i;
+	unsigned char *d;
+	const unsigned char *s;
+
+	printf("%s (MB/s)\n", title);
+	printf("%-8s %6s %10s %10s %10s\n",
+	       "align", "size", "bytes", "os161", "host");
+	for (a=0; a<NALIGNS; a++) {
+		d = dstbuf + aligns[a].doff;
+		s = srcbuf + aligns[a].soff;
+		for (i=0; i<NSIZES; i++) {
+			printf("%-8s %6zu %10.0f %10.0f %10.0f\n",
+			       aligns[a].name, sizes[i],
+			       runcopy(bytes, d, s, sizes[i]),
+			       runcopy(os161, d, s, sizes[i]),
+			       runcopy(host, d, s, sizes[i]));
+		}
+	}
+	printf("\n");
+}
+
+static
+void
+bench_set(void)
+{
+	unsigned a, i;
+	unsigned char *d;
+
+	printf("memset (MB/s)\n");
+	printf("%-8s %6s %10s %10s %10s\n",
+	       "align", "size", "bytes", "os161", "host");
+	for (a=0; a<NALIGNS; a++) {
+		d = dstbuf + aligns[a].doff;
+		for (i=0; i<NSIZES; i++) {
+			printf("%-8s %6zu %10.0f %10.0f %10.0f\n",
+			       aligns[a].name, sizes[i],
+			       runset(byte_memset, d, sizes[i]),
+			       runset(os161_memset, d, sizes[i]),
+			       runset(memset, d, sizes[i]));
+		}
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	hostcompat_init(argc, argv);
+
+	bytes_per_size = 256UL * 1048576;
+	if (argc == 2 && !strcmp(argv[1], "-q")) {
+		bytes_per_size = 16UL * 1048576;
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: membench [-q]");
+	}
+
+	srcbuf = malloc(BUFSIZE);
+	dstbuf = malloc(BUFSIZE);
+	refbuf = malloc(BUFSIZE);
+	if (srcbuf == NULL || dstbuf == NULL || refbuf == NULL) {
+		err(1, "malloc");
+	}
+
+	check_memcpy();
+	check_memmove();
+	check_memset();
+	printf("membench: memcpy, memmove, memset correct\n\n");
+
+	fill(srcbuf, BUFSIZE, 1);
+	bench_copy("memcpy", os161_memcpy, byte_memcpy, memcpy);
+	/* memmove with dst above src exercises the backwards path */
+	bench_copy("memmove", os161_memmove, byte_memmove, memmove);
+	bench_set();
+
+	return 0;
+}
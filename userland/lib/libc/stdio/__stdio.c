@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/*
+ * Stream table and buffer management shared by the stdio functions.
+ */
+
+static char __stdin_buf[BUFSIZ];
+static char __stdout_buf[BUFSIZ];
+
+FILE __stdio_files[FOPEN_MAX] = {
+	{ STDIN_FILENO, __SRD|__SPROBE, __stdin_buf, BUFSIZ, 0, 0, { 0 } },
+	{ STDOUT_FILENO, __SWR|__SLBF|__SPROBE, __stdout_buf, BUFSIZ,
+	  0, 0, { 0 } },
+	{ STDERR_FILENO, __SWR|__SNBF, __stdio_files[2].f_nbuf, 1,
+	  0, 0, { 0 } },
+};
+
+/*
+ * Decide how stdin or stdout should be buffered. This is put off
+ * until first use, so that programs that never touch them don't pay
+ * for the fstat. If stdout is a plain file it doesn't need to be
+ * flushed every line. Only a plain file is worth reading ahead on
+ * stdin: on the console, reading ahead would hold back the prompt and
+ * echo that __stdio_fill pushes out before each read, and would steal
+ * input meant for the programs we run. If fstat fails (or isn't
+ * implemented), stdout stays line-buffered and stdin goes unbuffered,
+ * which is always safe.
+ */
+void
+__stdio_setup(FILE *f)
+{
+	struct stat st;
+	int isreg;
+
+	f->f_flags &= ~__SPROBE;
+	isreg = fstat(f->f_fd, &st) == 0 && S_ISREG(st.st_mode);
+	if (f->f_flags & __SWR) {
+		if (isreg) {
+			f->f_flags &= ~__SLBF;
+		}
+	}
+	else if (!isreg) {
+		f->f_buf = f->f_nbuf;
+		f->f_bufsize = 1;
+		f->f_flags |= __SNBF;
+	}
+}
+
+/*
+ * Write out pending output, or throw away read-ahead. In the latter
+ * case move the file position back to where the program thinks it
+ * is; on the console that fails, which is fine, since there's no
+ * position to get right.
+ */
+int
+__stdio_flush(FILE *f)
+{
+	size_t done;
+	ssize_t r;
+	off_t back;
+
+	if (f->f_flags & __SWRITING) {
+		for (done = 0; done < f->f_pos; done += r) {
+			r = write(f->f_fd, f->f_buf + done, f->f_pos - done);
+			if (r <= 0) {
+				/* lose whatever's left */
+				f->f_flags |= __SERR;
+				f->f_flags &= ~__SWRITING;
+				f->f_pos = 0;
+				return EOF;
+			}
+		}
+		f->f_flags &= ~__SWRITING;
+		f->f_pos = 0;
+	}
+	else if (f->f_flags & __SREADING) {
+		if (f->f_pos < f->f_len) {
+			back = f->f_len - f->f_pos;
+			lseek(f->f_fd, -back, SEEK_CUR);
+		}
+		f->f_flags &= ~__SREADING;
+		f->f_pos = f->f_len = 0;
+	}
+	return 0;
+}
+
+/*
+ * Refill the read buffer; the old contents must all have been used.
+ * Before going to the file, push out any prompt sitting in stdout.
+ */
+size_t
+__stdio_fill(FILE *f)
+{
+	ssize_t r;
+
+	if (f->f_flags & __SPROBE) {
+		__stdio_setup(f);
+	}
+	if ((f->f_flags & __SRD) == 0) {
+		f->f_flags |= __SERR;
+		errno = EBADF;
+		return 0;
+	}
+	if (f->f_flags & __SWRITING) {
+		if (__stdio_flush(f)) {
+			return 0;
+		}
+	}
+	if (f != stdout &&
+	    (stdout->f_flags & (__SLBF|__SWRITING)) == (__SLBF|__SWRITING)) {
+		__stdio_flush(stdout);
+	}
+
+	f->f_pos = f->f_len = 0;
+	r = read(f->f_fd, f->f_buf, f->f_bufsize);
+	if (r < 0) {
+		f->f_flags |= __SERR;
+		return 0;
+	}
+	if (r == 0) {
+		f->f_flags |= __SEOF;
+		return 0;
+	}
+	f->f_flags |= __SREADING;
+	f->f_len = r;
+	return r;
+}
+
+/*
+ * Flush everything on the way out (called from exit()).
+ */
+void
+__stdio_exit(void)
+{
+	fflush(NULL);
+}
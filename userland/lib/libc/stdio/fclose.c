@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * C standard I/O function - flush and close a stream.
+ */
+
+int
+fclose(FILE *f)
+{
+	int ret;
+
+	ret = __stdio_flush(f);
+	if (close(f->f_fd) < 0) {
+		ret = EOF;
+	}
+	if (f->f_flags & __SMBF) {
+		free(f->f_buf);
+	}
+	f->f_buf = NULL;
+	f->f_bufsize = 0;
+	f->f_flags = 0;
+	return ret;
+}
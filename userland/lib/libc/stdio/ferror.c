@@ -0,0 +1,29 @@
+#include <stdio.h>
+
+/*
+ * C standard I/O functions - stream status.
+ */
+
+int
+feof(FILE *f)
+{
+	return (f->f_flags & __SEOF) != 0;
+}
+
+int
+ferror(FILE *f)
+{
+	return (f->f_flags & __SERR) != 0;
+}
+
+void
+clearerr(FILE *f)
+{
+	f->f_flags &= ~(__SEOF|__SERR);
+}
+
+int
+fileno(FILE *f)
+{
+	return f->f_fd;
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+/*
+ * C standard I/O function - flush a stream, or all streams if F is
+ * NULL.
+ */
+
+int
+fflush(FILE *f)
+{
+	int i, ret;
+
+	if (f != NULL) {
+		return __stdio_flush(f);
+	}
+
+	ret = 0;
+	for (i=0; i<FOPEN_MAX; i++) {
+		f = &__stdio_files[i];
+		if ((f->f_flags & __SWRITING) && __stdio_flush(f)) {
+			ret = EOF;
+		}
+	}
+	return ret;
+}
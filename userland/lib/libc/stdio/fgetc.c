@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+/*
+ * C standard I/O function - read one character from a stream and
+ * return it (0-255), or EOF at end of file or on error.
+ */
+
+int
+fgetc(FILE *f)
+{
+	if (f->f_pos >= f->f_len && __stdio_fill(f) == 0) {
+		return EOF;
+	}
+
+	/*
+	 * Cast through unsigned char, to prevent sign extension. This
+	 * sends back values on the range 0-255, rather than -128 to 127,
+	 * so EOF can be distinguished from legal input.
+	 */
+	return (int)(unsigned char)f->f_buf[f->f_pos++];
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+/*
+ * C standard I/O function - read a line, including the newline, of
+ * at most LEN-1 characters into BUF and null-terminate it. Returns
+ * BUF, or NULL if nothing could be read.
+ */
+
+char *
+fgets(char *buf, int len, FILE *f)
+{
+	int i;
+	char ch;
+
+	if (len <= 0) {
+		return NULL;
+	}
+
+	i = 0;
+	while (i < len - 1) {
+		if (f->f_pos >= f->f_len && __stdio_fill(f) == 0) {
+			break;
+		}
+		ch = f->f_buf[f->f_pos++];
+		buf[i++] = ch;
+		if (ch == '\n') {
+			break;
+		}
+	}
+
+	if (i == 0) {
+		return NULL;
+	}
+	buf[i] = 0;
+	return buf;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * C standard I/O functions - open a stream on a file by name, or on
+ * a file handle that's already open.
+ */
+
+/*
+ * Parse MODE into open flags (in *OFLAGS) and stream flags (in
+ * *SFLAGS). Returns -1 if it doesn't make sense.
+ */
+static
+int
+parsemode(const char *mode, int *oflags, unsigned *sflags)
+{
+	switch (mode[0]) {
+	    case 'r':
+		*oflags = O_RDONLY;
+		*sflags = __SRD;
+		break;
+	    case 'w':
+		*oflags = O_WRONLY|O_CREAT|O_TRUNC;
+		*sflags = __SWR;
+		break;
+	    case 'a':
+		*oflags = O_WRONLY|O_CREAT|O_APPEND;
+		*sflags = __SWR;
+		break;
+	    default:
+		return -1;
+	}
+
+	/* "b" means nothing here; "+" means both ways */
+	for (mode++; *mode != 0; mode++) {
+		if (*mode == '+') {
+			*oflags = (*oflags & ~O_ACCMODE) | O_RDWR;
+			*sflags = __SRD|__SWR;
+		}
+		else if (*mode != 'b') {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Set up a free stream slot on FD. If we can't get a buffer, run
+ * unbuffered rather than fail.
+ */
+static
+FILE *
+newstream(int fd, unsigned sflags)
+{
+	FILE *f;
+	int i;
+
+	for (i=0; i<FOPEN_MAX; i++) {
+		f = &__stdio_files[i];
+		if (f->f_flags == 0) {
+			break;
+		}
+	}
+	if (i == FOPEN_MAX) {
+		errno = EMFILE;
+		return NULL;
+	}
+
+	f->f_fd = fd;
+	f->f_pos = f->f_len = 0;
+	f->f_buf = malloc(BUFSIZ);
+	if (f->f_buf != NULL) {
+		f->f_bufsize = BUFSIZ;
+		f->f_flags = sflags | __SMBF;
+	}
+	else {
+		f->f_buf = f->f_nbuf;
+		f->f_bufsize = 1;
+		f->f_flags = sflags | __SNBF;
+	}
+	return f;
+}
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	int fd, oflags;
+	unsigned sflags;
+	FILE *f;
+
+	if (parsemode(mode, &oflags, &sflags) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(path, oflags, 0664);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	f = newstream(fd, sflags);
+	if (f == NULL) {
+		close(fd);
+		return NULL;
+	}
+	return f;
+}
+
+FILE *
+fdopen(int fd, const char *mode)
+{
+	int oflags;
+	unsigned sflags;
+
+	if (parsemode(mode, &oflags, &sflags) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return newstream(fd, sflags);
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+
+/*
+ * fprintf - C standard I/O function.
+ */
+
+struct fprintf_data {
+	FILE *f;
+	int err;
+};
+
+/*
+ * Function passed to __vprintf to do the actual output.
+ */
+static
+void
+__fprintf_send(void *mydata, const char *data, size_t len)
+{
+	struct fprintf_data *fd = mydata;
+
+	if (fwrite(data, 1, len, fd->f) != len) {
+		fd->err = errno;
+	}
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/* vfprintf: call __vprintf to do the work. */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	struct fprintf_data fd;
+	int chars;
+
+	fd.f = f;
+	fd.err = 0;
+	chars = __vprintf(__fprintf_send, &fd, fmt, ap);
+	if (fd.err) {
+		errno = fd.err;
+		return -1;
+	}
+	return chars;
+}
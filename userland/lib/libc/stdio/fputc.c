@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+/*
+ * C standard I/O function - write one character to a stream.
+ * Returns it, or EOF on error.
+ */
+
+int
+fputc(int ch, FILE *f)
+{
+	char c = ch;
+
+	/* Fast path: already writing and there's room. */
+	if ((f->f_flags & (__SWRITING|__SNBF)) == __SWRITING &&
+	    f->f_pos < f->f_bufsize) {
+		f->f_buf[f->f_pos++] = c;
+		if (f->f_pos == f->f_bufsize ||
+		    (c == '\n' && (f->f_flags & __SLBF))) {
+			if (__stdio_flush(f)) {
+				return EOF;
+			}
+		}
+		return (int)(unsigned char)c;
+	}
+
+	if (fwrite(&c, 1, 1, f) != 1) {
+		return EOF;
+	}
+	return (int)(unsigned char)c;
+}
@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * C standard I/O function - write a string (with no added newline)
+ * to a stream. Returns 0, or EOF on error.
+ */
+
+int
+fputs(const char *str, FILE *f)
+{
+	size_t len;
+
+	len = strlen(str);
+	if (fwrite(str, 1, len, f) != len) {
+		return EOF;
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * C standard I/O function - read NITEMS objects of SIZE bytes each.
+ * Returns the number of whole objects read.
+ */
+
+size_t
+fread(void *buf, size_t size, size_t nitems, FILE *f)
+{
+	char *data = buf;
+	size_t total, done, n;
+
+	total = size * nitems;
+	if (total == 0) {
+		return 0;
+	}
+
+	done = 0;
+	while (done < total) {
+		if (f->f_pos < f->f_len) {
+			n = f->f_len - f->f_pos;
+			if (n > total - done) {
+				n = total - done;
+			}
+			memcpy(data + done, f->f_buf + f->f_pos, n);
+			f->f_pos += n;
+			done += n;
+		}
+		else if (__stdio_fill(f) == 0) {
+			break;
+		}
+	}
+	return done / size;
+}
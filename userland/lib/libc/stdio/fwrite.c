@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * C standard I/O function - write NITEMS objects of SIZE bytes each.
+ * Returns the number of whole objects written (or at least buffered).
+ */
+
+/*
+ * Write straight to the file, bypassing the buffer.
+ */
+static
+size_t
+rawwrite(FILE *f, const char *data, size_t len)
+{
+	size_t done;
+	ssize_t r;
+
+	for (done = 0; done < len; done += r) {
+		r = write(f->f_fd, data + done, len - done);
+		if (r <= 0) {
+			f->f_flags |= __SERR;
+			break;
+		}
+	}
+	return done;
+}
+
+size_t
+fwrite(const void *buf, size_t size, size_t nitems, FILE *f)
+{
+	const char *data = buf;
+	size_t total, done, n, i;
+
+	total = size * nitems;
+	if (total == 0) {
+		return 0;
+	}
+
+	if (f->f_flags & __SPROBE) {
+		__stdio_setup(f);
+	}
+	if ((f->f_flags & __SWR) == 0) {
+		f->f_flags |= __SERR;
+		errno = EBADF;
+		return 0;
+	}
+	if (f->f_flags & __SREADING) {
+		__stdio_flush(f);
+	}
+
+	if (f->f_flags & __SNBF) {
+		return rawwrite(f, data, total) / size;
+	}
+
+	f->f_flags |= __SWRITING;
+	done = 0;
+	while (done < total) {
+		if (f->f_pos == 0 && total - done >= f->f_bufsize) {
+			/* Buffer's empty and wouldn't hold it; skip the copy */
+			n = rawwrite(f, data + done, total - done);
+			done += n;
+			if (done < total) {
+				break;
+			}
+			continue;
+		}
+		n = f->f_bufsize - f->f_pos;
+		if (n > total - done) {
+			n = total - done;
+		}
+		memcpy(f->f_buf + f->f_pos, data + done, n);
+		f->f_pos += n;
+		done += n;
+		if (f->f_pos == f->f_bufsize && __stdio_flush(f)) {
+			break;
+		}
+	}
+
+	if ((f->f_flags & __SLBF) && f->f_pos > 0) {
+		/* If a line ended, push it out */
+		for (i = total; i > 0; i--) {
+			if (data[i-1] == '\n') {
+				__stdio_flush(f);
+				break;
+			}
+		}
+	}
+
+	return done / size;
+}
@@ -29,30 +29,11 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <unistd.h>
-#include <errno.h>
-#include <string.h>
-#include <kern/secret.h>
 
 /*
  * printf - C standard I/O function.
  */
 
-
-/*
- * Function passed to __vprintf to do the actual output.
- */
-static
-void
-__printf_send(void *mydata, const char *data, size_t len)
-{
-	ssize_t ret;
-	int *err = mydata;
-
-	ret = write(STDOUT_FILENO, data, len);
-	*err = (ret == -1) ? errno : 0;
-}
-
 /* printf: hand off to vprintf */
 int
 printf(const char *fmt, ...)
@@ -66,15 +47,9 @@ printf(const char *fmt, ...)
 	return chars;
 }
 
-/* vprintf: call __vprintf to do the work. */
+/* vprintf: vfprintf to stdout. */
 int
 vprintf(const char *fmt, va_list ap)
 {
-	int chars, err;
-	chars = __vprintf(__printf_send, &err, fmt, ap);
-	if (err) {
-		errno = err;
-		return -1;
-	}
-	return chars;
+	return vfprintf(stdout, fmt, ap);
 }
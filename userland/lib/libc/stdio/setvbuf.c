@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * C standard I/O function - change how a stream is buffered. Anything
+ * already buffered is flushed first. If BUF is NULL a buffer of SIZE
+ * bytes (BUFSIZ if SIZE is 0) is allocated, unless the stream already
+ * has a real buffer, in which case that's kept.
+ */
+
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	char *newbuf;
+
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		return EOF;
+	}
+	if (__stdio_flush(f)) {
+		return EOF;
+	}
+
+	if (mode == _IONBF) {
+		newbuf = f->f_nbuf;
+		size = 1;
+	}
+	else if (buf != NULL) {
+		newbuf = buf;
+	}
+	else if (f->f_bufsize > 1) {
+		newbuf = f->f_buf;
+		size = f->f_bufsize;
+	}
+	else {
+		if (size == 0) {
+			size = BUFSIZ;
+		}
+		newbuf = malloc(size);
+		if (newbuf == NULL) {
+			return EOF;
+		}
+	}
+
+	if (newbuf != f->f_buf) {
+		if (f->f_flags & __SMBF) {
+			free(f->f_buf);
+			f->f_flags &= ~__SMBF;
+		}
+		if (mode != _IONBF && buf == NULL) {
+			f->f_flags |= __SMBF;
+		}
+		f->f_buf = newbuf;
+		f->f_bufsize = size;
+	}
+
+	f->f_flags &= ~(__SLBF|__SNBF|__SPROBE);
+	if (mode == _IOLBF) {
+		f->f_flags |= __SLBF;
+	}
+	else if (mode == _IONBF) {
+		f->f_flags |= __SNBF;
+	}
+	return 0;
+}
@@ -30,10 +30,28 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is a sequence of blocks, each with a header that records
+ * the sizes of it and the block before it ("boundary tags"), so any
+ * block can find its neighbors in constant time. Free blocks are kept
+ * on doubly-linked free lists ("bins") threaded through their data
+ * area, so allocation never has to walk the heap:
+ *
+ *  - Small blocks (up to MSMALLMAX bytes) have one bin per size. A
+ *    small allocation that finds its bin nonempty just pops it. Small
+ *    blocks are not coalesced when freed, since they're usually about
+ *    to be reused at the same size.
+ *
+ *  - Larger blocks have one bin per power of two. Freeing one merges
+ *    it with any free neighbors right away.
+ *
+ *  - When nothing fits and small blocks have been freed since the last
+ *    time, we walk the heap once to coalesce them before growing it.
+ *
+ *  - The heap is grown with sbrk at least MSBRKPAGES pages at a time.
+ *
+ * It still performs abysmally if the heap becomes larger than physical
+ * memory. To get (much) better out-of-core performance, port the
+ * kernel's malloc. :-)
  */
 
 #include <stdlib.h>
@@ -134,6 +152,38 @@ struct mheader {
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Free list links, kept in the data area of free blocks. Every block
+ * has at least MBLOCKSIZE bytes of data, which is enough room.
+ *
+ * M_FREE:		return free list links of a header
+ * MF_HEADER:		return header of free list links
+ */
+struct mfree {
+	struct mfree *mf_next;
+	struct mfree *mf_prev;
+};
+
+#define M_FREE(mh)	((struct mfree *)M_DATA(mh))
+#define MF_HEADER(mf)	(((struct mheader *)(mf))-1)
+
+/*
+ * Bins.
+ *
+ * MSMALLMAX is the largest "small" block. There is one bin for each
+ * small size, then NLARGEBINS bins for (MSMALLMAX, 2*MSMALLMAX],
+ * (2*MSMALLMAX, 4*MSMALLMAX], and so on, the last of which also
+ * takes everything bigger.
+ *
+ * MSBRKPAGES is the minimum number of pages to ask sbrk for at once.
+ */
+#define MSMALLMAX	512
+#define NSMALLBINS	(MSMALLMAX / MBLOCKSIZE)
+#define NLARGEBINS	20
+#define NBINS		(NSMALLBINS + NLARGEBINS)
+
+#define MSBRKPAGES	16
+
 /*
  * System page size. In POSIX you're supposed to call
  * sysconf(_SC_PAGESIZE). If _SC_PAGESIZE isn't defined, as on OS/161,
@@ -150,9 +200,15 @@ static size_t __malloc_pagesize;
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, the
+ * last block on the heap (NULL if there aren't any), the free list
+ * bins, and the number of small blocks freed since the last time they
+ * were coalesced.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__heaplast;
+static struct mfree *__malloc_bins[NBINS];
+static unsigned __malloc_nsmallfree;
 
 /*
  * Setup function.
@@ -175,6 +231,9 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfree) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - free links too large");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -219,6 +278,69 @@ __malloc_init(void)
 		__heapbase += adjust;
 		__heaptop = __heapbase;
 	}
+	__heaplast = NULL;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Return the bin for blocks with SIZE bytes of data.
+ */
+static
+unsigned
+__malloc_binindex(size_t size)
+{
+	unsigned b;
+	size_t limit;
+
+	if (size <= MSMALLMAX) {
+		return size / MBLOCKSIZE - 1;
+	}
+	b = NSMALLBINS;
+	limit = 2 * MSMALLMAX;
+	while (size > limit && b < NBINS - 1) {
+		limit <<= 1;
+		b++;
+	}
+	return b;
+}
+
+/*
+ * Put a free block on the front of its bin.
+ */
+static
+void
+__malloc_link(struct mheader *mh)
+{
+	struct mfree *mf = M_FREE(mh);
+	unsigned b = __malloc_binindex(M_SIZE(mh));
+
+	mf->mf_prev = NULL;
+	mf->mf_next = __malloc_bins[b];
+	if (mf->mf_next != NULL) {
+		mf->mf_next->mf_prev = mf;
+	}
+	__malloc_bins[b] = mf;
+}
+
+/*
+ * Take a free block off its bin.
+ */
+static
+void
+__malloc_unlink(struct mheader *mh)
+{
+	struct mfree *mf = M_FREE(mh);
+
+	if (mf->mf_prev != NULL) {
+		mf->mf_prev->mf_next = mf->mf_next;
+	}
+	else {
+		__malloc_bins[__malloc_binindex(M_SIZE(mh))] = mf->mf_next;
+	}
+	if (mf->mf_next != NULL) {
+		mf->mf_next->mf_prev = mf->mf_prev;
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -226,19 +348,24 @@ __malloc_init(void)
 #ifdef MALLOCDEBUG
 
 /*
- * Debugging print function to iterate and dump the entire heap.
+ * Debugging print function to iterate and dump the entire heap. Also
+ * checks that the bins hold exactly the free blocks.
  */
 static
 void
 __malloc_dump(void)
 {
 	struct mheader *mh;
+	struct mfree *mf;
 	uintptr_t i;
 	size_t rightprevblock;
+	unsigned b, nfree, nbinned;
 
 	warnx("heap: ************************************************");
 
 	rightprevblock = 0;
+	nfree = 0;
+	mh = NULL;
 	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
 		mh = (struct mheader *) i;
 		if (!M_OK(mh)) {
@@ -255,6 +382,9 @@ __malloc_dump(void)
 			     (unsigned long) rightprevblock << MBLOCKSHIFT);
 		}
 		rightprevblock = mh->mh_nextblock;
+		if (!mh->mh_inuse) {
+			nfree++;
+		}
 
 		warnx("heap: 0x%lx 0x%-6lx (next: 0x%lx) %s",
 		      (unsigned long) i + MBLOCKSIZE,
@@ -265,6 +395,27 @@ __malloc_dump(void)
 	if (i!=__heaptop) {
 		errx(1, "malloc: Heap corrupt; ran off end");
 	}
+	if (mh != __heaplast) {
+		errx(1, "malloc: Heap corrupt; last block is %p, "
+		     "not %p", mh, __heaplast);
+	}
+
+	nbinned = 0;
+	for (b=0; b<NBINS; b++) {
+		for (mf = __malloc_bins[b]; mf != NULL; mf = mf->mf_next) {
+			mh = MF_HEADER(mf);
+			if (!M_OK(mh) || mh->mh_inuse ||
+			    __malloc_binindex(M_SIZE(mh)) != b) {
+				errx(1, "malloc: Heap corrupt; bad block %p "
+				     "in bin %u", mh, b);
+			}
+			nbinned++;
+		}
+	}
+	if (nbinned != nfree) {
+		errx(1, "malloc: Heap corrupt; %u free blocks but %u "
+		     "in bins", nfree, nbinned);
+	}
 
 	warnx("heap: ************************************************");
 }
@@ -273,6 +424,196 @@ __malloc_dump(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Clear a range of memory with 0xdeadbeef.
+ * ptr must be suitably aligned.
+ */
+static
+void
+__malloc_deadbeef(void *ptr, size_t size)
+{
+	uint32_t *x = ptr;
+	size_t i, n = size/sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		x[i] = 0xdeadbeef;
+	}
+}
+
+/*
+ * Merge two adjacent free blocks (mh below mhnext). Neither may be on
+ * a bin.
+ */
+static
+void
+__malloc_merge(struct mheader *mh, struct mheader *mhnext)
+{
+	struct mheader *mhnextnext;
+
+	if (mh->mh_nextblock != mhnext->mh_prevblock) {
+		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
+		     mh, mhnext);
+	}
+	if (mh->mh_inuse || mhnext->mh_inuse) {
+		errx(1, "malloc: Internal error (merging block in use)");
+	}
+
+	mhnextnext = M_NEXT(mhnext);
+
+	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
+				     MBLOCKSIZE + M_SIZE(mhnext));
+
+	if (mhnextnext != (struct mheader *)__heaptop) {
+		mhnextnext->mh_prevblock = mh->mh_nextblock;
+	}
+	if (mhnext == __heaplast) {
+		__heaplast = mh;
+	}
+
+	/* Deadbeef out the memory used by the now-obsolete header */
+	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+}
+
+/*
+ * Put a free block that isn't on a bin onto one, after merging it
+ * with any free neighbors.
+ */
+static
+void
+__malloc_release(struct mheader *mh)
+{
+	struct mheader *mhnext, *mhprev;
+
+	/* Try merging with the block above (but not if we're at the top) */
+	mhnext = M_NEXT(mh);
+	if (mhnext != (struct mheader *)__heaptop) {
+		if (!M_OK(mhnext)) {
+			errx(1, "free: Heap corrupt; header at %p has bad "
+			     "magic bits", mhnext);
+		}
+		if (!mhnext->mh_inuse) {
+			__malloc_unlink(mhnext);
+			__malloc_merge(mh, mhnext);
+		}
+	}
+
+	/* Try merging with the block below (but not if we're at the bottom) */
+	if (mh != (struct mheader *)__heapbase) {
+		mhprev = M_PREV(mh);
+		if (!M_OK(mhprev)) {
+			errx(1, "free: Heap corrupt; header at %p has bad "
+			     "magic bits", mhprev);
+		}
+		if (!mhprev->mh_inuse) {
+			__malloc_unlink(mhprev);
+			__malloc_merge(mhprev, mh);
+			mh = mhprev;
+		}
+	}
+
+	__malloc_link(mh);
+}
+
+/*
+ * Coalesce all adjacent free blocks by walking the whole heap, and
+ * rebuild the bins. This picks up the small blocks free doesn't
+ * merge. Since it's O(heap), only do it when about to grow the heap.
+ */
+static
+void
+__malloc_consolidate(void)
+{
+	struct mheader *mh, *run;
+	uintptr_t i;
+	unsigned b;
+
+	for (b=0; b<NBINS; b++) {
+		__malloc_bins[b] = NULL;
+	}
+	__malloc_nsmallfree = 0;
+
+	run = NULL;
+	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
+		mh = (struct mheader *) i;
+		if (!M_OK(mh)) {
+			errx(1, "malloc: Heap corrupt; header at 0x%lx"
+			     " has bad magic bits",
+			     (unsigned long) i);
+		}
+		if (mh->mh_inuse) {
+			if (run != NULL) {
+				__malloc_link(run);
+				run = NULL;
+			}
+		}
+		else if (run == NULL) {
+			run = mh;
+		}
+		else {
+			__malloc_merge(run, mh);
+			/* continue from the end of the merged block */
+			mh = run;
+			i = (uintptr_t)run;
+		}
+	}
+	if (run != NULL) {
+		__malloc_link(run);
+	}
+}
+
+/*
+ * Find a free block with at least SIZE bytes of data and take it off
+ * its bin. Small bins hold only one size, and every block in a bin
+ * past SIZE's own is big enough, so only SIZE's own bin ever needs to
+ * be searched past the first entry; search it for the best fit to
+ * limit fragmentation.
+ */
+static
+struct mheader *
+__malloc_findfree(size_t size)
+{
+	struct mheader *mh, *best;
+	struct mfree *mf;
+	unsigned b;
+
+	b = __malloc_binindex(size);
+	if (size > MSMALLMAX) {
+		best = NULL;
+		for (mf = __malloc_bins[b]; mf != NULL; mf = mf->mf_next) {
+			mh = MF_HEADER(mf);
+			if (!M_OK(mh) || mh->mh_inuse) {
+				errx(1, "malloc: Heap corrupt; bad block %p "
+				     "on free list", mh);
+			}
+			if (M_SIZE(mh) >= size &&
+			    (best == NULL || M_SIZE(mh) < M_SIZE(best))) {
+				best = mh;
+				if (M_SIZE(mh) == size) {
+					break;
+				}
+			}
+		}
+		if (best != NULL) {
+			__malloc_unlink(best);
+			return best;
+		}
+		b++;
+	}
+
+	for (; b < NBINS; b++) {
+		mf = __malloc_bins[b];
+		if (mf != NULL) {
+			mh = MF_HEADER(mf);
+			if (!M_OK(mh) || mh->mh_inuse) {
+				errx(1, "malloc: Heap corrupt; bad block %p "
+				     "on free list", mh);
+			}
+			__malloc_unlink(mh);
+			return mh;
+		}
+	}
+	return NULL;
+}
+
 /*
  * Get more memory (at the top of the heap) using sbrk, and
  * return a pointer to it.
@@ -298,10 +639,73 @@ __malloc_sbrk(size_t size)
 	return x;
 }
 
+/*
+ * Grow the heap so there's a free block with at least SIZE bytes of
+ * data at the top, and return that block (not on a bin).
+ *
+ * If the top block is free, we can expand it. Otherwise we need a new
+ * block. Ask for at least MSBRKPAGES pages so that a run of small
+ * allocations doesn't call sbrk every time; if that much isn't
+ * available, settle for what's needed.
+ */
+static
+struct mheader *
+__malloc_grow(size_t size)
+{
+	struct mheader *mh;
+	size_t need, morespace;
+	void *p;
+
+	mh = __heaplast;
+	if (mh != NULL && !mh->mh_inuse) {
+		assert(size > M_SIZE(mh));
+		need = size - M_SIZE(mh);
+	}
+	else {
+		mh = NULL;
+		need = MBLOCKSIZE + size;
+	}
+
+	/* Round the amount of space we ask for up to a whole page. */
+	need = PAGE_SIZE * ((need + PAGE_SIZE - 1) / PAGE_SIZE);
+	morespace = need;
+	if (morespace < MSBRKPAGES * PAGE_SIZE) {
+		morespace = MSBRKPAGES * PAGE_SIZE;
+	}
+
+	p = __malloc_sbrk(morespace);
+	if (p == NULL && morespace > need) {
+		morespace = need;
+		p = __malloc_sbrk(morespace);
+	}
+	if (p == NULL) {
+		return NULL;
+	}
+
+	if (mh != NULL) {
+		/* update old header */
+		__malloc_unlink(mh);
+		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
+	}
+	else {
+		/* fill out new header */
+		mh = p;
+		mh->mh_prevblock = __heaplast == NULL ? 0 :
+			__heaplast->mh_nextblock;
+		mh->mh_magic1 = MMAGIC;
+		mh->mh_magic2 = MMAGIC;
+		mh->mh_pad = 0;
+		mh->mh_inuse = 0;
+		mh->mh_nextblock = M_MKFIELD(morespace);
+		__heaplast = mh;
+	}
+	return mh;
+}
+
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * MBLOCKSIZE. The new block goes on a bin.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
@@ -343,6 +747,11 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	if (mh == __heaplast) {
+		__heaplast = mhnew;
+	}
+
+	__malloc_release(mhnew);
 }
 
 /*
@@ -352,10 +761,6 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
-	size_t morespace;
-	void *p;
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -372,104 +777,38 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
-	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
-	 */
-	rightprevblock = 0;
-	mh = NULL;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
-		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
-		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
-	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+	/* Don't let the rounding below overflow. */
+	if (size > ((size_t)-1) / 2) {
+		return NULL;
 	}
 
 	/*
-	 * Didn't find anything. Expand the heap.
-	 *
-	 * If the heap is nonempty and the top block (the one mh is
-	 * left pointing to after the above loop) is free, we can
-	 * expand it. Otherwise we need a new block.
+	 * Round size up to an integral number of blocks, and to at
+	 * least one block so there's room for the free list links.
 	 */
-	if (mh != NULL && !mh->mh_inuse) {
-		assert(size > M_SIZE(mh));
-		morespace = size - M_SIZE(mh);
-	}
-	else {
-		morespace = MBLOCKSIZE + size;
-	}
-
-	/* Round the amount of space we ask for up to a whole page. */
-	morespace = PAGE_SIZE * ((morespace + PAGE_SIZE - 1) / PAGE_SIZE);
-
-	p = __malloc_sbrk(morespace);
-	if (p == NULL) {
-		return NULL;
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
 	}
 
-	if (mh != NULL && !mh->mh_inuse) {
-		/* update old header */
-		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
-		mh->mh_inuse = 1;
+	mh = __malloc_findfree(size);
+	if (mh == NULL && __malloc_nsmallfree > 0) {
+		__malloc_consolidate();
+		mh = __malloc_findfree(size);
 	}
-	else {
-		/* fill out new header */
-		mh = p;
-		mh->mh_prevblock = rightprevblock;
-		mh->mh_magic1 = MMAGIC;
-		mh->mh_magic2 = MMAGIC;
-		mh->mh_pad = 0;
-		mh->mh_inuse = 1;
-		mh->mh_nextblock = M_MKFIELD(morespace);
+	if (mh == NULL) {
+		mh = __malloc_grow(size);
+		if (mh == NULL) {
+			return NULL;
+		}
 	}
 
 	/*
-	 * Either way, try splitting the block we got as because of
-	 * the page rounding it might be quite a bit bigger than we
-	 * needed.
+	 * Now, allocate. Split off whatever we don't need; the block
+	 * may be much bigger than we asked for, e.g. if it came from
+	 * __malloc_grow.
 	 */
+	mh->mh_inuse = 1;
 	__malloc_split(mh, size);
 
 #ifdef MALLOCDEBUG
@@ -481,59 +820,13 @@ malloc(size_t size)
 
 ////////////////////////////////////////////////////////////
 
-/*
- * Clear a range of memory with 0xdeadbeef.
- * ptr must be suitably aligned.
- */
-static
-void
-__malloc_deadbeef(void *ptr, size_t size)
-{
-	uint32_t *x = ptr;
-	size_t i, n = size/sizeof(uint32_t);
-	for (i=0; i<n; i++) {
-		x[i] = 0xdeadbeef;
-	}
-}
-
-/*
- * Attempt to merge two adjacent blocks (mh below mhnext).
- */
-static
-void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
-{
-	struct mheader *mhnextnext;
-
-	if (mh->mh_nextblock != mhnext->mh_prevblock) {
-		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
-		     mh, mhnext);
-	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
-	}
-
-	mhnextnext = M_NEXT(mhnext);
-
-	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
-				     MBLOCKSIZE + M_SIZE(mhnext));
-
-	if (mhnextnext != (struct mheader *)__heaptop) {
-		mhnextnext->mh_prevblock = mh->mh_nextblock;
-	}
-
-	/* Deadbeef out the memory used by the now-obsolete header */
-	__malloc_deadbeef(mhnext, sizeof(struct mheader));
-}
-
 /*
  * The actual free() implementation.
  */
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct mheader *mh;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -572,16 +865,17 @@ free(void *x)
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	/*
+	 * Small blocks go straight back on their bin for reuse;
+	 * __malloc_consolidate merges them later if need be. Larger
+	 * blocks get merged with their neighbors now.
+	 */
+	if (M_SIZE(mh) <= MSMALLMAX) {
+		__malloc_link(mh);
+		__malloc_nsmallfree++;
 	}
-
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+	else {
+		__malloc_release(mh);
 	}
 
 #ifdef MALLOCDEBUG
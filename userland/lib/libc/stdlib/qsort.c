@@ -28,118 +28,261 @@
  */
 
 #include <stdlib.h>
-#include <string.h>
-#include <assert.h>
+#include <stdint.h>
 
 /*
  * qsort() for OS/161, where it isn't in libc.
+ *
+ * This is an introsort: quicksort with a median-of-three pivot,
+ * switching to heapsort for any partition that's been split more
+ * than 2*log2(n) times (so adversarial inputs can't make it
+ * quadratic), and to insertion sort for partitions small enough
+ * that quicksort's overhead isn't worth it. Partitioning stops on
+ * keys equal to the pivot, so inputs with many duplicates still
+ * split evenly.
  */
+
+/* Partitions this size or smaller get insertion sorted. */
+#define QS_CUTOFF	12
+
+/* Partitions bigger than this pick their pivot from nine samples. */
+#define QS_NINTHER	40
+
+/*
+ * How to exchange two elements. Elements that are whole, aligned
+ * words are swapped a word at a time (and single words directly)
+ * instead of a byte at a time.
+ */
+#define QS_SWAPBYTES	0
+#define QS_SWAPWORDS	1
+#define QS_SWAPWORD	2
+
+struct qsort_info {
+	size_t size;
+	int swaptype;
+	int (*f)(const void *, const void *);
+};
+
+static
+inline
 void
-qsort(void *vdata, unsigned num, size_t size,
-      int (*f)(const void *, const void *))
+qs_swap(const struct qsort_info *qi, char *a, char *b)
 {
-	unsigned pivot, head, tail;
-	char *data = vdata;
-	char tmp[size];
+	size_t i, n;
 
-#define COMPARE(aa, bb) \
-		((aa) == (bb) ? 0 : f(data + (aa) * size, data + (bb) * size))
-#define EXCHANGE(aa, bb) \
-		memcpy(tmp, data + (aa) * size, size);			\
-		memcpy(data + (aa) * size, data + (bb) * size, size);	\
-		memcpy(data + (bb) * size, tmp, size)
+	if (qi->swaptype == QS_SWAPWORD) {
+		long t = *(long *)a;
+		*(long *)a = *(long *)b;
+		*(long *)b = t;
+	}
+	else if (qi->swaptype == QS_SWAPWORDS) {
+		long *la = (long *)a, *lb = (long *)b, t;
 
+		n = qi->size / sizeof(long);
+		for (i=0; i<n; i++) {
+			t = la[i];
+			la[i] = lb[i];
+			lb[i] = t;
+		}
+	}
+	else {
+		char t;
 
-	if (num <= 1) {
-		return;
+		for (i=0; i<qi->size; i++) {
+			t = a[i];
+			a[i] = b[i];
+			b[i] = t;
+		}
 	}
-	if (num == 2) {
-		if (COMPARE(0, 1) > 0) {
-			EXCHANGE(0, 1);
-			return;
+}
+
+/*
+ * Return whichever of A, B, and C holds the middle value.
+ */
+static
+char *
+qs_med3(const struct qsort_info *qi, char *a, char *b, char *c)
+{
+	if (qi->f(a, b) < 0) {
+		if (qi->f(b, c) < 0) {
+			return b;
 		}
+		return qi->f(a, c) < 0 ? c : a;
 	}
+	if (qi->f(b, c) > 0) {
+		return b;
+	}
+	return qi->f(a, c) > 0 ? c : a;
+}
 
-	/*
-	 * 1. Pick a pivot value. For simplicity, always use the
-	 * middle of the array.
-	 */
-	pivot = num / 2;
-
-	/*
-	 * 2. Shift all values less than or equal to the pivot value
-	 * to the front of the array.
-	 */
-	head = 0;
-	tail = num - 1;
-
-	while (head < tail) {
-		if (COMPARE(head, pivot) <= 0) {
-			head++;
+static
+void
+qs_insertion(const struct qsort_info *qi, char *data, unsigned num)
+{
+	char *end = data + num * qi->size;
+	char *p, *q;
+
+	for (p = data + qi->size; p < end; p += qi->size) {
+		for (q = p; q > data && qi->f(q - qi->size, q) > 0;
+		     q -= qi->size) {
+			qs_swap(qi, q - qi->size, q);
 		}
-		else if (COMPARE(tail, pivot) > 0) {
-			tail--;
+	}
+}
+
+/*
+ * Push element POS of the NUM-element heap at DATA down to where it
+ * belongs.
+ */
+static
+void
+qs_siftdown(const struct qsort_info *qi, char *data, unsigned pos,
+	    unsigned num)
+{
+	unsigned child;
+
+	while ((child = 2 * pos + 1) < num) {
+		if (child + 1 < num &&
+		    qi->f(data + child * qi->size,
+			  data + (child + 1) * qi->size) < 0) {
+			child++;
 		}
-		else {
-			EXCHANGE(head, tail);
-			if (pivot == head) {
-				pivot = tail;
-			}
-			else if (pivot == tail) {
-				pivot = head;
-			}
-			head++;
-			tail--;
+		if (qi->f(data + pos * qi->size,
+			  data + child * qi->size) >= 0) {
+			break;
 		}
+		qs_swap(qi, data + pos * qi->size, data + child * qi->size);
+		pos = child;
 	}
+}
 
-	/*
-	 * 3. If there's an even number of elements and we swapped the
-	 * last two, the head and tail indexes will cross. In this
-	 * case the first entry on the tail side is tail+1. If there's
-	 * an odd number of elements, we stop with head == tail, and
-	 * the first entry on the tail side is this value (hence,
-	 * tail) if it's is greater than the pivot value, and the next
-	 * element (hence, tail+1) if it's less than or equal to the
-	 * pivot value.
-	 *
-	 * Henceforth use "tail" to hold the index of the first entry
-	 * of the back portion of the array.
-	 */
-	if (head > tail || COMPARE(head, pivot) <= 0) {
-		tail++;
+static
+void
+qs_heapsort(const struct qsort_info *qi, char *data, unsigned num)
+{
+	unsigned i;
+
+	for (i = num / 2; i > 0; i--) {
+		qs_siftdown(qi, data, i - 1, num);
+	}
+	for (i = num - 1; i > 0; i--) {
+		qs_swap(qi, data, data + i * qi->size);
+		qs_siftdown(qi, data, 0, i);
 	}
+}
+
+/*
+ * Sort NUM elements at DATA, allowing DEPTH more levels of
+ * partitioning before giving up on quicksort. Recurses on the
+ * smaller side and loops on the larger, so the stack stays
+ * O(log n) deep.
+ */
+static
+void
+qs_sort(const struct qsort_info *qi, char *data, unsigned num,
+	unsigned depth)
+{
+	size_t size = qi->size;
+	char *lo, *hi, *mid, *i, *j;
+	size_t step;
+	unsigned nleft, nright;
+
+	while (num > QS_CUTOFF) {
+		if (depth == 0) {
+			qs_heapsort(qi, data, num);
+			return;
+		}
+		depth--;
+
+		/*
+		 * Move the median of the first, middle, and last
+		 * elements to the front to use as the pivot. For big
+		 * partitions, take the median of three such medians
+		 * (Tukey's ninther) instead; a single median of three
+		 * does badly on what partitioning leaves behind from
+		 * reversed input.
+		 */
+		lo = data;
+		hi = data + (num - 1) * size;
+		mid = data + (num / 2) * size;
+		if (num > QS_NINTHER) {
+			step = (num / 8) * size;
+			lo = qs_med3(qi, lo, lo + step, lo + 2 * step);
+			mid = qs_med3(qi, mid - step, mid, mid + step);
+			hi = qs_med3(qi, hi - 2 * step, hi - step, hi);
+		}
+		mid = qs_med3(qi, lo, mid, hi);
+		lo = data;
+		hi = data + (num - 1) * size;
+		qs_swap(qi, lo, mid);
 
-	/*
-	 * 4. If we got a bad pivot that gave us only one partition,
-	 * because of the order of the advances in the loop above it
-	 * will always put everything in the front portion of the
-	 * array (so tail == num). This happens if we picked the
-	 * largest value. Move the pivot to the end, if necessary, lop
-	 * off all values equal to it, and recurse on the rest.  (If
-	 * there is no rest, the array is already sorted and we're
-	 * done.)
-	 */
-	if (tail == num) {
-		if (pivot < num - 1) {
-			if (COMPARE(pivot, num - 1) > 0) {
-				EXCHANGE(pivot, num - 1);
+		/*
+		 * Partition. I stops on anything not less than the
+		 * pivot, J on anything not greater; swap and go on
+		 * until they cross. Then put the pivot between the
+		 * halves, at J.
+		 */
+		i = lo;
+		j = hi + size;
+		while (1) {
+			do {
+				i += size;
+			} while (i <= hi && qi->f(i, lo) < 0);
+			do {
+				j -= size;
+			} while (j > lo && qi->f(j, lo) > 0);
+			if (i >= j) {
+				break;
 			}
+			qs_swap(qi, i, j);
 		}
-		tail = num - 1;
-		while (tail > 0 && COMPARE(tail - 1, tail) == 0) {
-			tail--;
+		if (j != lo) {
+			qs_swap(qi, lo, j);
 		}
-		if (tail > 0) {
-			qsort(vdata, tail, size, f);
+
+		nleft = (j - data) / size;
+		nright = num - nleft - 1;
+		if (nleft < nright) {
+			qs_sort(qi, data, nleft, depth);
+			data = j + size;
+			num = nright;
+		}
+		else {
+			qs_sort(qi, j + size, nright, depth);
+			num = nleft;
 		}
+	}
+	qs_insertion(qi, data, num);
+}
+
+void
+qsort(void *vdata, unsigned num, size_t size,
+      int (*f)(const void *, const void *))
+{
+	struct qsort_info qi;
+	unsigned n, depth;
+
+	if (num <= 1 || size == 0) {
 		return;
 	}
-	assert(tail > 0 && tail < num);
 
-	/*
-	 * 5. Recurse on each subpart of the array.
-	 */
-	qsort(vdata, tail, size, f);
-	qsort((char *)vdata + tail * size, num - tail, size, f);
+	qi.size = size;
+	qi.f = f;
+	if (((uintptr_t)vdata | size) % sizeof(long) != 0) {
+		qi.swaptype = QS_SWAPBYTES;
+	}
+	else if (size == sizeof(long)) {
+		qi.swaptype = QS_SWAPWORD;
+	}
+	else {
+		qi.swaptype = QS_SWAPWORDS;
+	}
+
+	/* depth limit: 2 * floor(log2(num)) */
+	depth = 0;
+	for (n = num; n > 1; n >>= 1) {
+		depth += 2;
+	}
+
+	qs_sort(&qi, vdata, num, depth);
 }
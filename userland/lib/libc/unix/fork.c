@@ -0,0 +1,15 @@
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * fork: flush stdio, then call the system call __fork. Otherwise
+ * anything sitting in a stdio buffer (e.g. a partial line on stdout)
+ * would be printed by both parent and child.
+ */
+
+pid_t
+fork(void)
+{
+	fflush(NULL);
+	return __fork();
+}
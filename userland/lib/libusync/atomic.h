@@ -0,0 +1,86 @@
+#ifndef _LIBUSYNC_ATOMIC_H_
+#define _LIBUSYNC_ATOMIC_H_
+
+/*
+ * Atomic operations on an int, using LL/SC as the kernel's spinlocks
+ * do (see the comments there). Each asm block is one LL/SC attempt
+ * with no other memory accesses in between; the C loop retries if
+ * the SC failed. All three return the value the word held before.
+ */
+
+/* If *P is OLD, make it NEW. */
+static inline
+int
+usync_cas(volatile int *p, int old, int new)
+{
+	int seen, ok;
+
+	do {
+		/* store back what was there if it isn't OLD */
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"
+			"move %1, %0;"
+			"bne %0, %3, 1f;"
+			"move %1, %4;"
+			"1: sc %1, 0(%2);"
+			"sync;"
+			".set pop"
+			: "=&r" (seen), "=&r" (ok)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+	} while (ok == 0);
+	return seen;
+}
+
+/* Set *P to NEW. */
+static inline
+int
+usync_swap(volatile int *p, int new)
+{
+	int seen, ok;
+
+	do {
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"
+			"move %1, %3;"
+			"sc %1, 0(%2);"
+			"sync;"
+			".set pop"
+			: "=&r" (seen), "=&r" (ok)
+			: "r" (p), "r" (new)
+			: "memory");
+	} while (ok == 0);
+	return seen;
+}
+
+/* Add DELTA to *P. */
+static inline
+int
+usync_add(volatile int *p, int delta)
+{
+	int seen, ok;
+
+	do {
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"
+			"addu %1, %0, %3;"
+			"sc %1, 0(%2);"
+			"sync;"
+			".set pop"
+			: "=&r" (seen), "=&r" (ok)
+			: "r" (p), "r" (delta)
+			: "memory");
+	} while (ok == 0);
+	return seen;
+}
+
+#endif /* _LIBUSYNC_ATOMIC_H_ */
@@ -0,0 +1,44 @@
+/*
+ * Condition variables. A waiter samples the sequence number before
+ * dropping the mutex and sleeps only if it hasn't changed, so a
+ * signal that comes in between isn't lost. Waiters may wake up
+ * spuriously and should recheck their condition, as usual.
+ */
+
+#include <unistd.h>
+#include <usync.h>
+#include "atomic.h"
+
+/* wake count for "everyone" */
+#define WAKEALL 0x7fffffff
+
+void
+ucond_init(struct ucond *c)
+{
+	c->uc_seq = 0;
+}
+
+void
+ucond_wait(struct ucond *c, struct umutex *m)
+{
+	int seq;
+
+	seq = c->uc_seq;
+	umutex_unlock(m);
+	futex(&c->uc_seq, FUTEX_WAIT, seq);
+	umutex_lock(m);
+}
+
+void
+ucond_signal(struct ucond *c)
+{
+	usync_add(&c->uc_seq, 1);
+	futex(&c->uc_seq, FUTEX_WAKE, 1);
+}
+
+void
+ucond_broadcast(struct ucond *c)
+{
+	usync_add(&c->uc_seq, 1);
+	futex(&c->uc_seq, FUTEX_WAKE, WAKEALL);
+}
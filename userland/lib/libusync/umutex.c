@@ -0,0 +1,60 @@
+/*
+ * Mutexes. This is the three-state futex mutex from Drepper's
+ * "Futexes Are Tricky": unlock only calls into the kernel if the
+ * state says someone might be waiting.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <usync.h>
+#include "atomic.h"
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	int c;
+
+	c = usync_cas(&m->um_state, 0, 1);
+	if (c == 0) {
+		/* got it */
+		return;
+	}
+
+	/*
+	 * Mark it contended and wait. Whoever we take it from this
+	 * way will see the 2 and wake someone, and since we can't
+	 * tell whether we were the last waiter we leave it at 2.
+	 */
+	if (c != 2) {
+		c = usync_swap(&m->um_state, 2);
+	}
+	while (c != 0) {
+		futex(&m->um_state, FUTEX_WAIT, 2);
+		c = usync_swap(&m->um_state, 2);
+	}
+}
+
+int
+umutex_trylock(struct umutex *m)
+{
+	if (usync_cas(&m->um_state, 0, 1) != 0) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	if (usync_add(&m->um_state, -1) != 1) {
+		/* it was 2: there may be waiters */
+		m->um_state = 0;
+		futex(&m->um_state, FUTEX_WAKE, 1);
+	}
+}
@@ -163,6 +163,14 @@ dumpsb(void)
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
 	dumplval("Volume name", sb.sb_volname);
+	if (sb.sb_journalblocks != 0) {
+		dumpvalf("Journal start", "%u", SWAP32(sb.sb_journalstart));
+		dumpvalf("Journal size", "%u blocks",
+			 SWAP32(sb.sb_journalblocks));
+	}
+	else {
+		dumplval("Journal", "none");
+	}
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -228,6 +236,146 @@ dumpfreemap(uint32_t fsblocks)
 	printf("\n");
 }
 
+/*
+ * Print a list of block numbers from a journal descriptor.
+ */
+static
+void
+dumpjblocks(const char *what, const uint32_t *blocks, uint32_t num)
+{
+	uint32_t i;
+
+	for (i=0; i<num; i++) {
+		if (i % 8 == 0) {
+			printf("%s      %s:", i > 0 ? "\n" : "", what);
+		}
+		printf(" %u", SWAP32(blocks[i]));
+	}
+	if (num > 0) {
+		printf("\n");
+	}
+}
+
+/*
+ * Dump the journal header and walk the log from there the way mount
+ * would replay it, showing each transaction found.
+ */
+static
+void
+dumpjournal(void)
+{
+	struct sfs_superblock sb;
+	union {
+		struct sfs_jheader jh;
+		struct sfs_jdesc jd;
+		struct sfs_jcommit jc;
+		uint32_t words[SFS_BLOCKSIZE / sizeof(uint32_t)];
+	} blk;
+	uint32_t jstart, jsize, pos, seq, nblocks, csum, nimages, nrevoke;
+	uint32_t i, k;
+	bool done;
+
+	diskread(&sb, SFS_SUPER_BLOCK);
+	jstart = SWAP32(sb.sb_journalstart);
+	jsize = SWAP32(sb.sb_journalblocks);
+
+	printf("Journal\n");
+	printf("-------\n");
+	if (jsize == 0) {
+		printf("    No journal\n\n");
+		return;
+	}
+	if (jsize < SFS_JOURNAL_MINBLOCKS) {
+		printf("    Journal size %u is too small\n\n", jsize);
+		return;
+	}
+
+	diskread(&blk, jstart);
+	if (SWAP32(blk.jh.jh_magic) != SFS_JHEADER_MAGIC) {
+		printf("    Bad header magic 0x%x\n\n",
+		       SWAP32(blk.jh.jh_magic));
+		return;
+	}
+	pos = SWAP32(blk.jh.jh_start);
+	seq = SWAP32(blk.jh.jh_seq);
+	dumpvalf("Log start", "%u", pos);
+	dumpvalf("Sequence", "%u", seq);
+	if (dumppos % 2 == 1) {
+		printf("\n");
+		dumppos++;
+	}
+	if (pos == 0 || pos >= jsize) {
+		printf("    Log start out of range\n\n");
+		return;
+	}
+
+	done = false;
+	while (!done) {
+		printf("    Transaction %u at %u:\n", seq, pos);
+		nblocks = 0;
+		csum = 0;
+		while (1) {
+			if (nblocks >= jsize - 1) {
+				printf("      (runs all the way around)\n");
+				done = true;
+				break;
+			}
+			diskread(&blk, jstart + pos);
+			pos = pos + 1 < jsize ? pos + 1 : 1;
+
+			if (SWAP32(blk.jc.jc_magic) == SFS_JCOMMIT_MAGIC &&
+			    SWAP32(blk.jc.jc_seq) == seq) {
+				if (SWAP32(blk.jc.jc_nblocks) != nblocks ||
+				    SWAP32(blk.jc.jc_checksum) != csum) {
+					printf("      Commit block does not "
+					       "match; not replayed\n");
+					done = true;
+				}
+				else {
+					printf("      Committed, %u blocks\n",
+					       nblocks);
+				}
+				break;
+			}
+			if (SWAP32(blk.jd.jd_magic) != SFS_JDESC_MAGIC ||
+			    SWAP32(blk.jd.jd_seq) != seq) {
+				printf("      %s\n", nblocks == 0 ?
+				       "(none; end of log)" :
+				       "No commit block; not replayed");
+				done = true;
+				break;
+			}
+			nimages = SWAP32(blk.jd.jd_nimages);
+			nrevoke = SWAP32(blk.jd.jd_nrevoke);
+			if (nimages + nrevoke > SFS_JDESC_MAX) {
+				printf("      Bad descriptor (%u images, "
+				       "%u revokes)\n", nimages, nrevoke);
+				done = true;
+				break;
+			}
+			dumpjblocks("images", blk.jd.jd_blocks, nimages);
+			dumpjblocks("revoked", blk.jd.jd_blocks + nimages,
+				    nrevoke);
+			for (i=0; i<ARRAYCOUNT(blk.words); i++) {
+				csum = SFS_JCSUM(csum, SWAP32(blk.words[i]));
+			}
+			nblocks++;
+
+			for (k=0; k<nimages; k++) {
+				diskread(&blk, jstart + pos);
+				pos = pos + 1 < jsize ? pos + 1 : 1;
+				for (i=0; i<ARRAYCOUNT(blk.words); i++) {
+					csum = SFS_JCSUM(csum,
+						SWAP32(blk.words[i]));
+				}
+				nblocks++;
+			}
+		}
+		seq++;
+	}
+	printf("\n");
+}
+
 static
 void
 dumpindirect(uint32_t block)
@@ -508,12 +656,13 @@ usage(void)
 	warnx("Usage: dumpsfs [options] device/diskfile");
 	warnx("   -s: dump superblock");
 	warnx("   -b: dump free block bitmap");
+	warnx("   -j: dump journal");
 	warnx("   -i ino: dump specified inode");
 	warnx("   -I: dump indirect blocks");
 	warnx("   -f: dump file contents");
 	warnx("   -d: dump directory contents");
 	warnx("   -r: recurse into directory contents");
-	warnx("   -a: equivalent to -sbdfr -i 1");
+	warnx("   -a: equivalent to -sbjdfr -i 1");
 	errx(1, "   Default is -i 1");
 }
 
@@ -522,6 +671,7 @@ main(int argc, char **argv)
 {
 	bool dosb = false;
 	bool dofreemap = false;
+	bool dojournal = false;
 	uint32_t dumpino = 0;
 	const char *dumpdisk = NULL;
 
@@ -540,6 +690,7 @@ main(int argc, char **argv)
 				switch (argv[i][j]) {
 				    case 's': dosb = true; break;
 				    case 'b': dofreemap = true; break;
+				    case 'j': dojournal = true; break;
 				    case 'i':
 					if (argv[i][j+1] == 0) {
 						dumpino = atoi(argv[++i]);
@@ -557,6 +708,7 @@ main(int argc, char **argv)
 				    case 'a':
 					dosb = true;
 					dofreemap = true;
+					dojournal = true;
 					if (dumpino == 0) {
 						dumpino = SFS_ROOTDIR_INO;
 					}
@@ -584,7 +736,7 @@ main(int argc, char **argv)
 		usage();
 	}
 
-	if (!dosb && !dofreemap && dumpino == 0) {
+	if (!dosb && !dofreemap && !dojournal && dumpino == 0) {
 		dumpino = SFS_ROOTDIR_INO;
 	}
 
@@ -597,6 +749,9 @@ main(int argc, char **argv)
 	if (dofreemap) {
 		dumpfreemap(nblocks);
 	}
+	if (dojournal) {
+		dumpjournal();
+	}
 	if (dumpino != 0) {
 		dumpinode(dumpino, NULL);
 	}
@@ -0,0 +1,434 @@
+/*
+ * fsckbench - time sfsck on a large synthetic SFS volume (host only).
+ *
+ * Usage: fsckbench [-d dirs] [-f files] [-b blocks] [-r runs]
+ *                  [-j threads,...] [-s sfsck] disk-image
+ *
+ * Lays out a fresh SFS volume on the disk image, as mksfs would, and
+ * fills it with DIRS directories under the root, each holding FILES
+ * files of BLOCKS blocks. Files longer than SFS_NDIRECT blocks, and
+ * big directories, get an indirect block. File contents are not
+ * written, since sfsck never looks at them. Then sfsck (by default
+ * host-sfsck, found in $PATH) is run on the volume RUNS times and
+ * the wall-clock time of each run is printed. With -j, that's done
+ * for each of the listed thread counts (sfsck -j N). The volume is
+ * consistent, so every run should come out clean.
+ *
+ * The disk image must already exist and be big enough; make it with
+ * disk161 or by hand (a 512-byte header block starting with the
+ * string "System/161 Disk Image" and then the sectors).
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <err.h>
+
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for htonl
+#include "hostcompat.h"
+#include "kern/sfs.h"
+#include "disk.h"
+
+#define SWAP32(x) htonl(x)
+#define SWAP16(x) htons(x)
+
+/* Most blocks an inode can map: the direct blocks and one indirect. */
+#define MAXFILEBLOCKS	(SFS_NDIRECT + SFS_DBPERIDB)
+
+#define DIRENTSPERBLOCK	(SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+static uint32_t fsblocks;	/* size of the volume */
+static uint8_t *freemap;	/* in-memory free block bitmap */
+static uint32_t nextblock;	/* next block to allocate */
+static uint32_t nfiles, ndirs;	/* objects created */
+
+////////////////////////////////////////////////////////////
+// building the volume
+
+static
+void
+markused(uint32_t block)
+{
+	freemap[block / CHAR_BIT] |= 1 << (block % CHAR_BIT);
+}
+
+/*
+ * Blocks are handed out in order; there's no free list because
+ * nothing is ever freed.
+ */
+static
+uint32_t
+allocblock(void)
+{
+	uint32_t block;
+
+	if (nextblock >= fsblocks) {
+		errx(1, "Disk image too small (%u blocks) for this volume",
+		     fsblocks);
+	}
+	block = nextblock++;
+	markused(block);
+	return block;
+}
+
+/*
+ * Give SFI NBLOCKS blocks, and fill in BLOCKS (if not NULL) with
+ * their numbers. Writes out the indirect block, if there is one.
+ */
+static
+void
+mapblocks(struct sfs_dinode *sfi, uint32_t nblocks, uint32_t *blocks)
+{
+	uint32_t indir[SFS_DBPERIDB];
+	uint32_t i, b;
+
+	if (nblocks > MAXFILEBLOCKS) {
+		errx(1, "Object of %u blocks too large (max %u)",
+		     nblocks, MAXFILEBLOCKS);
+	}
+
+	memset(indir, 0, sizeof(indir));
+	for (i=0; i<nblocks; i++) {
+		if (i == SFS_NDIRECT) {
+			sfi->sfi_indirect = SWAP32(allocblock());
+		}
+		b = allocblock();
+		if (i < SFS_NDIRECT) {
+			sfi->sfi_direct[i] = SWAP32(b);
+		}
+		else {
+			indir[i - SFS_NDIRECT] = SWAP32(b);
+		}
+		if (blocks != NULL) {
+			blocks[i] = b;
+		}
+	}
+	if (nblocks > SFS_NDIRECT) {
+		diskwrite(indir, SWAP32(sfi->sfi_indirect));
+	}
+}
+
+/*
+ * Create a file of NBLOCKS blocks and return its inode number.
+ */
+static
+uint32_t
+makefile(uint32_t nblocks)
+{
+	struct sfs_dinode sfi;
+	uint32_t ino;
+
+	ino = allocblock();
+
+	memset(&sfi, 0, sizeof(sfi));
+	sfi.sfi_size = SWAP32(nblocks * SFS_BLOCKSIZE);
+	sfi.sfi_type = SWAP16(SFS_TYPE_FILE);
+	sfi.sfi_linkcount = SWAP16(1);
+	mapblocks(&sfi, nblocks, NULL);
+	diskwrite(&sfi, ino);
+
+	nfiles++;
+	return ino;
+}
+
+/*
+ * Write out directory INO, with parent PARENTINO, containing the
+ * NENTS entries in ENTS (including . and ..), NSUBDIRS of which are
+ * subdirectories.
+ */
+static
+void
+writedir(uint32_t ino, uint32_t parentino,
+	 struct sfs_direntry *ents, uint32_t nents, uint32_t nsubdirs)
+{
+	struct sfs_dinode sfi;
+	struct sfs_direntry buf[DIRENTSPERBLOCK];
+	uint32_t blocks[MAXFILEBLOCKS];
+	uint32_t nblocks, i, j, k;
+
+	strcpy(ents[0].sfd_name, ".");
+	ents[0].sfd_ino = ino;
+	strcpy(ents[1].sfd_name, "..");
+	ents[1].sfd_ino = parentino;
+
+	nblocks = (nents + DIRENTSPERBLOCK - 1) / DIRENTSPERBLOCK;
+
+	memset(&sfi, 0, sizeof(sfi));
+	sfi.sfi_size = SWAP32(nents * sizeof(struct sfs_direntry));
+	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
+	sfi.sfi_linkcount = SWAP16(nsubdirs + 2);
+	mapblocks(&sfi, nblocks, blocks);
+
+	for (i=0; i<nblocks; i++) {
+		memset(buf, 0, sizeof(buf));
+		for (j=0; j<DIRENTSPERBLOCK; j++) {
+			k = i * DIRENTSPERBLOCK + j;
+			if (k >= nents) {
+				break;
+			}
+			buf[j] = ents[k];
+			buf[j].sfd_ino = SWAP32(ents[k].sfd_ino);
+		}
+		diskwrite(buf, blocks[i]);
+	}
+	diskwrite(&sfi, ino);
+
+	ndirs++;
+}
+
+/*
+ * Create a directory under PARENTINO holding NF files of FBLOCKS
+ * blocks each, and return its inode number.
+ */
+static
+uint32_t
+makedir(uint32_t parentino, uint32_t nf, uint32_t fblocks)
+{
+	struct sfs_direntry *ents;
+	uint32_t ino, i;
+
+	ino = allocblock();
+
+	ents = calloc(nf + 2, sizeof(ents[0]));
+	if (ents == NULL) {
+		err(1, "calloc");
+	}
+	for (i=0; i<nf; i++) {
+		snprintf(ents[i+2].sfd_name, SFS_NAMELEN, "f%u", i);
+		ents[i+2].sfd_ino = makefile(fblocks);
+	}
+	writedir(ino, parentino, ents, nf + 2, 0);
+	free(ents);
+
+	return ino;
+}
+
+/*
+ * Lay out the whole volume: superblock, root directory, ND
+ * directories of NF files of FBLOCKS blocks each, and the freemap.
+ */
+static
+void
+makevolume(uint32_t nd, uint32_t nf, uint32_t fblocks)
+{
+	struct sfs_superblock sb;
+	struct sfs_direntry *ents;
+	uint32_t mapblocks, i;
+
+	fsblocks = diskblocks();
+	mapblocks = SFS_FREEMAPBLOCKS(fsblocks);
+	freemap = calloc(mapblocks, SFS_BLOCKSIZE);
+	if (freemap == NULL) {
+		err(1, "calloc");
+	}
+
+	markused(SFS_SUPER_BLOCK);
+	markused(SFS_ROOTDIR_INO);
+	for (i=0; i<mapblocks; i++) {
+		markused(SFS_FREEMAP_START + i);
+	}
+	for (i=fsblocks; i<SFS_FREEMAPBITS(fsblocks); i++) {
+		markused(i);
+	}
+	nextblock = SFS_FREEMAP_START + mapblocks;
+
+	ents = calloc(nd + 2, sizeof(ents[0]));
+	if (ents == NULL) {
+		err(1, "calloc");
+	}
+	for (i=0; i<nd; i++) {
+		snprintf(ents[i+2].sfd_name, SFS_NAMELEN, "d%u", i);
+		ents[i+2].sfd_ino = makedir(SFS_ROOTDIR_INO, nf, fblocks);
+	}
+	writedir(SFS_ROOTDIR_INO, SFS_ROOTDIR_INO, ents, nd + 2, nd);
+	free(ents);
+
+	memset(&sb, 0, sizeof(sb));
+	sb.sb_magic = SWAP32(SFS_MAGIC);
+	sb.sb_nblocks = SWAP32(fsblocks);
+	strcpy(sb.sb_volname, "fsckbench");
+	diskwrite(&sb, SFS_SUPER_BLOCK);
+
+	for (i=0; i<mapblocks; i++) {
+		diskwrite(freemap + i * SFS_BLOCKSIZE, SFS_FREEMAP_START + i);
+	}
+	free(freemap);
+}
+
+////////////////////////////////////////////////////////////
+// running sfsck
+
+/*
+ * Run SFSCK on IMAGE, with THREADS threads (0 for the default), with
+ * its output thrown away, and return the elapsed time in
+ * milliseconds.
+ */
+static
+unsigned long
+runfsck(const char *sfsck, const char *image, unsigned threads)
+{
+	char jarg[16];
+
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	pid_t pid;
+	int status, fd;
+
+	__time(&s0, &ns0);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		if (threads > 0) {
+			snprintf(jarg, sizeof(jarg), "%u", threads);
+			execlp(sfsck, sfsck, "-j", jarg, image, (char *)NULL);
+		}
+		else {
+			execlp(sfsck, sfsck, image, (char *)NULL);
+		}
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	__time(&s1, &ns1);
+
+	if (WIFSIGNALED(status)) {
+		errx(1, "%s: signal %d", sfsck, WTERMSIG(status));
+	}
+	if (WEXITSTATUS(status) == 127) {
+		errx(1, "%s: could not run it", sfsck);
+	}
+	if (WEXITSTATUS(status) != 0) {
+		warnx("%s: exit %d (volume not clean?)", sfsck,
+		      WEXITSTATUS(status));
+	}
+
+	return (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 -
+		ns0 / 1000000;
+}
+
+////////////////////////////////////////////////////////////
+// main
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: fsckbench [-d dirs] [-f files] [-b blocks] "
+	     "[-r runs] [-j threads,...] [-s sfsck] disk-image");
+}
+
+static
+uint32_t
+getnum(const char *s)
+{
+	char *end;
+	unsigned long val;
+
+	val = strtoul(s, &end, 0);
+	if (*s == 0 || *end != 0 || val > UINT32_MAX) {
+		usage();
+	}
+	return val;
+}
+
+/*
+ * Time RUNS runs of SFSCK on IMAGE with THREADS threads.
+ */
+static
+void
+timefsck(const char *sfsck, const char *image, unsigned threads,
+	 uint32_t runs)
+{
+	unsigned long ms, total, best;
+	uint32_t i;
+
+	if (threads > 0) {
+		printf("%u threads:\n", threads);
+	}
+	total = 0;
+	best = ULONG_MAX;
+	for (i=0; i<runs; i++) {
+		ms = runfsck(sfsck, image, threads);
+		printf("run %u: %lu.%03lu s\n", i+1, ms / 1000, ms % 1000);
+		total += ms;
+		if (ms < best) {
+			best = ms;
+		}
+	}
+	if (runs > 0) {
+		printf("best %lu.%03lu s, average %lu.%03lu s\n",
+		       best / 1000, best % 1000,
+		       total / runs / 1000, total / runs % 1000);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t nd = 64, nf = 1000, fblocks = 16, runs = 3;
+	const char *sfsck = "host-sfsck";
+	const char *image;
+	char *threadlist = NULL, *t;
+	int ch;
+
+	hostcompat_init(argc, argv);
+
+	while ((ch = getopt(argc, argv, "d:f:b:r:j:s:")) != -1) {
+		switch (ch) {
+		    case 'd': nd = getnum(optarg); break;
+		    case 'f': nf = getnum(optarg); break;
+		    case 'b': fblocks = getnum(optarg); break;
+		    case 'r': runs = getnum(optarg); break;
+		    case 'j': threadlist = optarg; break;
+		    case 's': sfsck = optarg; break;
+		    default: usage(); break;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage();
+	}
+	image = argv[optind];
+
+	/* . and .. take up two entries in each directory */
+	if ((nd + 2 + DIRENTSPERBLOCK - 1) / DIRENTSPERBLOCK > MAXFILEBLOCKS ||
+	    (nf + 2 + DIRENTSPERBLOCK - 1) / DIRENTSPERBLOCK > MAXFILEBLOCKS) {
+		errx(1, "At most %lu entries per directory",
+		     (unsigned long)(MAXFILEBLOCKS * DIRENTSPERBLOCK - 2));
+	}
+
+	opendisk(image);
+	makevolume(nd, nf, fblocks);
+	printf("%s: %u blocks; %u used; %u directories; %u files\n",
+	       image, fsblocks, nextblock, ndirs, nfiles);
+	closedisk();
+
+	if (threadlist == NULL) {
+		timefsck(sfsck, image, 0, runs);
+	}
+	else {
+		for (t = strtok(threadlist, ","); t != NULL;
+		     t = strtok(NULL, ",")) {
+			timefsck(sfsck, image, getnum(t), runs);
+		}
+	}
+
+	return 0;
+}
@@ -29,6 +29,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HOST
+#include <sys/mman.h>
+#endif
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
@@ -47,8 +50,81 @@
 #define EINTR 0
 #endif
 
+/*
+ * How we get at the disk.
+ *
+ * On the host we mmap the whole image if we can, and then reading or
+ * writing a block is just a memcpy; the kernel's page cache does the
+ * rest. If that fails, and always on OS/161, which has no mmap, we
+ * go through the file with read and write, but not a block at a
+ * time. Reads go through a small cache, so blocks the checker keeps
+ * coming back to (inodes, indirect blocks, directories) are read
+ * once while they stay in it. The cache is kept in clusters of
+ * consecutive blocks; a read that carries on from the previous one
+ * fetches the rest of its cluster in the same read, while a random
+ * read fetches just the one block. Writes to consecutive blocks are
+ * collected and sent with a single write. Pending writes are flushed
+ * before any read that misses the cache, and the cache is updated on
+ * write, so reads always see what was last written.
+ */
+
+#ifdef HOST
+/* The disk image starts with a header block, which we skip. */
+#define DISKSTART  1
+#define NCLUSTERS  512		/* 2M of cache */
+#else
+#define DISKSTART  0
+#define NCLUSTERS  16		/* 64k of cache */
+#endif
+
+#define CLUSTERBLOCKS  8	/* blocks read at once */
+#define WBBLOCKS       64	/* most blocks written at once */
+#define NOCLUSTER      ((uint32_t)-1)
+
+struct cluster {
+	uint32_t c_first;	/* first block, or NOCLUSTER */
+	unsigned c_valid;	/* bitmask of blocks present */
+	char c_data[CLUSTERBLOCKS * BLOCKSIZE];
+};
+
 static int fd=-1;
 static uint32_t nblocks;
+static off_t curpos;		/* file offset, to skip needless seeks */
+
+#ifdef HOST
+static char *map;		/* the whole image, if mapped */
+static size_t maplen;
+#endif
+
+static struct cluster clusters[NCLUSTERS];
+static uint32_t lastread;	/* block last read, for readahead */
+
+static char wbbuf[WBBLOCKS * BLOCKSIZE];
+static uint32_t wbfirst;	/* first block in wbbuf */
+static uint32_t wbcount;	/* number of blocks in wbbuf */
+
+/*
+ * Try to map the image. On failure leave map NULL; we'll use the
+ * cache instead.
+ */
+#ifdef HOST
+static
+void
+mapdisk(off_t size)
+{
+	void *p;
+
+	if (size <= 0 || (off_t)(size_t)size != size) {
+		return;
+	}
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		return;
+	}
+	map = p;
+	maplen = size;
+}
+#endif
 
 /*
  * Open a disk. If we're built for the host OS, check that it's a
@@ -58,6 +134,7 @@ void
 opendisk(const char *path)
 {
 	struct stat statbuf;
+	unsigned i;
 
 	assert(fd<0);
 	fd = open(path, O_RDWR);
@@ -91,7 +168,16 @@ opendisk(const char *path)
 			errx(1, "%s: Not a System/161 disk image", path);
 		}
 	}
+
+	mapdisk((off_t)(nblocks + DISKSTART) * BLOCKSIZE);
 #endif
+
+	for (i=0; i<NCLUSTERS; i++) {
+		clusters[i].c_first = NOCLUSTER;
+	}
+	lastread = NOCLUSTER;
+	wbcount = 0;
+	curpos = -1;
 }
 
 /*
@@ -115,28 +201,53 @@ diskblocks(void)
 }
 
 /*
- * Write a block.
+ * Seek to BLOCK, unless we're already there.
  */
+static
 void
-diskwrite(const void *data, uint32_t block)
+seekblock(uint32_t block)
 {
-	const char *cdata = data;
-	uint32_t tot=0;
-	int len;
+	off_t pos = (off_t)(block + DISKSTART) * BLOCKSIZE;
 
-	assert(fd>=0);
+	if (pos != curpos) {
+		if (lseek(fd, pos, SEEK_SET)<0) {
+			err(1, "lseek");
+		}
+		curpos = pos;
+	}
+}
 
+/*
+ * Return nonzero if diskread may be called from several threads at
+ * once. That's only so if the image is mapped; the cache and the
+ * collected writes have no locking.
+ */
+int
+diskthreadsafe(void)
+{
+	assert(fd>=0);
 #ifdef HOST
-	// skip over disk file header
-	block++;
+	return map != NULL;
+#else
+	return 0;
 #endif
+}
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
-	}
+/*
+ * Write NUM blocks starting at BLOCK straight to the file.
+ */
+static
+void
+writeblocks(const void *data, uint32_t block, uint32_t num)
+{
+	const char *cdata = data;
+	size_t tot=0, size = (size_t)num * BLOCKSIZE;
+	ssize_t len;
+
+	seekblock(block);
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < size) {
+		len = write(fd, cdata + tot, size - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -148,31 +259,24 @@ diskwrite(const void *data, uint32_t block)
 		}
 		tot += len;
 	}
+	curpos += size;
 }
 
 /*
- * Read a block.
+ * Read NUM blocks starting at BLOCK straight from the file.
  */
+static
 void
-diskread(void *data, uint32_t block)
+readblocks(void *data, uint32_t block, uint32_t num)
 {
 	char *cdata = data;
-	uint32_t tot=0;
-	int len;
-
-	assert(fd>=0);
-
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
+	size_t tot=0, size = (size_t)num * BLOCKSIZE;
+	ssize_t len;
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
-	}
+	seekblock(block);
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < size) {
+		len = read(fd, cdata + tot, size - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -184,6 +288,109 @@ diskread(void *data, uint32_t block)
 		}
 		tot += len;
 	}
+	curpos += size;
+}
+
+/*
+ * Send any collected writes.
+ */
+static
+void
+flushwrites(void)
+{
+	if (wbcount > 0) {
+		writeblocks(wbbuf, wbfirst, wbcount);
+		wbcount = 0;
+	}
+}
+
+/*
+ * Write a block.
+ */
+void
+diskwrite(const void *data, uint32_t block)
+{
+	struct cluster *c;
+	uint32_t first;
+
+	assert(fd>=0);
+	if (block >= nblocks) {
+		errx(1, "write: block %u past end of disk", block);
+	}
+
+#ifdef HOST
+	if (map != NULL) {
+		memcpy(map + (size_t)(block + DISKSTART) * BLOCKSIZE, data,
+		       BLOCKSIZE);
+		return;
+	}
+#endif
+
+	first = block - block % CLUSTERBLOCKS;
+	c = &clusters[(first / CLUSTERBLOCKS) % NCLUSTERS];
+	if (c->c_first == first) {
+		memcpy(c->c_data + (block - first) * BLOCKSIZE, data,
+		       BLOCKSIZE);
+		c->c_valid |= 1U << (block - first);
+	}
+
+	if (wbcount > 0 &&
+	    (block != wbfirst + wbcount || wbcount == WBBLOCKS)) {
+		flushwrites();
+	}
+	if (wbcount == 0) {
+		wbfirst = block;
+	}
+	memcpy(wbbuf + wbcount * BLOCKSIZE, data, BLOCKSIZE);
+	wbcount++;
+}
+
+/*
+ * Read a block.
+ */
+void
+diskread(void *data, uint32_t block)
+{
+	struct cluster *c;
+	uint32_t first, num, i;
+
+	assert(fd>=0);
+	if (block >= nblocks) {
+		errx(1, "read: block %u past end of disk", block);
+	}
+
+#ifdef HOST
+	if (map != NULL) {
+		memcpy(data, map + (size_t)(block + DISKSTART) * BLOCKSIZE,
+		       BLOCKSIZE);
+		return;
+	}
+#endif
+
+	first = block - block % CLUSTERBLOCKS;
+	c = &clusters[(first / CLUSTERBLOCKS) % NCLUSTERS];
+	if (c->c_first != first) {
+		c->c_first = first;
+		c->c_valid = 0;
+	}
+	if ((c->c_valid & (1U << (block - first))) == 0) {
+		flushwrites();
+		num = 1;
+		if (block == lastread + 1) {
+			/* sequential; read the rest of the cluster */
+			num = CLUSTERBLOCKS - (block - first);
+			if (num > nblocks - block) {
+				num = nblocks - block;
+			}
+		}
+		readblocks(c->c_data + (block - first) * BLOCKSIZE,
+			   block, num);
+		for (i=0; i<num; i++) {
+			c->c_valid |= 1U << (block - first + i);
+		}
+	}
+	lastread = block;
+	memcpy(data, c->c_data + (block - first) * BLOCKSIZE, BLOCKSIZE);
 }
 
 /*
@@ -193,6 +400,16 @@ void
 closedisk(void)
 {
 	assert(fd>=0);
+
+	flushwrites();
+#ifdef HOST
+	if (map != NULL) {
+		if (munmap(map, maplen)) {
+			err(1, "munmap");
+		}
+		map = NULL;
+	}
+#endif
 	if (close(fd)) {
 		err(1, "close");
 	}
@@ -31,6 +31,7 @@ void opendisk(const char *path);
 
 uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
+int diskthreadsafe(void);
 
 void diskwrite(const void *data, uint32_t block);
 void diskread(void *data, uint32_t block);
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -57,8 +58,24 @@
 
 #include "disk.h"
 
-/* Maximum size of freemap we support */
+/*
+ * Maximum size of freemap we support. On the host, allow images of
+ * up to 8G (16M blocks); on OS/161, 64M.
+ */
+#ifdef HOST
+#define MAXFREEMAPBLOCKS 4096
+#else
 #define MAXFREEMAPBLOCKS 32
+#endif
+
+/*
+ * Default journal size: 1/64 of the volume, but at least
+ * MINJOURNAL and at most MAXJOURNAL blocks. Volumes too small to
+ * spare MINJOURNAL blocks that way get no journal by default.
+ */
+#define JOURNALFRAC 64
+#define MINJOURNAL  64
+#define MAXJOURNAL  1024
 
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
@@ -73,6 +90,9 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -94,7 +114,7 @@ allocblock(uint32_t block)
  */
 static
 void
-initfreemap(uint32_t fsblocks)
+initfreemap(uint32_t fsblocks, uint32_t journalblocks)
 {
 	uint32_t freemapbits = SFS_FREEMAPBITS(fsblocks);
 	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
@@ -114,6 +134,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* and so must the journal, which comes right after */
+	for (i=0; i<journalblocks; i++) {
+		allocblock(SFS_FREEMAP_START + freemapblocks + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -125,7 +150,7 @@ initfreemap(uint32_t fsblocks)
  */
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks, uint32_t journalblocks)
 {
 	struct sfs_superblock sb;
 
@@ -140,6 +165,11 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	if (journalblocks > 0) {
+		sb.sb_journalstart =
+			SWAP32(SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks));
+		sb.sb_journalblocks = SWAP32(journalblocks);
+	}
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -164,6 +194,74 @@ writefreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Write out an empty journal: a header saying the log starts at
+ * its first block, then zeros, so nothing left over from earlier
+ * use of the disk can look like a transaction.
+ */
+static
+void
+writejournal(uint32_t fsblocks, uint32_t journalblocks)
+{
+	struct sfs_jheader jh;
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t start, i;
+
+	if (journalblocks == 0) {
+		return;
+	}
+	start = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JHEADER_MAGIC);
+	jh.jh_seq = SWAP32(1);
+	jh.jh_start = SWAP32(1);
+	diskwrite(&jh, start);
+
+	bzero(zeros, sizeof(zeros));
+	for (i=1; i<journalblocks; i++) {
+		diskwrite(zeros, start + i);
+	}
+}
+
+/*
+ * Pick the journal size, given the -j argument (or NULL).
+ */
+static
+uint32_t
+journalsize(const char *arg, uint32_t fsblocks)
+{
+	uint32_t reserved, journalblocks;
+
+	reserved = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+
+	if (arg != NULL) {
+		journalblocks = atoi(arg);
+		if (journalblocks == 0) {
+			return 0;
+		}
+		if (journalblocks < SFS_JOURNAL_MINBLOCKS) {
+			errx(1, "Journal must be at least %u blocks",
+			     SFS_JOURNAL_MINBLOCKS);
+		}
+		if (reserved > fsblocks ||
+		    journalblocks > (fsblocks - reserved) / 2) {
+			errx(1, "Journal of %u blocks too large for volume",
+			     journalblocks);
+		}
+		return journalblocks;
+	}
+
+	journalblocks = fsblocks / JOURNALFRAC;
+	if (journalblocks < MINJOURNAL) {
+		return 0;
+	}
+	if (journalblocks > MAXJOURNAL) {
+		journalblocks = MAXJOURNAL;
+	}
+	return journalblocks;
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -189,15 +287,22 @@ writerootdir(void)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, journalblocks;
+	const char *journalarg = NULL;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	if (argc==5 && !strcmp(argv[1], "-j")) {
+		journalarg = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-j journal-blocks] "
+		     "device/diskfile volume-name");
 	}
 
 	check();
@@ -227,12 +332,17 @@ main(int argc, char **argv)
 		     blocksize, SFS_BLOCKSIZE);
 	}
 	size = diskblocks();
-
-	/* Write out the on-disk structures */
-	initfreemap(size);
-	writesuper(volname, size);
-	writefreemap(size);
+	journalblocks = journalsize(journalarg, size);
+
+	/*
+	 * Write out the on-disk structures, in block order, so the
+	 * writes go out together.
+	 */
+	initfreemap(size, journalblocks);
+	writesuper(volname, size, journalblocks);
 	writerootdir();
+	writefreemap(size);
+	writejournal(size, journalblocks);
 
 	closedisk();
 
@@ -31,6 +31,7 @@
 #include <limits.h>	/* also for CHAR_BIT */
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <err.h>
 
@@ -46,6 +47,16 @@
 static unsigned long blocksinuse = 0;
 static uint8_t *freemapdata;
 static uint8_t *tofreedata;
+static size_t freemapbytes;
+
+/*
+ * A partial freemap: blocks found in use by one thread of the
+ * parallel pass 1, not yet merged into freemapdata.
+ */
+struct freemap_part {
+	uint8_t *fp_bits;
+	unsigned long fp_count;		/* bits set */
+};
 
 /*
  * Allocate space to keep track of the free block bitmap. This is
@@ -67,6 +78,7 @@ freemap_setup(void)
 	for (i=0; i<mapbytes; i++) {
 		freemapdata[i] = tofreedata[i] = 0;
 	}
+	freemapbytes = mapbytes;
 
 	/* Mark off what's in the freemap but past the volume end. */
 	for (i=fsblocks; i < mapblocks*SFS_BITSPERBLOCK; i++) {
@@ -78,6 +90,11 @@ freemap_setup(void)
 	for (i=0; i < mapblocks; i++) {
 		freemap_blockinuse(SFS_FREEMAP_START+i, B_FREEMAPBLOCK, i);
 	}
+
+	/* and the journal, if any */
+	for (i=0; i < sb_journalblocks(); i++) {
+		freemap_blockinuse(sb_journalstart()+i, B_JOURNAL, i);
+	}
 }
 
 /*
@@ -95,6 +112,10 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 		snprintf(rv, sizeof(rv), "freemap block %lu",
 			 (unsigned long) howdesc);
 		break;
+	    case B_JOURNAL:
+		snprintf(rv, sizeof(rv), "journal block %lu",
+			 (unsigned long) howdesc);
+		break;
 	    case B_INODE:
 		snprintf(rv, sizeof(rv), "inode %lu",
 			 (unsigned long) howdesc);
@@ -175,6 +196,83 @@ freemap_blockfree(uint32_t block)
 	tofreedata[index] |= mask;
 }
 
+/*
+ * Create an empty partial freemap.
+ */
+struct freemap_part *
+freemap_part_create(void)
+{
+	struct freemap_part *fp;
+	size_t i;
+
+	fp = domalloc(sizeof(*fp));
+	fp->fp_bits = domalloc(freemapbytes);
+	for (i=0; i<freemapbytes; i++) {
+		fp->fp_bits[i] = 0;
+	}
+	fp->fp_count = 0;
+	return fp;
+}
+
+void
+freemap_part_destroy(struct freemap_part *fp)
+{
+	free(fp->fp_bits);
+	free(fp);
+}
+
+/*
+ * Mark BLOCK in use in the partial freemap FP. Returns 1 (and does
+ * nothing) if it's already marked there.
+ */
+int
+freemap_part_inuse(struct freemap_part *fp, uint32_t block)
+{
+	unsigned index = block/8;
+	uint8_t mask = ((uint8_t)1)<<(block%8);
+
+	if (fp->fp_bits[index] & mask) {
+		return 1;
+	}
+	fp->fp_bits[index] |= mask;
+	fp->fp_count++;
+	return 0;
+}
+
+/*
+ * Merge the NPARTS partial freemaps in PARTS into the freemap. If any
+ * block is marked in more than one of them, or was already marked
+ * in the freemap, return 1 and change nothing; otherwise the result
+ * is the same as calling freemap_blockinuse for every block.
+ */
+int
+freemap_part_merge(struct freemap_part **parts, unsigned nparts)
+{
+	size_t i;
+	unsigned j;
+	uint8_t seen;
+
+	for (i=0; i<freemapbytes; i++) {
+		seen = freemapdata[i];
+		for (j=0; j<nparts; j++) {
+			if (seen & parts[j]->fp_bits[i]) {
+				return 1;
+			}
+			seen |= parts[j]->fp_bits[i];
+		}
+	}
+
+	for (i=0; i<freemapbytes; i++) {
+		for (j=0; j<nparts; j++) {
+			freemapdata[i] |= parts[j]->fp_bits[i];
+		}
+	}
+	for (j=0; j<nparts; j++) {
+		blocksinuse += parts[j]->fp_count;
+	}
+	return 0;
+}
+
 /*
  * Count the number of bits set.
  */
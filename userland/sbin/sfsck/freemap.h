@@ -41,6 +41,7 @@
 typedef enum {
 	B_SUPERBLOCK,	/* Block that is the superblock */
 	B_FREEMAPBLOCK,	/* Block used by free-block bitmap */
+	B_JOURNAL,	/* Block used by the journal */
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
@@ -63,5 +64,20 @@ void freemap_check(void);
 /* Return the number of blocks in use. Valid after freemap_check(). */
 unsigned long freemap_blocksused(void);
 
+/*
+ * Partial freemaps, for finding blocks in use in several threads at
+ * once (see pass1.c). Each thread marks blocks in its own; they are
+ * merged at the end. freemap_part_inuse returns 1 if the block was
+ * already marked in that partial map. freemap_part_merge returns 1,
+ * and changes nothing, if any block is marked twice across the maps
+ * and the freemap.
+ */
+struct freemap_part;
+
+struct freemap_part *freemap_part_create(void);
+void freemap_part_destroy(struct freemap_part *fp);
+int freemap_part_inuse(struct freemap_part *fp, uint32_t block);
+int freemap_part_merge(struct freemap_part **parts, unsigned nparts);
+
 
 #endif /* FREEMAP_H */
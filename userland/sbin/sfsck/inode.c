@@ -60,6 +60,80 @@ static unsigned ninodes = 0, maxinodes = 0;
 /* Whether the table is sorted and can be looked up with binary search. */
 static int inodes_sorted = 0;
 
+/*
+ * Hash of inode number to table index, so inode_add doesn't have to
+ * search the whole table. Open addressing with linear probing; the
+ * size is a power of two, kept at least twice the number of inodes.
+ */
+#define NOINDEX ((unsigned)-1)
+static unsigned *inodehash = NULL;
+static unsigned inodehashsize = 0;
+
+////////////////////////////////////////////////////////////
+// inode hash ops
+
+static
+unsigned
+inode_hashslot(uint32_t ino)
+{
+	return (ino * 2654435761U) & (inodehashsize - 1);
+}
+
+/*
+ * Put table entry INDEX in the hash.
+ */
+static
+void
+inode_hashinsert(unsigned index)
+{
+	unsigned slot;
+
+	slot = inode_hashslot(inodes[index].ino);
+	while (inodehash[slot] != NOINDEX) {
+		slot = (slot + 1) & (inodehashsize - 1);
+	}
+	inodehash[slot] = index;
+}
+
+/*
+ * Rebuild the hash with NEWSIZE slots.
+ */
+static
+void
+inode_rehash(unsigned newsize)
+{
+	unsigned i;
+
+	free(inodehash);
+	inodehash = domalloc(newsize * sizeof(inodehash[0]));
+	inodehashsize = newsize;
+	for (i=0; i<newsize; i++) {
+		inodehash[i] = NOINDEX;
+	}
+	for (i=0; i<ninodes; i++) {
+		inode_hashinsert(i);
+	}
+}
+
+/*
+ * Look up INO in the hash; returns the table index or NOINDEX.
+ */
+static
+unsigned
+inode_hashfind(uint32_t ino)
+{
+	unsigned slot;
+
+	slot = inode_hashslot(ino);
+	while (inodehash[slot] != NOINDEX) {
+		if (inodes[inodehash[slot]].ino == ino) {
+			return inodehash[slot];
+		}
+		slot = (slot + 1) & (inodehashsize - 1);
+	}
+	return NOINDEX;
+}
+
 ////////////////////////////////////////////////////////////
 // inode table ops
 
@@ -121,6 +195,11 @@ inode_sorttable(void)
 {
 	qsort(inodes, ninodes, sizeof(inodes[0]), inode_compare);
 	inodes_sorted = 1;
+
+	/* the indexes have all moved */
+	if (inodehashsize > 0) {
+		inode_rehash(inodehashsize);
+	}
 }
 
 /*
@@ -169,28 +248,46 @@ inode_find(uint32_t ino)
 /*
  * Add an inode; returns 1 if we've already seen it.
  *
- * Uses linear search because we only sort the table for faster access
- * after all inodes have been added. In the FUTURE this could be
- * changed to a better data structure.
+ * The table isn't sorted until all inodes have been added, so this
+ * looks the inode up in the hash.
  */
 int
 inode_add(uint32_t ino, int type)
 {
 	unsigned i;
 
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount == 0);
-			assert(inodes[i].type == type);
-			return 1;
-		}
+	if (inodehashsize < 2 * (ninodes + 1)) {
+		inode_rehash(inodehashsize ? inodehashsize * 2 : 64);
+	}
+
+	i = inode_hashfind(ino);
+	if (i != NOINDEX) {
+		assert(inodes[i].linkcount == 0);
+		assert(inodes[i].type == type);
+		return 1;
 	}
 
 	inode_addtable(ino, type);
+	inode_hashinsert(ninodes - 1);
 
 	return 0;
 }
 
+/*
+ * Forget all inodes added so far.
+ */
+void
+inode_reset(void)
+{
+	unsigned i;
+
+	ninodes = 0;
+	inodes_sorted = 0;
+	for (i=0; i<inodehashsize; i++) {
+		inodehash[i] = NOINDEX;
+	}
+}
+
 /*
  * Mark an inode (directories only, because that's all the caller
  * does) visited. Returns nonzero if already visited.
@@ -39,6 +39,9 @@
 /* Add an inode. Returns 1 if we've seen this inode before. */
 int inode_add(uint32_t ino, int type);
 
+/* Forget all the inodes added so far (for a pass 1 that gave up). */
+void inode_reset(void);
+
 /* Sort the inode table for faster lookup once all inode_add() done. */
 void inode_sorttable(void);
 
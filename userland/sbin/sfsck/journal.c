@@ -0,0 +1,274 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "utils.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+/*
+ * A journal block, as read off the disk. Only the fields we look at
+ * get byte-swapped; images are copied as they are.
+ */
+union jblock {
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	uint32_t words[SFS_BLOCKSIZE / sizeof(uint32_t)];
+};
+
+/* Revokes found so far, with the latest transaction revoking each. */
+struct revoke {
+	uint32_t block;
+	uint32_t seq;
+};
+
+static uint32_t jstart, jsize;
+static struct revoke *revokes;
+static unsigned numrevokes, maxrevokes;
+
+/*
+ * Read or write block OFF of the journal.
+ */
+static
+void
+jread(union jblock *blk, uint32_t off)
+{
+	diskread(blk, jstart + off);
+}
+
+static
+void
+jwrite(union jblock *blk, uint32_t off)
+{
+	diskwrite(blk, jstart + off);
+}
+
+/*
+ * Advance an offset in the log, wrapping around.
+ */
+static
+uint32_t
+jnext(uint32_t off)
+{
+	return off + 1 < jsize ? off + 1 : 1;
+}
+
+/*
+ * Fold a block into a running checksum.
+ */
+static
+uint32_t
+jcsum(uint32_t csum, const union jblock *blk)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		csum = SFS_JCSUM(csum, SWAP32(blk->words[i]));
+	}
+	return csum;
+}
+
+static
+void
+addrevoke(uint32_t block, uint32_t seq)
+{
+	unsigned i;
+
+	for (i=0; i<numrevokes; i++) {
+		if (revokes[i].block == block) {
+			revokes[i].seq = seq;
+			return;
+		}
+	}
+	if (numrevokes == maxrevokes) {
+		unsigned newmax = maxrevokes ? maxrevokes * 2 : 16;
+
+		revokes = dorealloc(revokes, maxrevokes * sizeof(*revokes),
+				    newmax * sizeof(*revokes));
+		maxrevokes = newmax;
+	}
+	revokes[numrevokes].block = block;
+	revokes[numrevokes].seq = seq;
+	numrevokes++;
+}
+
+static
+bool
+isrevoked(uint32_t block, uint32_t seq)
+{
+	unsigned i;
+
+	for (i=0; i<numrevokes; i++) {
+		if (revokes[i].block == block) {
+			return revokes[i].seq > seq;
+		}
+	}
+	return false;
+}
+
+/*
+ * Process transaction SEQ at *POS: on the first pass (APPLY false)
+ * check it and collect its revokes, and return whether it's
+ * complete; on the second, write its images in place. Either way
+ * advance *POS past it. This matches sfs_jreplaytrans in the kernel.
+ */
+static
+bool
+replaytrans(uint32_t *pos, uint32_t seq, bool apply)
+{
+	union jblock blk, desc;
+	uint32_t nblocks, csum, nimages, nrevoke, block, i;
+	unsigned oldnumrevokes = numrevokes;
+
+	nblocks = 0;
+	csum = 0;
+	while (nblocks < jsize - 1) {
+		jread(&blk, *pos);
+		*pos = jnext(*pos);
+
+		if (SWAP32(blk.jc.jc_magic) == SFS_JCOMMIT_MAGIC &&
+		    SWAP32(blk.jc.jc_seq) == seq) {
+			if (SWAP32(blk.jc.jc_nblocks) == nblocks &&
+			    SWAP32(blk.jc.jc_checksum) == csum) {
+				return true;
+			}
+			break;
+		}
+
+		if (SWAP32(blk.jd.jd_magic) != SFS_JDESC_MAGIC ||
+		    SWAP32(blk.jd.jd_seq) != seq) {
+			break;
+		}
+		nimages = SWAP32(blk.jd.jd_nimages);
+		nrevoke = SWAP32(blk.jd.jd_nrevoke);
+		if (nimages + nrevoke > SFS_JDESC_MAX) {
+			break;
+		}
+		for (i=0; i<nimages + nrevoke; i++) {
+			block = SWAP32(blk.jd.jd_blocks[i]);
+			if ((block >= jstart && block < jstart + jsize) ||
+			    block >= sb_totalblocks()) {
+				goto bad;
+			}
+		}
+		csum = jcsum(csum, &blk);
+		nblocks++;
+
+		if (!apply) {
+			for (i=0; i<nrevoke; i++) {
+				addrevoke(SWAP32(blk.jd.jd_blocks[nimages+i]),
+					  seq);
+			}
+		}
+
+		desc = blk;
+		for (i=0; i<nimages; i++) {
+			block = SWAP32(desc.jd.jd_blocks[i]);
+			jread(&blk, *pos);
+			*pos = jnext(*pos);
+			csum = jcsum(csum, &blk);
+			nblocks++;
+
+			if (apply && !isrevoked(block, seq)) {
+				diskwrite(&blk, block);
+			}
+		}
+	}
+ bad:
+	numrevokes = oldnumrevokes;
+	return false;
+}
+
+/*
+ * Write a fresh header for an empty log starting at POS.
+ */
+static
+void
+writeheader(uint32_t pos, uint32_t seq)
+{
+	union jblock blk;
+
+	memset(&blk, 0, sizeof(blk));
+	blk.jh.jh_magic = SWAP32(SFS_JHEADER_MAGIC);
+	blk.jh.jh_seq = SWAP32(seq);
+	blk.jh.jh_start = SWAP32(pos);
+	jwrite(&blk, 0);
+}
+
+void
+journal_replay(void)
+{
+	union jblock blk;
+	uint32_t pos, seq, tail, tailseq, i, ntrans;
+
+	jstart = sb_journalstart();
+	jsize = sb_journalblocks();
+	if (jsize == 0) {
+		return;
+	}
+
+	jread(&blk, 0);
+	tail = SWAP32(blk.jh.jh_start);
+	tailseq = SWAP32(blk.jh.jh_seq);
+	if (SWAP32(blk.jh.jh_magic) != SFS_JHEADER_MAGIC ||
+	    tail == 0 || tail >= jsize) {
+		/*
+		 * Nothing in the log can be trusted. Start it over,
+		 * clearing it so no old transaction can be mistaken
+		 * for a new one.
+		 */
+		warnx("Journal header invalid (journal cleared)");
+		setbadness(EXIT_RECOV);
+		memset(&blk, 0, sizeof(blk));
+		for (i=1; i<jsize; i++) {
+			jwrite(&blk, i);
+		}
+		writeheader(1, 1);
+		return;
+	}
+
+	/* First pass: find the complete transactions. */
+	pos = tail;
+	seq = tailseq;
+	ntrans = 0;
+	while (replaytrans(&pos, seq, false)) {
+		seq++;
+		ntrans++;
+	}
+
+	/* Second pass: write them in place. */
+	pos = tail;
+	seq = tailseq;
+	for (i=0; i<ntrans; i++) {
+		if (!replaytrans(&pos, seq, true)) {
+			assert(0);
+		}
+		seq++;
+	}
+
+	free(revokes);
+	revokes = NULL;
+	numrevokes = maxrevokes = 0;
+
+	if (ntrans == 0) {
+		return;
+	}
+	writeheader(pos, seq);
+
+	warnx("Journal: replayed %lu transaction%s",
+	      (unsigned long)ntrans, ntrans == 1 ? "" : "s");
+	setbadness(EXIT_RECOV);
+
+	/* The superblock may have been among the images. */
+	sb_load();
+	sb_check();
+}
@@ -0,0 +1,14 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/*
+ * The journal module replays the metadata journal, if the volume
+ * has one, the same way mounting the volume would. This has to
+ * happen before anything else looks at the metadata, or sfsck
+ * would "fix" things the journal is about to put right.
+ */
+
+/* Call after sb_check(); reloads the superblock if it replays anything. */
+void journal_replay(void);
+
+#endif /* JOURNAL_H */
@@ -30,6 +30,8 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <err.h>
 
 #include "compat.h"
@@ -39,6 +41,7 @@
 #include "sb.h"
 #include "freemap.h"
 #include "inode.h"
+#include "journal.h"
 #include "passes.h"
 #include "main.h"
 
@@ -69,15 +72,31 @@ main(int argc, char **argv)
 #endif
 
 	/* FUTURE: add -n option */
+#ifdef HOST
+	if (argc==4 && !strcmp(argv[1], "-j")) {
+		if (atoi(argv[2]) < 1) {
+			errx(EXIT_USAGE, "Usage: sfsck [-j threads] "
+			     "device/diskfile");
+		}
+		pass1_setthreads(atoi(argv[2]));
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc!=2) {
+		errx(EXIT_USAGE, "Usage: sfsck [-j threads] device/diskfile");
+	}
+#else
 	if (argc!=2) {
 		errx(EXIT_USAGE, "Usage: sfsck device/diskfile");
 	}
+#endif
 
 	opendisk(argv[1]);
 
 	sfs_setup();
 	sb_load();
 	sb_check();
+	journal_replay();
 	freemap_setup();
 
 	printf("Phase 1 -- check blocks and sizes\n");
@@ -33,6 +33,9 @@
 #include <string.h>
 #include <assert.h>
 #include <err.h>
+#ifdef HOST
+#include <pthread.h>
+#endif
 
 #include "compat.h"
 #include <kern/sfs.h>
@@ -474,12 +477,423 @@ pass1_rootdir(void)
 	pass1_dir(SFS_ROOTDIR_INO, path);
 }
 
+////////////////////////////////////////////////////////////
+// parallel pass 1 (host only)
+
+#ifdef HOST
+
+/*
+ * Most volumes are clean, and on a clean volume pass 1 prints nothing
+ * and changes nothing: all it does is record the inodes and the
+ * blocks in use. So with more than one thread (sfsck -j) we first
+ * try a quick version of pass 1 that only looks. One thread walks
+ * the directory tree as usual, but the file inodes it finds are
+ * handed to a pool of workers, which check them and their indirect
+ * blocks and mark the blocks in per-thread partial freemaps. At the
+ * end the partial freemaps are merged. If everything was clean and
+ * no block turned up twice, that's exactly what the serial pass would
+ * have produced. At the first sign of anything wrong the quick pass
+ * gives up, forgets what it found, and the serial pass runs instead,
+ * so any messages and repairs come out exactly as they always have.
+ *
+ * This means every check here has to match one above: anything the
+ * serial code would complain about or fix must make the quick check
+ * fail. This only works if the disk can be read from several threads
+ * at once; if it can't, we just run the serial pass.
+ */
+
+#define QUICK_CHUNK 64		/* inodes handed to a worker at a time */
+
+static unsigned quick_threads = 1;
+
+/* File inodes found by the walk, for the workers. */
+static uint32_t *quick_files;
+static unsigned quick_nfiles, quick_maxfiles;
+
+/* Worker state, protected by quick_lock. */
+static pthread_mutex_t quick_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned quick_next;	/* next entry of quick_files to do */
+static int quick_failed;	/* someone found a problem */
+
+/*
+ * The checks of check_indirect_block, on indirect block IBLOCK at
+ * level INDIRECTION, marking blocks in FP. IBS keeps track of where
+ * we are in the file. ISDIR is set for directories, which mustn't
+ * have holes. Returns 0 if anything is wrong.
+ */
+static
+int
+quick_indirect(struct freemap_part *fp, struct ibstate *ibs, int isdir,
+	       uint32_t iblock, int indirection)
+{
+	uint32_t entries[SFS_DBPERIDB];
+	uint32_t i, ct, coveredblocks;
+	int j;
+
+	if (iblock == 0) {
+		if (isdir && ibs->curfileblock < ibs->fileblocks) {
+			/* sparse directory */
+			return 0;
+		}
+		coveredblocks = 1;
+		for (j=0; j<indirection; j++) {
+			coveredblocks *= SFS_DBPERIDB;
+		}
+		ibs->curfileblock += coveredblocks;
+		return 1;
+	}
+	if (iblock >= ibs->volblocks) {
+		return 0;
+	}
+
+	sfs_readindirect(iblock, entries);
+	if (freemap_part_inuse(fp, iblock)) {
+		return 0;
+	}
+
+	ct = 0;
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		if (indirection > 1) {
+			if (!quick_indirect(fp, ibs, isdir, entries[i],
+					    indirection-1)) {
+				return 0;
+			}
+		}
+		else {
+			if (entries[i] >= ibs->volblocks) {
+				return 0;
+			}
+			if (entries[i] != 0) {
+				if (ibs->curfileblock >= ibs->fileblocks) {
+					return 0;
+				}
+				if (freemap_part_inuse(fp, entries[i])) {
+					return 0;
+				}
+			}
+			else if (isdir &&
+				 ibs->curfileblock < ibs->fileblocks) {
+				return 0;
+			}
+			ibs->curfileblock++;
+		}
+		if (entries[i] != 0) {
+			ct++;
+		}
+	}
+
+	/* the serial pass frees indirect blocks with nothing in them */
+	return ct > 0;
+}
+
+/*
+ * The checks of pass1_inode and check_inode_blocks, on inode INO,
+ * already loaded into SFI. Marks its blocks in FP. Returns 0 if
+ * anything is wrong.
+ */
+static
+int
+quick_inode(struct freemap_part *fp, uint32_t ino,
+	    const struct sfs_dinode *sfi)
+{
+	struct ibstate ibs;
+	const unsigned char *waste;
+	uint32_t datablock;
+	int isdir = sfi->sfi_type == SFS_TYPE_DIR;
+	size_t k;
+	int i;
+
+	if (freemap_part_inuse(fp, ino)) {
+		return 0;
+	}
+
+	waste = (const unsigned char *)sfi->sfi_waste;
+	for (k=0; k<sizeof(sfi->sfi_waste); k++) {
+		if (waste[k] != 0) {
+			return 0;
+		}
+	}
+
+	ibs.ino = ino;
+	ibs.fileblocks = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE) /
+		SFS_BLOCKSIZE;
+	ibs.volblocks = sb_totalblocks();
+	ibs.pasteofcount = 0;
+	ibs.usagetype = isdir ? B_DIRDATA : B_DATA;
+
+	for (ibs.curfileblock=0; ibs.curfileblock<NUM_D; ibs.curfileblock++) {
+		datablock = GET_D(sfi, ibs.curfileblock);
+		if (datablock >= ibs.volblocks) {
+			return 0;
+		}
+		if (datablock > 0) {
+			if (ibs.curfileblock >= ibs.fileblocks) {
+				return 0;
+			}
+			if (freemap_part_inuse(fp, datablock)) {
+				return 0;
+			}
+		}
+		else if (isdir && ibs.curfileblock < ibs.fileblocks) {
+			return 0;
+		}
+	}
+
+	for (i=0; i<NUM_I; i++) {
+		if (!quick_indirect(fp, &ibs, isdir, GET_I(sfi, i), 1)) {
+			return 0;
+		}
+	}
+	for (i=0; i<NUM_II; i++) {
+		if (!quick_indirect(fp, &ibs, isdir, GET_II(sfi, i), 2)) {
+			return 0;
+		}
+	}
+	for (i=0; i<NUM_III; i++) {
+		if (!quick_indirect(fp, &ibs, isdir, GET_III(sfi, i), 3)) {
+			return 0;
+		}
+	}
+
+	/* a directory bigger than the inode can map is sparse too */
+	if (isdir && ibs.curfileblock < ibs.fileblocks) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The checks of pass1_direntry. Returns 0 if anything is wrong.
+ */
+static
+int
+quick_direntry(const struct sfs_direntry *sfd)
+{
+	size_t k;
+
+	if (sfd->sfd_ino == SFS_NOINO) {
+		return sfd->sfd_name[0] == 0;
+	}
+	if (sfd->sfd_ino >= sb_totalblocks()) {
+		return 0;
+	}
+	if (sfd->sfd_name[0] == 0) {
+		return 0;
+	}
+	for (k=0; k<sizeof(sfd->sfd_name) && sfd->sfd_name[k] != 0; k++) {
+		if (sfd->sfd_name[k] == ':' || sfd->sfd_name[k] == '/') {
+			return 0;
+		}
+	}
+	/* not null-terminated */
+	return k < sizeof(sfd->sfd_name);
+}
+
+/*
+ * Remember a file inode for the workers.
+ */
+static
+void
+quick_addfile(uint32_t ino)
+{
+	unsigned newmax;
+
+	if (quick_nfiles == quick_maxfiles) {
+		newmax = quick_maxfiles ? quick_maxfiles * 2 : 1024;
+		quick_files = dorealloc(quick_files,
+					quick_maxfiles * sizeof(uint32_t),
+					newmax * sizeof(uint32_t));
+		quick_maxfiles = newmax;
+	}
+	quick_files[quick_nfiles++] = ino;
+}
+
+/*
+ * The walk of pass1_dir, on directory INO. Directories are checked
+ * here, marking their blocks in FP; file inodes are queued for the
+ * workers. Returns 0 if anything is wrong.
+ */
+static
+int
+quick_dir(struct freemap_part *fp, uint32_t ino)
+{
+	struct sfs_dinode sfi, subsfi;
+	struct sfs_direntry *direntries;
+	uint32_t ndirentries, subino, i;
+	int ok = 1;
+
+	sfs_readinode(ino, &sfi);
+	if (sfi.sfi_size % sizeof(struct sfs_direntry) != 0) {
+		return 0;
+	}
+	count_dirs++;
+
+	if (inode_add(ino, sfi.sfi_type)) {
+		/* crosslinked; pass 2 deals with it */
+		return 1;
+	}
+	if (!quick_inode(fp, ino, &sfi)) {
+		return 0;
+	}
+
+	ndirentries = sfi.sfi_size/sizeof(struct sfs_direntry);
+	direntries = domalloc(sfi.sfi_size);
+	sfs_readdir(&sfi, direntries, ndirentries);
+
+	for (i=0; ok && i<ndirentries; i++) {
+		ok = quick_direntry(&direntries[i]);
+	}
+
+	for (i=0; ok && i<ndirentries; i++) {
+		if (direntries[i].sfd_ino == SFS_NOINO ||
+		    !strcmp(direntries[i].sfd_name, ".") ||
+		    !strcmp(direntries[i].sfd_name, "..")) {
+			continue;
+		}
+		subino = direntries[i].sfd_ino;
+		sfs_readinode(subino, &subsfi);
+		switch (subsfi.sfi_type) {
+		    case SFS_TYPE_FILE:
+			if (!inode_add(subino, SFS_TYPE_FILE)) {
+				quick_addfile(subino);
+				count_files++;
+			}
+			break;
+		    case SFS_TYPE_DIR:
+			ok = quick_dir(fp, subino);
+			break;
+		    default:
+			ok = 0;
+			break;
+		}
+	}
+
+	free(direntries);
+	return ok;
+}
+
+/*
+ * Worker thread: check file inodes, QUICK_CHUNK at a time, marking
+ * their blocks in our own partial freemap.
+ */
+static
+void *
+quick_worker(void *arg)
+{
+	struct freemap_part *fp = arg;
+	struct sfs_dinode sfi;
+	unsigned i, start, end;
+
+	while (1) {
+		pthread_mutex_lock(&quick_lock);
+		if (quick_failed || quick_next >= quick_nfiles) {
+			pthread_mutex_unlock(&quick_lock);
+			break;
+		}
+		start = quick_next;
+		end = start + QUICK_CHUNK;
+		if (end > quick_nfiles) {
+			end = quick_nfiles;
+		}
+		quick_next = end;
+		pthread_mutex_unlock(&quick_lock);
+
+		for (i=start; i<end; i++) {
+			sfs_readinode(quick_files[i], &sfi);
+			if (!quick_inode(fp, quick_files[i], &sfi)) {
+				pthread_mutex_lock(&quick_lock);
+				quick_failed = 1;
+				pthread_mutex_unlock(&quick_lock);
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Try the quick pass 1. Returns 1 if it worked, and 0 if the serial
+ * pass should be run instead.
+ */
+static
+int
+pass1_quick(void)
+{
+	struct sfs_dinode sfi;
+	struct freemap_part **parts;
+	pthread_t *threads;
+	unsigned nparts, i;
+	int ok, result;
+
+	nparts = quick_threads + 1;
+	parts = domalloc(nparts * sizeof(parts[0]));
+	threads = domalloc(quick_threads * sizeof(threads[0]));
+	for (i=0; i<nparts; i++) {
+		parts[i] = freemap_part_create();
+	}
+	quick_nfiles = 0;
+	quick_next = 0;
+	quick_failed = 0;
+
+	/* parts[0] is for the walk; the rest for the workers */
+	sfs_readinode(SFS_ROOTDIR_INO, &sfi);
+	ok = sfi.sfi_type == SFS_TYPE_DIR &&
+		quick_dir(parts[0], SFS_ROOTDIR_INO);
+
+	if (ok) {
+		for (i=0; i<quick_threads; i++) {
+			result = pthread_create(&threads[i], NULL,
+						quick_worker, parts[i+1]);
+			if (result) {
+				errx(EXIT_FATAL, "pthread_create: %s",
+				     strerror(result));
+			}
+		}
+		for (i=0; i<quick_threads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		ok = !quick_failed && !freemap_part_merge(parts, nparts);
+	}
+
+	for (i=0; i<nparts; i++) {
+		freemap_part_destroy(parts[i]);
+	}
+	free(parts);
+	free(threads);
+	free(quick_files);
+	quick_files = NULL;
+	quick_maxfiles = 0;
+
+	if (!ok) {
+		inode_reset();
+		count_dirs = 0;
+		count_files = 0;
+	}
+	return ok;
+}
+
+/*
+ * Set the number of worker threads for pass 1.
+ */
+void
+pass1_setthreads(unsigned n)
+{
+	quick_threads = n;
+}
+
+#endif /* HOST */
+
 ////////////////////////////////////////////////////////////
 // public interface
 
 void
 pass1(void)
 {
+#ifdef HOST
+	if (quick_threads > 1 && diskthreadsafe() && pass1_quick()) {
+		return;
+	}
+#endif
 	pass1_rootdir();
 }
 
@@ -44,6 +44,14 @@
 void pass1(void);
 void pass2(void);
 
+#ifdef HOST
+/*
+ * Use N worker threads for pass 1 (default 1). With more than one, a
+ * quick read-only pass 1 is tried first; see pass1.c.
+ */
+void pass1_setthreads(unsigned n);
+#endif
+
 /* After pass1 is done, return the number of dirs and files on the volume. */
 unsigned long pass1_founddirs(void);
 unsigned long pass1_foundfiles(void);
@@ -0,0 +1,199 @@
+/*
+ * asidtest - check that processes don't see each other's memory
+ * through stale TLB entries.
+ *
+ * Every process running this program has its data at the same
+ * virtual addresses, so if the VM system leaves one process's TLB
+ * entries usable by the next, the second one reads and writes the
+ * first one's pages. Two phases:
+ *
+ *    1. Children run one after another. Each checks that its copy
+ *	 of a zero-filled array really is zero, fills it with its own
+ *	 pattern, and checks it again.
+ *
+ *    2. A parent and a child take turns, handing off through a pair
+ *	 of semfs semaphores, each rewriting and rechecking its own
+ *	 pattern at the same addresses on every turn.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NPAGES		8
+#define PAGEWORDS	(4096 / sizeof(unsigned))
+#define NWORDS		(NPAGES * PAGEWORDS)
+#define NSEQUENTIAL	8
+#define NTURNS		50
+
+static volatile unsigned data[NWORDS];
+
+static
+void
+fill(unsigned tag)
+{
+	unsigned i;
+
+	for (i=0; i<NWORDS; i++) {
+		data[i] = tag ^ i;
+	}
+}
+
+static
+void
+check(unsigned tag, const char *what)
+{
+	unsigned i;
+
+	for (i=0; i<NWORDS; i++) {
+		if (data[i] != (tag ^ i)) {
+			errx(1, "%s: word %u is 0x%x, expected 0x%x",
+			     what, i, data[i], tag ^ i);
+		}
+	}
+}
+
+static
+void
+waitfor(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", what);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: child failed", what);
+	}
+}
+
+/*
+ * Phase 1: back-to-back children.
+ */
+static
+void
+sequential(void)
+{
+	unsigned n, tag;
+	pid_t pid;
+
+	for (n=0; n<NSEQUENTIAL; n++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			/* We never wrote data, so it must still be zero. */
+			check(0, "fresh child");
+			tag = 0x5a5a0000 | (getpid() << 4) | n;
+			fill(tag);
+			check(tag, "sequential child");
+			_exit(0);
+		}
+		waitfor(pid, "sequential");
+	}
+}
+
+/*
+ * Semaphores for phase 2.
+ */
+static
+int
+semopen(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+static
+void
+semP(int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) != 1) {
+		err(1, "semaphore read");
+	}
+}
+
+static
+void
+semV(int fd)
+{
+	char c = 0;
+
+	if (write(fd, &c, 1) != 1) {
+		err(1, "semaphore write");
+	}
+}
+
+/*
+ * One side of phase 2: on each turn, check that our pattern survived
+ * the other side's turn, write a new one, and hand off.
+ */
+static
+void
+turns(int mine, int theirs, unsigned base, const char *what)
+{
+	unsigned t;
+
+	for (t=0; t<NTURNS; t++) {
+		semP(mine);
+		if (t > 0) {
+			check(base + t - 1, what);
+		}
+		fill(base + t);
+		check(base + t, what);
+		semV(theirs);
+	}
+}
+
+static
+void
+alternating(void)
+{
+	int parentsem, childsem;
+	pid_t pid;
+
+	parentsem = semopen("sem:asidtest.parent");
+	childsem = semopen("sem:asidtest.child");
+
+	fill(0);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		turns(childsem, parentsem, 0xc0000000, "alternating child");
+		_exit(0);
+	}
+	semV(parentsem);
+	turns(parentsem, childsem, 0xa0000000, "alternating parent");
+	waitfor(pid, "alternating");
+
+	close(parentsem);
+	close(childsem);
+	remove("sem:asidtest.parent");
+	remove("sem:asidtest.child");
+}
+
+int
+main(void)
+{
+	sequential();
+	printf("asidtest: sequential children ok\n");
+	alternating();
+	printf("asidtest: alternating processes ok\n");
+	success(TEST161_SUCCESS, SECRET, "/testbin/asidtest");
+	return 0;
+}
@@ -33,8 +33,14 @@
  * 	Tests whether console can be written to.
  *
  * This should run correctly when open and write syscalls are correctly implemented
+ *
+ * With "-b lines procs", instead measures console output speed: procs
+ * processes each print the given number of lines at once, and the
+ * total lines per second is reported at the end.
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -42,16 +48,68 @@
 #include <err.h>
 #include <test161/test161.h>
 
+#define MAXPROCS 32
+
+static
+void
+bench(unsigned lines, unsigned procs)
+{
+	pid_t pids[MAXPROCS];
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned i, j, msecs;
+	int status;
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<procs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			for (j=0; j<lines; j++) {
+				printf("consoletest: process %u line %u of %u\n",
+				       i, j, lines);
+			}
+			exit(0);
+		}
+	}
+	for (i=0; i<procs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	msecs = (endsecs - startsecs) * 1000;
+	msecs += endnsecs / 1000000;
+	msecs -= startnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("consoletest: %u lines from %u processes in %u.%03u s: "
+	       "%u lines/s\n", lines * procs, procs,
+	       msecs / 1000, msecs % 1000, lines * procs * 1000 / msecs);
+}
+
 // 23 Mar 2012 : GWA : BUFFER_COUNT must be even.
 
 int
 main(int argc, char **argv)
 {
+	unsigned lines, procs;
 
-	// 23 Mar 2012 : GWA : Assume argument passing is *not* supported.
+	if (argc == 4 && !strcmp(argv[1], "-b")) {
+		lines = atoi(argv[2]);
+		procs = atoi(argv[3]);
+		if (lines == 0 || procs == 0 || procs > MAXPROCS) {
+			errx(1, "Usage: consoletest [-b lines procs]");
+		}
+		bench(lines, procs);
+		return 0;
+	}
 
-	(void) argc;
-	(void) argv;
+	// 23 Mar 2012 : GWA : Assume argument passing is *not* supported.
 
 	secprintf(SECRET, "Able was i ere i saw elbA", "/testbin/consoletest");
 	return 0;
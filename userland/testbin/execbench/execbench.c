@@ -0,0 +1,163 @@
+/*
+ * execbench - time execv with large argument vectors.
+ *
+ * The program execs itself over and over, carrying the iteration
+ * count and the start time along in its arguments, followed by the
+ * payload. Two payloads are run: 1000 short words, and as many short
+ * words as fit in ARG_MAX (about 64K of arguments, mostly spent on
+ * pointers and terminators). Reports the average time per exec.
+ *
+ * Usage: execbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <err.h>
+
+#define _PATH_MYSELF "/testbin/execbench"
+
+#define DEFITERS	20
+#define WORD		"Dalemark"
+
+/*
+ * argv[0], "-c", total iterations, iterations left, config, start
+ * secs, start nsecs
+ */
+#define NHEADER		7
+
+/*
+ * (8+1+4)*5020 = 65260, which with the header leaves a little slop
+ * under ARG_MAX, as in bigexec.
+ */
+#define MAXWORDS	5020
+
+static const struct {
+	const char *name;
+	int nwords;
+} configs[] = {
+	{ "1k args", 1000 },
+	{ "64K args", MAXWORDS },
+};
+static const int nconfigs = sizeof(configs) / sizeof(configs[0]);
+
+static char *args[NHEADER + MAXWORDS + 1];
+static char totalbuf[16], leftbuf[16], configbuf[16];
+static char secsbuf[16], nsecsbuf[16];
+
+static
+void
+run(int config, int total, int left, time_t secs, unsigned long nsecs)
+{
+	int i, n;
+
+	snprintf(totalbuf, sizeof(totalbuf), "%d", total);
+	snprintf(leftbuf, sizeof(leftbuf), "%d", left);
+	snprintf(configbuf, sizeof(configbuf), "%d", config);
+	snprintf(secsbuf, sizeof(secsbuf), "%d", (int)secs);
+	snprintf(nsecsbuf, sizeof(nsecsbuf), "%lu", nsecs);
+
+	args[0] = (char *)_PATH_MYSELF;
+	args[1] = (char *)"-c";
+	args[2] = totalbuf;
+	args[3] = leftbuf;
+	args[4] = configbuf;
+	args[5] = secsbuf;
+	args[6] = nsecsbuf;
+	n = configs[config].nwords;
+	for (i = 0; i < n; i++) {
+		args[NHEADER + i] = (char *)WORD;
+	}
+	args[NHEADER + n] = NULL;
+
+	execv(_PATH_MYSELF, args);
+	err(1, "execv (%s)", configs[config].name);
+}
+
+static
+void
+start(int config, int total)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	run(config, total, total, secs, nsecs);
+}
+
+static
+void
+report(int config, int total, time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned long long usecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	secs -= startsecs;
+	nsecs -= startnsecs;
+	usecs = (unsigned long long)secs * 1000000 + nsecs / 1000;
+
+	printf("%-10s %d execs  %llu.%06llu s  %llu us/exec\n",
+	       configs[config].name, total,
+	       usecs / 1000000, usecs % 1000000, usecs / total);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int total, left, config, i;
+	time_t secs;
+	unsigned long nsecs;
+
+	if (argc < 2 || strcmp(argv[1], "-c") != 0) {
+		total = argc > 1 ? atoi(argv[1]) : DEFITERS;
+		if (total < 1) {
+			errx(1, "Usage: execbench [iterations]");
+		}
+		start(0, total);
+	}
+
+	if (argc < NHEADER) {
+		errx(1, "Bad continuation arguments");
+	}
+	total = atoi(argv[2]);
+	left = atoi(argv[3]);
+	config = atoi(argv[4]);
+	secs = atoi(argv[5]);
+	nsecs = atoi(argv[6]);
+	if (config < 0 || config >= nconfigs || total < 1) {
+		errx(1, "Bad continuation arguments");
+	}
+
+	/* Make sure the payload arrived intact. */
+	if (argc != NHEADER + configs[config].nwords) {
+		errx(1, "%s: got %d args, expected %d", configs[config].name,
+		     argc, NHEADER + configs[config].nwords);
+	}
+	for (i = NHEADER; i < argc; i++) {
+		if (strcmp(argv[i], WORD) != 0) {
+			errx(1, "%s: argv[%d] is wrong", configs[config].name,
+			     i);
+		}
+	}
+	if (argv[argc] != NULL) {
+		errx(1, "argv[argc] is not NULL");
+	}
+
+	if (left > 1) {
+		run(config, total, left - 1, secs, nsecs);
+	}
+
+	report(config, total, secs, nsecs);
+	if (config + 1 < nconfigs) {
+		start(config + 1, total);
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * futexbench - compare libusync locks against semfs semaphores.
+ *
+ * Forks some processes, each of which times three loops:
+ *
+ *    umutex	lock/unlock of an uncontended umutex; this should
+ *		never enter the kernel.
+ *    wake	futex(FUTEX_WAKE) with no waiters, the cost of the
+ *		slow path when it turns out to be unnecessary.
+ *    semfs	a P and a V on a semfs semaphore (one read and one
+ *		write on a "sem:" file).
+ *
+ * Each process uses its own lock and semaphore, so this measures the
+ * per-operation cost and how well it scales with more processes
+ * running at once, not contention on a single lock.
+ *
+ * Also checks that FUTEX_WAIT with a stale value fails with EAGAIN
+ * and that a misaligned address fails with EINVAL.
+ *
+ * Usage: futexbench [processes [iterations]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <usync.h>
+
+#define DEFPROCS	4
+#define DEFITERS	10000
+#define MAXPROCS	32
+
+static
+unsigned long long
+usecs_since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	secs -= startsecs;
+	nsecs -= startnsecs;
+	return (unsigned long long)secs * 1000000 + nsecs / 1000;
+}
+
+static
+void
+report(int proc, const char *name, int iters, unsigned long long usecs)
+{
+	printf("proc %d: %-7s %d ops  %llu.%06llu s  %llu ns/op\n",
+	       proc, name, iters, usecs / 1000000, usecs % 1000000,
+	       usecs * 1000 / iters);
+}
+
+static
+void
+checkerrors(void)
+{
+	volatile int word[2];
+	int r;
+
+	word[0] = 1;
+	word[1] = 0;
+
+	r = futex(&word[0], FUTEX_WAIT, 0);
+	if (r != -1 || errno != EAGAIN) {
+		errx(1, "FUTEX_WAIT on a changed word: expected EAGAIN, "
+		     "got %d (errno %d)", r, errno);
+	}
+
+	r = futex((volatile int *)((volatile char *)word + 1),
+		  FUTEX_WAKE, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "FUTEX_WAKE on a misaligned word: expected EINVAL, "
+		     "got %d (errno %d)", r, errno);
+	}
+
+	r = futex(&word[1], FUTEX_WAKE, 1);
+	if (r != 0) {
+		errx(1, "FUTEX_WAKE with no waiters: expected 0, got %d", r);
+	}
+}
+
+static
+void
+work(int proc, int iters)
+{
+	struct umutex mutex = UMUTEX_INITIALIZER;
+	volatile int word = 0;
+	char name[32];
+	time_t secs;
+	unsigned long nsecs;
+	int i, fd;
+	char c = 0;
+
+	__time(&secs, &nsecs);
+	for (i = 0; i < iters; i++) {
+		umutex_lock(&mutex);
+		umutex_unlock(&mutex);
+	}
+	report(proc, "umutex", iters, usecs_since(secs, nsecs));
+
+	__time(&secs, &nsecs);
+	for (i = 0; i < iters; i++) {
+		futex(&word, FUTEX_WAKE, 1);
+	}
+	report(proc, "wake", iters, usecs_since(secs, nsecs));
+
+	snprintf(name, sizeof(name), "sem:futexbench.%d", proc);
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	__time(&secs, &nsecs);
+	for (i = 0; i < iters; i++) {
+		if (write(fd, &c, 1) != 1) {
+			err(1, "%s: write", name);
+		}
+		if (read(fd, &c, 1) != 1) {
+			err(1, "%s: read", name);
+		}
+	}
+	report(proc, "semfs", iters, usecs_since(secs, nsecs));
+	close(fd);
+	remove(name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pid_t pids[MAXPROCS];
+	int nprocs, iters, i, status, failed;
+
+	nprocs = argc > 1 ? atoi(argv[1]) : DEFPROCS;
+	iters = argc > 2 ? atoi(argv[2]) : DEFITERS;
+	if (nprocs < 1 || nprocs > MAXPROCS || iters < 1) {
+		errx(1, "Usage: futexbench [processes [iterations]]");
+	}
+
+	checkerrors();
+
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			work(i, iters);
+			_exit(0);
+		}
+	}
+
+	failed = 0;
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED");
+	}
+	printf("futexbench done\n");
+	return 0;
+}
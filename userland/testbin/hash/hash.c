@@ -39,8 +39,6 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <err.h>
 
 #ifdef HOST
@@ -52,8 +50,8 @@
 int
 main(int argc, char *argv[])
 {
-	int fd;
-	char readbuf[1];
+	FILE *f;
+	int ch;
 	int j = 0;
 
 #ifdef HOST
@@ -64,18 +62,18 @@ main(int argc, char *argv[])
 		errx(1, "Usage: hash filename");
 	}
 
-	fd = open(argv[1], O_RDONLY, 0664);
+	f = fopen(argv[1], "r");
 
-	if (fd<0) {
+	if (f == NULL) {
 		err(1, "%s", argv[1]);
 	}
 
-	for (;;) {
-		if (read(fd, readbuf, 1) <= 0) break;
-		j = ((j*8) + (int) readbuf[0]) % HASHP;
+	/* (char) keeps the sign extension the old byte-at-a-time read had */
+	while ((ch = getc(f)) != EOF) {
+		j = ((j*8) + (int)(char)ch) % HASHP;
 	}
 
-	close(fd);
+	fclose(f);
 
 	tprintf("Hash : %d\n", j);
 
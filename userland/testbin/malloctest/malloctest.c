@@ -36,9 +36,11 @@
  * These tests (subject to restrictions and limitations noted below)
  * should work once the kernel provides sbrk().
  *
- * Note that because the userlevel malloc is extremely dumb,
- * malloctest 3 is extremely slow and on most VM systems will run more
- * or less forever.
+ * Note that malloctest 3 allocates memory until it runs out, so on
+ * most VM systems it will run more or less forever.
+ *
+ * malloctest 8 is a benchmark rather than a test; it reports how fast
+ * malloc and free run as the number of live blocks grows.
  */
 
 #include <stdint.h>
@@ -629,6 +631,95 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8
+ *
+ * Allocation throughput versus the number of live blocks. For each
+ * count, allocate that many blocks of mixed sizes, then time a long
+ * run of freeing a random one and allocating a new one in its place.
+ * If malloc has to search through the heap the rate falls off as the
+ * count goes up; if not it should stay about the same.
+ */
+
+#define BENCHMAXLIVE  2048
+#define BENCHOPS      20000
+
+static void *benchptrs[BENCHMAXLIVE];
+
+static
+size_t
+benchsize(void)
+{
+	/* mostly small, with the occasional bigger one */
+	if (random() % 16 == 0) {
+		return 1024 + random() % 1024;
+	}
+	return 16 + random() % 240;
+}
+
+static
+void
+test8(void)
+{
+	static const unsigned counts[] = { 16, 128, 512, BENCHMAXLIVE };
+
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
+	unsigned c, i, n, count;
+
+	tprintf("Beginning malloc test 8\n");
+
+	for (c=0; c<sizeof(counts)/sizeof(counts[0]); c++) {
+		count = counts[c];
+		srandom(0);
+
+		for (i=0; i<count; i++) {
+			benchptrs[i] = malloc(benchsize());
+			if (benchptrs[i] == NULL) {
+				tprintf("FAILED: malloc failed with %u "
+					"blocks live\n", i);
+				while (i > 0) {
+					free(benchptrs[--i]);
+				}
+				return;
+			}
+		}
+
+		__time(&startsecs, &startnsecs);
+		for (i=0; i<BENCHOPS; i++) {
+			n = random() % count;
+			free(benchptrs[n]);
+			benchptrs[n] = malloc(benchsize());
+			if (benchptrs[n] == NULL) {
+				tprintf("FAILED: malloc failed\n");
+				break;
+			}
+		}
+		__time(&endsecs, &endnsecs);
+
+		msecs = (endsecs - startsecs) * 1000;
+		msecs += endnsecs / 1000000;
+		msecs -= startnsecs / 1000000;
+		if (msecs == 0) {
+			msecs = 1;
+		}
+		tprintf("%5u live blocks: %lu ms for %u free/malloc pairs "
+			"(%lu pairs/sec)\n", count, msecs, BENCHOPS,
+			BENCHOPS * 1000UL / msecs);
+
+		for (n=0; n<count; n++) {
+			free(benchptrs[n]);
+		}
+		if (i < BENCHOPS) {
+			return;
+		}
+	}
+
+	tprintf("Passed malloc test 8\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -641,6 +732,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Throughput vs. live blocks", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -0,0 +1,223 @@
+/*
+ * qsortbench - time libc's qsort on some input patterns that are
+ * known to be hard on simple quicksorts: already sorted, reversed,
+ * random, lots of duplicates, and "organ pipe" (up, then down).
+ *
+ * Each pattern is sorted as plain ints and as 12-byte records, to
+ * exercise both the single-word and the multi-word swap code, and
+ * the result is checked. Reports time and comparison counts.
+ *
+ * Finally it runs McIlroy's adversary ("A Killer Adversary for
+ * Quicksort", 1999), a comparison function that makes up the input
+ * as it goes so as to defeat whatever pivot choice the sort makes.
+ * Any quicksort without a fallback goes quadratic on it.
+ *
+ * Usage: qsortbench [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define MAXCOUNT	20000
+#define DEFCOUNT	MAXCOUNT
+
+struct rec {
+	int key;
+	int stuff[2];
+};
+
+static int ints[MAXCOUNT];
+static struct rec recs[MAXCOUNT];
+static unsigned long ncompares;
+
+/* adversary state; see killercmp */
+static int killervals[MAXCOUNT];
+static int killergas, killersolid, killercandidate;
+
+static
+int
+intcmp(const void *av, const void *bv)
+{
+	int a = *(const int *)av;
+	int b = *(const int *)bv;
+
+	ncompares++;
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static
+int
+reccmp(const void *av, const void *bv)
+{
+	const struct rec *a = av;
+	const struct rec *b = bv;
+
+	ncompares++;
+	return a->key < b->key ? -1 : a->key > b->key ? 1 : 0;
+}
+
+/*
+ * The adversary. Elements are indexes into killervals. All values
+ * start out as "gas", which compares greater than anything solid.
+ * When two gas values are compared, one of them is frozen to the
+ * next solid value; it picks the one that looks like it might be a
+ * pivot candidate, so that the pivot ends up being small.
+ */
+static
+int
+killercmp(const void *av, const void *bv)
+{
+	int a = *(const int *)av;
+	int b = *(const int *)bv;
+
+	ncompares++;
+	if (killervals[a] == killergas && killervals[b] == killergas) {
+		if (a == killercandidate) {
+			killervals[a] = killersolid++;
+		}
+		else {
+			killervals[b] = killersolid++;
+		}
+	}
+	if (killervals[a] == killergas) {
+		killercandidate = a;
+	}
+	else if (killervals[b] == killergas) {
+		killercandidate = b;
+	}
+	return killervals[a] - killervals[b];
+}
+
+/*
+ * Input patterns.
+ */
+static
+int
+genkey(unsigned pattern, unsigned i, unsigned count)
+{
+	switch (pattern) {
+	    case 0: return i;
+	    case 1: return count - i;
+	    case 2: return random();
+	    case 3: return random() % 8;
+	    case 4: return i < count / 2 ? i : count - i;
+	}
+	return 0;
+}
+
+static const char *const patternnames[] = {
+	"sorted", "reverse", "random", "dups", "organpipe",
+};
+#define NPATTERNS (sizeof(patternnames) / sizeof(patternnames[0]))
+
+static
+unsigned long
+msecsince(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs, msecs;
+
+	__time(&secs, &nsecs);
+	msecs = (secs - startsecs) * 1000;
+	msecs += nsecs / 1000000;
+	msecs -= startnsecs / 1000000;
+	return msecs;
+}
+
+static
+void
+bench(unsigned pattern, unsigned count, int dorecs)
+{
+	time_t startsecs;
+	unsigned long startnsecs, msecs;
+	unsigned i;
+
+	srandom(pattern + 1);
+	for (i=0; i<count; i++) {
+		if (dorecs) {
+			recs[i].key = genkey(pattern, i, count);
+			recs[i].stuff[0] = i;
+			recs[i].stuff[1] = ~i;
+		}
+		else {
+			ints[i] = genkey(pattern, i, count);
+		}
+	}
+
+	ncompares = 0;
+	__time(&startsecs, &startnsecs);
+	if (dorecs) {
+		qsort(recs, count, sizeof(recs[0]), reccmp);
+	}
+	else {
+		qsort(ints, count, sizeof(ints[0]), intcmp);
+	}
+	msecs = msecsince(startsecs, startnsecs);
+
+	for (i=1; i<count; i++) {
+		if (dorecs ? recs[i-1].key > recs[i].key ||
+		    recs[i].stuff[1] != ~recs[i].stuff[0] :
+		    ints[i-1] > ints[i]) {
+			errx(1, "%s %s: not sorted at %u", patternnames[pattern],
+			     dorecs ? "recs" : "ints", i);
+		}
+	}
+
+	printf("%-10s %-5s %8lu ms %10lu compares\n", patternnames[pattern],
+	       dorecs ? "recs" : "ints", msecs, ncompares);
+}
+
+static
+void
+killer(unsigned count)
+{
+	time_t startsecs;
+	unsigned long startnsecs, msecs;
+	unsigned i;
+
+	killergas = count;
+	killersolid = 0;
+	killercandidate = 0;
+	for (i=0; i<count; i++) {
+		ints[i] = i;
+		killervals[i] = killergas;
+	}
+
+	ncompares = 0;
+	__time(&startsecs, &startnsecs);
+	qsort(ints, count, sizeof(ints[0]), killercmp);
+	msecs = msecsince(startsecs, startnsecs);
+
+	for (i=1; i<count; i++) {
+		if (killervals[ints[i-1]] > killervals[ints[i]]) {
+			errx(1, "adversary: not sorted at %u", i);
+		}
+	}
+
+	printf("%-10s %-5s %8lu ms %10lu compares\n", "adversary", "ints",
+	       msecs, ncompares);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned count, pattern;
+
+	count = DEFCOUNT;
+	if (argc > 1) {
+		count = atoi(argv[1]);
+	}
+	if (count < 1 || count > MAXCOUNT) {
+		errx(1, "Usage: qsortbench [count], count 1-%u", MAXCOUNT);
+	}
+
+	printf("qsortbench: %u elements\n", count);
+	for (pattern = 0; pattern < NPATTERNS; pattern++) {
+		bench(pattern, count, 0);
+		bench(pattern, count, 1);
+	}
+	killer(count);
+	return 0;
+}
@@ -33,8 +33,15 @@
  * 	Tests whether console can be written to.
  *
  * This should run correctly when open and write syscalls are correctly implemented
+ *
+ * With "-b count", instead measures how many commands per second can
+ * be started the way the shell does it: runs /bin/true count times
+ * with fork+execv, then count times with vfork+execv, then count
+ * times through system().
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -45,14 +52,81 @@
 
 // 23 Mar 2012 : GWA : BUFFER_COUNT must be even.
 
+#define BENCHPROG "/bin/true"
+
+static
+pid_t
+spawn(int usevfork)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)BENCHPROG;
+	args[1] = NULL;
+
+	pid = usevfork ? vfork() : fork();
+	if (pid < 0) {
+		err(1, usevfork ? "vfork" : "fork");
+	}
+	if (pid == 0) {
+		execv(BENCHPROG, args);
+		_exit(255);
+	}
+	return pid;
+}
+
+static
+void
+bench(const char *name, int how, unsigned count)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned i, msecs;
+	int status;
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<count; i++) {
+		if (how == 2) {
+			status = system(BENCHPROG);
+		}
+		else if (waitpid(spawn(how), &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (status != 0) {
+			errx(1, "%s: %s exited with status %d",
+			     name, BENCHPROG, status);
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	msecs = (endsecs - startsecs) * 1000;
+	msecs += endnsecs / 1000000;
+	msecs -= startnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("%-12s %u commands in %u.%03u s: %u.%u commands/s\n",
+	       name, count, msecs / 1000, msecs % 1000,
+	       count * 1000 / msecs, (count * 10000 / msecs) % 10);
+}
+
 int
 main(int argc, char **argv)
 {
+	unsigned count;
 
-	// 23 Mar 2012 : GWA : Assume argument passing is *not* supported.
+	if (argc == 3 && !strcmp(argv[1], "-b")) {
+		count = atoi(argv[2]);
+		if (count == 0) {
+			errx(1, "Usage: shelltest [-b count]");
+		}
+		bench("fork+execv", 0, count);
+		bench("vfork+execv", 1, count);
+		bench("system", 2, count);
+		return 0;
+	}
 
-	(void) argc;
-	(void) argv;
+	// 23 Mar 2012 : GWA : Assume argument passing is *not* supported.
 
 	int i;
 	char buf[64];
@@ -0,0 +1,171 @@
+/*
+ * shoottest - check that heap pages given back with sbrk stop being
+ * accessible on every CPU.
+ *
+ * Shrinking the heap has to remove its pages from the TLB of every
+ * CPU the process has run on, not just the current one; otherwise a
+ * process that migrates back to a CPU it touched them on can go on
+ * using them. Several workers run at once, so that children get moved
+ * around while they spin. Each child:
+ *
+ *    1. grows the heap, fills it, spins, and checks it;
+ *    2. shrinks it again and grows it back, and checks that the
+ *	 pages come back zeroed;
+ *    3. fills and spins again, shrinks the heap, and touches the
+ *	 page it gave back, which should kill it with SIGSEGV.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define PAGE_SIZE	4096
+#define NPAGES		4
+#define HEAPSIZE	(NPAGES * PAGE_SIZE)
+#define NWORDS		(HEAPSIZE / sizeof(unsigned))
+#define NWORKERS	3
+#define NCHILDREN	8
+#define SPINS		200000
+
+static
+void
+spin(void)
+{
+	volatile unsigned i;
+
+	for (i=0; i<SPINS; i++) {
+		/* nothing */
+	}
+}
+
+static
+volatile unsigned *
+grow(void)
+{
+	void *p;
+
+	p = sbrk(HEAPSIZE);
+	if (p == (void *)-1) {
+		err(1, "sbrk");
+	}
+	return p;
+}
+
+static
+void
+shrink(void)
+{
+	if (sbrk(-HEAPSIZE) == (void *)-1) {
+		err(1, "sbrk");
+	}
+}
+
+static
+void
+child(unsigned tag)
+{
+	volatile unsigned *heap, *again;
+	unsigned i;
+
+	heap = grow();
+	for (i=0; i<NWORDS; i++) {
+		heap[i] = tag ^ i;
+	}
+	spin();
+	for (i=0; i<NWORDS; i++) {
+		if (heap[i] != (tag ^ i)) {
+			errx(1, "child %u: word %u is 0x%x", tag, i, heap[i]);
+		}
+	}
+
+	shrink();
+	again = grow();
+	if (again != heap) {
+		errx(1, "child %u: heap moved", tag);
+	}
+	for (i=0; i<NWORDS; i++) {
+		if (heap[i] != 0) {
+			errx(1, "child %u: reused word %u is 0x%x",
+			     tag, i, heap[i]);
+		}
+		heap[i] = tag;
+	}
+	spin();
+
+	shrink();
+	heap[NWORDS - 1] = tag;
+	errx(1, "child %u: heap still accessible after shrinking", tag);
+}
+
+static
+void
+worker(unsigned w)
+{
+	unsigned n;
+	int status;
+	pid_t pid;
+
+	for (n=0; n<NCHILDREN; n++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			child(w * NCHILDREN + n);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFSIGNALED(status) || WTERMSIG(status) != 11) {
+			errx(1, "worker %u: child %u did not segfault",
+			     w, n);
+		}
+	}
+	exit(0);
+}
+
+int
+main(void)
+{
+	pid_t pids[NWORKERS];
+	unsigned w;
+	uintptr_t brk;
+	int status, failed = 0;
+
+	/* page-align the break so the heap pages are ours alone */
+	brk = (uintptr_t)sbrk(0);
+	if (brk % PAGE_SIZE != 0) {
+		if (sbrk(PAGE_SIZE - brk % PAGE_SIZE) == (void *)-1) {
+			err(1, "sbrk");
+		}
+	}
+
+	for (w=0; w<NWORKERS; w++) {
+		pids[w] = fork();
+		if (pids[w] < 0) {
+			err(1, "fork");
+		}
+		if (pids[w] == 0) {
+			worker(w);
+		}
+	}
+	for (w=0; w<NWORKERS; w++) {
+		if (waitpid(pids[w], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED");
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/shoottest");
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * txtbusy - check that a program can't be changed while it's running.
+ *
+ * Copies itself to a scratch file and runs the copy, which waits on a
+ * semfs semaphore. While the copy is running, writing to it and
+ * opening it with O_TRUNC must both fail with ETXTBSY. Once it has
+ * exited both must work, and since the copy is now empty, running it
+ * again must fail instead of reusing its old text.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define PROG	"/testbin/txtbusy"
+#define COPY	"txtbusy.tmp"
+#define UPSEM	"sem:txtbusy.up"
+#define GOSEM	"sem:txtbusy.go"
+
+static
+void
+copyself(void)
+{
+	char buf[4096];
+	int in, out;
+	ssize_t r;
+
+	in = open(PROG, O_RDONLY);
+	if (in < 0) {
+		err(1, "%s", PROG);
+	}
+	out = open(COPY, O_WRONLY|O_CREAT|O_TRUNC, 0775);
+	if (out < 0) {
+		err(1, "%s", COPY);
+	}
+	while ((r = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, r) != r) {
+			err(1, "%s: write", COPY);
+		}
+	}
+	if (r < 0) {
+		err(1, "%s: read", PROG);
+	}
+	close(in);
+	close(out);
+}
+
+static
+int
+semopen(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDWR|O_CREAT, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+static
+void
+semP(int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) != 1) {
+		err(1, "semaphore read");
+	}
+}
+
+static
+void
+semV(int fd)
+{
+	char c = 0;
+
+	if (write(fd, &c, 1) != 1) {
+		err(1, "semaphore write");
+	}
+}
+
+/*
+ * The copy: say we're running, and wait to be told to go away.
+ */
+static
+void
+child(void)
+{
+	semV(semopen(UPSEM));
+	semP(semopen(GOSEM));
+	exit(0);
+}
+
+static
+pid_t
+runcopy(void)
+{
+	char *args[3];
+	pid_t pid;
+
+	args[0] = (char *)COPY;
+	args[1] = (char *)"-child";
+	args[2] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(COPY, args);
+		_exit(errno);
+	}
+	return pid;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int up, go, fd, status;
+	pid_t pid;
+
+	if (argc == 2 && !strcmp(argv[1], "-child")) {
+		child();
+	}
+
+	up = semopen(UPSEM);
+	go = semopen(GOSEM);
+	copyself();
+
+	pid = runcopy();
+	semP(up);
+
+	fd = open(COPY, O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s: open for writing", COPY);
+	}
+	if (write(fd, "x", 1) != -1 || errno != ETXTBSY) {
+		errx(1, "FAILED: write to running text: expected ETXTBSY");
+	}
+	close(fd);
+	if (open(COPY, O_WRONLY|O_TRUNC) != -1 || errno != ETXTBSY) {
+		errx(1, "FAILED: truncate of running text: expected ETXTBSY");
+	}
+	printf("txtbusy: running text can't be changed\n");
+
+	semV(go);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: copy did not exit cleanly");
+	}
+
+	fd = open(COPY, O_WRONLY|O_TRUNC);
+	if (fd < 0) {
+		err(1, "FAILED: truncate after exit");
+	}
+	close(fd);
+
+	pid = runcopy();
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) == 0) {
+		errx(1, "FAILED: emptied copy still ran");
+	}
+	printf("txtbusy: changed text isn't reused\n");
+
+	close(up);
+	close(go);
+	remove(UPSEM);
+	remove(GOSEM);
+	remove(COPY);
+	success(TEST161_SUCCESS, SECRET, "/testbin/txtbusy");
+	return 0;
+}